@@ -45,8 +45,9 @@
 
 #define ARRAY_CNT(array) ((sizeof(array)/sizeof(array[0])))
 
-/* Command list pointers.  One extra so it's always NULL terminated. */
-static const at_command_t *m_commands[MAX_AT_CMD_LISTS + 1] = { NULL };
+/* Every registered command, kept sorted by name so lookups are a binary search */
+static const at_command_t *m_commands[MAX_AT_CMDS];
+static uint32_t m_command_count;
 
 /* This is set to true when the lock state changes from locked to unlocked.
    The system will automatically relock after the next command. */
@@ -72,32 +73,127 @@ void at_commands_init(void)
     at_commands_gpio_init();
 }
 
-/* Register a new list of commands.  By default, the global
-   "p_default_commands" is registered.  More lists can be registered
-   with this function, up to a max of CONSOLE_MAX_CMD_LISTS.
-   Returns true on success. */
+/* Compare a command name of name_len characters against a registered
+   command string, ordered like strcmp. */
+static int compare_command(const char * name, uint32_t name_len, const char * command)
+{
+    int result = strncmp(name, command, name_len);
+    
+    /* name is a prefix of command, so it sorts first */
+    if(result == 0 && command[name_len] != '\0')
+    {
+        result = -1;
+    }
+    
+    return result;
+}
+
+/* Exact match lookup, returns NULL if there is no such command */
+static const at_command_t * find_command(const char * name, uint32_t name_len)
+{
+    uint32_t low = 0;
+    uint32_t high = m_command_count;
+    
+    while(low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        int result = compare_command(name, name_len, m_commands[mid]->command);
+        
+        if(result == 0)
+        {
+            return m_commands[mid];
+        }
+        else if(result < 0)
+        {
+            high = mid;
+        }
+        else
+        {
+            low = mid + 1;
+        }
+    }
+    
+    return NULL;
+}
+
+/* Split the next space separated token off the line in place and advance
+   *pp_pos past it. Returns NULL when the line is exhausted. */
+static char * next_token(char ** pp_pos, bool lowercase)
+{
+    char * p_pos = *pp_pos;
+    char * p_token;
+    
+    while(*p_pos == ' ')
+    {
+        p_pos++;
+    }
+    
+    if(*p_pos == '\0')
+    {
+        *pp_pos = p_pos;
+        return NULL;
+    }
+    
+    p_token = p_pos;
+    for( ; *p_pos != '\0' && *p_pos != ' '; p_pos++)
+    {
+        if(lowercase)
+        {
+            *p_pos = (char)tolower((unsigned char)*p_pos);
+        }
+    }
+    
+    if(*p_pos == ' ')
+    {
+        *p_pos++ = '\0';
+    }
+    
+    *pp_pos = p_pos;
+    return p_token;
+}
+
+/* Register a new list of commands.  Commands from all lists share one
+   sorted index of up to MAX_AT_CMDS entries.  If a name is registered
+   twice, the first registration wins.  Returns true on success. */
 bool at_commands_register(const at_command_t *cmds)
 {
-    for (uint32_t i = 0; i < MAX_AT_CMD_LISTS; i++)
+    for(const at_command_t *p_cmd = cmds; p_cmd->command != NULL; p_cmd++)
     {
-        if (m_commands[i] == NULL) 
+        uint32_t len = strlen(p_cmd->command);
+        
+        if(find_command(p_cmd->command, len) != NULL)
+        {
+            continue;
+        }
+        
+        if(m_command_count >= MAX_AT_CMDS)
+        {
+            return false;
+        }
+        
+        /* insert in order, lists are short and only registered at init */
+        uint32_t i = m_command_count;
+        while(i > 0 && compare_command(p_cmd->command, len, m_commands[i - 1]->command) < 0)
         {
-            m_commands[i] = cmds;
-            return true;
+            m_commands[i] = m_commands[i - 1];
+            i--;
         }
+        
+        m_commands[i] = p_cmd;
+        m_command_count++;
     }
 
-    return false;
+    return true;
 }
 
 uint32_t at_command_parse(uint8_t * line)
 {
     bool is_query = false;
     uint32_t argc = 0;
-    static char * strtok_save;
-    const at_command_t **pp_command_list;
+    char * p_pos = (char*)line;
     const at_command_t *p_cmd;
-    bool is_name_command = false;
+    const char * p_name;
+    uint32_t name_len;
     
     /* Defined static so it's in static ram and not the stack */
     static char *argv[MAX_AT_CMD_ARGS];
@@ -107,45 +203,19 @@ uint32_t at_command_parse(uint8_t * line)
         return AT_RESULT_ERROR;
     }
     
-    /* Split line into arguments */
-    argv[0] = strtok_r( (char*)line, " ", &strtok_save );
+    /* Command is always lowercase */
+    argv[0] = next_token(&p_pos, true);
     if ( argv[0] == NULL ) 
     {
         return AT_RESULT_ERROR;
     }
     
-    /* Convert command to lowercase */
-    unsigned char * line_ptr = (unsigned char *)argv[0];
-    for ( ; *line_ptr; ++line_ptr) *line_ptr = (uint8_t)tolower(*line_ptr);
-    
-    /* SPECIAL CASE - If this is the name command, then don't convert to lower case */
-    if(strncmp( &argv[0][AT_COMMAND_HEADER_SZ], "name", 4 ) == 0)
-    {
-        is_name_command = true;
-    }
-    
-    /* Process argument and update argument count (command counts as 1 argument) */
-    for( argc = 1; argc < MAX_AT_CMD_ARGS; argc++ )
-    {
-        argv[argc] = strtok_r( NULL, " ", &strtok_save );
-        if( argv[argc] == NULL )
-            break;
-        
-        /* Convert everything to lower case if this is not the name command */
-        if(!is_name_command)
-        {
-            unsigned char * line_ptr = (unsigned char*)argv[argc];
-            for ( ; *line_ptr; ++line_ptr) *line_ptr = (uint8_t)tolower(*line_ptr);
-        }
-    }
-    
     /* Handle special case of command AT (compares against first two characters of header) */
     if((strncmp(argv[0], AT_COMMAND_HEADER, AT_COMMAND_HEADER_SZ - 1) == 0) &&
-        (strlen(argv[0]) == AT_COMMAND_HEADER_SZ - 1) &&
-        ((argc - 1) == 0))
+        (strlen(argv[0]) == AT_COMMAND_HEADER_SZ - 1))
     {
         /* This is the special AT command */
-        return AT_RESULT_OK;
+        return (next_token(&p_pos, false) == NULL) ? AT_RESULT_OK : AT_RESULT_ERROR;
     }
     
     /* Verify command has AT command header */
@@ -154,29 +224,31 @@ uint32_t at_command_parse(uint8_t * line)
         return AT_RESULT_ERROR;
     }
     
-    /* Find command, return unknown if not found */
-    bool found = false;
-    for (pp_command_list = m_commands; !found && *pp_command_list; pp_command_list++) 
-    {
-        for (p_cmd = *pp_command_list; !found && p_cmd->command != NULL; p_cmd++) 
-        {            
-            if( strncmp( &argv[0][AT_COMMAND_HEADER_SZ], p_cmd->command, strlen(p_cmd->command) ) == 0 ) 
-            {
-                found = true;
-                break;
-            }
-        
-        }
+    /* Check if command is a query */
+    p_name = &argv[0][AT_COMMAND_HEADER_SZ];
+    name_len = strlen(p_name);
+    is_query = (name_len > 0 && p_name[name_len - 1] == AT_COMMAND_QUERY);
+    if(is_query)
+    {
+        name_len -= AT_COMMAND_QUERY_SZ;
     }
     
-    if(!found)
+    /* Find command, return unknown if not found */
+    p_cmd = find_command(p_name, name_len);
+    if(p_cmd == NULL)
     {
         return AT_RESULT_UNKNOWN;
     }
     
-    /* Check if command is a query */
-    uint8_t command_len = strlen(argv[0]);
-    is_query = (argv[0][command_len - 1] == AT_COMMAND_QUERY);
+    /* Process arguments and update argument count (command counts as 1 argument).
+       SPECIAL CASE - the name command keeps the case of its argument */
+    bool lowercase = (strcmp(p_cmd->command, "name") != 0);
+    for( argc = 1; argc < MAX_AT_CMD_ARGS; argc++ )
+    {
+        argv[argc] = next_token(&p_pos, lowercase);
+        if( argv[argc] == NULL )
+            break;
+    }
     
     /* Verify correct number of parameters was provided. If query, count should be 0 */
     if((argc - 1) < p_cmd->min_args || (argc - 1) > p_cmd->max_args)
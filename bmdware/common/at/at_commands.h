@@ -54,9 +54,10 @@ void at_commands_init(void);
 
 /* Register a new list of commands.  By default, the global
    "cmds_default" is registered.  More lists can be registered
-   with this function, up to a max of MAX_AT_CMD_LISTS.
-   Returns true on success. */
-#define MAX_AT_CMD_LISTS 10
+   with this function, up to a total of MAX_AT_CMDS commands.
+   Lookups are exact matches on the command name.
+   Returns false if the index fills up partway through the list. */
+#define MAX_AT_CMDS      48
 bool at_commands_register(const at_command_t *cmds);
 
 
@@ -4,6 +4,7 @@
 #include <stddef.h>
 
 #include "nrf_error.h"
+#include "app_error.h"
 #include "storage_intf.h"
 #include "advertising.h"
 #include "ble_beacon_config.h"
@@ -365,7 +366,7 @@ const at_command_t beacon_cmds[] = {
 
 void at_commands_beacon_init(void)
 {
-    at_commands_register(beacon_cmds);
+    APP_ERROR_CHECK_BOOL(at_commands_register(beacon_cmds));
 }
 
 static void uint8_to_char(uint8_t num, char * high, char * low)
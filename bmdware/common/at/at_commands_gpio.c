@@ -11,6 +11,7 @@
 
 #include "nrf.h"
 #include "nrf_error.h"
+#include "app_error.h"
 #include "gpio_ctrl.h"
 #include "at_commands.h"
 #include "storage_intf.h"
@@ -232,7 +233,7 @@ const at_command_t gpio_cmds[] = {
 
 void at_commands_gpio_init(void)
 {
-    at_commands_register(gpio_cmds);
+    APP_ERROR_CHECK_BOOL(at_commands_register(gpio_cmds));
 }
 
 /* Only works for 8-bit input values */
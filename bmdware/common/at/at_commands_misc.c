@@ -13,6 +13,7 @@
 
 #include "nrf.h"
 #include "nrf_error.h"
+#include "app_error.h"
 #include "nrf_delay.h"
 #include "nrf_soc.h"
 #include "storage_intf.h"
@@ -511,5 +512,5 @@ const at_command_t default_cmds[] = {
 
 void at_commands_misc_init()
 {
-    at_commands_register(default_cmds);
+    APP_ERROR_CHECK_BOOL(at_commands_register(default_cmds));
 }
@@ -11,6 +11,7 @@
 #include <stdio.h>
 
 #include "nrf_error.h"
+#include "app_error.h"
 #include "storage_intf.h"
 #include "ble_nus.h"
 
@@ -105,7 +106,7 @@ static const at_command_t uart_cmds[] = {
 
 void at_commands_uart_init(void)
 {
-    at_commands_register(uart_cmds);
+    APP_ERROR_CHECK_BOOL(at_commands_register(uart_cmds));
 }
 
 static uint32_t baud_rate_from_str(char *br)
@@ -60,6 +60,8 @@ uint8_t ble_nus_uuid_type;
 static uint32_t m_conn_handle = BLE_CONN_HANDLE_INVALID;
 static const ble_beacon_config_t * mp_beacon_config;
 
+static uint8_t m_tx_buf_free;   /* SoftDevice application packet buffers available */
+
 static bool triggered_buffer_notification = false;
 static sw_irq_callback_id_t swi_handle;
 static uint8_t swi_notif;
@@ -99,6 +101,11 @@ static void on_connect(ble_nus_t * p_nus, ble_evt_t * p_ble_evt)
     p_nus->conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
     m_conn_handle = p_nus->conn_handle;
     p_nus->is_notification_enabled = false;
+    
+    if(sd_ble_tx_packet_count_get(m_conn_handle, &m_tx_buf_free) != NRF_SUCCESS)
+    {
+        m_tx_buf_free = 1;
+    }
     //ringBufClear(&ble_tx_ring_buffer);
 }
 
@@ -115,6 +122,7 @@ static void on_disconnect(ble_nus_t * p_nus, ble_evt_t * p_ble_evt)
     p_nus->conn_handle = BLE_CONN_HANDLE_INVALID;
     m_conn_handle = BLE_CONN_HANDLE_INVALID;
     p_nus->is_notification_enabled = false;
+    m_tx_buf_free = 0;
 }
 
 static bool is_valid_baud(uint32_t baud)
@@ -770,9 +778,19 @@ static uint32_t control_char_add(ble_nus_t * p_nus, const ble_nus_init_t * p_nus
 #endif
 
 
-static void send_more_ble_data(ble_nus_t * p_nus)
+static void send_more_ble_data(ble_nus_t * p_nus, ble_evt_t * p_ble_evt)
 {
-    timer_start_uart();
+    uint8_t total;
+    
+    m_tx_buf_free += p_ble_evt->evt.common_evt.params.tx_complete.count;
+    
+    if(sd_ble_tx_packet_count_get(m_conn_handle, &total) == NRF_SUCCESS
+        && m_tx_buf_free > total)
+    {
+        m_tx_buf_free = total;
+    }
+    
+    uart_ble_tx_complete_handler();
 }
 
 void ble_nus_on_ble_evt(ble_nus_t * p_nus, ble_evt_t * p_ble_evt)
@@ -797,7 +815,7 @@ void ble_nus_on_ble_evt(ble_nus_t * p_nus, ble_evt_t * p_ble_evt)
             break;
         
         case BLE_EVT_TX_COMPLETE:
-            send_more_ble_data(p_nus);
+            send_more_ble_data(p_nus, p_ble_evt);
             break;
 
         default:
@@ -943,6 +961,12 @@ static uint32_t send_ble_data(ble_nus_t * p_nus, uint8_t * string, uint16_t leng
     
     memset(&hvx_params, 0, sizeof(hvx_params));
 
+    // don't bother the SoftDevice when all of its buffers are queued
+    if (m_tx_buf_free == 0)
+    {
+        return BLE_ERROR_NO_TX_PACKETS;
+    }
+    
     hvx_params.handle = p_nus->rx_handles.value_handle;
     hvx_params.p_data = string;
     hvx_params.p_len  = &length;
@@ -950,6 +974,16 @@ static uint32_t send_ble_data(ble_nus_t * p_nus, uint8_t * string, uint16_t leng
     
     uint32_t err_code = sd_ble_gatts_hvx(p_nus->conn_handle, &hvx_params);
     
+    if (err_code == NRF_SUCCESS)
+    {
+        m_tx_buf_free--;
+    }
+    else if (err_code == BLE_ERROR_NO_TX_PACKETS)
+    {
+        // other notifications share the buffers, resync on the next TX_COMPLETE
+        m_tx_buf_free = 0;
+    }
+    
     return err_code;
 }
 
@@ -14,4 +14,7 @@
 
 uint8_t crc8(const uint8_t *data, uint16_t len);
 
+/* incremental, start with crc = 0x00 */
+uint8_t crc8_update(uint8_t crc, const uint8_t *data, uint16_t len);
+
 #endif
@@ -15,13 +15,26 @@
 #include "nrf_delay.h"
 #include "nrf_gpio.h"
 #include "nrf_uarte.h"
+#include "nrf_timer.h"
+#include "nrf_ppi.h"
 
 #include "app_util_platform.h"
 
 #include "simple_uarte.h"
+#include "uarte_cfg.h"
 
-//Set up for an event for every byte rx'd
-#define DMA_RX_MAX_COUNT    1
+/* RX is double buffered: while the DMA fills one buffer the other is queued
+ * in RXD.PTR and picked up by the ENDRX_STARTRX short */
+#define DMA_RX_BUF_SIZE     64
+#define DMA_RX_BUF_COUNT    2
+
+/* RX idle detection: RXDRDY counts bytes on UARTE_RX_COUNT_TIMER and
+ * restarts UARTE_RX_IDLE_TIMER, see uarte_cfg.h; when the line has been
+ * idle for RX_IDLE_CHARS character times the bytes already in the active
+ * buffer are handed up */
+#define RX_IDLE_CHARS           4
+/* CONFIG has no STOP field on the nRF52832, so the UARTE always uses one */
+#define UARTE_STOP_BITS         1
 
 /* Callback for RX'd bytes */
 static void (*rx_ready_callback)(const uint8_t * const rx_buffer, uint8_t count);
@@ -29,9 +42,16 @@ static void (*rx_ready_callback)(const uint8_t * const rx_buffer, uint8_t count)
 /* Called when TX is complete, set via put function */
 static void (*tx_complete_callback)(void);
 
-static uint8_t rx_buf[DMA_BUFFER_SIZE];
+static uint8_t rx_buf[DMA_RX_BUF_COUNT][DMA_RX_BUF_SIZE];
 static uint8_t tx_buf[DMA_BUFFER_SIZE];
 
+static uint8_t  rx_active;      /* buffer the DMA is currently filling */
+static uint32_t rx_reported;    /* bytes of the active buffer already handed up */
+static uint32_t rx_count_base;  /* byte count at the start of the active buffer */
+
+static void rx_idle_config(uint32_t baud_select, nrf_uarte_parity_t parity);
+static void rx_report(uint32_t end);
+
 static uint8_t rts_pin;
 
 void simple_uarte_config(uint8_t rts_pin_number,
@@ -68,7 +88,10 @@ void simple_uarte_config(uint8_t rts_pin_number,
     }
     nrf_uarte_configure(NRF_UARTE0, parity, flow_ctrl);
     
-    nrf_uarte_rx_buffer_set(NRF_UARTE0, rx_buf, DMA_RX_MAX_COUNT);
+    rx_active = 0;
+    rx_reported = 0;
+    rx_count_base = 0;
+    nrf_uarte_rx_buffer_set(NRF_UARTE0, rx_buf[rx_active], DMA_RX_BUF_SIZE);
     
     
     tx_complete_callback = NULL;
@@ -77,6 +100,8 @@ void simple_uarte_config(uint8_t rts_pin_number,
     //TODO: use the appropriate function
     NRF_UARTE0->BAUDRATE = (baud_select << UART_BAUDRATE_BAUDRATE_Pos);
     
+    rx_idle_config(baud_select, parity);
+    
     nrf_uarte_event_clear(NRF_UARTE0, NRF_UARTE_EVENT_CTS);
 }
 
@@ -89,6 +114,17 @@ void simple_uarte_enable(void (*rx_callback)(const uint8_t * const data, uint8_t
     
     NVIC_EnableIRQ(UARTE0_UART0_IRQn);
     NVIC_SetPriority(UARTE0_UART0_IRQn, APP_IRQ_PRIORITY_HIGH);
+    
+    /* same priority as the UARTE so buffer swaps and idle flushes never nest */
+    nrf_timer_int_enable(UARTE_RX_IDLE_TIMER, NRF_TIMER_INT_COMPARE0_MASK);
+    NVIC_ClearPendingIRQ(UARTE_RX_IDLE_TIMER_IRQn);
+    NVIC_SetPriority(UARTE_RX_IDLE_TIMER_IRQn, APP_IRQ_PRIORITY_HIGH);
+    NVIC_EnableIRQ(UARTE_RX_IDLE_TIMER_IRQn);
+    /* both at once, so the count and the idle timer start on the same byte;
+     * nrf_ppi.h has no nrf_ppi_channels_enable */
+    NRF_PPI->CHENSET = (1UL << UARTE_RX_PPI_CH_COUNT) | (1UL << UARTE_RX_PPI_CH_IDLE);
+    nrf_timer_task_trigger(UARTE_RX_COUNT_TIMER, NRF_TIMER_TASK_START);
+    
     nrf_uarte_task_trigger(NRF_UARTE0, NRF_UARTE_TASK_STARTRX);
 }
 
@@ -102,6 +138,15 @@ void simple_uarte_put(const uint8_t * data, uint8_t size, void (*callback)(void)
     nrf_uarte_task_trigger(NRF_UARTE0, NRF_UARTE_TASK_STARTTX);
 }
 
+void simple_uarte_put_direct(const uint8_t * data, uint8_t size, void (*callback)(void))
+{
+    tx_complete_callback = callback;
+    
+    nrf_uarte_tx_buffer_set(NRF_UARTE0, data, size);
+    nrf_uarte_int_enable(NRF_UARTE0, NRF_UARTE_INT_ENDTX_MASK);
+    nrf_uarte_task_trigger(NRF_UARTE0, NRF_UARTE_TASK_STARTTX);
+}
+
 void simple_uarte_putstring(const uint8_t * str, void (*callback)(void))
 {
     uint_fast8_t i  = 0;
@@ -114,6 +159,12 @@ void simple_uarte_putstring(const uint8_t * str, void (*callback)(void))
 void simple_uarte_disable( void )
 {
     NVIC_DisableIRQ(UARTE0_UART0_IRQn);
+    NVIC_DisableIRQ(UARTE_RX_IDLE_TIMER_IRQn);
+    nrf_ppi_channels_disable((1UL << UARTE_RX_PPI_CH_COUNT) | (1UL << UARTE_RX_PPI_CH_IDLE));
+    nrf_timer_task_trigger(UARTE_RX_IDLE_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(UARTE_RX_COUNT_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_int_disable(UARTE_RX_IDLE_TIMER, NRF_TIMER_INT_COMPARE0_MASK);
+    nrf_uarte_shorts_disable(NRF_UARTE0, NRF_UARTE_SHORT_ENDRX_STARTRX);
     nrf_uarte_task_trigger(NRF_UARTE0, NRF_UARTE_TASK_STOPRX);
     nrf_uarte_task_trigger(NRF_UARTE0, NRF_UARTE_TASK_STOPTX);
     nrf_uarte_disable(NRF_UARTE0);
@@ -153,27 +204,30 @@ void UARTE0_UART0_IRQHandler(void)
     
     if(nrf_uarte_event_check(NRF_UARTE0, NRF_UARTE_EVENT_RXTO))
     {
+        /* RX is only stopped on disable, nothing to hand up */
         nrf_uarte_event_clear(NRF_UARTE0, NRF_UARTE_EVENT_RXTO);
-        nrf_uarte_task_trigger(NRF_UARTE0, NRF_UARTE_TASK_FLUSHRX);
-        
-        if(rx_ready_callback)
-        {
-            rx_ready_callback(rx_buf, NRF_UARTE0->RXD.AMOUNT);
-        }
     }
     
     if(nrf_uarte_event_check(NRF_UARTE0, NRF_UARTE_EVENT_ENDRX))
     {
         nrf_uarte_event_clear(NRF_UARTE0, NRF_UARTE_EVENT_ENDRX);
-        if(rx_ready_callback)
-        {
-            rx_ready_callback(rx_buf, NRF_UARTE0->RXD.AMOUNT);
-        }
+        
+        /* the short has already restarted RX into the other buffer, hand up
+         * whatever the idle flush has not delivered from this one */
+        uint32_t amount = nrf_uarte_rx_amount_get(NRF_UARTE0);
+        rx_report(amount);
+        
+        rx_count_base += amount;
+        rx_reported = 0;
+        rx_active ^= 1;
     }
     
     if(nrf_uarte_event_check(NRF_UARTE0, NRF_UARTE_EVENT_RXSTARTED))
     {
         nrf_uarte_event_clear(NRF_UARTE0, NRF_UARTE_EVENT_RXSTARTED);
+        
+        /* queue the other buffer for the next ENDRX_STARTRX */
+        nrf_uarte_rx_buffer_set(NRF_UARTE0, rx_buf[rx_active ^ 1], DMA_RX_BUF_SIZE);
     }
     
     if(nrf_uarte_event_check(NRF_UARTE0, NRF_UARTE_EVENT_ERROR))
@@ -184,3 +238,80 @@ void UARTE0_UART0_IRQHandler(void)
         
     }
 }
+
+void UARTE_RX_IDLE_TIMER_IRQHandler(void)
+{
+    if(nrf_timer_event_check(UARTE_RX_IDLE_TIMER, NRF_TIMER_EVENT_COMPARE0))
+    {
+        nrf_timer_event_clear(UARTE_RX_IDLE_TIMER, NRF_TIMER_EVENT_COMPARE0);
+        
+        /* the line has been idle for a few character times, so every byte
+         * counted has long since been moved to RAM by the DMA */
+        nrf_timer_task_trigger(UARTE_RX_COUNT_TIMER, NRF_TIMER_TASK_CAPTURE0);
+        uint32_t received = nrf_timer_cc_read(UARTE_RX_COUNT_TIMER, NRF_TIMER_CC_CHANNEL0) - rx_count_base;
+        
+        /* a full buffer is handed up by ENDRX */
+        if(received < DMA_RX_BUF_SIZE)
+        {
+            rx_report(received);
+        }
+    }
+}
+
+static void rx_report(uint32_t end)
+{
+    if(end > rx_reported)
+    {
+        if(rx_ready_callback)
+        {
+            rx_ready_callback(&rx_buf[rx_active][rx_reported], (uint8_t)(end - rx_reported));
+        }
+        rx_reported = end;
+    }
+}
+
+static void rx_idle_config(uint32_t baud_select, nrf_uarte_parity_t parity)
+{
+    /* BAUDRATE is rate * 2^32 / 16 MHz */
+    uint32_t rate = (uint32_t)(((uint64_t)baud_select * 16000000UL) >> 32);
+    
+    /* start + 8 data + parity + stop bits per character, 11 with parity, so
+     * the gap between parity bytes isn't taken for an idle line; timer ticks
+     * at 1 MHz, rounded up */
+    uint32_t bits = 1 + 8 + ((parity == NRF_UARTE_PARITY_INCLUDED) ? 1 : 0) + UARTE_STOP_BITS;
+    uint32_t idle_us;
+    
+    if(rate == 0)
+    {
+        rate = 1;
+    }
+    idle_us = (uint32_t)(((uint64_t)RX_IDLE_CHARS * bits * 1000000UL + rate - 1) / rate);
+    
+    nrf_timer_task_trigger(UARTE_RX_IDLE_TIMER, NRF_TIMER_TASK_STOP);
+    nrf_timer_task_trigger(UARTE_RX_COUNT_TIMER, NRF_TIMER_TASK_STOP);
+    
+    nrf_timer_mode_set(UARTE_RX_IDLE_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(UARTE_RX_IDLE_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_frequency_set(UARTE_RX_IDLE_TIMER, NRF_TIMER_FREQ_1MHz);
+    nrf_timer_cc_write(UARTE_RX_IDLE_TIMER, NRF_TIMER_CC_CHANNEL0, (idle_us != 0) ? idle_us : 1);
+    nrf_timer_shorts_enable(UARTE_RX_IDLE_TIMER, NRF_TIMER_SHORT_COMPARE0_STOP_MASK | NRF_TIMER_SHORT_COMPARE0_CLEAR_MASK);
+    nrf_timer_task_trigger(UARTE_RX_IDLE_TIMER, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_event_clear(UARTE_RX_IDLE_TIMER, NRF_TIMER_EVENT_COMPARE0);
+    
+    nrf_timer_mode_set(UARTE_RX_COUNT_TIMER, NRF_TIMER_MODE_COUNTER);
+    nrf_timer_bit_width_set(UARTE_RX_COUNT_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_task_trigger(UARTE_RX_COUNT_TIMER, NRF_TIMER_TASK_CLEAR);
+    
+    /* nrf_uarte_event_t has no RXDRDY in this SDK */
+    uint32_t rxdrdy = (uint32_t)&NRF_UARTE0->EVENTS_RXDRDY;
+    nrf_ppi_channel_endpoint_setup(UARTE_RX_PPI_CH_COUNT, 
+        rxdrdy,
+        (uint32_t)nrf_timer_task_address_get(UARTE_RX_COUNT_TIMER, NRF_TIMER_TASK_COUNT));
+    /* nrf_ppi.h only has the fork functions with NRF52832 defined, and the
+     * projects define NRF52 */
+    NRF_PPI->FORK[UARTE_RX_PPI_CH_COUNT].TEP = 
+        (uint32_t)nrf_timer_task_address_get(UARTE_RX_IDLE_TIMER, NRF_TIMER_TASK_CLEAR);
+    nrf_ppi_channel_endpoint_setup(UARTE_RX_PPI_CH_IDLE, 
+        rxdrdy,
+        (uint32_t)nrf_timer_task_address_get(UARTE_RX_IDLE_TIMER, NRF_TIMER_TASK_START));
+}
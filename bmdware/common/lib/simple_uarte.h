@@ -28,6 +28,8 @@ void simple_uarte_disable_rx(void);
 void simple_uarte_enable_rx(void);
 
 void simple_uarte_put(const uint8_t * data, uint8_t size, void (*callback)(void));
+/* data must be in RAM and left untouched until the callback runs */
+void simple_uarte_put_direct(const uint8_t * data, uint8_t size, void (*callback)(void));
 void simple_uarte_putstring(const uint8_t * str, void (*callback)(void));
 
 #ifdef __cplusplus
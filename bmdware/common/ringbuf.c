@@ -11,6 +11,15 @@
 *       If read == write buffer is empty
 *       If (write+1) == read buffer is full
 *
+* @par  Single producer/single consumer mode
+*       Buffers set up with ringBufInitSpsc may be written from one context
+*       (e.g. an ISR) and read from another without a critical section.
+*       The element count must be a power of two; the read/write indices
+*       run freely and are masked on access, so every slot is usable.
+*       Each index is only ever written by its owner and is published
+*       after a memory barrier. ringBufClear is not safe while the
+*       producer is active.
+*
 * All rights reserved. */
 
 #include <stdint.h>
@@ -19,13 +28,24 @@
 
 #include "ringbuf.h"
 
+#if defined(__CC_ARM) || (defined(__GNUC__) && defined(__arm__))
+    #include "nrf.h"
+    #define RINGBUF_BARRIER()   __DMB()
+#else
+    #define RINGBUF_BARRIER()   __sync_synchronize()
+#endif
+
 #define ALMOST_FULL_THRESHOLD_PERCENT   (80)    
 
 /* Helper functions */
 static bool update_callback(ringBufEventCallback_t * list, 
     ringBufEventCallback_t callback, bool set);
-static void incrementIdx(uint32_t bufSize, uint32_t* idx);
+static uint32_t slotIdx(ringBuf_t* ringBuf, uint32_t idx);
+static void advanceIdx(ringBuf_t* ringBuf, volatile uint32_t* idx, uint32_t count);
+static void copyOut(ringBuf_t* ringBuf, uint8_t* dest, uint32_t elementCount);
+static void copyIn(ringBuf_t* ringBuf, const uint8_t* src, uint32_t elementCount);
 static void executeCallbacks(ringBuf_t* ringBuf, ringBufEvent_t event);
+static void executeWriteCallbacks(ringBuf_t* ringBuf);
 
 uint8_t ringBufInit(ringBuf_t* ringBuf, uint32_t elementSize, uint32_t elementCount, void* elementBuffer )
 {
@@ -50,6 +70,25 @@ uint8_t ringBufInit(ringBuf_t* ringBuf, uint32_t elementSize, uint32_t elementCo
     return RINGBUF_ERROR;
 }
 
+uint8_t ringBufInitSpsc(ringBuf_t* ringBuf, uint32_t elementSize, uint32_t elementCount, void* elementBuffer )
+{
+    /* masked indexing requires a power of two */
+    if( elementCount < 2
+        || (elementCount & (elementCount - 1)) != 0 )
+    {
+        return RINGBUF_ERROR;
+    }
+    
+    if( ringBufInit(ringBuf, elementSize, elementCount, elementBuffer) != RINGBUF_SUCCESS )
+    {
+        return RINGBUF_ERROR;
+    }
+    
+    ringBuf->mask = elementCount - 1;
+    
+    return RINGBUF_SUCCESS;
+}
+
 uint8_t ringBufClear(ringBuf_t* ringBuf)
 {
     if( ringBuf == NULL )
@@ -79,7 +118,13 @@ uint32_t ringBufWaiting(ringBuf_t* ringBuf)
     writeIdx = ringBuf->writeIdx;
     readIdx = ringBuf->readIdx;
 
-    if(writeIdx >= readIdx)
+    if(ringBuf->mask)
+    {
+        /* order the index loads before any access to the elements */
+        RINGBUF_BARRIER();
+        return (writeIdx - readIdx);
+    }
+    else if(writeIdx >= readIdx)
     {
         return (writeIdx - readIdx);
     }
@@ -91,6 +136,12 @@ uint32_t ringBufWaiting(ringBuf_t* ringBuf)
 
 uint32_t ringBufUnused(ringBuf_t* ringBuf)
 {
+    if(ringBuf->mask)
+    {
+        /* free running indices, every slot is usable */
+        return ringBuf->elementCount - ringBufWaiting(ringBuf);
+    }
+    
     /* leave one slot open so we can detect empty vs full */
     uint32_t free = (ringBuf->elementCount-1) - ringBufWaiting(ringBuf);
     return(free);
@@ -110,10 +161,10 @@ uint8_t ringBufReadOne(ringBuf_t* ringBuf, void* elementOut)
     }
     else
     {
-        uint32_t readOffset = ringBuf->readIdx * ringBuf->elementSize;
+        uint32_t readOffset = slotIdx(ringBuf, ringBuf->readIdx) * ringBuf->elementSize;
         memcpy(elementOut, &ringBuf->buffer[readOffset], ringBuf->elementSize);
 
-        incrementIdx(ringBuf->elementCount, &(ringBuf->readIdx));
+        advanceIdx(ringBuf, &(ringBuf->readIdx), 1);
         if(ringBufWaiting(ringBuf) == 0)
         {
             executeCallbacks(ringBuf, RINGBUF_EVENT_EMPTY);
@@ -132,7 +183,7 @@ uint8_t ringBufPeekOne(ringBuf_t* ringBuf, void* elementOut)
     }
     else
     {
-        uint32_t readOffset = ringBuf->readIdx * ringBuf->elementSize;
+        uint32_t readOffset = slotIdx(ringBuf, ringBuf->readIdx) * ringBuf->elementSize;
         memcpy(elementOut, &ringBuf->buffer[readOffset], ringBuf->elementSize);
 
         return RINGBUF_SUCCESS;
@@ -149,20 +200,11 @@ uint8_t ringBufWriteOne(ringBuf_t* ringBuf, void* elementIn)
     }
     else
     {
-        uint32_t writeOffset = ringBuf->writeIdx * ringBuf->elementSize;
+        uint32_t writeOffset = slotIdx(ringBuf, ringBuf->writeIdx) * ringBuf->elementSize;
         memcpy(&ringBuf->buffer[writeOffset],elementIn,ringBuf->elementSize);
 
-        incrementIdx(ringBuf->elementCount, &(ringBuf->writeIdx));
-        
-        uint32_t waiting = ringBufWaiting(ringBuf);
-        if(waiting == ringBuf->elementCount)
-        {
-            executeCallbacks(ringBuf, RINGBUF_EVENT_FULL);
-        }
-        else if(waiting > ringBuf->almostFullThreshold)
-        {
-            executeCallbacks(ringBuf, RINGBUF_EVENT_ALMOST_FULL);
-        }
+        advanceIdx(ringBuf, &(ringBuf->writeIdx), 1);
+        executeWriteCallbacks(ringBuf);
         
         return RINGBUF_SUCCESS;
     }
@@ -180,13 +222,12 @@ uint8_t ringBufRead(ringBuf_t* ringBuf, void* elementsOut, uint32_t elementCount
     }
     else
     {
-        uint32_t idx;
-        uint8_t* ptr = elementsOut;
-
-        for(idx = 0; idx<elementCount; idx++)
+        copyOut(ringBuf, elementsOut, elementCount);
+        advanceIdx(ringBuf, &(ringBuf->readIdx), elementCount);
+        
+        if(ringBufWaiting(ringBuf) == 0)
         {
-            ringBufReadOne(ringBuf, ptr);
-            ptr += ringBuf->elementSize;
+            executeCallbacks(ringBuf, RINGBUF_EVENT_EMPTY);
         }
         return RINGBUF_SUCCESS;
     }
@@ -203,23 +244,7 @@ uint8_t ringBufPeek(ringBuf_t* ringBuf, void* elementsOut, uint32_t elementCount
     }
     else
     {
-        uint32_t readOffset     = ringBuf->readIdx * ringBuf->elementSize;
-        uint32_t writeOffset    = 0;
-        uint8_t* p_data_out     = (uint8_t*)elementsOut;
-        
-        for(uint32_t i=0; i<elementCount; i++)
-        {
-            memcpy(&p_data_out[writeOffset], &ringBuf->buffer[readOffset], ringBuf->elementSize);
-            
-            writeOffset += ringBuf->elementSize;
-            readOffset  += ringBuf->elementSize;
-            
-            //handle wrap
-            if(readOffset >= (ringBuf->elementSize*ringBuf->elementCount))
-            {
-                readOffset = 0;
-            }
-        }
+        copyOut(ringBuf, elementsOut, elementCount);
         
         return RINGBUF_SUCCESS;
     }
@@ -237,14 +262,10 @@ uint8_t ringBufWrite(ringBuf_t* ringBuf, void* elementsIn, uint32_t elementCount
     }
     else
     {
-        uint32_t idx;
-        uint8_t* ptr = elementsIn;
-
-        for(idx = 0; idx<elementCount; idx++)
-        {
-            ringBufWriteOne(ringBuf, ptr);
-            ptr += ringBuf->elementSize;
-        }
+        copyIn(ringBuf, elementsIn, elementCount);
+        advanceIdx(ringBuf, &(ringBuf->writeIdx), elementCount);
+        executeWriteCallbacks(ringBuf);
+        
         return RINGBUF_SUCCESS;
     }
 }
@@ -255,17 +276,14 @@ uint8_t ringBufDiscard(ringBuf_t* ringBuf, uint32_t elementCount)
 {
     if( ringBuf == NULL
         || elementCount == 0
-        || ringBufUnused(ringBuf) < elementCount )
+        || ringBufWaiting(ringBuf) < elementCount )
     {
         return RINGBUF_ERROR;
     }
     else
     {
         // just move the index
-        for(uint32_t i=0; i<elementCount; i++)
-        {
-            incrementIdx(ringBuf->elementCount, &(ringBuf->readIdx));
-        }
+        advanceIdx(ringBuf, &(ringBuf->readIdx), elementCount);
         
         if(ringBufWaiting(ringBuf) == 0)
         {
@@ -277,6 +295,72 @@ uint8_t ringBufDiscard(ringBuf_t* ringBuf, uint32_t elementCount)
 }
 
 
+/* zero-copy */
+uint32_t ringBufWriteClaim(ringBuf_t* ringBuf, void** elements)
+{
+    if( ringBuf == NULL
+        || elements == NULL )
+    {
+        return 0;
+    }
+    
+    uint32_t writeIdx = slotIdx(ringBuf, ringBuf->writeIdx);
+    uint32_t span = ringBuf->elementCount - writeIdx;
+    uint32_t free = ringBufUnused(ringBuf);
+    
+    if( span > free )
+    {
+        span = free;
+    }
+    
+    *elements = &ringBuf->buffer[writeIdx * ringBuf->elementSize];
+    return span;
+}
+
+uint8_t ringBufWriteCommit(ringBuf_t* ringBuf, uint32_t elementCount)
+{
+    if( ringBuf == NULL
+        || elementCount == 0
+        || ringBufUnused(ringBuf) < elementCount )
+    {
+        return RINGBUF_ERROR;
+    }
+    else
+    {
+        advanceIdx(ringBuf, &(ringBuf->writeIdx), elementCount);
+        executeWriteCallbacks(ringBuf);
+        
+        return RINGBUF_SUCCESS;
+    }
+}
+
+uint32_t ringBufReadClaim(ringBuf_t* ringBuf, void** elements)
+{
+    if( ringBuf == NULL
+        || elements == NULL )
+    {
+        return 0;
+    }
+    
+    uint32_t readIdx = slotIdx(ringBuf, ringBuf->readIdx);
+    uint32_t span = ringBuf->elementCount - readIdx;
+    uint32_t waiting = ringBufWaiting(ringBuf);
+    
+    if( span > waiting )
+    {
+        span = waiting;
+    }
+    
+    *elements = &ringBuf->buffer[readIdx * ringBuf->elementSize];
+    return span;
+}
+
+uint8_t ringBufReadRelease(ringBuf_t* ringBuf, uint32_t elementCount)
+{
+    return ringBufDiscard(ringBuf, elementCount);
+}
+
+
 /* events */
 uint32_t ringBufRegisterEventCallback(ringBuf_t* ringBuf, 
     ringBufEvent_t event, ringBufEventCallback_t callback)
@@ -307,6 +391,20 @@ uint32_t ringBufUnregisterEventCallback(ringBuf_t* ringBuf,
 }
 
 /* helper functions */
+static void executeWriteCallbacks(ringBuf_t* ringBuf)
+{
+    uint32_t waiting = ringBufWaiting(ringBuf);
+    
+    if(waiting == ringBuf->elementCount)
+    {
+        executeCallbacks(ringBuf, RINGBUF_EVENT_FULL);
+    }
+    else if(waiting > ringBuf->almostFullThreshold)
+    {
+        executeCallbacks(ringBuf, RINGBUF_EVENT_ALMOST_FULL);
+    }
+}
+
 static void executeCallbacks(ringBuf_t* ringBuf, ringBufEvent_t event)
 {
     for(uint8_t i = 0; i < RINGBUF_MAX_CALLBACKS_PER_EVENT; i++)
@@ -319,14 +417,67 @@ static void executeCallbacks(ringBuf_t* ringBuf, ringBufEvent_t event)
     }
 }
 
-static void incrementIdx(uint32_t bufSize, uint32_t* idx)
+static uint32_t slotIdx(ringBuf_t* ringBuf, uint32_t idx)
 {
-    *idx = (*idx) + 1;
+    return (ringBuf->mask) ? (idx & ringBuf->mask) : idx;
+}
+
+static void advanceIdx(ringBuf_t* ringBuf, volatile uint32_t* idx, uint32_t count)
+{
+    uint32_t next = (*idx) + count;
 
-    /* do we need to wrap? */
-    if( *idx == bufSize )
+    if( ringBuf->mask )
     {
-        *idx = 0;
+        /* element accesses must complete before the index is published */
+        RINGBUF_BARRIER();
+    }
+    /* count is never larger than the buffer, so at most one wrap */
+    else if( next >= ringBuf->elementCount )
+    {
+        next -= ringBuf->elementCount;
+    }
+    *idx = next;
+}
+
+/* copy elementCount elements starting at readIdx, in at most two segments */
+static void copyOut(ringBuf_t* ringBuf, uint8_t* dest, uint32_t elementCount)
+{
+    uint32_t elementSize = ringBuf->elementSize;
+    uint32_t readIdx = slotIdx(ringBuf, ringBuf->readIdx);
+    uint32_t first = ringBuf->elementCount - readIdx;
+
+    if( first > elementCount )
+    {
+        first = elementCount;
+    }
+
+    memcpy(dest, &ringBuf->buffer[readIdx * elementSize], first * elementSize);
+
+    if( elementCount > first )
+    {
+        memcpy(&dest[first * elementSize], ringBuf->buffer,
+            (elementCount - first) * elementSize);
+    }
+}
+
+/* copy elementCount elements in at writeIdx, in at most two segments */
+static void copyIn(ringBuf_t* ringBuf, const uint8_t* src, uint32_t elementCount)
+{
+    uint32_t elementSize = ringBuf->elementSize;
+    uint32_t writeIdx = slotIdx(ringBuf, ringBuf->writeIdx);
+    uint32_t first = ringBuf->elementCount - writeIdx;
+
+    if( first > elementCount )
+    {
+        first = elementCount;
+    }
+
+    memcpy(&ringBuf->buffer[writeIdx * elementSize], src, first * elementSize);
+
+    if( elementCount > first )
+    {
+        memcpy(ringBuf->buffer, &src[first * elementSize],
+            (elementCount - first) * elementSize);
     }
 }
 
@@ -354,25 +505,28 @@ static bool update_callback(ringBufEventCallback_t * list,
 }
 
 
-#if 0
+#ifdef RINGBUF_SELF_TEST
 uint32_t ringBufSelfTest(void)
 {
   uint32_t errors = 0;
   ringBuf_t r;
   uint8_t rbuf[64];
 
-  if( ringBufInit(&r, rbuf, sizeof(rbuf)) == RINGBUF_SUCCESS )
+  if( ringBufInit(&r, sizeof(rbuf[0]), sizeof(rbuf), rbuf) == RINGBUF_SUCCESS )
   {
     uint8_t buf1[64];
     uint8_t buf2[128];
-    int i;
+    uint32_t i;
 
-    // 1 slot always free
-    if( ringBufBytesTotalSize(&r) != sizeof(rbuf) )
+    if( ringBufTotalCapacity(&r) != sizeof(rbuf) )
       errors++;
 
     // buffer is empty
-    if( ringBufBytesWaiting(&r) != 0 )
+    if( ringBufWaiting(&r) != 0 )
+      errors++;
+
+    // 1 slot always free
+    if( ringBufUnused(&r) != sizeof(rbuf) - 1 )
       errors++;
 
     if( ringBufRead( &r, buf2, 2 ) != RINGBUF_ERROR )
@@ -384,7 +538,9 @@ uint32_t ringBufSelfTest(void)
     if( ringBufPeekOne( &r, buf2 ) != RINGBUF_ERROR )
       errors++;
 
-    // queue 3 bytes
+    if( ringBufDiscard( &r, 1 ) != RINGBUF_ERROR )
+      errors++;
+
     for(i=0;i<sizeof(buf1); i++)
     {
       buf1[i] = i;
@@ -393,8 +549,12 @@ uint32_t ringBufSelfTest(void)
     if( ringBufWrite(&r, buf1, 63) == RINGBUF_ERROR )
       errors++;
 
-    /* 3 bytes waiting */
-    if( ringBufBytesWaiting(&r) != 63)
+    /* 63 bytes waiting */
+    if( ringBufWaiting(&r) != 63)
+      errors++;
+
+    /* full, nothing more fits */
+    if( ringBufWriteOne(&r, buf1) != RINGBUF_ERROR )
       errors++;
 
     /* peek */
@@ -405,7 +565,8 @@ uint32_t ringBufSelfTest(void)
     if( ringBufRead(&r, buf2, 63) == RINGBUF_ERROR || memcmp(buf1, buf2, 63) != 0 )
         errors++;
 
-    for( i=0; i<32; i++)
+    /* walk the indices around the buffer so every copy length wraps */
+    for( i=0; i<64; i++)
     {
       memset(buf2, 0xff, sizeof(buf2));
 
@@ -414,33 +575,43 @@ uint32_t ringBufSelfTest(void)
         errors++;
 
       /* check we queued */
-      if( ringBufBytesWaiting(&r) != 60)
-        errors++;
-
-      /* peek one */
-      if( ringBufPeekOne(&r, &buf2[0]) == RINGBUF_ERROR || buf2[0] != 0 )
+      if( ringBufWaiting(&r) != 60)
         errors++;
 
-      /* ensure peek didnt increment */
-      if( ringBufBytesWaiting(&r) != 60)
+      /* peek across the wrap, ensure peek didnt increment */
+      if( ringBufPeek(&r, buf2, 60) == RINGBUF_ERROR
+          || memcmp(buf1, buf2, 60) != 0
+          || ringBufWaiting(&r) != 60 )
         errors++;
 
       /* try to read more than is available */
       if( ringBufRead(&r, &buf2[1], 61) != RINGBUF_ERROR )
         errors++;
 
-      /* read 60 bytes */
+      /* try to discard more than is available */
+      if( ringBufDiscard(&r, 61) != RINGBUF_ERROR )
+        errors++;
+
       /* read one */
       if( ringBufReadOne(&r, &buf2[0]) == RINGBUF_ERROR || buf2[0] != 0 )
         errors++;
 
-      /* read 59 */
-      if( ringBufRead(&r, &buf2[1], 59) == RINGBUF_ERROR || memcmp(buf1, buf2, 59) != 0 )
+      /* read 58 */
+      if( ringBufRead(&r, &buf2[1], 58) == RINGBUF_ERROR || memcmp(buf1, buf2, 59) != 0 )
+        errors++;
+
+      /* discard the last one */
+      if( ringBufDiscard(&r, 1) == RINGBUF_ERROR || ringBufWaiting(&r) != 0 )
         errors++;
 
       /* write overflow */
       if( ringBufWrite(&r, buf1, 64) != RINGBUF_ERROR )
         errors++;
+
+      /* shift the indices by one for the next pass */
+      if( ringBufWriteOne(&r, buf1) == RINGBUF_ERROR
+          || ringBufReadOne(&r, buf2) == RINGBUF_ERROR )
+        errors++;
     }
   }
   else
@@ -449,8 +620,103 @@ uint32_t ringBufSelfTest(void)
     errors++;
   }
 
+  /* zero-copy spans never cross the end of the buffer */
+  if( ringBufInit(&r, sizeof(rbuf[0]), sizeof(rbuf), rbuf) == RINGBUF_SUCCESS )
+  {
+    uint8_t* span;
+    uint8_t seq = 0;
+    uint8_t expected = 0;
+    uint32_t i;
+    uint32_t j;
+    uint32_t n;
+
+    for( i=0; i<256; i++)
+    {
+      /* fill with sequential values, possibly in two spans */
+      while( (n = ringBufWriteClaim(&r, (void**)&span)) != 0 )
+      {
+        if( n > (i % 13) + 1 )
+          n = (i % 13) + 1;
+
+        if( (uint32_t)(span - rbuf) + n > sizeof(rbuf) )
+          errors++;
+
+        for( j=0; j<n; j++)
+          span[j] = seq++;
+
+        if( ringBufWriteCommit(&r, n) == RINGBUF_ERROR )
+          errors++;
+
+        if( ringBufWaiting(&r) > (i % 31) + 20 )
+          break;
+      }
+
+      /* drain and verify order */
+      while( (n = ringBufReadClaim(&r, (void**)&span)) != 0 )
+      {
+        if( n > (i % 7) + 1 )
+          n = (i % 7) + 1;
+
+        for( j=0; j<n; j++)
+        {
+          if( span[j] != expected++ )
+            errors++;
+        }
+
+        if( ringBufReadRelease(&r, n) == RINGBUF_ERROR )
+          errors++;
+      }
+    }
+
+    if( ringBufWriteCommit(&r, sizeof(rbuf)) != RINGBUF_ERROR )
+      errors++;
+  }
+  else
+  {
+    errors++;
+  }
+
+  /* spsc mode needs a power of two and uses every slot */
+  if( ringBufInitSpsc(&r, sizeof(rbuf[0]), sizeof(rbuf) - 1, rbuf) != RINGBUF_ERROR )
+    errors++;
+
+  if( ringBufInitSpsc(&r, sizeof(rbuf[0]), sizeof(rbuf), rbuf) == RINGBUF_SUCCESS )
+  {
+    uint8_t buf1[64];
+    uint8_t buf2[64];
+    uint32_t i;
+
+    for(i=0;i<sizeof(buf1); i++)
+    {
+      buf1[i] = i;
+    }
+
+    if( ringBufUnused(&r) != sizeof(rbuf) )
+      errors++;
+
+    for( i=0; i<64; i++)
+    {
+      if( ringBufWrite(&r, buf1, 64) == RINGBUF_ERROR || ringBufUnused(&r) != 0 )
+        errors++;
+
+      if( ringBufWriteOne(&r, buf1) != RINGBUF_ERROR )
+        errors++;
+
+      if( ringBufRead(&r, buf2, 64) == RINGBUF_ERROR || memcmp(buf1, buf2, 64) != 0 )
+        errors++;
+
+      /* shift the indices by one for the next pass */
+      if( ringBufWriteOne(&r, buf1) == RINGBUF_ERROR
+          || ringBufReadOne(&r, buf2) == RINGBUF_ERROR )
+        errors++;
+    }
+  }
+  else
+  {
+    errors++;
+  }
+
 
   return errors;
 }
-
 #endif
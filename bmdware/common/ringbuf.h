@@ -41,8 +41,11 @@ struct ringBuf_s
     uint8_t* buffer;
 
     /* read/write index */
-    uint32_t writeIdx;
-    uint32_t readIdx;
+    volatile uint32_t writeIdx;
+    volatile uint32_t readIdx;
+    
+    /* index mask, non-zero for single producer/single consumer buffers */
+    uint32_t mask;
     
     /* almost full count */
     uint32_t almostFullThreshold;
@@ -53,6 +56,7 @@ struct ringBuf_s
 
 /* init */
 uint8_t ringBufInit(ringBuf_t* ringBuf, uint32_t elementSize, uint32_t elementCount, void* elementBuffer);
+uint8_t ringBufInitSpsc(ringBuf_t* ringBuf, uint32_t elementSize, uint32_t elementCount, void* elementBuffer);
 uint8_t ringBufClear(ringBuf_t* ringBuf);
 
 /* event registration */
@@ -77,7 +81,13 @@ uint8_t ringBufPeek(ringBuf_t* ringBuf, void* elementsIn, uint32_t elementCount)
 uint8_t ringBufWrite(ringBuf_t* ringBuf, void* elementsIn, uint32_t elementCount);
 uint8_t ringBufDiscard(ringBuf_t* ringBuf, uint32_t elementCount);
 
-/* self test */
+/* zero-copy, claims return the largest contiguous span (in elements) */
+uint32_t ringBufWriteClaim(ringBuf_t* ringBuf, void** elements);
+uint8_t ringBufWriteCommit(ringBuf_t* ringBuf, uint32_t elementCount);
+uint32_t ringBufReadClaim(ringBuf_t* ringBuf, void** elements);
+uint8_t ringBufReadRelease(ringBuf_t* ringBuf, uint32_t elementCount);
+
+/* self test, build with RINGBUF_SELF_TEST defined */
 uint32_t ringBufSelfTest(void);
 
 #endif /* __RINGBUF_H */
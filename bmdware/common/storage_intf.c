@@ -20,8 +20,17 @@
 #include "lock.h"
 #include "crc.h"
 
-#define STORAGE_BLOCK_COUNT         1
-#define STORAGE_SIZE                sizeof(default_app_settings_t)
+/* Settings are kept as an append-only log of records spread over NUM_PAGES
+ * flash pages, one pstorage block each. A save writes the next blank record
+ * slot; only when the active page is full is the oldest page cleared and the
+ * log continued there. The newest valid record is always left intact until
+ * its successor has been written, so a reset mid-write falls back to the
+ * previous settings. */
+#define NUM_PAGES                   2
+#define LOG_PAGE_SIZE               PSTORAGE_FLASH_PAGE_SIZE
+
+#define RECORD_MAGIC                0xA5
+#define STORE_RETRIES               3   //failed stores retried before waiting for the next save
     
 #define DEFAULT_CONN_ADV_INT        1285
 #define DEFAULT_BEACON_ADV_INT      100
@@ -75,11 +84,33 @@ const default_app_settings_t default_settings =
     0, 					    //crc8 calculated at write time
 };
 
+/* One log entry. The trailer is the last word written by pstorage_store, so
+ * a partially written record is left without its magic/crc and is ignored. */
+typedef struct
+{
+    default_app_settings_t settings;
+    uint16_t seq;                   //record sequence number, wraps
+    uint8_t magic;                  //RECORD_MAGIC
+    uint8_t crc8;                   //crc over everything above
+} storage_record_t;
+STATIC_ASSERT((sizeof(storage_record_t) % 4) == 0);
+
 static pstorage_handle_t m_storage_handle;
 static default_app_settings_t m_app_settings;
 static bool m_is_dirty = false;
 
+static storage_record_t m_record;   //staging buffer, must outlive pstorage_store
+static uint32_t m_slots_per_page;
+static uint8_t  m_active_page;
+static uint32_t m_next_slot;
+static uint16_t m_seq;
+static bool m_store_pending = false;
+static bool m_save_deferred = false;
+static uint8_t m_store_retries = 0;
+
 static bool is_valid( void );
+static uint32_t record_append( void );
+static bool log_scan( void );
 static void dm_pstorage_cb_handler(pstorage_handle_t * p_handle,
                                    uint8_t             op_code,
                                    uint32_t            result,
@@ -95,13 +126,15 @@ uint32_t storage_intf_init( void )
     err_code = pstorage_init();
     APP_ERROR_CHECK(err_code);
     
-    pstorage_param.block_count = STORAGE_BLOCK_COUNT;
-    pstorage_param.block_size = STORAGE_SIZE;
+    pstorage_param.block_count = NUM_PAGES;
+    pstorage_param.block_size = LOG_PAGE_SIZE;
     pstorage_param.cb = dm_pstorage_cb_handler;
     
     err_code = pstorage_register(&pstorage_param, &m_storage_handle);
     APP_ERROR_CHECK(err_code);
     
+    m_slots_per_page = LOG_PAGE_SIZE / sizeof(storage_record_t);
+    
     err_code = storage_intf_load();
     APP_ERROR_CHECK(err_code);
     
@@ -111,14 +144,24 @@ uint32_t storage_intf_init( void )
 
 uint32_t storage_intf_load( void )
 {
-    uint32_t err_code;
-    pstorage_handle_t block_handle;
-    
-    err_code = pstorage_block_identifier_get(&m_storage_handle, 0, &block_handle);
-    APP_ERROR_CHECK(err_code);
+    uint32_t err_code = NRF_SUCCESS;
     
-    err_code = pstorage_load((uint8_t*)&m_app_settings, &block_handle, STORAGE_SIZE, 0);
-    APP_ERROR_CHECK(err_code);
+    if(!log_scan())
+    {
+        /* no log yet, pick up the settings the single block layout stored at
+         * the start of page 0. They fill slot 0 but for its trailer, so the
+         * scan has already moved past it, and they are left there until the
+         * log has filled page 0, by which time they are in the log. */
+        memcpy((void*)&m_app_settings, (void*)m_storage_handle.block_id,
+            sizeof(m_app_settings));
+        
+        if(is_valid())
+        {
+            m_is_dirty = true;
+            err_code = storage_intf_save();
+            APP_ERROR_CHECK(err_code);
+        }
+    }
     
     if(!is_valid())
     {
@@ -134,18 +177,20 @@ uint32_t storage_intf_load( void )
 uint32_t storage_intf_save( void )
 {
     uint32_t err_code;
-    pstorage_handle_t block_handle;
     
     if(!m_is_dirty)
         return NRF_ERROR_INVALID_STATE;
     
-    err_code = pstorage_block_identifier_get(&m_storage_handle, 0, &block_handle);
-    APP_ERROR_CHECK(err_code);
+    m_store_retries = 0;
     
-    err_code = pstorage_clear(&m_storage_handle, STORAGE_SIZE);
-    APP_ERROR_CHECK(err_code);
+    /* the staging record is in use, append again once that store completes */
+    if(m_store_pending)
+    {
+        m_save_deferred = true;
+        return NRF_SUCCESS;
+    }
     
-    err_code = pstorage_store(&block_handle, (uint8_t*)&m_app_settings, STORAGE_SIZE, 0);
+    err_code = record_append();
     APP_ERROR_CHECK(err_code);
     
     return err_code;
@@ -156,9 +201,16 @@ uint32_t storage_intf_clear( void )
 {
     uint32_t err_code;
     
-    err_code = pstorage_clear(&m_storage_handle, STORAGE_SIZE);
+    err_code = pstorage_clear(&m_storage_handle, NUM_PAGES * LOG_PAGE_SIZE);
     APP_ERROR_CHECK(err_code);
     
+    m_seq = 0;
+    m_active_page = 0;
+    m_next_slot = 0;
+    m_store_pending = false;
+    m_save_deferred = false;
+    m_store_retries = 0;
+    
     return err_code;
 }
 // ------------------------------------------------------------------------------
@@ -198,6 +250,140 @@ static bool is_valid( void )
 
 	return (crcCalc == m_app_settings.crc8);
 }
+// ------------------------------------------------------------------------------
+
+static const storage_record_t * slot_addr(uint8_t page, uint32_t slot)
+{
+    return (const storage_record_t*)(m_storage_handle.block_id + 
+        page * LOG_PAGE_SIZE + slot * sizeof(storage_record_t));
+}
+// ------------------------------------------------------------------------------
+
+static bool record_is_valid(const storage_record_t * record)
+{
+    if(record->magic != RECORD_MAGIC)
+        return false;
+    
+    if(crc8((uint8_t*)record, sizeof(storage_record_t) - 1) != record->crc8)
+        return false;
+    
+    /* bits left by a torn erase can pass the record's crc by chance, and
+     * would be taken for the newest settings; their own crc must pass too */
+    return (crc8((uint8_t*)&record->settings, sizeof(default_app_settings_t) - 1) == 
+        record->settings.crc8);
+}
+// ------------------------------------------------------------------------------
+
+static bool slot_is_blank(const storage_record_t * record)
+{
+    const uint32_t * p_word = (const uint32_t*)record;
+    
+    for(uint32_t i = 0; i < sizeof(storage_record_t) / sizeof(uint32_t); i++)
+    {
+        if(p_word[i] != PSTORAGE_FLASH_EMPTY_MASK)
+            return false;
+    }
+    
+    return true;
+}
+// ------------------------------------------------------------------------------
+
+/**@brief Find the newest valid record and the next free slot after it.
+ *
+ * @return true and m_app_settings loaded if a valid record was found
+ */
+static bool log_scan( void )
+{
+    const storage_record_t * p_newest = NULL;
+    
+    for(uint8_t page = 0; page < NUM_PAGES; page++)
+    {
+        for(uint32_t slot = 0; slot < m_slots_per_page; slot++)
+        {
+            const storage_record_t * p_record = slot_addr(page, slot);
+            
+            if(!record_is_valid(p_record))
+                continue;
+            
+            /* sequence numbers wrap, compare by signed distance */
+            if(p_newest == NULL || (int16_t)(p_record->seq - m_seq) > 0)
+            {
+                p_newest = p_record;
+                m_seq = p_record->seq;
+                m_active_page = page;
+                m_next_slot = slot + 1;
+            }
+        }
+    }
+    
+    if(p_newest == NULL)
+    {
+        m_seq = 0;
+        m_active_page = 0;
+        m_next_slot = 0;
+    }
+    
+    /* skip slots holding a torn write, they can't be programmed again until
+     * the page is cleared */
+    while(m_next_slot < m_slots_per_page && 
+        !slot_is_blank(slot_addr(m_active_page, m_next_slot)))
+    {
+        m_next_slot++;
+    }
+    
+    if(p_newest == NULL)
+        return false;
+    
+    memcpy(&m_app_settings, &p_newest->settings, sizeof(m_app_settings));
+    
+    return true;
+}
+// ------------------------------------------------------------------------------
+
+static uint32_t record_append( void )
+{
+    uint32_t err_code;
+    pstorage_handle_t block_handle;
+    
+    /* active page is full, continue the log on the oldest page */
+    if(m_next_slot >= m_slots_per_page)
+    {
+        m_active_page = (m_active_page + 1) % NUM_PAGES;
+        m_next_slot = 0;
+        
+        err_code = pstorage_block_identifier_get(&m_storage_handle, m_active_page, &block_handle);
+        if(err_code != NRF_SUCCESS)
+            return err_code;
+        
+        err_code = pstorage_clear(&block_handle, LOG_PAGE_SIZE);
+        if(err_code != NRF_SUCCESS)
+            return err_code;
+    }
+    
+    err_code = pstorage_block_identifier_get(&m_storage_handle, m_active_page, &block_handle);
+    if(err_code != NRF_SUCCESS)
+        return err_code;
+    
+    memcpy(&m_record.settings, &m_app_settings, sizeof(m_record.settings));
+    m_record.seq = m_seq + 1;
+    m_record.magic = RECORD_MAGIC;
+    m_record.crc8 = crc8((uint8_t*)&m_record, sizeof(m_record) - 1);
+    
+    err_code = pstorage_store(&block_handle, (uint8_t*)&m_record, sizeof(m_record),
+        m_next_slot * sizeof(m_record));
+    if(err_code != NRF_SUCCESS)
+        return err_code;
+    
+    m_seq++;
+    m_next_slot++;
+    m_store_pending = true;
+    
+    /* a set() from here on marks the settings dirty again */
+    m_is_dirty = false;
+    
+    return NRF_SUCCESS;
+}
+// ------------------------------------------------------------------------------
 
 /**@brief Function for pstorage module callback.
  *
@@ -217,11 +403,33 @@ static void dm_pstorage_cb_handler(pstorage_handle_t * p_handle,
                                    uint8_t           * p_data,
                                    uint32_t            data_len)
 {
+    uint32_t err_code;
+    
     if( op_code == PSTORAGE_STORE_OP_CODE )
     {
-        if(result == NRF_SUCCESS)
+        m_store_pending = false;
+        
+        /* the slot is consumed either way, the record is retried in the next one */
+        if(result != NRF_SUCCESS)
+        {
+            m_is_dirty = true;
+            
+            if(m_store_retries < STORE_RETRIES)
+            {
+                m_store_retries++;
+                m_save_deferred = true;
+            }
+        }
+        else
+        {
+            m_store_retries = 0;
+        }
+        
+        if(m_save_deferred && m_is_dirty)
         {
-            m_is_dirty = false;
+            m_save_deferred = false;
+            err_code = record_append();
+            APP_ERROR_CHECK(err_code);
         }
     }
 }
@@ -25,18 +25,23 @@
 #else
     #error "nRF IC Not Defined!"
 #endif
-static uint32_t m_uart_timeout_ms;
+static uint32_t m_uart_timeout_ticks;
 static bool m_uart_timer_started = false;    
 
 /**@brief Create Uart Timeout Timer
 *
-* @details Create a timer for the uart sending timeout.  This timer will trigger data to send
-*          if no data has been received from the UART for 50 ms.
+* @details Create a timer for the uart sending timeout.  While a partial packet waits,
+*          this timer polls for an idle line so it is sent once no data has been received
+*          from the UART for a few character times.  The UART sets the period from its
+*          baud rate with timer_set_uart_timeout_ticks, and stops the timer once nothing
+*          is waiting.
 *
 * @param[in]   p_timeout_func   Callback function to handle the timer timeout
-* @param[in]   timeout_ms       Milliseconds until timeout
+* @param[in]   initial_ms       Period in milliseconds until timer_set_uart_timeout_ticks
+*                               sets one
+* @param[in]   repeated         Restart the timer each time it expires
 */
-void timer_create_uart( app_timer_timeout_handler_t p_timeout_func, uint32_t timeout_ms, bool repeated )
+void timer_create_uart( app_timer_timeout_handler_t p_timeout_func, uint32_t initial_ms, bool repeated )
 {
     uint32_t err_code;
     app_timer_mode_t mode;
@@ -53,9 +58,48 @@ void timer_create_uart( app_timer_timeout_handler_t p_timeout_func, uint32_t tim
                                 p_timeout_func);
     APP_ERROR_CHECK(err_code);
     
-    m_uart_timeout_ms = timeout_ms;
+    m_uart_timeout_ticks = APP_TIMER_TICKS(initial_ms, APP_TIMER_PRESCALER);
 }    
 
+/**@brief Set Uart Timeout Timer period
+*
+* @details Takes effect immediately if the timer is running.
+*
+* @param[in]   timeout_ticks    RTC1 ticks until timeout
+*/
+void timer_set_uart_timeout_ticks( uint32_t timeout_ticks )
+{
+    if(timeout_ticks < APP_TIMER_MIN_TIMEOUT_TICKS)
+    {
+        timeout_ticks = APP_TIMER_MIN_TIMEOUT_TICKS;
+    }
+    
+    m_uart_timeout_ticks = timeout_ticks;
+    
+    if(m_uart_timer_started)
+    {
+        timer_stop_uart();
+        timer_start_uart();
+    }
+}
+
+/**@brief Get the current RTC1 tick count
+*/
+uint32_t timer_get_ticks( void )
+{
+    return app_timer_cnt_get();
+}
+
+/**@brief Get the RTC1 ticks elapsed since a value returned by timer_get_ticks
+*/
+uint32_t timer_ticks_since( uint32_t ticks_from )
+{
+    uint32_t diff;
+    
+    (void)app_timer_cnt_diff_compute(app_timer_cnt_get(), ticks_from, &diff);
+    return diff;
+}
+
 /**@brief Stop Uart Timeout Timer
 */
 void timer_stop_uart( void )
@@ -82,7 +126,7 @@ void timer_start_uart( void )
         return;
     }
     
-    err = app_timer_start(m_uart_timer, APP_TIMER_TICKS(m_uart_timeout_ms, APP_TIMER_PRESCALER), NULL);
+    err = app_timer_start(m_uart_timer, m_uart_timeout_ticks, NULL);
     APP_ERROR_CHECK(err);
 }
 
@@ -15,8 +15,12 @@
 
 void timers_init(void);
 
-void timer_create_uart(app_timer_timeout_handler_t p_timeout_func, uint32_t timeout_ms, bool repeated);
+void timer_create_uart(app_timer_timeout_handler_t p_timeout_func, uint32_t initial_ms, bool repeated);
 void timer_start_uart(void);
 void timer_stop_uart(void);
+void timer_set_uart_timeout_ticks(uint32_t timeout_ticks);
+
+uint32_t timer_get_ticks(void);
+uint32_t timer_ticks_since(uint32_t ticks_from);
 
 #endif
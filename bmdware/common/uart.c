@@ -50,13 +50,20 @@
 #endif
 
 #define UART_MAX_AT_LEN         (MAX_AT_COMMAND_LEN + MAX_AT_DATA_LEN)
-#define UART_RX_BUF_SIZE        (4096)
+#define UART_RX_BUF_SIZE        (4096)  /* power of two, see ringBufInitSpsc */
 #define MAX_UART_BLE_DATA       (GATT_MTU_SIZE - 3)
 
+/* partial packets are sent once the line has been idle this long */
+#define UART_IDLE_FLUSH_CHARS   (4)
+#define UART_IDLE_FLUSH_MIN_MS  (1)
+
 static bool         m_hwfc = false;
 static ble_nus_t * 	mp_uart_service;
 static uart_mode_t 	m_mode = UART_MODE_INACTIVE;
 static bool         m_should_send;
+static bool         m_ble_tx_blocked;   /* waiting on a SoftDevice TX buffer */
+static uint32_t     m_idle_ticks;       /* RTC1 ticks of silence before a flush */
+static volatile uint32_t m_last_rx_ticks;
 
 // rx data
 static uint8_t 		data_array_rx[UART_RX_BUF_SIZE];/* This array is used by the ring buffer. Do NOT locally modify! */
@@ -69,7 +76,7 @@ static ringBuf_t    data_ring_buf_tx;
 static bool         is_tx_in_progress;
 
 #ifdef NRF52_UARTE
-    static uint8_t  dma_tx_buffer[DMA_BUFFER_SIZE];
+    static uint32_t dma_tx_len;     /* tx ring elements owned by the DMA */
 #endif
 
 // ble tx buffer
@@ -84,6 +91,7 @@ static void config_uart(uint8_t rts_pin_number,
                             uint8_t parity_select);
                         
 static uint32_t     get_baud_bitfield_from_rate(uint32_t rate);
+static uint32_t     get_idle_ticks_from_rate(uint32_t rate, bool parity);
 static bool         uart_irq_can_rx(void);
 static inline void  uart_irq_proc_data(uint8_t data);
 static void         uart_rx_ringbuf_event_callback(ringBuf_t *ringBuf, ringBufEvent_t event);
@@ -146,6 +154,7 @@ void uart_configure_passthrough_mode(ble_nus_t * p_uart_service)
     
     mp_uart_service = p_uart_service;
     m_should_send = false;	
+    m_ble_tx_blocked = false;
     timer_stop_uart();
 }
 
@@ -213,19 +222,18 @@ void uart_transfer_data(void)
     else if( m_mode == UART_MODE_BMDWARE_PT && m_should_send )
     {	
         // Data needs to be sent if there are at least runtime MTU bytes in the buffer 
-        // or more than 50 ms have passed since the last byte was received.
+        // or the line has been idle for UART_IDLE_FLUSH_CHARS character times.
         if(m_should_send) 
         {
             m_should_send = false;
             
             uint32_t err_code;
-            memset(tx_data_buffer, 0, sizeof(tx_data_buffer));
             uint32_t total_len = ringBufWaiting(&data_ring_buf_rx);
             uint32_t len;
 
             while(total_len)
             {
-                uint8_t rb_error;
+                uint8_t * p_data;
                 
                 len = total_len;
                 uint16_t runtime_mtu = gatt_get_runtime_mtu();
@@ -237,14 +245,19 @@ void uart_transfer_data(void)
                 {
                     timer_stop_uart();
                 }
-                rb_error = ringBufPeek(&data_ring_buf_rx, tx_data_buffer, len);
                 
-                if(rb_error != RINGBUF_SUCCESS)
+                // notify straight from the ring, the SoftDevice copies the data;
+                // only a packet that straddles the end of the ring is gathered
+                if(ringBufReadClaim(&data_ring_buf_rx, (void**)&p_data) < len)
                 {
-                    bmd_log("ringbuf peek error\n");
+                    if(ringBufPeek(&data_ring_buf_rx, tx_data_buffer, len) != RINGBUF_SUCCESS)
+                    {
+                        bmd_log("ringbuf peek error\n");
+                    }
+                    p_data = tx_data_buffer;
                 }
                 
-                err_code = ble_nus_send_string(mp_uart_service, tx_data_buffer, len);
+                err_code = ble_nus_send_string(mp_uart_service, p_data, len);
                 
                 if (err_code == NRF_SUCCESS)
                 {
@@ -256,9 +269,19 @@ void uart_transfer_data(void)
                             ble_tx_count,
                             ringBufWaiting(&data_ring_buf_rx));
                 }
+                else if(err_code == BLE_ERROR_NO_TX_PACKETS)
+                {
+                    // every SoftDevice buffer is queued, BLE_EVT_TX_COMPLETE
+                    // restarts us as soon as one frees up, so the timer
+                    // needn't poll meanwhile
+                    m_ble_tx_blocked = true;
+                    timer_stop_uart();
+                    break;
+                }
                 else
                 {
-                    // busy, try again later
+                    // busy or not ready; no BLE_EVT_TX_COMPLETE is coming
+                    // for this one, so try again later
                     timer_start_uart();
                     break;
                 }
@@ -266,7 +289,9 @@ void uart_transfer_data(void)
                 //more to tx?
                 total_len = ringBufWaiting(&data_ring_buf_rx);
                 
-                if(total_len < runtime_mtu)
+                // a partial packet waits for the line to go idle; once the
+                // ring is empty the timer stays stopped until more arrives
+                if(total_len != 0 && total_len < runtime_mtu)
                 {
                    timer_start_uart();
                    break;
@@ -277,21 +302,38 @@ void uart_transfer_data(void)
 }
 
 #ifdef NRF52_UARTE
-static void uarte_tx_complete_callback(void)
+static void uarte_tx_complete_callback(void);
+
+// send the next span of the ring straight from it, or stop if it's empty
+static void uarte_tx_next(void)
 {
-    uint32_t waiting = ringBufWaiting(&data_ring_buf_tx);
-    if(waiting != 0)
+    uint8_t * p_span;
+    uint32_t span;
+    
+    span = ringBufReadClaim(&data_ring_buf_tx, (void**)&p_span);
+    if(span != 0)
     {
         is_tx_in_progress = true;
-        uint8_t to_read = (waiting >= DMA_BUFFER_SIZE) ? DMA_BUFFER_SIZE : waiting;
-        ringBufRead(&data_ring_buf_tx, dma_tx_buffer, to_read);
-        simple_uarte_put(dma_tx_buffer, to_read, uarte_tx_complete_callback);
+        dma_tx_len = (span >= DMA_BUFFER_SIZE) ? DMA_BUFFER_SIZE : span;
+        simple_uarte_put_direct(p_span, (uint8_t)dma_tx_len, uarte_tx_complete_callback);
     }
     else
     {
         is_tx_in_progress = false;
     }
 }
+
+static void uarte_tx_complete_callback(void)
+{
+    // the previous span has been sent, hand it back to the ring
+    if(dma_tx_len != 0)
+    {
+        ringBufReadRelease(&data_ring_buf_tx, dma_tx_len);
+        dma_tx_len = 0;
+    }
+    
+    uarte_tx_next();
+}
 #else
 static void uart_tx_complete_callback(void)
 {
@@ -357,19 +399,8 @@ void uart_ble_data_handler(ble_nus_t * p_uart_service, uint8_t * p_data, uint16_
         return;
     }
 
-#ifdef NRF52_UARTE
-    //todo: check if flow control is enabled, if not, this step isn't necessary
-    if(!is_tx_in_progress)
-    {
-        is_tx_in_progress = true;
-        simple_uarte_put(p_data, (uint8_t)length, uarte_tx_complete_callback);
-    }
-    else
-    {
-        (void)ringBufWrite(&data_ring_buf_tx, p_data, length);
-    }
-#else
     uint8_t result;
+    bool start_tx;
     
     //queue to ringbuffer
     result = ringBufWrite(&data_ring_buf_tx, p_data, length);    
@@ -380,7 +411,23 @@ void uart_ble_data_handler(ble_nus_t * p_uart_service, uint8_t * p_data, uint16_
         bmd_log("data_ring_buf_tx write err: %d/%d\n", waiting, ringBufTotalCapacity(&data_ring_buf_tx));
     }
     
-    
+    //the tx complete interrupt clears this once the ring is empty, so
+    //check and claim it in one go
+    CRITICAL_REGION_ENTER();
+    start_tx = !is_tx_in_progress && waiting;
+    if(start_tx)
+    {
+        is_tx_in_progress = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+#ifdef NRF52_UARTE
+    //the first packet goes out of the ring too, without a copy
+    if(start_tx)
+    {
+        uarte_tx_next();
+    }
+#else
     for(int i=0; i<length; i++)
     {
         bmd_log("%02x",p_data[i]);
@@ -388,10 +435,9 @@ void uart_ble_data_handler(ble_nus_t * p_uart_service, uint8_t * p_data, uint16_
     bmd_log("\n");
     
     //put the byte, if we arent working already
-    if(!is_tx_in_progress && waiting)
+    if(start_tx)
     {
         uint8_t tx_byte;
-        is_tx_in_progress = true;
         
         ringBufReadOne(&data_ring_buf_tx, &tx_byte);
         simple_uart_put_nonblocking(tx_byte);
@@ -406,7 +452,45 @@ uint32_t uart_get_tx_buffer_waiting(void)
 
 void uart_ble_timeout_handler(void * p_context)
 {
-    m_should_send = true;
+    bool empty;
+    
+    // nothing left to flush, stop polling until the next byte restarts us;
+    // the rx interrupt is held off so a byte can't land in between
+    CRITICAL_REGION_ENTER();
+    empty = (ringBufWaiting(&data_ring_buf_rx) == 0);
+    if(empty)
+    {
+        timer_stop_uart();
+    }
+    CRITICAL_REGION_EXIT();
+    
+    if(empty)
+    {
+        return;
+    }
+    
+    // only flush a partial packet once the line has gone idle
+    if(timer_ticks_since(m_last_rx_ticks) >= m_idle_ticks)
+    {
+        m_should_send = true;
+    }
+}
+
+void uart_ble_tx_complete_handler(void)
+{
+    if(m_mode != UART_MODE_BMDWARE_PT)
+    {
+        return;
+    }
+    
+    // refill the freed buffers right away if a send was held off, or if a
+    // full packet is waiting; partial packets are still left to the timer
+    if(m_ble_tx_blocked 
+        || ringBufWaiting(&data_ring_buf_rx) >= gatt_get_runtime_mtu())
+    {
+        m_ble_tx_blocked = false;
+        m_should_send = true;
+    }
 }
 
 static void config_uart(uint8_t rts_pin_number,
@@ -424,10 +508,13 @@ static void config_uart(uint8_t rts_pin_number,
     if(baud_bitval == 0)
     {
         baud_bitval = UART_BAUDRATE_BAUDRATE_Baud57600;
+        baudrate_number = 57600;
     }  
     
     // quick teardown, stop the timeout and disable interrupts
     timer_stop_uart();
+    m_idle_ticks = get_idle_ticks_from_rate(baudrate_number, (parity_select != 0));
+    timer_set_uart_timeout_ticks(m_idle_ticks);
 #ifdef NRF52_UARTE
     NVIC_DisableIRQ(UARTE0_UART0_IRQn);
 #else
@@ -445,7 +532,8 @@ static void config_uart(uint8_t rts_pin_number,
                         parity_select);
     
     simple_uarte_enable(uarte_rx_callback);
-    memset(dma_tx_buffer, 0, sizeof(dma_tx_buffer));
+    is_tx_in_progress = false;
+    dma_tx_len = 0;
 #else
     simple_uart_config( rts_pin_number, 
                         txd_pin_number, 
@@ -464,9 +552,9 @@ static void config_uart(uint8_t rts_pin_number,
     simple_uart_set_canrx_callback(uart_irq_can_rx);
 #endif
     
-    // reinit ringbuffers
-    ringBufInit(&data_ring_buf_rx, sizeof(data_array_rx[0]), sizeof(data_array_rx), data_array_rx);
-    ringBufInit(&data_ring_buf_tx, sizeof(data_array_tx[0]), sizeof(data_array_tx), data_array_tx);
+    // reinit ringbuffers, each is filled and drained from different contexts
+    ringBufInitSpsc(&data_ring_buf_rx, sizeof(data_array_rx[0]), sizeof(data_array_rx), data_array_rx);
+    ringBufInitSpsc(&data_ring_buf_tx, sizeof(data_array_tx[0]), sizeof(data_array_tx), data_array_tx);
     
     ringBufRegisterEventCallback(&data_ring_buf_rx, RINGBUF_EVENT_ALMOST_FULL, uart_rx_ringbuf_event_callback);
     ringBufRegisterEventCallback(&data_ring_buf_rx, RINGBUF_EVENT_FULL, uart_rx_ringbuf_event_callback);
@@ -514,6 +602,16 @@ static uint32_t get_baud_bitfield_from_rate(uint32_t rate)
     }
 }
 
+static uint32_t get_idle_ticks_from_rate(uint32_t rate, bool parity)
+{
+    // start + 8 data + stop, plus parity
+    uint32_t bits = (UART_IDLE_FLUSH_CHARS * (parity ? 11 : 10));
+    uint32_t ticks = (uint32_t)((((uint64_t)bits * APP_TIMER_CLOCK_FREQ) + rate - 1) / rate);
+    uint32_t min_ticks = APP_TIMER_TICKS(UART_IDLE_FLUSH_MIN_MS, 0);
+    
+    return (ticks > min_ticks) ? ticks : min_ticks;
+}
+
 static uint32_t rx_count = 0;
 
 
@@ -580,6 +678,8 @@ static inline void uart_irq_proc_data(uint8_t data)
     // passthrough mode
     if(m_mode == UART_MODE_BMDWARE_PT)
     {
+        m_last_rx_ticks = timer_get_ticks();
+        
         uint16_t runtime_mtu = gatt_get_runtime_mtu();
         if(waiting >= runtime_mtu)
         {
@@ -614,14 +714,45 @@ static inline void uart_irq_proc_data(uint8_t data)
 #ifdef NRF52_UARTE
 /**@brief   Function for handling UART interrupts.
  *
- * @details This function will receive a single character from the UART and
- *          place it in the appropriate ring buffer based on the current
- *          mode.  In AT and Pass-through modes, it will also setup the next
- *          action if additional handling of the data is needed.
+ * @details This function receives a completed (or idle flushed) DMA buffer
+ *          from the UARTE. In Pass-through mode the block is queued to the
+ *          rx ring buffer in one go; AT and DTM modes still need to look
+ *          at each character.
  */
 static void uarte_rx_callback(const uint8_t * const p_data, uint8_t len)
 {
-    if( m_mode != UART_MODE_INACTIVE )
+    if( m_mode == UART_MODE_BMDWARE_PT )
+    {
+        uint32_t free = ringBufUnused(&data_ring_buf_rx);
+        uint32_t to_write = (len > free) ? free : len;
+        
+        if(to_write != 0)
+        {
+            (void)ringBufWrite(&data_ring_buf_rx, (void*)p_data, to_write);
+        }
+        
+        if(to_write != len)
+        {
+            bmd_log("uart_rx: ringbuf overrun, %u dropped\n", len - to_write);
+            
+            #ifdef UART_ASSERT_ON_ERROR
+                APP_ERROR_CHECK_BOOL(false);
+            #endif
+        }
+        
+        rx_count += len;
+        m_last_rx_ticks = timer_get_ticks();
+        
+        if(ringBufWaiting(&data_ring_buf_rx) >= gatt_get_runtime_mtu())
+        {
+            m_should_send = true;
+        }
+        else
+        {
+            timer_start_uart();
+        }
+    }
+    else if( m_mode != UART_MODE_INACTIVE )
     {
         uint8_t byte; 
         
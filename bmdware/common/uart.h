@@ -22,7 +22,7 @@ typedef enum
     UART_MODE_BMDWARE_PT,
 } uart_mode_t;
 
-#define UART_TX_BUFFER_SIZE     (4096)
+#define UART_TX_BUFFER_SIZE     (4096)  /* power of two, see ringBufInitSpsc */
 
 void uart_init_dtm(void);
 void uart_deinit(void);
@@ -39,6 +39,7 @@ void uart_disable_passthrough_mode(void);
 uart_mode_t uart_get_mode(void);
 
 void uart_ble_timeout_handler(void * p_context);
+void uart_ble_tx_complete_handler(void);
 void uart_ble_data_handler(ble_nus_t * p_nus, uint8_t * p_data, uint16_t length);
 void uart_transfer_data(void);
 uint32_t uart_get_tx_buffer_waiting(void);
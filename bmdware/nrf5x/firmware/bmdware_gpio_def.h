@@ -15,6 +15,8 @@
 #define BMD_DTM_UART_BAUD		    19200	
 #define BMD_DTM_UART_HWFC 		    false
 #define BMD_DTM_UART_PARITY	        0
+/* The UARTE's RX idle detection also takes two timers and two PPI
+   channels, see uarte_cfg.h */
 #elif defined(S130)
 #define BMD_UART_RTS      	        11
 #define BMD_UART_CTS      	        8 
@@ -701,6 +701,8 @@
 
 // <q> PPI_ENABLED  - nrf_drv_ppi - PPI peripheral driver
  
+// simple_uarte.c programs the PPI channels in uarte_cfg.h itself, don't
+// allocate them with the driver
 
 #ifndef PPI_ENABLED
 #define PPI_ENABLED 0
@@ -1390,6 +1392,7 @@
 
 // <q> TIMER3_ENABLED  - Enable TIMER3 instance
  
+// TIMER3 and TIMER4 are simple_uarte.c's, see uarte_cfg.h
 
 #ifndef TIMER3_ENABLED
 #define TIMER3_ENABLED 0
@@ -20,8 +20,15 @@
 #include "lock.h"
 #include "crc.h"
 
-#define NUM_PAGES         1
-//todo - calculate page count by struct size
+/* Settings are kept as an append-only log of records spread over NUM_PAGES
+ * flash pages. A save writes the next blank record slot; only when the
+ * active page is full is the oldest page erased and the log continued there.
+ * The newest valid record is always left intact until its successor has been
+ * written, so a reset mid-write falls back to the previous settings. */
+#define NUM_PAGES         2
+
+#define RECORD_MAGIC      0xA5
+#define STORE_RETRIES     3     //failed stores retried before waiting for the next save
     
 #ifdef BMD_DEBUG
 #define DEFAULT_CONN_ADV_INT        100
@@ -80,10 +87,36 @@ const default_app_settings_t default_settings =
     0, 					    //crc8 calculated at write time
 };
 
+/* One log entry. The trailer is the last word written by fs_store, so a
+ * partially written record is left without its magic/crc and is ignored. */
+typedef struct
+{
+    default_app_settings_t settings;
+    uint16_t seq;                   //record sequence number, wraps
+    uint8_t magic;                  //RECORD_MAGIC
+    uint8_t crc8;                   //crc over everything above
+} storage_record_t;
+STATIC_ASSERT((sizeof(storage_record_t) % 4) == 0);
+
+#define RECORD_WORDS      (sizeof(storage_record_t) / sizeof(uint32_t))
+
 static default_app_settings_t m_app_settings;
 static bool m_is_dirty = false;
 
+static storage_record_t m_record;   //staging buffer, must outlive fs_store
+static uint32_t m_page_words;
+static uint32_t m_slots_per_page;
+static uint8_t  m_active_page;
+static uint32_t m_next_slot;
+static uint16_t m_seq;
+static bool m_store_pending = false;
+static bool m_save_deferred = false;
+static uint8_t m_store_retries = 0;
+
 static bool is_valid( void );
+static uint32_t record_append( void );
+static bool log_scan( void );
+static uint32_t log_start( void );
 static void fstorage_callback(fs_evt_t const * const evt, fs_ret_t result);
 
 FS_REGISTER_CFG(fs_config_t fs_config) =
@@ -101,6 +134,9 @@ uint32_t storage_intf_init( void )
     err_code = fs_init();
     APP_ERROR_CHECK(err_code);
     
+    m_page_words = (fs_config.p_end_addr - fs_config.p_start_addr) / NUM_PAGES;
+    m_slots_per_page = m_page_words / RECORD_WORDS;
+    
     err_code = storage_intf_load();
     APP_ERROR_CHECK(err_code);
     
@@ -112,8 +148,25 @@ uint32_t storage_intf_load( void )
 {
     uint32_t err_code = NRF_SUCCESS;
     
-    /* just memcpy out... */
-    memcpy((void*)&m_app_settings, (void*)fs_config.p_start_addr, sizeof(m_app_settings));
+    if(!log_scan())
+    {
+        /* no log yet, start one on page 0 and pick up the settings the single
+         * page layout stored on the last page. That page is left alone until
+         * the log has filled page 0, by which time they are in the log. */
+        err_code = log_start();
+        APP_ERROR_CHECK(err_code);
+        
+        memcpy((void*)&m_app_settings, 
+            (void*)(fs_config.p_start_addr + (NUM_PAGES - 1) * m_page_words),
+            sizeof(m_app_settings));
+        
+        if(is_valid())
+        {
+            m_is_dirty = true;
+            err_code = storage_intf_save();
+            APP_ERROR_CHECK(err_code);
+        }
+    }
     
     if(!is_valid())
     {
@@ -133,10 +186,16 @@ uint32_t storage_intf_save( void )
     if(!m_is_dirty)
         return NRF_ERROR_INVALID_STATE;
     
-    err_code = fs_erase(&fs_config, fs_config.p_start_addr, NUM_PAGES, NULL);
-    APP_ERROR_CHECK(err_code);
+    m_store_retries = 0;
+    
+    /* the staging record is in use, append again once that store completes */
+    if(m_store_pending)
+    {
+        m_save_deferred = true;
+        return NRF_SUCCESS;
+    }
     
-    err_code = fs_store(&fs_config, fs_config.p_start_addr, (void*)&m_app_settings, sizeof(m_app_settings), NULL);
+    err_code = record_append();
     APP_ERROR_CHECK(err_code);
     
     return err_code;
@@ -150,6 +209,13 @@ uint32_t storage_intf_clear( void )
     err_code = fs_erase(&fs_config, fs_config.p_start_addr, NUM_PAGES, NULL);
     APP_ERROR_CHECK(err_code);
     
+    m_seq = 0;
+    m_active_page = 0;
+    m_next_slot = 0;
+    m_store_pending = false;
+    m_save_deferred = false;
+    m_store_retries = 0;
+    
     return err_code;
 }
 // ------------------------------------------------------------------------------
@@ -189,6 +255,143 @@ static bool is_valid( void )
 
 	return (crcCalc == m_app_settings.crc8);
 }
+// ------------------------------------------------------------------------------
+
+static const storage_record_t * slot_addr(uint8_t page, uint32_t slot)
+{
+    return (const storage_record_t*)(fs_config.p_start_addr + 
+        page * m_page_words + slot * RECORD_WORDS);
+}
+// ------------------------------------------------------------------------------
+
+static bool record_is_valid(const storage_record_t * record)
+{
+    if(record->magic != RECORD_MAGIC)
+        return false;
+    
+    if(crc8((uint8_t*)record, sizeof(storage_record_t) - 1) != record->crc8)
+        return false;
+    
+    /* bits left by a torn erase can pass the record's crc by chance, and
+     * would be taken for the newest settings; their own crc must pass too */
+    return (crc8((uint8_t*)&record->settings, sizeof(default_app_settings_t) - 1) == 
+        record->settings.crc8);
+}
+// ------------------------------------------------------------------------------
+
+static bool slot_is_blank(const storage_record_t * record)
+{
+    const uint32_t * p_word = (const uint32_t*)record;
+    
+    for(uint32_t i = 0; i < RECORD_WORDS; i++)
+    {
+        if(p_word[i] != 0xFFFFFFFF)
+            return false;
+    }
+    
+    return true;
+}
+// ------------------------------------------------------------------------------
+
+/**@brief Find the newest valid record and the next free slot after it.
+ *
+ * @return true and m_app_settings loaded if a valid record was found
+ */
+static bool log_scan( void )
+{
+    const storage_record_t * p_newest = NULL;
+    
+    for(uint8_t page = 0; page < NUM_PAGES; page++)
+    {
+        for(uint32_t slot = 0; slot < m_slots_per_page; slot++)
+        {
+            const storage_record_t * p_record = slot_addr(page, slot);
+            
+            if(!record_is_valid(p_record))
+                continue;
+            
+            /* sequence numbers wrap, compare by signed distance */
+            if(p_newest == NULL || (int16_t)(p_record->seq - m_seq) > 0)
+            {
+                p_newest = p_record;
+                m_seq = p_record->seq;
+                m_active_page = page;
+                m_next_slot = slot + 1;
+            }
+        }
+    }
+    
+    if(p_newest == NULL)
+    {
+        m_seq = 0;
+        m_active_page = 0;
+        m_next_slot = 0;
+    }
+    
+    /* skip slots holding a torn write, they can't be programmed again until
+     * the page is erased */
+    while(m_next_slot < m_slots_per_page && 
+        !slot_is_blank(slot_addr(m_active_page, m_next_slot)))
+    {
+        m_next_slot++;
+    }
+    
+    if(p_newest == NULL)
+        return false;
+    
+    memcpy(&m_app_settings, &p_newest->settings, sizeof(m_app_settings));
+    
+    return true;
+}
+// ------------------------------------------------------------------------------
+
+/**@brief Erase page 0 for a new log, whatever it held before.
+ */
+static uint32_t log_start( void )
+{
+    m_seq = 0;
+    m_active_page = 0;
+    m_next_slot = 0;
+    
+    return fs_erase(&fs_config, fs_config.p_start_addr, 1, NULL);
+}
+// ------------------------------------------------------------------------------
+
+static uint32_t record_append( void )
+{
+    uint32_t err_code;
+    
+    /* active page is full, continue the log on the oldest page */
+    if(m_next_slot >= m_slots_per_page)
+    {
+        m_active_page = (m_active_page + 1) % NUM_PAGES;
+        m_next_slot = 0;
+        
+        err_code = fs_erase(&fs_config, 
+            fs_config.p_start_addr + m_active_page * m_page_words, 1, NULL);
+        if(err_code != FS_SUCCESS)
+            return err_code;
+    }
+    
+    memcpy(&m_record.settings, &m_app_settings, sizeof(m_record.settings));
+    m_record.seq = m_seq + 1;
+    m_record.magic = RECORD_MAGIC;
+    m_record.crc8 = crc8((uint8_t*)&m_record, sizeof(m_record) - 1);
+    
+    err_code = fs_store(&fs_config, (const uint32_t*)slot_addr(m_active_page, m_next_slot), 
+        (const uint32_t*)&m_record, RECORD_WORDS, NULL);
+    if(err_code != FS_SUCCESS)
+        return err_code;
+    
+    m_seq++;
+    m_next_slot++;
+    m_store_pending = true;
+    
+    /* a set() from here on marks the settings dirty again */
+    m_is_dirty = false;
+    
+    return NRF_SUCCESS;
+}
 
 /**@brief Function for fstorage module callback.
  *
@@ -197,11 +400,33 @@ static bool is_valid( void )
  */
 static void fstorage_callback(fs_evt_t const * const evt, fs_ret_t result)
 {
+    uint32_t err_code;
+    
     if(evt->id == FS_EVT_STORE)
     {
-        if(result == FS_SUCCESS)
+        m_store_pending = false;
+        
+        /* the slot is consumed either way, the record is retried in the next one */
+        if(result != FS_SUCCESS)
+        {
+            m_is_dirty = true;
+            
+            if(m_store_retries < STORE_RETRIES)
+            {
+                m_store_retries++;
+                m_save_deferred = true;
+            }
+        }
+        else
+        {
+            m_store_retries = 0;
+        }
+        
+        if(m_save_deferred && m_is_dirty)
         {
-            m_is_dirty = false;
+            m_save_deferred = false;
+            err_code = record_append();
+            APP_ERROR_CHECK(err_code);
         }
     }
 }
@@ -0,0 +1,40 @@
+/** @file uarte_cfg.h
+*
+* @brief Peripherals simple_uarte.c takes for RX idle detection
+* @par
+* Two timers and two PPI channels, which nothing else may use while the
+* UARTE is enabled. TIMER0 is the SoftDevice's, and DTM and the timeslot
+* code use it too, as DTM uses PPI channel 0; the PPI channels must also
+* be ones the SoftDevice leaves to the application. Each can be
+* overridden from the project's defines.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#ifndef __UARTE_CFG_H__
+#define __UARTE_CFG_H__
+
+/* Restarted by each received byte, times the line out once it's idle */
+#ifndef UARTE_RX_IDLE_TIMER
+#define UARTE_RX_IDLE_TIMER             NRF_TIMER3
+#define UARTE_RX_IDLE_TIMER_IRQn        TIMER3_IRQn
+#define UARTE_RX_IDLE_TIMER_IRQHandler  TIMER3_IRQHandler
+#endif
+
+/* Counts received bytes */
+#ifndef UARTE_RX_COUNT_TIMER
+#define UARTE_RX_COUNT_TIMER            NRF_TIMER4
+#endif
+
+/* RXDRDY -> count, fork idle timer clear */
+#ifndef UARTE_RX_PPI_CH_COUNT
+#define UARTE_RX_PPI_CH_COUNT           NRF_PPI_CHANNEL10
+#endif
+
+/* RXDRDY -> idle timer start */
+#ifndef UARTE_RX_PPI_CH_IDLE
+#define UARTE_RX_PPI_CH_IDLE            NRF_PPI_CHANNEL11
+#endif
+
+#endif
@@ -0,0 +1,411 @@
+/** @file flash.c
+*
+* @brief fstorage and pstorage for the host build, over flash that
+*        outlives a boot
+*
+* @par
+* See flash.h.  An erase or a write happens when it completes, as the
+* SoftDevice does it, so one still queued when power goes is lost.
+* fs_erase and pstorage_clear of several pages are an operation for each
+* page, and their callback runs once, after the last.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "flash.h"
+
+#define FLASH_SIZE          (FLASH_PAGES * FLASH_PAGE_SIZE)
+#define FLASH_PAGE_WORDS    (FLASH_PAGE_SIZE / sizeof(uint32_t))
+
+/* Kept across boots, with the flash */
+static struct
+{
+    flash_count_t count;
+    uint32_t power_loss_at;     /* count.ops when power goes, 0 for never */
+    bool torn;
+} * m_retained;
+
+typedef struct
+{
+    bool erase;
+    bool notify;                /* the last operation of the caller's request */
+    uint32_t addr;
+    const uint32_t * p_src;
+    uint32_t words;
+    const fs_config_t * p_config;   /* NULL for pstorage */
+    void * p_context;
+    pstorage_handle_t handle;
+    uint32_t first_addr;        /* the first page of an erase */
+} flash_op_t;
+
+static flash_op_t m_queue[FLASH_QUEUE];
+static uint32_t m_head;
+static uint32_t m_count;
+
+static pstorage_ntf_cb_t m_ps_cb;
+static uint32_t m_ps_size;
+
+/* fs_config_t's registered with FS_REGISTER_CFG, if any */
+extern fs_config_t __start_fs_data[] __attribute__((weak));
+extern fs_config_t __stop_fs_data[] __attribute__((weak));
+
+static void op_complete(void * p_context);
+
+static uint64_t op_ns(const flash_op_t * p_op)
+{
+    return p_op->erase ? FLASH_ERASE_NS : p_op->words * FLASH_WORD_NS;
+}
+
+static bool range_ok(uint32_t addr, uint32_t len)
+{
+    return addr >= FLASH_BASE && addr <= FLASH_BASE + FLASH_SIZE &&
+           len <= FLASH_BASE + FLASH_SIZE - addr;
+}
+
+static bool push(const flash_op_t * p_op)
+{
+    if (m_count == FLASH_QUEUE)
+        return false;
+    m_queue[(m_head + m_count) % FLASH_QUEUE] = *p_op;
+    if (m_count++ == 0)
+        host_at(host_time() + op_ns(p_op), op_complete, NULL);
+    return true;
+}
+
+static void program(uint32_t addr, const uint32_t * src, uint32_t words)
+{
+    volatile uint32_t * dst = (volatile uint32_t *)(uintptr_t)addr;
+    uint32_t i;
+
+    for (i = 0; i < words; i++)
+    {
+        if ((dst[i] & src[i]) != src[i])
+            host_fail("flash write of %08x over %08x at %#x", src[i], dst[i], addr + 4 * i);
+        dst[i] &= src[i];
+    }
+}
+
+static void notify(const flash_op_t * p_op)
+{
+    fs_evt_t evt;
+
+    if (p_op->p_config == NULL)
+    {
+        pstorage_handle_t handle = p_op->handle;
+
+        m_ps_cb(&handle, p_op->erase ? PSTORAGE_CLEAR_OP_CODE : PSTORAGE_STORE_OP_CODE,
+                NRF_SUCCESS, (uint8_t *)p_op->p_src, p_op->words * sizeof(uint32_t));
+        return;
+    }
+
+    memset(&evt, 0, sizeof(evt));
+    evt.p_context = p_op->p_context;
+    if (p_op->erase)
+    {
+        evt.id = FS_EVT_ERASE;
+        evt.erase.first_page = p_op->first_addr / FLASH_PAGE_SIZE;
+        evt.erase.last_page = p_op->addr / FLASH_PAGE_SIZE;
+    }
+    else
+    {
+        evt.id = FS_EVT_STORE;
+        evt.store.p_data = (const uint32_t *)(uintptr_t)p_op->addr;
+        evt.store.length_words = p_op->words;
+    }
+    p_op->p_config->callback(&evt, FS_SUCCESS);
+}
+
+/* Finish the operation at the head of the queue, or lose power during it */
+static void op_complete(void * p_context)
+{
+    flash_op_t op = m_queue[m_head];
+    bool lose_power = m_retained->power_loss_at != 0 &&
+                      m_retained->count.ops + 1 == m_retained->power_loss_at;
+    uint32_t words = op.erase ? FLASH_PAGE_WORDS : op.words;
+    volatile uint32_t * dst = (volatile uint32_t *)(uintptr_t)op.addr;
+    uint32_t i;
+
+    if (lose_power && m_retained->torn)
+    {
+        uint32_t done = host_rand() % words;
+
+        if (op.erase)
+        {
+            for (i = 0; i < words; i++)
+                dst[i] |= host_rand() & host_rand();
+        }
+        else
+        {
+            program(op.addr, op.p_src, done);
+            dst[done] &= op.p_src[done] | host_rand();
+        }
+        fflush(NULL);
+        _exit(FLASH_EXIT_POWER_LOSS);
+    }
+
+    if (op.erase)
+    {
+        for (i = 0; i < words && dst[i] == 0xFFFFFFFF; i++)
+            ;
+        if (i == words)
+            m_retained->count.blank_erases++;
+        m_retained->count.erases++;
+        memset((void *)dst, 0xFF, FLASH_PAGE_SIZE);
+    }
+    else
+    {
+        m_retained->count.writes++;
+        program(op.addr, op.p_src, words);
+    }
+    m_retained->count.ops++;
+
+    if (lose_power)
+    {
+        fflush(NULL);
+        _exit(FLASH_EXIT_POWER_LOSS);
+    }
+
+    m_head = (m_head + 1) % FLASH_QUEUE;
+    if (--m_count != 0)
+        host_at(host_time() + op_ns(&m_queue[m_head]), op_complete, NULL);
+    if (op.notify)
+        notify(&op);
+}
+
+/* ---- The model ---- */
+
+void flash_init(void)
+{
+    if (m_retained == NULL)
+    {
+        void * p = mmap((void *)FLASH_BASE, FLASH_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+        m_retained = mmap(NULL, sizeof(*m_retained), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p != (void *)FLASH_BASE || m_retained == MAP_FAILED)
+        {
+            perror("mmap");
+            exit(1);
+        }
+    }
+    memset((void *)FLASH_BASE, 0xFF, FLASH_SIZE);
+    memset(m_retained, 0, sizeof(*m_retained));
+}
+
+int flash_boot(void (*fn)(void * p_context), void * p_context)
+{
+    uint32_t seed = host_rand();
+    pid_t pid;
+    int status;
+
+    fflush(NULL);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        host_init(seed);
+        m_head = 0;
+        m_count = 0;
+        m_ps_cb = NULL;
+        fn(p_context);
+        fflush(NULL);
+        _exit(FLASH_EXIT_DONE);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return FLASH_EXIT_FAIL;
+    return WEXITSTATUS(status);
+}
+
+void flash_power_loss_after(uint32_t ops, bool torn)
+{
+    m_retained->power_loss_at = ops ? m_retained->count.ops + ops : 0;
+    m_retained->torn = torn;
+}
+
+bool flash_busy(void)
+{
+    return m_count != 0;
+}
+
+flash_count_t flash_count(void)
+{
+    return m_retained->count;
+}
+
+/* ---- fstorage ---- */
+
+fs_ret_t fs_init(void)
+{
+    fs_config_t * p_config;
+    uint32_t addr = FLASH_BASE;
+
+    for (p_config = __start_fs_data; p_config < __stop_fs_data; p_config++)
+    {
+        p_config->p_start_addr = (const uint32_t *)(uintptr_t)addr;
+        addr += p_config->num_pages * FLASH_PAGE_SIZE;
+        p_config->p_end_addr = (const uint32_t *)(uintptr_t)addr;
+        if (!range_ok(FLASH_BASE, addr - FLASH_BASE))
+            host_fail("fs_init: more than %u pages", FLASH_PAGES);
+    }
+    return FS_SUCCESS;
+}
+
+fs_ret_t fs_store(fs_config_t const * const p_config, uint32_t const * const p_dest,
+                  uint32_t const * const p_src, uint16_t length_words, void * p_context)
+{
+    flash_op_t op = { 0 };
+
+    if (p_config == NULL || p_dest == NULL || p_src == NULL)
+        return FS_ERR_NULL_ARG;
+    if (length_words == 0)
+        return FS_ERR_INVALID_ARG;
+    if (p_dest < p_config->p_start_addr || p_dest + length_words > p_config->p_end_addr)
+        return FS_ERR_INVALID_ADDR;
+    if ((uintptr_t)p_src & 3)
+        return FS_ERR_UNALIGNED_ADDR;
+
+    op.notify = true;
+    op.addr = (uint32_t)(uintptr_t)p_dest;
+    op.p_src = p_src;
+    op.words = length_words;
+    op.p_config = p_config;
+    op.p_context = p_context;
+    return push(&op) ? FS_SUCCESS : FS_ERR_QUEUE_FULL;
+}
+
+fs_ret_t fs_erase(fs_config_t const * const p_config, uint32_t const * const p_page_addr,
+                  uint16_t num_pages, void * p_context)
+{
+    flash_op_t op = { 0 };
+    uint16_t i;
+
+    if (p_config == NULL || p_page_addr == NULL)
+        return FS_ERR_NULL_ARG;
+    if (num_pages == 0)
+        return FS_ERR_INVALID_ARG;
+    if ((uintptr_t)p_page_addr % FLASH_PAGE_SIZE)
+        return FS_ERR_UNALIGNED_ADDR;
+    if (p_page_addr < p_config->p_start_addr ||
+        p_page_addr + num_pages * FLASH_PAGE_WORDS > p_config->p_end_addr)
+        return FS_ERR_INVALID_ADDR;
+    if (m_count + num_pages > FLASH_QUEUE)
+        return FS_ERR_QUEUE_FULL;
+
+    op.erase = true;
+    op.first_addr = (uint32_t)(uintptr_t)p_page_addr;
+    op.p_config = p_config;
+    op.p_context = p_context;
+    for (i = 0; i < num_pages; i++)
+    {
+        op.addr = op.first_addr + i * FLASH_PAGE_SIZE;
+        op.notify = i + 1 == num_pages;
+        push(&op);
+    }
+    return FS_SUCCESS;
+}
+
+/* ---- pstorage ---- */
+
+uint32_t pstorage_init(void)
+{
+    m_ps_cb = NULL;
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_register(pstorage_module_param_t * p_module_param,
+                           pstorage_handle_t * p_block_id)
+{
+    if (p_module_param == NULL || p_block_id == NULL || p_module_param->cb == NULL)
+        return NRF_ERROR_NULL;
+    if (m_ps_cb != NULL)
+        return NRF_ERROR_NO_MEM;
+    if (p_module_param->block_size % sizeof(uint32_t) || p_module_param->block_count == 0 ||
+        (uint32_t)p_module_param->block_size * p_module_param->block_count > FLASH_SIZE)
+        return NRF_ERROR_INVALID_PARAM;
+
+    m_ps_cb = p_module_param->cb;
+    m_ps_size = p_module_param->block_size;
+    p_block_id->module_id = 0;
+    p_block_id->block_id = FLASH_BASE;
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_block_identifier_get(pstorage_handle_t * p_base_id, pstorage_size_t block_num,
+                                       pstorage_handle_t * p_block_id)
+{
+    if (p_base_id == NULL || p_block_id == NULL)
+        return NRF_ERROR_NULL;
+    if (m_ps_cb == NULL)
+        return NRF_ERROR_INVALID_STATE;
+
+    p_block_id->module_id = p_base_id->module_id;
+    p_block_id->block_id = p_base_id->block_id + block_num * m_ps_size;
+    if (!range_ok(p_block_id->block_id, m_ps_size))
+        return NRF_ERROR_INVALID_PARAM;
+    return NRF_SUCCESS;
+}
+
+uint32_t pstorage_store(pstorage_handle_t * p_dest, uint8_t * p_src, pstorage_size_t size,
+                        pstorage_size_t offset)
+{
+    flash_op_t op = { 0 };
+
+    if (p_dest == NULL || p_src == NULL)
+        return NRF_ERROR_NULL;
+    if (m_ps_cb == NULL)
+        return NRF_ERROR_INVALID_STATE;
+    if (size == 0 || size % sizeof(uint32_t) || offset % sizeof(uint32_t) ||
+        !range_ok(p_dest->block_id + offset, size))
+        return NRF_ERROR_INVALID_PARAM;
+    if ((uintptr_t)p_src & 3)
+        return NRF_ERROR_INVALID_ADDR;
+
+    op.notify = true;
+    op.addr = p_dest->block_id + offset;
+    op.p_src = (const uint32_t *)p_src;
+    op.words = size / sizeof(uint32_t);
+    op.handle = *p_dest;
+    return push(&op) ? NRF_SUCCESS : NRF_ERROR_NO_MEM;
+}
+
+uint32_t pstorage_clear(pstorage_handle_t * p_base_id, pstorage_size_t size)
+{
+    flash_op_t op = { 0 };
+    uint32_t pages = size / FLASH_PAGE_SIZE;
+    uint32_t i;
+
+    if (p_base_id == NULL)
+        return NRF_ERROR_NULL;
+    if (m_ps_cb == NULL)
+        return NRF_ERROR_INVALID_STATE;
+    if (p_base_id->block_id % FLASH_PAGE_SIZE || size % FLASH_PAGE_SIZE)
+        host_fail("pstorage_clear of %u bytes at %#x: only whole pages", size,
+                  p_base_id->block_id);
+    if (size == 0 || !range_ok(p_base_id->block_id, size))
+        return NRF_ERROR_INVALID_PARAM;
+    if (m_count + pages > FLASH_QUEUE)
+        return NRF_ERROR_NO_MEM;
+
+    op.erase = true;
+    op.first_addr = p_base_id->block_id;
+    op.handle = *p_base_id;
+    for (i = 0; i < pages; i++)
+    {
+        op.addr = op.first_addr + i * FLASH_PAGE_SIZE;
+        op.notify = i + 1 == pages;
+        push(&op);
+    }
+    return NRF_SUCCESS;
+}
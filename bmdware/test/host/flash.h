@@ -0,0 +1,161 @@
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "host.h"
+
+/* The settings' flash, standing in for fstorage on the nRF52 and
+   pstorage on the nRF51.  Its FLASH_PAGES pages are shared with child
+   processes, so what was written outlives a boot run with flash_boot.
+   Operations queue as the SDK queues them and complete one after the
+   other, each taking the time the chip takes, when the caller's
+   callback runs.  A write may only clear bits. */
+
+#ifndef FLASH_PAGE_SIZE
+#define FLASH_PAGE_SIZE         4096
+#endif
+#define FLASH_PAGES             2
+#define FLASH_BASE              0x70000UL   /* below 4 GB, for pstorage's uint32_t addresses */
+#define FLASH_QUEUE             4
+#define FLASH_ERASE_NS          85000000ULL
+#define FLASH_WORD_NS           41000ULL
+
+enum
+{
+    FLASH_EXIT_DONE,            /* the function given to flash_boot returned */
+    FLASH_EXIT_FAIL,            /* host_fail, or the boot didn't exit */
+    FLASH_EXIT_POWER_LOSS,      /* see flash_power_loss_after */
+};
+
+/* Map and erase the pages, and clear the counts */
+void flash_init(void);
+
+/* Run fn in a child process as one boot of the device, after host_init
+   with the next host_rand; returns its FLASH_EXIT_ code */
+int flash_boot(void (*fn)(void * p_context), void * p_context);
+
+/* Lose power when the ops'th flash operation from now completes, in
+   whichever boot that is, or while it is under way if torn: part of a
+   write is done, and an erase leaves random bits set.  0 disarms. */
+void flash_power_loss_after(uint32_t ops, bool torn);
+
+/* Whether operations are queued or under way */
+bool flash_busy(void);
+
+/* Operations completed since flash_init, and the page erases among
+   them, including those of pages that were already blank */
+typedef struct
+{
+    uint32_t ops;
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t blank_erases;
+} flash_count_t;
+flash_count_t flash_count(void);
+
+/* ---- fstorage.h, section_vars.h ---- */
+
+typedef enum
+{
+    FS_SUCCESS,
+    FS_ERR_NOT_INITIALIZED,
+    FS_ERR_INVALID_CFG,
+    FS_ERR_NULL_ARG,
+    FS_ERR_INVALID_ARG,
+    FS_ERR_INVALID_ADDR,
+    FS_ERR_UNALIGNED_ADDR,
+    FS_ERR_QUEUE_FULL,
+    FS_ERR_OPERATION_TIMEOUT,
+    FS_ERR_INTERNAL,
+    FS_ERR_FAILURE_SINCE_LAST
+} fs_ret_t;
+
+typedef enum
+{
+    FS_EVT_STORE,
+    FS_EVT_ERASE
+} fs_evt_id_t;
+
+typedef struct
+{
+    fs_evt_id_t id;
+    void * p_context;
+    union
+    {
+        struct
+        {
+            uint32_t const * p_data;
+            uint16_t length_words;
+        } store;
+        struct
+        {
+            uint16_t first_page;
+            uint16_t last_page;
+        } erase;
+    };
+} fs_evt_t;
+
+typedef void (*fs_cb_t)(fs_evt_t const * const evt, fs_ret_t result);
+
+typedef struct
+{
+    uint32_t const * p_start_addr;      /* set by fs_init */
+    uint32_t const * p_end_addr;
+    fs_cb_t const callback;
+    uint8_t const num_pages;
+    uint8_t const priority;
+} fs_config_t;
+
+/* Registered in a section of their own, as NRF_SECTION_VARS does */
+#define FS_REGISTER_CFG(cfg_var) __attribute__((section("fs_data"), used)) cfg_var
+
+fs_ret_t fs_init(void);
+fs_ret_t fs_store(fs_config_t const * const p_config, uint32_t const * const p_dest,
+                  uint32_t const * const p_src, uint16_t length_words, void * p_context);
+fs_ret_t fs_erase(fs_config_t const * const p_config, uint32_t const * const p_page_addr,
+                  uint16_t num_pages, void * p_context);
+
+/* ---- pstorage.h, pstorage_platform.h ---- */
+
+#define PSTORAGE_FLASH_PAGE_SIZE    FLASH_PAGE_SIZE
+#define PSTORAGE_FLASH_EMPTY_MASK   0xFFFFFFFF
+
+#define PSTORAGE_ERROR_OP_CODE      0x01
+#define PSTORAGE_STORE_OP_CODE      0x02
+#define PSTORAGE_LOAD_OP_CODE       0x03
+#define PSTORAGE_CLEAR_OP_CODE      0x04
+#define PSTORAGE_UPDATE_OP_CODE     0x05
+
+typedef uint32_t pstorage_block_t;
+typedef uint16_t pstorage_size_t;
+
+typedef struct
+{
+    uint32_t module_id;
+    pstorage_block_t block_id;
+} pstorage_handle_t;
+
+typedef void (*pstorage_ntf_cb_t)(pstorage_handle_t * p_handle, uint8_t op_code,
+                                  uint32_t result, uint8_t * p_data, uint32_t data_len);
+
+typedef struct
+{
+    pstorage_ntf_cb_t cb;
+    pstorage_size_t block_size;
+    pstorage_size_t block_count;
+} pstorage_module_param_t;
+
+/* One module, as BMDware registers; pstorage_clear only clears whole
+   pages, which it erases without going through the swap page */
+uint32_t pstorage_init(void);
+uint32_t pstorage_register(pstorage_module_param_t * p_module_param,
+                           pstorage_handle_t * p_block_id);
+uint32_t pstorage_block_identifier_get(pstorage_handle_t * p_base_id, pstorage_size_t block_num,
+                                       pstorage_handle_t * p_block_id);
+uint32_t pstorage_store(pstorage_handle_t * p_dest, uint8_t * p_src, pstorage_size_t size,
+                        pstorage_size_t offset);
+uint32_t pstorage_clear(pstorage_handle_t * p_base_id, pstorage_size_t size);
+
+#endif
@@ -0,0 +1,470 @@
+/** @file host.c
+*
+* @brief Fake SoftDevice, app_timer and chip for the host build
+*
+* @par
+* See host.h.  Everything here runs in one thread: an event, a timeout
+* or a connection event is delivered, runs to completion, and then the
+* main loop gets its turn before the next.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "host.h"
+
+#define HOST_PERIPH_BASE    0x40000000UL    /* APB peripherals, POWER to PPI */
+#define HOST_PERIPH_SIZE    0x40000
+#define HOST_GPIO_SIZE      0x1000
+#define HOST_MAX_EVENTS     64
+#define HOST_MAX_TIMERS     8
+#define HOST_MAX_IRQS       64
+#define HOST_LINK_BUFFERS   32
+#define HOST_LINK_MAX_LEN   (GATT_EXTENDED_MTU_SIZE - 3)
+
+static uint32_t m_rand = 1;
+static uint64_t m_now;
+static uint64_t m_seq;
+static void (*m_loop)(void);
+static uint32_t m_timeouts;
+
+static struct
+{
+    uint64_t at;
+    uint64_t seq;
+    host_event_t fn;
+    void * p_context;
+} m_events[HOST_MAX_EVENTS];
+static uint32_t m_event_count;
+
+static app_timer_id_t m_timers[HOST_MAX_TIMERS];
+static uint32_t m_timer_count;
+
+static bool m_irq_enabled[HOST_MAX_IRQS];
+static bool m_irq_pending[HOST_MAX_IRQS];
+
+/* The SoftDevice's side of the connection */
+static struct
+{
+    host_link_t link;
+    bool up;
+    uint32_t generation;        /* stale connection events are dropped */
+    uint32_t busy;
+    uint8_t head;
+    uint8_t queued;
+    uint16_t len[HOST_LINK_BUFFERS];
+    uint8_t data[HOST_LINK_BUFFERS][HOST_LINK_MAX_LEN];
+} m_link;
+
+uint32_t host_rand(void)
+{
+    /* xorshift32 */
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+void host_fail(const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    fflush(NULL);
+    _exit(1);
+}
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t * p_file_name)
+{
+    host_fail("error %u at %s:%u", error_code, (const char *)p_file_name, line_num);
+}
+
+static void map_fixed(uintptr_t addr, size_t len)
+{
+    void * p = mmap((void *)addr, len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *)addr)
+    {
+        perror("mmap");
+        exit(1);
+    }
+}
+
+void host_init(uint32_t seed)
+{
+    static bool mapped;
+
+    if (!mapped)
+    {
+        map_fixed(HOST_PERIPH_BASE, HOST_PERIPH_SIZE);
+        map_fixed(NRF_P0_BASE, HOST_GPIO_SIZE);
+        mapped = true;
+    }
+    memset((void *)HOST_PERIPH_BASE, 0, HOST_PERIPH_SIZE);
+    memset((void *)NRF_P0_BASE, 0, HOST_GPIO_SIZE);
+
+    m_now = 0;
+    m_seq = 0;
+    m_loop = NULL;
+    m_timeouts = 0;
+    m_event_count = 0;
+    m_timer_count = 0;
+    memset(m_irq_enabled, 0, sizeof(m_irq_enabled));
+    memset(m_irq_pending, 0, sizeof(m_irq_pending));
+    m_link.up = false;
+    m_link.generation++;
+
+    m_rand = seed ? seed : 1;
+}
+
+/* ---- Time ---- */
+
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+    return (ticks * HOST_NS_PER_S + APP_TIMER_CLOCK_FREQ - 1) / APP_TIMER_CLOCK_FREQ;
+}
+
+uint64_t host_time(void)
+{
+    return m_now;
+}
+
+uint64_t host_ticks(void)
+{
+    return m_now * APP_TIMER_CLOCK_FREQ / HOST_NS_PER_S;
+}
+
+void host_at(uint64_t at, host_event_t fn, void * p_context)
+{
+    if (m_event_count == HOST_MAX_EVENTS)
+        host_fail("more than %u events", HOST_MAX_EVENTS);
+    m_events[m_event_count].at = at < m_now ? m_now : at;
+    m_events[m_event_count].seq = m_seq++;
+    m_events[m_event_count].fn = fn;
+    m_events[m_event_count].p_context = p_context;
+    m_event_count++;
+}
+
+void host_set_loop(void (*fn)(void))
+{
+    m_loop = fn;
+}
+
+uint32_t host_timeouts(void)
+{
+    return m_timeouts;
+}
+
+void host_run_until(uint64_t until)
+{
+    for (;;)
+    {
+        app_timer_id_t timer = NULL;
+        int32_t event = -1;
+        uint64_t at = UINT64_MAX;
+        uint32_t i;
+
+        /* In order of time, then of scheduling; a timeout on the same
+           nanosecond as an event goes after it */
+        for (i = 0; i < m_event_count; i++)
+            if (event < 0 || m_events[i].at < m_events[event].at
+                || (m_events[i].at == m_events[event].at
+                    && m_events[i].seq < m_events[event].seq))
+                event = i;
+        if (event >= 0)
+            at = m_events[event].at;
+        for (i = 0; i < m_timer_count; i++)
+            if (m_timers[i]->expires && ticks_to_ns(m_timers[i]->expires) < at
+                && (!timer || m_timers[i]->expires < timer->expires))
+                timer = m_timers[i];
+        if (timer)
+            at = ticks_to_ns(timer->expires);
+        if (at > until)
+            break;
+
+        if (at > m_now)
+            m_now = at;
+        if (timer)
+        {
+            timer->expires = timer->mode == APP_TIMER_MODE_REPEATED
+                             ? timer->expires + timer->ticks : 0;
+            m_timeouts++;
+            timer->handler(timer->p_context);
+        }
+        else
+        {
+            host_event_t fn = m_events[event].fn;
+            void * p_context = m_events[event].p_context;
+
+            m_events[event] = m_events[--m_event_count];
+            fn(p_context);
+        }
+        if (m_loop)
+            m_loop();
+    }
+    if (until > m_now)
+        m_now = until;
+}
+
+/* ---- app_timer, on RTC1 ---- */
+
+uint32_t app_timer_init(uint32_t prescaler, uint8_t op_queue_size, void * p_buffer,
+                        void * evt_schedule_func)
+{
+    if (prescaler != 0)
+        host_fail("app_timer prescaler %u isn't modelled", prescaler);
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode,
+                          app_timer_timeout_handler_t timeout_handler)
+{
+    app_timer_id_t timer = *p_timer_id;
+    uint32_t i;
+
+    if (timeout_handler == NULL)
+        return NRF_ERROR_INVALID_PARAM;
+    timer->handler = timeout_handler;
+    timer->mode = mode;
+    timer->expires = 0;
+    for (i = 0; i < m_timer_count; i++)
+        if (m_timers[i] == timer)
+            return NRF_SUCCESS;
+    if (m_timer_count == HOST_MAX_TIMERS)
+        return NRF_ERROR_NO_MEM;
+    m_timers[m_timer_count++] = timer;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+    if (timer_id->handler == NULL)
+        return NRF_ERROR_INVALID_STATE;
+    if (timeout_ticks < APP_TIMER_MIN_TIMEOUT_TICKS)
+        return NRF_ERROR_INVALID_PARAM;
+    timer_id->ticks = timeout_ticks;
+    timer_id->expires = host_ticks() + timeout_ticks;
+    timer_id->p_context = p_context;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_stop(app_timer_id_t timer_id)
+{
+    timer_id->expires = 0;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_stop_all(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < m_timer_count; i++)
+        m_timers[i]->expires = 0;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(void)
+{
+    return (uint32_t)host_ticks() & 0xFFFFFF;
+}
+
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from,
+                                    uint32_t * p_ticks_diff)
+{
+    *p_ticks_diff = (ticks_to - ticks_from) & 0xFFFFFF;
+    return NRF_SUCCESS;
+}
+
+void nrf_delay_ms(uint32_t volatile number_of_ms)
+{
+    m_now += (uint64_t)number_of_ms * 1000000;
+}
+
+void nrf_delay_us(uint32_t volatile number_of_us)
+{
+    m_now += (uint64_t)number_of_us * 1000;
+}
+
+/* ---- NVIC ---- */
+
+static uint32_t irq_index(IRQn_Type irq)
+{
+    if ((int32_t)irq < 0 || irq >= HOST_MAX_IRQS)
+        host_fail("IRQ %d isn't modelled", irq);
+    return irq;
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    m_irq_enabled[irq_index(IRQn)] = true;
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    m_irq_enabled[irq_index(IRQn)] = false;
+}
+
+void NVIC_SetPendingIRQ(IRQn_Type IRQn)
+{
+    m_irq_pending[irq_index(IRQn)] = true;
+}
+
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    m_irq_pending[irq_index(IRQn)] = false;
+}
+
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    (void)irq_index(IRQn);
+}
+
+bool host_irq_enabled(IRQn_Type irq)
+{
+    return m_irq_enabled[irq_index(irq)];
+}
+
+/* ---- SoftDevice ---- */
+
+static void link_dispatch(uint16_t evt_id, uint8_t count)
+{
+    ble_evt_t evt;
+
+    memset(&evt, 0, sizeof(evt));
+    evt.header.evt_id = evt_id;
+    evt.header.evt_len = sizeof(evt);
+    if (evt_id == BLE_EVT_TX_COMPLETE)
+    {
+        evt.evt.common_evt.conn_handle = 0;
+        evt.evt.common_evt.params.tx_complete.count = count;
+    }
+    else
+    {
+        evt.evt.gap_evt.conn_handle = 0;
+    }
+    m_link.link.dispatch(&evt);
+}
+
+/* Send what fits in this connection event and schedule the next */
+static void link_event(void * p_context)
+{
+    uint8_t sent = 0;
+
+    if ((uintptr_t)p_context != m_link.generation)
+        return;
+    while (m_link.queued && sent < m_link.link.per_event)
+    {
+        if (m_link.link.sent)
+            m_link.link.sent(m_link.data[m_link.head], m_link.len[m_link.head]);
+        m_link.head = (m_link.head + 1) % HOST_LINK_BUFFERS;
+        m_link.queued--;
+        sent++;
+    }
+    if (sent)
+        link_dispatch(BLE_EVT_TX_COMPLETE, sent);
+    host_at(m_now + m_link.link.interval, link_event, (void *)(uintptr_t)m_link.generation);
+}
+
+void host_link_start(const host_link_t * p_link)
+{
+    if (p_link->buffers == 0 || p_link->buffers > HOST_LINK_BUFFERS)
+        host_fail("%u link buffers", p_link->buffers);
+    m_link.link = *p_link;
+    m_link.up = true;
+    m_link.generation++;
+    m_link.busy = 0;
+    m_link.head = 0;
+    m_link.queued = 0;
+    link_dispatch(BLE_GAP_EVT_CONNECTED, 0);
+    host_at(m_now + m_link.link.interval, link_event, (void *)(uintptr_t)m_link.generation);
+}
+
+void host_link_stop(void)
+{
+    m_link.up = false;
+    m_link.generation++;
+    link_dispatch(BLE_GAP_EVT_DISCONNECTED, 0);
+}
+
+void host_link_busy(uint32_t calls)
+{
+    m_link.busy = calls;
+}
+
+uint32_t sd_ble_tx_packet_count_get(uint16_t conn_handle, uint8_t * p_count)
+{
+    if (!m_link.up)
+        return BLE_ERROR_INVALID_CONN_HANDLE;
+    *p_count = m_link.link.buffers;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_hvx(uint16_t conn_handle, ble_gatts_hvx_params_t const * p_hvx_params)
+{
+    uint32_t tail;
+    uint16_t len = *p_hvx_params->p_len;
+
+    if (!m_link.up)
+        return BLE_ERROR_INVALID_CONN_HANDLE;
+    if (len > HOST_LINK_MAX_LEN)
+        host_fail("notification of %u bytes", len);
+    if (m_link.busy)
+    {
+        m_link.busy--;
+        return NRF_ERROR_BUSY;
+    }
+    if (m_link.queued == m_link.link.buffers)
+        return BLE_ERROR_NO_TX_PACKETS;
+
+    tail = (m_link.head + m_link.queued) % HOST_LINK_BUFFERS;
+    if (m_link.link.queued)
+        m_link.link.queued(p_hvx_params->p_data, len);
+    memcpy(m_link.data[tail], p_hvx_params->p_data, len);
+    m_link.len[tail] = len;
+    m_link.queued++;
+    return NRF_SUCCESS;
+}
+
+/* GATT table setup, which the tests don't look at */
+
+uint32_t sd_ble_uuid_vs_add(ble_uuid128_t const * p_vs_uuid, uint8_t * p_uuid_type)
+{
+    *p_uuid_type = BLE_UUID_TYPE_VENDOR_BEGIN;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_service_add(uint8_t type, ble_uuid_t const * p_uuid, uint16_t * p_handle)
+{
+    static uint16_t handle;
+
+    *p_handle = ++handle;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_characteristic_add(uint16_t service_handle,
+                                         ble_gatts_char_md_t const * p_char_md,
+                                         ble_gatts_attr_t const * p_attr_char_value,
+                                         ble_gatts_char_handles_t * p_handles)
+{
+    static uint16_t handle = 0x100;
+
+    memset(p_handles, 0, sizeof(*p_handles));
+    p_handles->value_handle = ++handle;
+    p_handles->cccd_handle = ++handle;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_ble_gatts_value_set(uint16_t conn_handle, uint16_t handle, ble_gatts_value_t * p_value)
+{
+    return NRF_SUCCESS;
+}
@@ -0,0 +1,169 @@
+/** @file host.h
+*
+* @brief Host stand-ins for the nRF5 SDK, SoftDevice and chip
+*
+* @par
+* Just enough to build BMDware's common modules on a PC.  The headers
+* under sdk/ include this one in place of the SDK's.  The SoftDevice's
+* own headers are used as they are, built with SVCALL_AS_NORMAL_FUNCTION
+* so its calls are plain functions, which host.c provides.  The nRF52's
+* register definitions are the real ones too, and host_init maps the
+* peripherals at their own addresses, so a model of one can see what the
+* code wrote to it.
+*
+* Time is simulated.  host_run_until delivers what is due in order:
+* events the test or a model scheduled with host_at, and app_timer
+* timeouts, on the RTC1 tick they fall on.  After each, the main loop
+* set with host_set_loop runs, as it would on waking from
+* sd_app_evt_wait.  Interrupts run to completion when they are raised,
+* so critical regions are empty.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+/* nrf.h: the chip's registers, see sdk/core_cm4.h */
+#include "nrf52.h"
+#include "nrf52_bitfields.h"
+#include "nrf51_to_nrf52.h"
+#include "nrf52_name_change.h"
+#include "compiler_abstraction.h"
+
+#include "nrf_error.h"
+#include "app_util.h"
+#include "ble.h"
+
+/* app_error.h: any error the code doesn't handle fails the test */
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t * p_file_name);
+#define APP_ERROR_HANDLER(ERR_CODE)                                         \
+    app_error_handler((ERR_CODE), __LINE__, (uint8_t *)__FILE__)
+#define APP_ERROR_CHECK(ERR_CODE)                                           \
+    do {                                                                    \
+        const uint32_t LOCAL_ERR_CODE = (ERR_CODE);                         \
+        if (LOCAL_ERR_CODE != NRF_SUCCESS)                                  \
+            APP_ERROR_HANDLER(LOCAL_ERR_CODE);                              \
+    } while (0)
+#define APP_ERROR_CHECK_BOOL(BOOLEAN_VALUE)                                 \
+    do {                                                                    \
+        if (!(BOOLEAN_VALUE))                                               \
+            APP_ERROR_HANDLER(0);                                           \
+    } while (0)
+
+/* app_util_platform.h: an interrupt runs to completion when it is
+   raised, so nothing can come between */
+typedef enum
+{
+    APP_IRQ_PRIORITY_HIGHEST = 2,
+    APP_IRQ_PRIORITY_HIGH    = 2,
+    APP_IRQ_PRIORITY_MID     = 4,
+    APP_IRQ_PRIORITY_LOW     = 6,
+    APP_IRQ_PRIORITY_LOWEST  = 7,
+    APP_IRQ_PRIORITY_THREAD  = 15
+} app_irq_priority_t;
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT()  }
+
+/* app_timer.h: RTC1 at 32768 Hz, prescaler 0, 24 bits */
+#define APP_TIMER_CLOCK_FREQ            32768
+#define APP_TIMER_MIN_TIMEOUT_TICKS     5
+#define APP_TIMER_TICKS(MS, PRESCALER)                                      \
+    ((uint32_t)ROUNDED_DIV((MS) * (uint64_t)APP_TIMER_CLOCK_FREQ, ((PRESCALER) + 1) * 1000))
+typedef void (*app_timer_timeout_handler_t)(void * p_context);
+typedef enum
+{
+    APP_TIMER_MODE_SINGLE_SHOT,
+    APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+typedef struct host_timer * app_timer_id_t;
+struct host_timer
+{
+    app_timer_timeout_handler_t handler;
+    app_timer_mode_t mode;
+    uint32_t ticks;
+    uint64_t expires;           /* RTC1 tick, 0 when stopped */
+    void * p_context;
+};
+#define APP_TIMER_DEF(timer_id)                                             \
+    static struct host_timer timer_id##_data;                               \
+    static const app_timer_id_t timer_id = &timer_id##_data
+#define APP_TIMER_INIT(PRESCALER, OP_QUEUE_SIZE, SCHEDULER_FUNC)            \
+    APP_ERROR_CHECK(app_timer_init((PRESCALER), (OP_QUEUE_SIZE), NULL, NULL))
+uint32_t app_timer_init(uint32_t prescaler, uint8_t op_queue_size, void * p_buffer,
+                        void * evt_schedule_func);
+uint32_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode,
+                          app_timer_timeout_handler_t timeout_handler);
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context);
+uint32_t app_timer_stop(app_timer_id_t timer_id);
+uint32_t app_timer_stop_all(void);
+uint32_t app_timer_cnt_get(void);
+uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from,
+                                    uint32_t * p_ticks_diff);
+
+/* nrf_delay.h: time moves on, without running anything */
+void nrf_delay_ms(uint32_t volatile number_of_ms);
+void nrf_delay_us(uint32_t volatile number_of_us);
+
+/* ---- The model, for the tests ---- */
+
+#define HOST_NS_PER_S           1000000000ULL
+
+/* Map the peripherals, reset time, timers and the NVIC; seed host_rand */
+void host_init(uint32_t seed);
+
+/* Pseudo-random numbers, the same for the same seed */
+uint32_t host_rand(void);
+
+/* Report a failed check and end the process */
+void host_fail(const char * fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+/* Simulated time in nanoseconds, and the RTC1 tick it falls in */
+uint64_t host_time(void);
+uint64_t host_ticks(void);
+
+/* Call fn at the given time; times already past run next */
+typedef void (*host_event_t)(void * p_context);
+void host_at(uint64_t at, host_event_t fn, void * p_context);
+
+/* The main loop, run after each event and timeout */
+void host_set_loop(void (*fn)(void));
+
+/* Deliver everything due up to the given time, then move time there */
+void host_run_until(uint64_t until);
+
+/* App timer timeouts delivered since host_init */
+uint32_t host_timeouts(void);
+
+/* Whether the NVIC has an interrupt enabled */
+bool host_irq_enabled(IRQn_Type irq);
+
+/* The SoftDevice's link to a peer.  Notifications queue in its
+   buffers, and each connection event sends up to per_event of them and
+   reports them done with BLE_EVT_TX_COMPLETE, through dispatch, as the
+   SoftDevice handler would.  Starting and stopping the link report
+   BLE_GAP_EVT_CONNECTED and BLE_GAP_EVT_DISCONNECTED the same way. */
+typedef struct
+{
+    uint8_t buffers;                /* sd_ble_tx_packet_count_get */
+    uint8_t per_event;
+    uint64_t interval;              /* ns between connection events */
+    void (*dispatch)(ble_evt_t * p_ble_evt);
+    /* Each notification as sd_ble_gatts_hvx takes it, and as it goes */
+    void (*queued)(const uint8_t * p_data, uint16_t len);
+    void (*sent)(const uint8_t * p_data, uint16_t len);
+} host_link_t;
+void host_link_start(const host_link_t * p_link);
+void host_link_stop(void);
+
+/* The next sd_ble_gatts_hvx calls fail with NRF_ERROR_BUSY, as they do
+   while the SoftDevice is busy with something else */
+void host_link_busy(uint32_t calls);
+
+#endif /* HOST_H */
@@ -0,0 +1,21 @@
+/* Host build: the parts of CMSIS nrf52.h needs.  The NVIC is modelled
+   in host.c, see host.h. */
+#ifndef HOST_CORE_CM4_H
+#define HOST_CORE_CM4_H
+
+#include <stdint.h>
+
+#define __I     volatile const
+#define __O     volatile
+#define __IO    volatile
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+void NVIC_SetPendingIRQ(IRQn_Type IRQn);
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn);
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+#define __WFI()
+#define __STATIC_INLINE static inline
+#define __REV(value)    __builtin_bswap32(value)
+
+#endif
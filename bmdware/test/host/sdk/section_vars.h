@@ -0,0 +1,2 @@
+/* Host build: see flash.h */
+#include "flash.h"
@@ -0,0 +1 @@
+/* Host build: nothing the tests need */
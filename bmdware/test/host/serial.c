@@ -0,0 +1,221 @@
+/** @file serial.c
+*
+* @brief simple_uart for the host build, and the peer at the far end
+*
+* @par
+* See serial.h.  A byte's RXDRDY comes at the end of its stop bit, when
+* the rx callback runs if the device will take it.  If not, the byte is
+* held as the UART would hold it, and simple_uart_enable_rx raises the
+* interrupt again.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include "host.h"
+#include "simple_uart.h"
+#include "serial.h"
+
+#define SERIAL_QUEUE    0x40000         /* power of two */
+#define SERIAL_TX_LOG   0x10000
+
+static simple_uart_rx_callback_t m_rx_cb;
+static simple_uart_tx_callback_t m_tx_cb;
+static simple_uart_canrx_callback_t m_canrx_cb;
+static bool m_rx_enable;
+static bool m_hwfc;
+static uint64_t m_char_ns = 1;
+
+/* From the peer */
+static uint8_t m_queue[SERIAL_QUEUE];
+static uint64_t m_not_before[SERIAL_QUEUE];
+static uint32_t m_head;
+static uint32_t m_tail;
+static uint64_t m_line_free;
+static uint32_t m_generation;   /* a new config drops the byte on the wire */
+static bool m_scheduled;
+static bool m_held;
+static uint8_t m_held_byte;
+static uint32_t m_lost;
+
+/* To the peer */
+static uint8_t m_tx_log[SERIAL_TX_LOG];
+static uint32_t m_tx_size;
+static bool m_tx_busy;
+
+static void byte_arrives(void * p_context);
+
+static void schedule_next(void)
+{
+    uint64_t start;
+    uint32_t i = m_head % SERIAL_QUEUE;
+
+    if (m_head == m_tail || m_scheduled || (m_held && m_hwfc))
+        return;
+    start = m_not_before[i];
+    if (start < m_line_free)
+        start = m_line_free;
+    if (start < host_time())
+        start = host_time();
+    m_scheduled = true;
+    host_at(start + m_char_ns, byte_arrives, (void *)(uintptr_t)m_generation);
+}
+
+static bool can_rx(void)
+{
+    return m_rx_enable && m_rx_cb != NULL && (m_canrx_cb == NULL || m_canrx_cb());
+}
+
+static void byte_arrives(void * p_context)
+{
+    uint8_t byte;
+
+    if ((uintptr_t)p_context != m_generation)
+        return;
+    m_scheduled = false;
+    byte = m_queue[m_head++ % SERIAL_QUEUE];
+    m_line_free = host_time();
+
+    if (m_held)
+        m_lost++;
+    else if (can_rx())
+        m_rx_cb(byte);
+    else
+    {
+        m_held = true;
+        m_held_byte = byte;
+    }
+    schedule_next();
+}
+
+/* The interrupt simple_uart_enable_rx raises */
+static void rx_pending(void * p_context)
+{
+    if (m_held && can_rx())
+    {
+        m_held = false;
+        m_rx_cb(m_held_byte);
+    }
+    schedule_next();
+}
+
+static void tx_done(void * p_context)
+{
+    m_tx_busy = false;
+    if (m_tx_cb)
+        m_tx_cb();
+}
+
+/* ---- The peer ---- */
+
+void serial_send(uint64_t at, const uint8_t * p_data, uint32_t len)
+{
+    uint32_t i;
+
+    if (m_tail - m_head + len > SERIAL_QUEUE)
+        host_fail("serial queue full");
+    for (i = 0; i < len; i++)
+    {
+        m_queue[m_tail % SERIAL_QUEUE] = p_data[i];
+        m_not_before[m_tail % SERIAL_QUEUE] = at;
+        m_tail++;
+    }
+    schedule_next();
+}
+
+uint64_t serial_char_ns(void)
+{
+    return m_char_ns;
+}
+
+uint32_t serial_pending(void)
+{
+    return m_tail - m_head + (m_held ? 1 : 0);
+}
+
+uint32_t serial_lost(void)
+{
+    return m_lost;
+}
+
+uint32_t serial_take(uint8_t * p_data, uint32_t max)
+{
+    uint32_t len = m_tx_size < max ? m_tx_size : max;
+
+    memcpy(p_data, m_tx_log, len);
+    memmove(m_tx_log, m_tx_log + len, m_tx_size - len);
+    m_tx_size -= len;
+    return len;
+}
+
+/* ---- simple_uart ---- */
+
+void simple_uart_config(uint8_t rts_pin_number, uint8_t txd_pin_number, uint8_t cts_pin_number,
+                        uint8_t rxd_pin_number, bool hwfc, uint32_t baud_select, uint8_t parity_select)
+{
+    /* BAUDRATE is the rate as a fraction of 2^32 of the 16 MHz clock */
+    uint64_t rate = ((uint64_t)baud_select * 16000000) >> 32;
+    uint32_t bits = parity_select ? 11 : 10;
+
+    if (rate == 0)
+        host_fail("baud rate %#x", baud_select);
+    m_char_ns = (bits * HOST_NS_PER_S + rate - 1) / rate;
+    m_hwfc = hwfc;
+    m_rx_cb = NULL;
+    m_rx_enable = true;
+    m_tx_busy = false;
+    m_generation++;
+    m_scheduled = false;
+    m_held = false;
+    m_line_free = host_time();
+    schedule_next();
+}
+
+void simple_uart_set_rx_callback(simple_uart_rx_callback_t cb)
+{
+    m_rx_cb = cb;
+}
+
+void simple_uart_set_tx_callback(simple_uart_tx_callback_t cb)
+{
+    m_tx_cb = cb;
+}
+
+void simple_uart_set_canrx_callback(simple_uart_canrx_callback_t cb)
+{
+    m_canrx_cb = cb;
+}
+
+void simple_uart_put_nonblocking(uint8_t cr)
+{
+    if (m_tx_busy)
+        host_fail("simple_uart_put_nonblocking while a byte is going out");
+    if (m_tx_size == SERIAL_TX_LOG)
+        host_fail("serial tx log full");
+    m_tx_log[m_tx_size++] = cr;
+    m_tx_busy = true;
+    host_at(host_time() + m_char_ns, tx_done, NULL);
+}
+
+void simple_uart_disable(void)
+{
+    m_rx_enable = false;
+    m_generation++;
+    m_scheduled = false;
+}
+
+void simple_uart_enable_rx(void)
+{
+    m_rx_enable = true;
+    host_at(host_time(), rx_pending, NULL);
+}
+
+void simple_uart_disable_rx(void)
+{
+    m_rx_enable = false;
+}
+
+bool simple_uart_get_rx_enable(void)
+{
+    return m_rx_enable;
+}
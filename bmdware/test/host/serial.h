@@ -0,0 +1,27 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* The far end of the UART, standing in for simple_uart.c.  Bytes go out
+   one character time apart at the rate and parity simple_uart_config
+   was given.  With flow control the sender holds off while the device
+   isn't taking bytes; without it, a byte that arrives while the last is
+   still held is lost. */
+
+/* Send bytes back to back, starting at the given time or once the
+   bytes before them are done */
+void serial_send(uint64_t at, const uint8_t * p_data, uint32_t len);
+
+/* Time one character takes on the line */
+uint64_t serial_char_ns(void);
+
+/* Bytes queued by serial_send and not yet received, and bytes lost */
+uint32_t serial_pending(void);
+uint32_t serial_lost(void);
+
+/* Take up to max of the bytes the device has sent */
+uint32_t serial_take(uint8_t * p_data, uint32_t max);
+
+#endif
@@ -0,0 +1,402 @@
+/** @file test_at.c
+*
+* @brief at_commands.c against the parser it replaced
+*
+* @par
+* ref/at_commands.c is the parser as it was before it looked commands up
+* in a sorted index, walking each list with a prefix strncmp; the
+* Makefile builds it with its functions renamed to ref_*.  Both get the
+* command lists at_commands_*.c register, in the same order, with one
+* handler that records its arguments, and parse the same lines: every
+* command in both cases, with and without '?', with too few and too many
+* arguments, then random lines.  The results, the handler's arguments
+* and the lock state must match, except where the old parser only found
+* the command by a prefix ("at$verx" ran "ver"), when the new one must
+* answer unknown.  Last, both parse the first set of lines over and
+* over, and the commands per second of each are printed.
+*
+*   usage: test_at [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "at_commands.h"
+#include "lock.h"
+
+#define LINE_SIZE       96          /* longer than at_proc.c takes */
+#define MAX_LINES       400
+#define RANDOM_LINES    200000
+#define BENCH_NS        200000000ULL
+
+uint32_t ref_at_command_parse(uint8_t * line);
+bool ref_at_commands_register(const at_command_t * cmds);
+
+static uint32_t record(uint8_t argc, char ** argv, bool query);
+
+/* at_commands_*.c's lists, as AT_CMD(command, min_args, max_args,
+   require_unlock) and AT_CMD_END after each; the Makefile takes them
+   from the sources */
+#define AT_CMD(c, min, max, unlock)     { c, min, max, unlock, record },
+#define AT_CMD_END                      { NULL },
+static const at_command_t m_lists[] =
+{
+#include "at_cmds.h"
+};
+
+typedef struct
+{
+    const char * name;
+    uint32_t (*parse)(uint8_t * line);
+    bool (*reg)(const at_command_t * cmds);
+    bool locked;
+    char log[LINE_SIZE * 2];        /* what the handler was given */
+} parser_t;
+
+static parser_t m_new = { "new", at_command_parse, at_commands_register };
+static parser_t m_ref = { "old", ref_at_command_parse, ref_at_commands_register };
+static parser_t * m_parser;         /* the one parsing */
+
+static const char * m_test;
+static uint32_t m_failures;
+static char m_lines[MAX_LINES][LINE_SIZE];
+static uint32_t m_line_count;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+/* ---- Stand-ins ---- */
+
+/* Each parser keeps its own lock, so their relocks can be compared */
+bool lock_is_locked(void)
+{
+    return m_parser->locked;
+}
+
+void lock_set(void)
+{
+    m_parser->locked = true;
+}
+
+/* The lists are registered here instead */
+void at_commands_misc_init(void) {}
+void at_commands_beacon_init(void) {}
+void at_commands_uart_init(void) {}
+void at_commands_gpio_init(void) {}
+
+static uint32_t record(uint8_t argc, char ** argv, bool query)
+{
+    char * p_log = m_parser->log;
+    uint32_t i;
+
+    p_log += sprintf(p_log, "%u%s", argc, query ? "?" : "");
+    for (i = 0; i < argc; i++)
+        p_log += sprintf(p_log, "|%s", argv[i]);
+    if (strcmp(argv[0], "at$unlock") == 0)
+        m_parser->locked = false;
+    return query ? AT_RESULT_QUERY : AT_RESULT_OK;
+}
+
+/* ---- Lines ---- */
+
+/* Whether the line's first word, less one '?', is a command exactly */
+static bool is_command(const char * line)
+{
+    char word[LINE_SIZE];
+    uint32_t len = 0;
+    uint32_t i;
+
+    while (*line == ' ')
+        line++;
+    while (line[len] != '\0' && line[len] != ' ')
+    {
+        word[len] = (char)tolower((unsigned char)line[len]);
+        len++;
+    }
+    if (len > 0 && word[len - 1] == '?')
+        len--;
+    word[len] = '\0';
+    if (strncmp(word, "at$", 3) != 0)
+        return false;
+    for (i = 0; i < sizeof(m_lists) / sizeof(m_lists[0]); i++)
+        if (m_lists[i].command != NULL && strcmp(m_lists[i].command, &word[3]) == 0)
+            return true;
+    return false;
+}
+
+static uint32_t parse(parser_t * p_parser, const char * line)
+{
+    uint8_t buf[LINE_SIZE];
+
+    /* zeroed past the line: the old parser may look past the command */
+    memset(buf, 0, sizeof(buf));
+    strcpy((char *)buf, line);
+    m_parser = p_parser;
+    p_parser->log[0] = '\0';
+    return p_parser->parse(buf);
+}
+
+/* Returns whether only the old parser found the command */
+static bool compare(const char * line)
+{
+    uint32_t result = parse(&m_new, line);
+    uint32_t ref_result = parse(&m_ref, line);
+
+    if (result == AT_RESULT_UNKNOWN && ref_result != AT_RESULT_UNKNOWN)
+    {
+        check(!is_command(line), "a command is unknown");
+        /* run a command on both, to take the old parser through any
+           relock the line caused */
+        parse(&m_new, "at$ver");
+        parse(&m_ref, "at$ver");
+        check(m_new.locked == m_ref.locked, "lock state differs after a prefix match");
+        return true;
+    }
+
+    if (result != ref_result || strcmp(m_new.log, m_ref.log) != 0 ||
+        m_new.locked != m_ref.locked)
+    {
+        fprintf(stderr, "%s: \"%s\": %u [%s] %s, old %u [%s] %s\n", m_test, line,
+                result, m_new.log, m_new.locked ? "locked" : "unlocked",
+                ref_result, m_ref.log, m_ref.locked ? "locked" : "unlocked");
+        m_failures++;
+    }
+    if (result == AT_RESULT_UNKNOWN)
+        check(!is_command(line), "a command is unknown");
+    return false;
+}
+
+static void add_line(const char * line)
+{
+    if (m_line_count < MAX_LINES)
+        strcpy(m_lines[m_line_count++], line);
+}
+
+static char * random_word(char * p_dest, uint32_t max_len)
+{
+    static const char chars[] = "abcxyzABCXYZ0189$?-_.";
+    uint32_t len = rand() % max_len + 1;
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+        *p_dest++ = chars[rand() % (sizeof(chars) - 1)];
+    *p_dest = '\0';
+    return p_dest;
+}
+
+/* Every command, in both cases, with and without '?', with each number
+   of arguments from none to one too many; and the odd ones */
+static void make_lines(void)
+{
+    static const char * const odd[] =
+    {
+        "", " ", "at", "AT", "  at  ", "at x", "at$", "at$?", "at$ ", "a", "x$ver",
+        "at$ver?", "at$name MixedCase", "at$NAME MixedCase", "at$unlock password1234",
+    };
+    char line[LINE_SIZE];
+    uint32_t i, j, n;
+
+    for (i = 0; i < sizeof(odd) / sizeof(odd[0]); i++)
+        add_line(odd[i]);
+
+    for (i = 0; i < sizeof(m_lists) / sizeof(m_lists[0]); i++)
+    {
+        const at_command_t * p_cmd = &m_lists[i];
+
+        if (p_cmd->command == NULL)
+            continue;
+        for (n = 0; n <= p_cmd->max_args + 1u; n++)
+        {
+            char * p = line + sprintf(line, "at$%s", p_cmd->command);
+
+            for (j = 0; j < n; j++)
+                p += sprintf(p, " Arg%u", j);
+            add_line(line);
+            for (p = line; *p != '\0'; p++)
+                *p = (char)toupper((unsigned char)*p);
+            add_line(line);
+        }
+        sprintf(line, "at$%s?", p_cmd->command);
+        add_line(line);
+        sprintf(line, "AT$%s? 1", p_cmd->command);
+        add_line(line);
+    }
+}
+
+/* A command, a near miss or noise, in random case, spaced at random,
+   with up to a dozen random arguments */
+static void random_line(char * line)
+{
+    uint32_t commands = sizeof(m_lists) / sizeof(m_lists[0]);
+    const char * p_name;
+    char * p = line;
+    uint32_t i, n;
+
+    do
+        p_name = m_lists[rand() % commands].command;
+    while (p_name == NULL);
+
+    if (rand() % 10 == 0)
+    {
+        /* bytes, any but NUL */
+        n = rand() % (LINE_SIZE - 1);
+        for (i = 0; i < n; i++)
+            line[i] = (char)(rand() % 255 + 1);
+        line[n] = '\0';
+        return;
+    }
+
+    for (n = rand() % 3; n > 0; n--)
+        *p++ = ' ';
+    p += sprintf(p, "%s", rand() % 8 ? "at$" : "at");
+    switch (rand() % 4)
+    {
+        case 0:     /* a prefix of it */
+            p += sprintf(p, "%.*s", (int)(rand() % strlen(p_name)), p_name);
+            break;
+        case 1:     /* longer */
+            p += sprintf(p, "%s", p_name);
+            p = random_word(p, 3);
+            break;
+        default:
+            p += sprintf(p, "%s", p_name);
+            break;
+    }
+    if (rand() % 4 == 0)
+        *p++ = '?';
+    for (n = rand() % 13; n > 0; n--)
+    {
+        for (i = rand() % 3 + 1; i > 0; i--)
+            *p++ = ' ';
+        p = random_word(p, 6);
+    }
+    *p = '\0';
+
+    for (p = line; *p != '\0'; p++)
+        if (rand() % 2)
+            *p = (char)toupper((unsigned char)*p);
+}
+
+/* ---- Tests ---- */
+
+static void test_lines(void)
+{
+    uint32_t prefix = 0;
+    uint32_t i;
+
+    m_test = "lines";
+    m_new.locked = m_ref.locked = true;
+    make_lines();
+    for (i = 0; i < m_line_count; i++)
+        prefix += compare(m_lines[i]);
+    check(prefix == 0, "a command only found by a prefix");
+}
+
+static void test_random(void)
+{
+    char line[LINE_SIZE];
+    uint32_t prefix = 0;
+    uint32_t i;
+
+    m_test = "random";
+    for (i = 0; i < RANDOM_LINES; i++)
+    {
+        /* one in ten unlocks, so lines run unlocked, and relock, too */
+        if (rand() % 10 == 0)
+            strcpy(line, "at$unlock password1234");
+        else
+            random_line(line);
+        prefix += compare(line);
+    }
+    printf("  %u random lines, %u only the old parser found by a prefix\n",
+           RANDOM_LINES, prefix);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Commands per second, parsing the lines over and over, unlocked */
+static double bench(parser_t * p_parser)
+{
+    uint8_t buf[LINE_SIZE];
+    uint64_t start = now_ns();
+    uint64_t elapsed;
+    uint32_t count = 0;
+    uint32_t i;
+
+    m_parser = p_parser;
+    do
+    {
+        for (i = 0; i < m_line_count; i++)
+        {
+            memcpy(buf, m_lines[i], LINE_SIZE);
+            p_parser->locked = false;
+            (void)p_parser->parse(buf);
+        }
+        count += m_line_count;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_NS);
+
+    return count * 1e9 / elapsed;
+}
+
+static void test_bench(void)
+{
+    double rate, ref_rate;
+
+    m_test = "bench";
+    ref_rate = bench(&m_ref);
+    rate = bench(&m_new);
+    printf("  %u lines: old %.2fM commands/s, new %.2fM commands/s\n",
+           m_line_count, ref_rate / 1e6, rate / 1e6);
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    const at_command_t * p_list = m_lists;
+    uint32_t i;
+
+    srand(seed);
+
+    /* each list as its init registers it */
+    for (i = 0; i < sizeof(m_lists) / sizeof(m_lists[0]); i++)
+    {
+        if (m_lists[i].command != NULL)
+            continue;
+        m_test = "register";
+        check(m_new.reg(p_list), "list not registered");
+        check(m_ref.reg(p_list), "list not registered by the old parser");
+        p_list = &m_lists[i + 1];
+    }
+
+    test_lines();
+    test_random();
+    test_bench();
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_at: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_at: ok\n");
+    return 0;
+}
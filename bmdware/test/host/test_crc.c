@@ -0,0 +1,98 @@
+/** @file test_crc.c
+*
+* @brief crc.c against the bitwise Dallas/Maxim CRC8
+*
+* @par
+* Built once for each of CRC8_BITWISE, CRC8_NIBBLE and CRC8_TABLE.
+* Checks the standard check value, then random data of random lengths,
+* whole and split into random pieces through crc8_update.
+*
+*   usage: test_crc [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "crc.h"
+
+#define RANDOM_RUNS     10000
+#define MAX_LEN         600
+
+static uint32_t m_failures;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "crc8: %s\n", what);
+        m_failures++;
+    }
+}
+
+/* The CRC8 crc.c had before it was table driven */
+static uint8_t crc8_ref(const uint8_t * data, uint16_t len)
+{
+    uint8_t crc = 0x00;
+
+    while (len--)
+    {
+        uint8_t extract = *data++;
+        uint8_t i;
+
+        for (i = 8; i; i--)
+        {
+            uint8_t sum = (crc ^ extract) & 0x01;
+
+            crc >>= 1;
+            if (sum)
+                crc ^= 0x8C;
+            extract >>= 1;
+        }
+    }
+    return crc;
+}
+
+int main(int argc, char * argv[])
+{
+    static uint8_t data[MAX_LEN];
+    uint32_t i;
+
+    srand(argc > 1 ? strtoul(argv[1], NULL, 0) : 1);
+
+    check(crc8((const uint8_t *)"123456789", 9) == 0xA1, "check value");
+    check(crc8(data, 0) == 0x00, "empty");
+
+    for (i = 0; i < RANDOM_RUNS && m_failures == 0; i++)
+    {
+        uint16_t len = rand() % MAX_LEN;
+        uint16_t at = 0;
+        uint8_t expected, crc = 0x00;
+        uint32_t j;
+
+        for (j = 0; j < len; j++)
+            data[j] = (uint8_t)rand();
+        expected = crc8_ref(data, len);
+
+        check(crc8(data, len) == expected, "whole");
+        while (at < len)
+        {
+            uint16_t n = rand() % (len - at) + 1;
+
+            crc = crc8_update(crc, &data[at], n);
+            at += n;
+        }
+        check(crc == expected, "in pieces");
+    }
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_crc: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_crc: ok\n");
+    return 0;
+}
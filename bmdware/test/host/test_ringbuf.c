@@ -0,0 +1,390 @@
+/** @file test_ringbuf.c
+*
+* @brief ringbuf.c against a simple model
+*
+* @par
+* Runs ringBufSelfTest, then random writes, reads, peeks, discards and
+* zero-copy claims of random lengths, for element sizes that don't divide the buffer evenly,
+* and checks every element comes out once and in order.  Single
+* producer/single consumer buffers get the same, with indices that wrap
+* past UINT32_MAX, and a producer and a consumer on two threads.
+* Last, bytes are written and read through a buffer the size of
+* uart.c's, a chunk at a time, by this ringbuf.c and by
+* ref/ringbuf.c, the one that copied an element at a time, which the
+* Makefile builds with its functions renamed to ref_*; the bytes per
+* second of each are printed.
+*
+*   usage: test_ringbuf [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "ringbuf.h"
+
+#define MAX_ELEMENT_SIZE    4
+#define ELEMENT_COUNT       61
+#define RANDOM_OPS          200000
+#define SPSC_ELEMENT_COUNT  64
+#define THREAD_ELEMENTS     (1u << 20)
+#define BENCH_SIZE          4096        /* UART_RX_BUF_SIZE */
+#define BENCH_FILL          1000        /* left waiting, so copies wrap anywhere */
+#define BENCH_NS            100000000ULL
+
+uint8_t ref_ringBufInit(ringBuf_t* ringBuf, uint32_t elementSize, uint32_t elementCount, void* elementBuffer);
+uint8_t ref_ringBufRead(ringBuf_t* ringBuf, void* elementsOut, uint32_t elementCount);
+uint8_t ref_ringBufWrite(ringBuf_t* ringBuf, void* elementsIn, uint32_t elementCount);
+
+typedef struct
+{
+    const char * name;
+    uint8_t (*init)(ringBuf_t *, uint32_t, uint32_t, void *);
+    uint8_t (*read)(ringBuf_t *, void *, uint32_t);
+    uint8_t (*write)(ringBuf_t *, void *, uint32_t);
+} impl_t;
+
+static const impl_t m_impls[] =
+{
+    { "old", ref_ringBufInit, ref_ringBufRead, ref_ringBufWrite },
+    { "new", ringBufInit, ringBufRead, ringBufWrite },
+    { "spsc", ringBufInitSpsc, ringBufRead, ringBufWrite },
+};
+
+static const char * m_test;
+static uint32_t m_failures;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+/* Element n of the stream, element_size bytes of a counter */
+static void fill(uint8_t * p_dest, uint32_t n, uint32_t count, uint32_t element_size)
+{
+    uint32_t i;
+
+    for (i = 0; i < count * element_size; i++)
+        p_dest[i] = (uint8_t)(n * element_size + i);
+}
+
+static bool matches(const uint8_t * p_src, uint32_t n, uint32_t count, uint32_t element_size)
+{
+    uint32_t i;
+
+    for (i = 0; i < count * element_size; i++)
+        if (p_src[i] != (uint8_t)(n * element_size + i))
+            return false;
+    return true;
+}
+
+/* A claim must give everything available up to the end of the buffer,
+   and nothing past it */
+static void check_span(ringBuf_t * p_r, uint32_t count, const uint8_t * p_span,
+                       uint32_t available)
+{
+    uint32_t slot = (uint32_t)(p_span - p_r->buffer) / p_r->elementSize;
+    uint32_t to_end = p_r->elementCount - slot;
+
+    check(p_span >= p_r->buffer && slot < p_r->elementCount, "claim outside the buffer");
+    check(count == (available < to_end ? available : to_end), "claimed span");
+}
+
+/* ---- Tests ---- */
+
+static void test_self(void)
+{
+    m_test = "self test";
+    check(ringBufSelfTest() == 0, "errors");
+}
+
+/* Random operations against the model; capacity is how many elements
+   the buffer holds */
+static void random_ops(ringBuf_t * p_r, uint32_t element_size, uint32_t capacity)
+{
+    /* big enough for either buffer */
+    static uint8_t data[SPSC_ELEMENT_COUNT * MAX_ELEMENT_SIZE];
+    uint32_t written = 0, read = 0;
+    uint32_t failures = m_failures;
+    uint32_t i;
+
+    for (i = 0; i < RANDOM_OPS && m_failures == failures; i++)
+    {
+        uint32_t n = rand() % capacity + 1;
+        uint32_t waiting = written - read;
+        uint32_t span;
+        uint8_t * p_span;
+        bool fits;
+
+        check(ringBufWaiting(p_r) == waiting, "waiting");
+        check(ringBufUnused(p_r) == capacity - waiting, "unused");
+
+        switch (rand() % 6)
+        {
+        case 0:
+            fits = (n <= capacity - waiting);
+            fill(data, written, n, element_size);
+            check(ringBufWrite(p_r, data, n) == (fits ? RINGBUF_SUCCESS : RINGBUF_ERROR),
+                  "write");
+            if (fits)
+                written += n;
+            break;
+
+        case 1:
+            fits = (n <= waiting);
+            memset(data, 0, sizeof(data));
+            check(ringBufPeek(p_r, data, n) == (fits ? RINGBUF_SUCCESS : RINGBUF_ERROR),
+                  "peek");
+            check(!fits || matches(data, read, n, element_size), "peeked data");
+            check(ringBufWaiting(p_r) == waiting, "peek moved the read index");
+            break;
+
+        case 2:
+            fits = (n <= waiting);
+            memset(data, 0, sizeof(data));
+            check(ringBufRead(p_r, data, n) == (fits ? RINGBUF_SUCCESS : RINGBUF_ERROR),
+                  "read");
+            check(!fits || matches(data, read, n, element_size), "read data");
+            if (fits)
+                read += n;
+            break;
+
+        case 3:
+            fits = (n <= waiting);
+            check(ringBufDiscard(p_r, n) == (fits ? RINGBUF_SUCCESS : RINGBUF_ERROR),
+                  "discard");
+            if (fits)
+                read += n;
+            break;
+
+        case 4:
+            span = ringBufWriteClaim(p_r, (void **)&p_span);
+            check_span(p_r, span, p_span, capacity - waiting);
+            if (n > span)
+                n = span;
+            if (n == 0)
+            {
+                check(ringBufWriteCommit(p_r, 1) == RINGBUF_ERROR, "commit when full");
+                break;
+            }
+            fill(p_span, written, n, element_size);
+            check(ringBufWriteCommit(p_r, n) == RINGBUF_SUCCESS, "commit");
+            written += n;
+            break;
+
+        default:
+            span = ringBufReadClaim(p_r, (void **)&p_span);
+            check_span(p_r, span, p_span, waiting);
+            if (n > span)
+                n = span;
+            if (n == 0)
+            {
+                check(ringBufReadRelease(p_r, 1) == RINGBUF_ERROR, "release when empty");
+                break;
+            }
+            check(matches(p_span, read, n, element_size), "claimed data");
+            check(ringBufReadRelease(p_r, n) == RINGBUF_SUCCESS, "release");
+            read += n;
+            break;
+        }
+    }
+}
+
+/* A buffer whose end falls mid-copy, so copies split at every point */
+static void test_random(uint32_t element_size)
+{
+    static uint8_t buffer[ELEMENT_COUNT * MAX_ELEMENT_SIZE];
+    ringBuf_t r;
+
+    m_test = "random";
+    check(ringBufInit(&r, element_size, ELEMENT_COUNT, buffer) == RINGBUF_SUCCESS,
+          "init");
+    random_ops(&r, element_size, ELEMENT_COUNT - 1);
+}
+
+/* Every slot is usable, and the free running indices start just short
+   of wrapping */
+static void test_spsc(uint32_t element_size)
+{
+    static uint8_t buffer[SPSC_ELEMENT_COUNT * MAX_ELEMENT_SIZE];
+    ringBuf_t r;
+
+    m_test = "spsc";
+    check(ringBufInitSpsc(&r, element_size, SPSC_ELEMENT_COUNT - 1, buffer) == RINGBUF_ERROR,
+          "init with a count that isn't a power of two");
+    check(ringBufInitSpsc(&r, element_size, SPSC_ELEMENT_COUNT, buffer) == RINGBUF_SUCCESS,
+          "init");
+    r.writeIdx = r.readIdx = UINT32_MAX - SPSC_ELEMENT_COUNT / 2;
+    random_ops(&r, element_size, SPSC_ELEMENT_COUNT);
+    check(r.readIdx < SPSC_ELEMENT_COUNT * RANDOM_OPS, "indices didn't wrap");
+}
+
+/* A producer and a consumer on their own threads, with no locking;
+   each yields when it has to wait, in case there's one CPU */
+static ringBuf_t m_thread_r;
+
+static void * producer(void * p_context)
+{
+    uint32_t n = 0;
+
+    while (n < THREAD_ELEMENTS)
+    {
+        uint32_t data[7];
+        uint32_t count = n % 7 + 1;
+        uint32_t i;
+
+        if (count > THREAD_ELEMENTS - n)
+            count = THREAD_ELEMENTS - n;
+        for (i = 0; i < count; i++)
+            data[i] = n + i;
+        if (ringBufWrite(&m_thread_r, data, count) == RINGBUF_SUCCESS)
+            n += count;
+        else
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void test_spsc_threads(void)
+{
+    static uint32_t buffer[SPSC_ELEMENT_COUNT];
+    pthread_t thread;
+    uint32_t n = 0;
+
+    m_test = "spsc threads";
+    check(ringBufInitSpsc(&m_thread_r, sizeof(buffer[0]), SPSC_ELEMENT_COUNT, buffer)
+          == RINGBUF_SUCCESS, "init");
+    m_thread_r.writeIdx = m_thread_r.readIdx = UINT32_MAX - THREAD_ELEMENTS / 2;
+    if (pthread_create(&thread, NULL, producer, NULL) != 0)
+    {
+        check(false, "can't start the producer");
+        return;
+    }
+
+    while (n < THREAD_ELEMENTS)
+    {
+        uint32_t data[5];
+        uint32_t count = n % 5 + 1;
+        uint32_t i;
+
+        if (count > THREAD_ELEMENTS - n)
+            count = THREAD_ELEMENTS - n;
+        if (ringBufRead(&m_thread_r, data, count) != RINGBUF_SUCCESS)
+        {
+            sched_yield();
+            continue;
+        }
+        for (i = 0; i < count; i++)
+        {
+            if (data[i] != n + i)
+            {
+                check(false, "data out of order");
+                n = THREAD_ELEMENTS;
+                break;
+            }
+        }
+        n += count;
+    }
+    pthread_join(thread, NULL);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Bytes per second through the buffer, writing and reading chunk bytes
+   at a time */
+static double bench(const impl_t * p_impl, uint32_t chunk)
+{
+    static uint8_t buffer[BENCH_SIZE];
+    static uint8_t counter[BENCH_SIZE + 256];     /* byte n holds n */
+    static uint8_t data[BENCH_SIZE];
+    ringBuf_t r;
+    uint32_t written = BENCH_FILL, read = 0;
+    uint64_t start, elapsed;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(counter); i++)
+        counter[i] = (uint8_t)i;
+    check(p_impl->init(&r, 1, BENCH_SIZE, buffer) == RINGBUF_SUCCESS, "init");
+    check(p_impl->write(&r, counter, BENCH_FILL) == RINGBUF_SUCCESS, "fill");
+
+    start = now_ns();
+    do
+    {
+        for (i = 0; i < 1000; i++)
+        {
+            uint8_t * p_src = &counter[written % 256];
+
+            written += chunk;
+            if (p_impl->write(&r, p_src, chunk) != RINGBUF_SUCCESS ||
+                p_impl->read(&r, data, chunk) != RINGBUF_SUCCESS)
+            {
+                check(false, "write or read failed");
+                return 0;
+            }
+            if (data[0] != (uint8_t)read || data[chunk - 1] != (uint8_t)(read + chunk - 1))
+            {
+                check(false, "data out of order");
+                return 0;
+            }
+            read += chunk;
+        }
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_NS);
+
+    return (double)(read) * 1e9 / elapsed;
+}
+
+static void test_bench(void)
+{
+    static const uint32_t chunks[] = { 1, 20, 244 };
+    uint32_t i, j;
+
+    m_test = "bench";
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    {
+        printf("  %3u byte chunks:", chunks[i]);
+        for (j = 0; j < sizeof(m_impls) / sizeof(m_impls[0]); j++)
+            printf(" %s %7.1f MB/s", m_impls[j].name, bench(&m_impls[j], chunks[i]) / 1e6);
+        printf("\n");
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    srand(argc > 1 ? strtoul(argv[1], NULL, 0) : 1);
+
+    test_self();
+    test_random(1);
+    test_random(3);
+    test_random(4);
+    test_spsc(1);
+    test_spsc(3);
+    test_spsc(4);
+    test_spsc_threads();
+    test_bench();
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_ringbuf: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_ringbuf: ok\n");
+    return 0;
+}
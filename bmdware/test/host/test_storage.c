@@ -0,0 +1,201 @@
+/** @file test_storage.c
+*
+* @brief storage_intf.c's record log, across power cuts
+*
+* @par
+* Built over fstorage with the nRF52's 4 KB pages, and over pstorage with
+* the nRF51's 1 KB pages.  The flash starts out with settings where the
+* single page layout kept them.  Each boot loads the settings, then saves
+* a new set after another, a random time apart, so a save may come while
+* the last is still being stored, until power goes after a random number
+* of flash operations, sometimes part way through one.  Every boot must
+* load the set last seen stored, or one saved after it, and never an
+* older one.  Set n has major and minor holding n.
+*
+* Then, without power cuts, the erases a thousand updates take are
+* counted and printed.  The single page layout erased its page for every
+* update.
+*
+*   usage: test_storage [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "host.h"
+#include "flash.h"
+#include "storage_intf.h"
+#include "crc.h"
+
+#define UPDATES             20000
+#define MAX_OPS             64          /* before power goes, at most */
+#define MAX_GAP_NS          (2 * FLASH_ERASE_NS)
+#define ERASE_UPDATES       1000
+#define RECORD_SIZE         (sizeof(default_app_settings_t) + 4)
+#define SLOTS               (FLASH_PAGE_SIZE / RECORD_SIZE)
+
+#ifdef STORAGE_PSTORAGE
+#define LEGACY_ADDR         FLASH_BASE  /* the start of its one block */
+#else
+#define LEGACY_ADDR         (FLASH_BASE + (FLASH_PAGES - 1) * FLASH_PAGE_SIZE)
+#endif
+
+/* Shared with the boots */
+static struct
+{
+    uint32_t stored;            /* the newest set known to be in flash */
+    uint32_t saved;             /* the newest set given to storage_intf_save */
+    uint32_t updates;
+    uint32_t boots;
+} * m_state;
+
+static void settings_make(uint32_t n, default_app_settings_t * p_settings)
+{
+    *p_settings = default_settings;
+    p_settings->major = (uint16_t)n;
+    p_settings->minor = (uint16_t)(n >> 16);
+    p_settings->crc8 = crc8((uint8_t *)p_settings, sizeof(*p_settings) - 1);
+}
+
+/* The set the settings are, checking they are all of it */
+static uint32_t settings_number(const default_app_settings_t * p_settings)
+{
+    default_app_settings_t expected;
+    uint32_t n = p_settings->major | (uint32_t)p_settings->minor << 16;
+
+    settings_make(n, &expected);
+    if (memcmp(p_settings, &expected, sizeof(expected)) != 0)
+        host_fail("loaded settings aren't any that were saved");
+    return n;
+}
+
+static void drain(void)
+{
+    while (flash_busy())
+        host_run_until(host_time() + FLASH_ERASE_NS);
+}
+
+static void save(uint32_t n)
+{
+    default_app_settings_t settings;
+
+    settings_make(n, &settings);
+    if (!storage_intf_set(&settings))
+        host_fail("storage_intf_set");
+    if (storage_intf_save() != NRF_SUCCESS)
+        host_fail("storage_intf_save");
+}
+
+static void boot_updates(void * p_context)
+{
+    uint32_t n;
+
+    m_state->boots++;
+    storage_intf_init();
+    n = settings_number(storage_intf_get());
+    if (n < m_state->stored || n > m_state->saved)
+        host_fail("boot %u loaded set %u, after %u was stored and %u saved",
+                  m_state->boots, n, m_state->stored, m_state->saved);
+    /* what's loaded is the newest in flash, so no later boot may go back,
+       and the sets saved after it are gone */
+    m_state->stored = n;
+    m_state->saved = n;
+
+    while (m_state->updates < UPDATES)
+    {
+        m_state->updates++;
+        m_state->saved++;
+        save(m_state->saved);
+        host_run_until(host_time() + host_rand() % MAX_GAP_NS);
+        if (!flash_busy() && !storage_intf_is_dirty())
+            m_state->stored = m_state->saved;
+    }
+    drain();
+    m_state->stored = m_state->saved;
+}
+
+static void boot_check(void * p_context)
+{
+    storage_intf_init();
+    if (settings_number(storage_intf_get()) != m_state->saved)
+        host_fail("the last set saved didn't load");
+}
+
+static void test_power_cuts(void)
+{
+    default_app_settings_t legacy;
+    uint32_t cuts = 0;
+    int status;
+
+    flash_init();
+    settings_make(1, &legacy);
+    memcpy((void *)LEGACY_ADDR, &legacy, sizeof(legacy));
+    memset(m_state, 0, sizeof(*m_state));
+    m_state->stored = 1;
+    m_state->saved = 1;
+
+    do
+    {
+        flash_power_loss_after(1 + host_rand() % MAX_OPS, host_rand() & 1);
+        status = flash_boot(boot_updates, NULL);
+        if (status == FLASH_EXIT_POWER_LOSS)
+            cuts++;
+        else if (status != FLASH_EXIT_DONE)
+            host_fail("boot %u failed", m_state->boots);
+    } while (status != FLASH_EXIT_DONE);
+
+    flash_power_loss_after(0, false);
+    if (flash_boot(boot_check, NULL) != FLASH_EXIT_DONE)
+        host_fail("boot after the updates failed");
+    printf("  %u updates, %u power cuts\n", UPDATES, cuts);
+}
+
+static void boot_erases(void * p_context)
+{
+    flash_count_t start;
+    uint32_t i, erases;
+
+    storage_intf_init();
+    drain();
+    start = flash_count();
+    for (i = 1; i <= ERASE_UPDATES; i++)
+    {
+        save(i);
+        drain();
+    }
+    erases = flash_count().erases - start.erases;
+    printf("  %u erases per %u updates, %u records a page; single page layout: %u\n",
+           erases, ERASE_UPDATES, (uint32_t)SLOTS, ERASE_UPDATES);
+    if (erases > ERASE_UPDATES / SLOTS + 1)
+        host_fail("more erases than one per page of records");
+}
+
+static void test_erases(void)
+{
+    flash_init();
+    if (flash_boot(boot_erases, NULL) != FLASH_EXIT_DONE)
+        host_fail("erase count boot failed");
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+
+    m_state = mmap(NULL, sizeof(*m_state), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (m_state == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    host_init(seed);
+
+    test_power_cuts();
+    test_erases();
+    printf("test_storage: ok\n");
+    return 0;
+}
@@ -0,0 +1,456 @@
+/** @file test_uart.c
+*
+* @brief Passthrough mode of uart.c and ble_nus.c, against the host's
+*        UART and SoftDevice
+*
+* @par
+* At each baud rate, timestamped bursts of bytes go in at the UART and
+* the notifications they become are checked: every byte comes out once
+* and in order, full packets go as soon as they fill, gaps shorter than
+* the idle time don't split a partial packet, and a partial packet goes
+* within two idle times of its last byte, the idle time being the
+* UART_IDLE_FLUSH_CHARS character times uart.c works out from the rate.
+* Once the ring is empty the idle timer must stay stopped, so a second
+* of quiet line must not wake the device at all.
+*
+* Then, with flow control at 1 Mbaud, a stream goes through links of
+* each MTU and connection interval.  The throughput is reported against
+* sending one packet per connection event, and must come within 15% of
+* whichever is slower, the UART or every SoftDevice buffer going each
+* event.  Notifications the SoftDevice turns away as busy must still go
+* once no more data comes in.
+*
+*   usage: test_uart [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "serial.h"
+#include "at_commands.h"
+#include "ble_beacon_config.h"
+#include "bmd_dtm.h"
+#include "ble_nus.h"
+#include "gatt.h"
+#include "lock.h"
+#include "service.h"
+#include "storage_intf.h"
+#include "sw_irq_manager.h"
+#include "sys_init.h"
+#include "timer.h"
+#include "uart.h"
+
+#define MAX_PACKETS         64          /* with their times; the rest are counted */
+#define STREAM_SIZE         0x40000
+#define IDLE_CHARS          4           /* UART_IDLE_FLUSH_CHARS */
+#define IDLE_MIN_TICKS      33          /* UART_IDLE_FLUSH_MIN_MS */
+#define QUIET_NS            HOST_NS_PER_S
+#define LINK_BUFFERS        6
+#define STREAM_NS           (2 * HOST_NS_PER_S)
+
+/* The link and the UART at the far end */
+typedef struct
+{
+    uint32_t rate;
+    uint8_t parity;
+    bool flow_control;
+    uint16_t mtu;
+    uint64_t interval;          /* ns */
+} device_t;
+
+static const uint32_t m_rates[] =
+{
+    1200, 2400, 4800, 9600, 14400, 19200, 28800, 38400, 57600,
+    76800, 115200, 230400, 460800, 921600, 1000000
+};
+
+static const uint16_t m_mtus[] = { GATT_MTU_SIZE_DEFAULT, 158, GATT_EXTENDED_MTU_SIZE };
+static const uint64_t m_intervals[] = { 7500000, 15000000, 30000000, 50000000 };
+
+static const char * m_test;
+static uint32_t m_failures;
+
+static ble_nus_t m_nus;
+
+/* What went in at the UART, and what came out as notifications */
+static uint8_t m_stream[STREAM_SIZE];
+static uint32_t m_stream_sent;
+static uint32_t m_stream_out;
+static uint64_t m_line_end;
+static uint32_t m_air;          /* bytes the link has sent */
+static uint32_t m_air_target;
+static uint64_t m_air_reached;  /* when m_air reached m_air_target */
+static struct
+{
+    uint64_t at;
+    uint16_t len;
+} m_packets[MAX_PACKETS];
+static uint32_t m_packet_count;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+/* ---- What the rest of BMDware would provide ---- */
+
+static default_app_settings_t m_settings;
+
+const default_app_settings_t * storage_intf_get(void)
+{
+    return &m_settings;
+}
+
+bool storage_intf_set(const default_app_settings_t * const settings)
+{
+    m_settings = *settings;
+    return true;
+}
+
+void at_proc_set_cmd_ready(ringBuf_t * data, uint16_t len)
+{
+    host_fail("AT command in passthrough mode");
+}
+
+void bmd_dtm_proc_rx(uint8_t byte, bool init)
+{
+    host_fail("DTM byte in passthrough mode");
+}
+
+bool lock_is_locked(void)
+{
+    return false;
+}
+
+bool sys_init_is_at_mode(void)
+{
+    return false;
+}
+
+uint32_t sw_irq_manager_register_callback(sw_irq_callback_t callback,
+        sw_irq_callback_id_t * p_callback_id, void * p_context)
+{
+    return NRF_SUCCESS;
+}
+
+uint32_t sw_irq_manager_trigger_int(sw_irq_callback_id_t callback_id)
+{
+    return NRF_SUCCESS;
+}
+
+ble_nus_t * services_get_nus_config_obj(void)
+{
+    return &m_nus;
+}
+
+uint32_t ble_beacon_config_send_notification(const ble_beacon_config_t * p_beacon_config,
+        uint16_t value_handle, uint8_t * data, uint16_t length)
+{
+    return NRF_SUCCESS;
+}
+
+bool ble_srv_is_notification_enabled(uint8_t const * p_encoded_data)
+{
+    return (p_encoded_data[0] & BLE_GATT_HVX_NOTIFICATION) != 0;
+}
+
+/* ---- The device ---- */
+
+static void on_ble_evt(ble_evt_t * p_ble_evt)
+{
+    ble_nus_on_ble_evt(&m_nus, p_ble_evt);
+}
+
+static void on_queued(const uint8_t * p_data, uint16_t len)
+{
+    if (m_packet_count < MAX_PACKETS)
+    {
+        m_packets[m_packet_count].at = host_time();
+        m_packets[m_packet_count].len = len;
+    }
+    m_packet_count++;
+
+    if (m_stream_out + len > m_stream_sent
+        || memcmp(p_data, m_stream + m_stream_out, len) != 0)
+        host_fail("%s: notification doesn't match what was sent", m_test);
+    m_stream_out += len;
+}
+
+static void on_sent(const uint8_t * p_data, uint16_t len)
+{
+    m_air += len;
+    if (m_air_reached == 0 && m_air >= m_air_target)
+        m_air_reached = host_time();
+}
+
+static void device_start(uint32_t seed, const device_t * p_device)
+{
+    host_link_t link =
+    {
+        .buffers = LINK_BUFFERS,
+        .per_event = LINK_BUFFERS,
+        .interval = p_device->interval,
+        .dispatch = on_ble_evt,
+        .queued = on_queued,
+        .sent = on_sent,
+    };
+
+    host_init(seed);
+    timers_init();
+    timer_create_uart(uart_ble_timeout_handler, 10, true);   /* as service.c */
+
+    memset(&m_nus, 0, sizeof(m_nus));
+    m_nus.conn_handle = BLE_CONN_HANDLE_INVALID;
+    m_nus.baud_rate = p_device->rate;
+    m_nus.parity = p_device->parity;
+    m_nus.flow_control = p_device->flow_control;
+    m_nus.enable = true;
+    host_link_start(&link);
+    m_nus.is_notification_enabled = true;
+    gatt_set_runtime_mtu(p_device->mtu);
+
+    uart_configure_passthrough_mode(&m_nus);
+    host_set_loop(uart_transfer_data);
+
+    m_stream_sent = 0;
+    m_stream_out = 0;
+    m_line_end = host_time();
+    m_packet_count = 0;
+    m_air = 0;
+    m_air_target = 0;
+    m_air_reached = 0;
+}
+
+/* Queue len bytes to go on the line from at, or once the last are done,
+   and return when the last of them will be received */
+static uint64_t send(uint64_t at, uint32_t len)
+{
+    uint32_t i;
+
+    if (m_stream_sent + len > STREAM_SIZE)
+        host_fail("stream full");
+    for (i = 0; i < len; i++)
+        m_stream[m_stream_sent + i] = (uint8_t)host_rand();
+    serial_send(at, m_stream + m_stream_sent, len);
+    m_stream_sent += len;
+
+    if (at > m_line_end)
+        m_line_end = at;
+    m_line_end += len * serial_char_ns();
+    return m_line_end;
+}
+
+/* As uart.c works it out, in RTC1 ticks */
+static uint32_t idle_ticks(uint32_t rate, uint8_t parity)
+{
+    uint32_t bits = IDLE_CHARS * (parity ? 11 : 10);
+    uint32_t ticks = (uint32_t)(((uint64_t)bits * APP_TIMER_CLOCK_FREQ + rate - 1) / rate);
+
+    return ticks > IDLE_MIN_TICKS ? ticks : IDLE_MIN_TICKS;
+}
+
+static uint64_t tick_ns(uint64_t ticks)
+{
+    return (ticks * HOST_NS_PER_S + APP_TIMER_CLOCK_FREQ - 1) / APP_TIMER_CLOCK_FREQ;
+}
+
+/* The partial packet ending with the byte received at last_rx must go
+   once the line has been idle, and before the timer's next period */
+static void check_flush(uint32_t packet, uint64_t last_rx, uint32_t idle)
+{
+    uint64_t tick = last_rx * APP_TIMER_CLOCK_FREQ / HOST_NS_PER_S;
+    char what[80];
+
+    if (packet >= m_packet_count)
+    {
+        check(false, "partial packet never sent");
+        return;
+    }
+    snprintf(what, sizeof(what), "flushed %lld ns after the last byte, idle is %u ticks",
+             (long long)(m_packets[packet].at - last_rx), idle);
+    check(m_packets[packet].at >= tick_ns(tick + idle)
+          && m_packets[packet].at <= tick_ns(tick + 2 * idle + 1), what);
+}
+
+/* Nothing is waiting, so nothing may run */
+static void check_quiet(void)
+{
+    uint32_t timeouts = host_timeouts();
+    uint32_t packets = m_packet_count;
+
+    host_run_until(host_time() + QUIET_NS);
+    check(host_timeouts() == timeouts, "idle timer still running with nothing to send");
+    check(m_packet_count == packets, "packet sent with nothing to send");
+}
+
+/* ---- Tests ---- */
+
+/* Short gaps don't split a partial packet, a long one flushes it */
+static void test_gaps(uint32_t seed, uint32_t rate, uint8_t parity)
+{
+    device_t device = { rate, parity, false, GATT_EXTENDED_MTU_SIZE, 7500000 };
+    uint32_t idle = idle_ticks(rate, parity);
+    /* from one byte's RXDRDY to the next, less than idle */
+    uint64_t short_gap;
+    uint32_t burst;
+
+    m_test = "gaps";
+    device_start(seed, &device);
+    short_gap = tick_ns(idle - 2) - serial_char_ns();
+
+    for (burst = 0; burst < 4; burst++)
+    {
+        uint32_t packets = m_packet_count;
+        uint64_t last_rx = host_time();
+        uint32_t chunk;
+
+        for (chunk = 0; chunk < 8; chunk++)
+            last_rx = send(last_rx + short_gap * (host_rand() % 1024) / 1024,
+                           1 + host_rand() % 8);
+        host_run_until(last_rx + tick_ns(3 * idle));
+
+        check(m_packet_count == packets + 1, "partial packet split or not sent");
+        check_flush(packets, last_rx, idle);
+        check(m_stream_out == m_stream_sent, "bytes left behind");
+        check_quiet();
+    }
+}
+
+/* Full packets go at once, the remainder once the line is idle */
+static void test_full(uint32_t seed, uint32_t rate, uint8_t parity, uint16_t mtu)
+{
+    device_t device = { rate, parity, false, mtu, 7500000 };
+    uint32_t idle = idle_ticks(rate, parity);
+    uint32_t payload = mtu - 3;
+    uint32_t len = payload * 2 + 1 + host_rand() % (payload - 1);
+    uint64_t last_rx;
+    uint32_t i;
+
+    m_test = "full packets";
+    device_start(seed, &device);
+
+    last_rx = send(0, len);
+    host_run_until(last_rx + tick_ns(3 * idle));
+
+    check(m_packet_count == 3, "packet count");
+    for (i = 0; i < 2 && i < m_packet_count; i++)
+    {
+        /* sent from the main loop right after the byte that filled it */
+        uint64_t filled = (uint64_t)(i + 1) * payload * serial_char_ns();
+
+        check(m_packets[i].len == payload, "full packet length");
+        check(m_packets[i].at >= filled && m_packets[i].at < filled + serial_char_ns(),
+              "full packet held back");
+    }
+    check_flush(2, last_rx, idle);
+    check(m_stream_out == m_stream_sent, "bytes left behind");
+    check_quiet();
+}
+
+/* A stream as fast as the UART goes, through a link of each MTU and
+   connection interval */
+static void test_throughput(uint32_t seed, uint16_t mtu, uint64_t interval)
+{
+    device_t device = { 1000000, 0, true, mtu, interval };
+    uint32_t payload = mtu - 3;
+    double uart, link, one, rate, expected;
+    uint32_t len;
+    char what[80];
+
+    m_test = "throughput";
+    device_start(seed, &device);
+
+    /* bytes per second each way could go */
+    uart = (double)HOST_NS_PER_S / serial_char_ns();
+    link = (double)LINK_BUFFERS * payload * HOST_NS_PER_S / interval;
+    one = (double)payload * HOST_NS_PER_S / interval;
+    expected = uart < link ? uart : link;
+
+    /* long enough that the first connection event and the last partial
+       packet don't count for much; timing stops at 90% */
+    len = (uint32_t)(expected * STREAM_NS / HOST_NS_PER_S);
+    if (len > STREAM_SIZE)
+        len = STREAM_SIZE;
+    m_air_target = len - len / 10;
+    send(0, len);
+    host_run_until(4 * STREAM_NS);
+
+    check(m_stream_out == m_stream_sent && m_air == len, "bytes left behind");
+    check(serial_lost() == 0, "bytes lost despite flow control");
+    if (m_air_reached == 0)
+        return;
+    rate = (double)m_air_target * HOST_NS_PER_S / m_air_reached;
+    printf("  mtu %3u, %4.1f ms interval: %6.0f B/s, %4.1fx one packet per event, "
+           "%3.0f%% of %s\n", mtu, interval / 1e6, rate, rate / one,
+           100 * rate / expected, uart < link ? "UART" : "link");
+    snprintf(what, sizeof(what), "%.0f B/s, expected %.0f", rate, expected);
+    check(rate >= 0.85 * expected, what);
+}
+
+/* NRF_ERROR_BUSY brings no BLE_EVT_TX_COMPLETE, so the timer retries */
+static void test_busy(uint32_t seed)
+{
+    device_t device = { 115200, 0, false, GATT_EXTENDED_MTU_SIZE, 7500000 };
+    uint32_t idle = idle_ticks(device.rate, device.parity);
+    uint64_t last_rx;
+    uint32_t i;
+
+    m_test = "busy";
+    device_start(seed, &device);
+
+    /* a partial packet, with nothing after it */
+    host_link_busy(3);
+    last_rx = send(0, 10);
+    host_run_until(last_rx + tick_ns(10 * idle));
+    check(m_packet_count == 1 && m_stream_out == m_stream_sent,
+          "partial packet not retried after NRF_ERROR_BUSY");
+
+    /* full packets, busy now and then */
+    for (i = 0; i < 20; i++)
+    {
+        host_link_busy(1 + host_rand() % 3);
+        last_rx = send(host_time(), 1 + host_rand() % 600);
+        host_run_until(last_rx - serial_char_ns() * (host_rand() % 100));
+    }
+    host_run_until(last_rx + tick_ns(20 * idle));
+    check(m_stream_out == m_stream_sent, "bytes left behind after NRF_ERROR_BUSY");
+    check_quiet();
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(m_rates) / sizeof(m_rates[0]); i++)
+    {
+        test_gaps(seed + i, m_rates[i], 0);
+        test_gaps(seed + i, m_rates[i], 1);
+        test_full(seed + i, m_rates[i], i & 1, GATT_MTU_SIZE_DEFAULT);
+        test_full(seed + i, m_rates[i], i & 1, GATT_EXTENDED_MTU_SIZE);
+    }
+    for (i = 0; i < sizeof(m_mtus) / sizeof(m_mtus[0]); i++)
+    {
+        uint32_t j;
+
+        for (j = 0; j < sizeof(m_intervals) / sizeof(m_intervals[0]); j++)
+            test_throughput(seed + i, m_mtus[i], m_intervals[j]);
+    }
+    test_busy(seed);
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_uart: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_uart: ok\n");
+    return 0;
+}
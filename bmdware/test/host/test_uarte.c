@@ -0,0 +1,494 @@
+/** @file test_uarte.c
+*
+* @brief simple_uarte.c's receive path, on a model of the UARTE, its two
+*        timers and the PPI
+*
+* @par
+* The model works from the registers the driver writes: the buffer it
+* queues in RXD.PTR is latched when RX starts, the ENDRX_STARTRX short
+* restarts RX into it, and RXDRDY reaches the timers only through the
+* PPI channels as they are set up.  A byte's RXDRDY comes at the end of
+* its stop bit and EasyDMA writes it up to half a character time later.
+* Interrupts of the same priority run in the order of their numbers,
+* and now and then none run for up to MAX_BLOCK_CHARS character times,
+* as while the SoftDevice has the CPU.
+*
+* Bursts of random bytes go in, back to back, a little apart, or far
+* enough apart for the idle timer to fire, half of them ending on a
+* buffer boundary.  Every byte must be handed up once and in order, and
+* all of them before the next burst after a gap that long.  The idle
+* flushes that come right after a buffer swap, and those that come with
+* the swap's ENDRX still pending, are counted and must both happen.
+*
+*   usage: test_uarte [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host.h"
+#include "simple_uarte.h"
+#include "uarte_cfg.h"
+
+#define STREAM_BYTES        200000
+#define RX_BUF_SIZE         64          /* simple_uarte.c's DMA_RX_BUF_SIZE */
+#define IDLE_CHARS          4           /* and RX_IDLE_CHARS */
+#define MAX_BLOCK_CHARS     16
+#define MAX_BURST           150
+#define PPI_CHANNELS        20
+
+typedef struct
+{
+    NRF_TIMER_Type * p_reg;
+    bool running;
+    uint32_t held;              /* the value while stopped */
+    uint64_t started_at;        /* when it last read held, while running */
+    uint32_t generation;        /* stale compares are dropped */
+} model_timer_t;
+
+static model_timer_t m_timers[2];
+
+static uint32_t m_uarte_inten;
+static uint32_t m_ppi_chen;
+static uint64_t m_char_ns;
+
+/* The DMA */
+static bool m_rx_on;
+static uint32_t m_rx_ptr;
+static uint32_t m_rx_maxcnt;
+static uint32_t m_rx_count;
+static struct
+{
+    uint32_t addr;
+    uint8_t byte;
+    bool last;
+} m_dma;
+
+static uint64_t m_blocked_until;
+
+/* The line */
+static uint8_t m_stream[STREAM_BYTES];
+static uint32_t m_sent;
+static uint32_t m_burst_left;
+static bool m_burst_start;
+static bool m_long_gap;
+
+/* What was handed up */
+static uint32_t m_delivered;
+static struct
+{
+    uint32_t swaps;
+    uint32_t idle_flushes;
+    uint32_t after_swap;
+    uint32_t swap_pending;
+} m_count;
+
+/* simple_uarte.c's, which the vector table would name */
+void UARTE0_UART0_IRQHandler(void);
+void UARTE_RX_IDLE_TIMER_IRQHandler(void);
+
+static void sync(void);
+static void irq_dispatch(void);
+
+/* ---- TIMER ---- */
+
+static uint64_t timer_tick_ns(const model_timer_t * p_timer)
+{
+    return (1000ULL << p_timer->p_reg->PRESCALER) / 16;
+}
+
+static bool timer_is_counter(const model_timer_t * p_timer)
+{
+    return p_timer->p_reg->MODE != TIMER_MODE_MODE_Timer;
+}
+
+static uint32_t timer_value(const model_timer_t * p_timer)
+{
+    if (!p_timer->running || timer_is_counter(p_timer))
+        return p_timer->held;
+    return p_timer->held + (host_time() - p_timer->started_at) / timer_tick_ns(p_timer);
+}
+
+static void timer_compare(void * p_context)
+{
+    model_timer_t * p_timer = &m_timers[(uintptr_t)p_context >> 16];
+
+    if (((uintptr_t)p_context & 0xFFFF) != (p_timer->generation & 0xFFFF))
+        return;
+    if (p_timer == &m_timers[0] && m_rx_count == 0)
+    {
+        m_count.after_swap++;
+        if (NRF_UARTE0->EVENTS_ENDRX)
+            m_count.swap_pending++;
+    }
+    p_timer->p_reg->EVENTS_COMPARE[0] = 1;
+    if (p_timer->p_reg->SHORTS & TIMER_SHORTS_COMPARE0_CLEAR_Msk)
+    {
+        p_timer->held = 0;
+        p_timer->started_at = host_time();
+    }
+    if (p_timer->p_reg->SHORTS & TIMER_SHORTS_COMPARE0_STOP_Msk)
+    {
+        p_timer->held = timer_value(p_timer);
+        p_timer->running = false;
+    }
+    p_timer->generation++;
+    irq_dispatch();
+}
+
+static void timer_schedule(model_timer_t * p_timer)
+{
+    uint32_t cc = p_timer->p_reg->CC[0];
+    uint32_t value = timer_value(p_timer);
+
+    p_timer->generation++;
+    if (!p_timer->running || timer_is_counter(p_timer) || cc <= value)
+        return;
+    host_at(host_time() + (cc - value) * timer_tick_ns(p_timer), timer_compare,
+            (void *)(uintptr_t)((p_timer - m_timers) << 16 | (p_timer->generation & 0xFFFF)));
+}
+
+static void timer_task(model_timer_t * p_timer, uint32_t offset)
+{
+    switch (offset)
+    {
+        case offsetof(NRF_TIMER_Type, TASKS_START):
+            if (!p_timer->running)
+            {
+                p_timer->running = true;
+                p_timer->started_at = host_time();
+            }
+            break;
+        case offsetof(NRF_TIMER_Type, TASKS_STOP):
+            p_timer->held = timer_value(p_timer);
+            p_timer->running = false;
+            break;
+        case offsetof(NRF_TIMER_Type, TASKS_CLEAR):
+            p_timer->held = 0;
+            p_timer->started_at = host_time();
+            break;
+        case offsetof(NRF_TIMER_Type, TASKS_COUNT):
+            /* only once started, as on the chip */
+            if (p_timer->running && timer_is_counter(p_timer))
+                p_timer->held++;
+            break;
+        case offsetof(NRF_TIMER_Type, TASKS_CAPTURE[0]):
+            p_timer->p_reg->CC[0] = timer_value(p_timer);
+            return;
+        default:
+            host_fail("TIMER task at offset %#x isn't modelled", offset);
+    }
+    /* The driver reads CC[0] straight after triggering CAPTURE[0], before
+       the model sees the task, so a counter's CC[0] is kept at its count
+       and irq_dispatch checks the capture was triggered */
+    if (timer_is_counter(p_timer))
+        p_timer->p_reg->CC[0] = p_timer->held;
+    timer_schedule(p_timer);
+}
+
+/* ---- PPI ---- */
+
+static void ppi_task(uint32_t addr)
+{
+    uint32_t i;
+
+    if (addr == 0)
+        return;
+    for (i = 0; i < 2; i++)
+    {
+        uint32_t base = (uint32_t)(uintptr_t)m_timers[i].p_reg;
+
+        if (addr >= base && addr < base + sizeof(NRF_TIMER_Type))
+        {
+            timer_task(&m_timers[i], addr - base);
+            return;
+        }
+    }
+    host_fail("PPI task at %#x isn't modelled", addr);
+}
+
+static void ppi_event(volatile uint32_t * p_event)
+{
+    uint32_t addr = (uint32_t)(uintptr_t)p_event;
+    uint32_t ch;
+
+    *p_event = 1;
+    for (ch = 0; ch < PPI_CHANNELS; ch++)
+        if ((m_ppi_chen & (1UL << ch)) && NRF_PPI->CH[ch].EEP == addr)
+        {
+            ppi_task(NRF_PPI->CH[ch].TEP);
+            ppi_task(NRF_PPI->FORK[ch].TEP);
+        }
+}
+
+/* ---- UARTE ---- */
+
+static void rx_start(void)
+{
+    m_rx_on = true;
+    m_rx_ptr = NRF_UARTE0->RXD.PTR;
+    m_rx_maxcnt = NRF_UARTE0->RXD.MAXCNT;
+    m_rx_count = 0;
+    if (m_rx_maxcnt == 0)
+        host_fail("RX started with no buffer");
+    NRF_UARTE0->EVENTS_RXSTARTED = 1;
+}
+
+static void dma_write(void * p_context)
+{
+    *(volatile uint8_t *)(uintptr_t)m_dma.addr = m_dma.byte;
+    if (m_dma.last)
+    {
+        *(volatile uint32_t *)&NRF_UARTE0->RXD.AMOUNT = m_rx_maxcnt;
+        NRF_UARTE0->EVENTS_ENDRX = 1;
+        m_rx_on = false;
+        m_count.swaps++;
+        if (NRF_UARTE0->SHORTS & UARTE_SHORTS_ENDRX_STARTRX_Msk)
+            rx_start();
+    }
+    irq_dispatch();
+}
+
+static bool uarte_irq(void)
+{
+    return host_irq_enabled(UARTE0_UART0_IRQn)
+        && ((NRF_UARTE0->EVENTS_ENDRX && (m_uarte_inten & UARTE_INTENSET_ENDRX_Msk))
+            || (NRF_UARTE0->EVENTS_RXSTARTED && (m_uarte_inten & UARTE_INTENSET_RXSTARTED_Msk))
+            || (NRF_UARTE0->EVENTS_ERROR && (m_uarte_inten & UARTE_INTENSET_ERROR_Msk)));
+}
+
+static bool idle_irq(void)
+{
+    return host_irq_enabled(UARTE_RX_IDLE_TIMER_IRQn)
+        && UARTE_RX_IDLE_TIMER->EVENTS_COMPARE[0]
+        && (UARTE_RX_IDLE_TIMER->INTENSET & TIMER_INTENSET_COMPARE0_Msk);
+}
+
+/* Run what's pending, lowest number first, unless interrupts are held
+   off, when unblock runs them */
+static void irq_dispatch(void)
+{
+    uint32_t runs = 0;
+
+    if (host_time() < m_blocked_until)
+        return;
+    for (;;)
+    {
+        if (++runs > 8)
+            host_fail("an interrupt doesn't clear its event");
+        if (uarte_irq())
+            UARTE0_UART0_IRQHandler();
+        else if (idle_irq())
+        {
+            m_count.idle_flushes++;
+            UARTE_RX_IDLE_TIMER_IRQHandler();
+            if (!UARTE_RX_COUNT_TIMER->TASKS_CAPTURE[0])
+                host_fail("the idle handler read the count without capturing it");
+        }
+        else
+            break;
+        sync();
+    }
+}
+
+/* Act on the tasks and enables the driver wrote since the last call.
+   They're plain memory here, so of two writes to INTENSET or CHENSET in
+   between, only the last is seen. */
+static void sync(void)
+{
+    static const uint32_t order[] =
+    {
+        offsetof(NRF_TIMER_Type, TASKS_STOP), offsetof(NRF_TIMER_Type, TASKS_CLEAR),
+        offsetof(NRF_TIMER_Type, TASKS_START), offsetof(NRF_TIMER_Type, TASKS_CAPTURE[0]),
+    };
+    uint32_t i, j;
+
+    m_uarte_inten = (m_uarte_inten | NRF_UARTE0->INTENSET) & ~NRF_UARTE0->INTENCLR;
+    NRF_UARTE0->INTENSET = 0;
+    NRF_UARTE0->INTENCLR = 0;
+    m_ppi_chen = (m_ppi_chen | NRF_PPI->CHENSET) & ~NRF_PPI->CHENCLR;
+    NRF_PPI->CHENSET = 0;
+    NRF_PPI->CHENCLR = 0;
+
+    for (i = 0; i < 2; i++)
+        for (j = 0; j < sizeof(order) / sizeof(order[0]); j++)
+        {
+            volatile uint32_t * p_task =
+                (volatile uint32_t *)((uint8_t *)m_timers[i].p_reg + order[j]);
+
+            if (*p_task)
+            {
+                *p_task = 0;
+                timer_task(&m_timers[i], order[j]);
+            }
+        }
+
+    if (NRF_UARTE0->TASKS_STOPRX)
+    {
+        NRF_UARTE0->TASKS_STOPRX = 0;
+        m_rx_on = false;
+    }
+    if (NRF_UARTE0->TASKS_STARTRX)
+    {
+        NRF_UARTE0->TASKS_STARTRX = 0;
+        if (NRF_UARTE0->ENABLE != UARTE_ENABLE_ENABLE_Enabled)
+            host_fail("RX started with the UARTE disabled");
+        rx_start();
+    }
+    NRF_UARTE0->TASKS_STARTTX = 0;
+    NRF_UARTE0->TASKS_STOPTX = 0;
+}
+
+/* ---- Interrupt latency ---- */
+
+static void unblock(void * p_context)
+{
+    irq_dispatch();
+}
+
+static void block(void * p_context)
+{
+    uint64_t held = host_rand() % (MAX_BLOCK_CHARS * m_char_ns);
+
+    m_blocked_until = host_time() + held;
+    host_at(m_blocked_until, unblock, NULL);
+    host_at(m_blocked_until + host_rand() % (4 * RX_BUF_SIZE * m_char_ns), block, NULL);
+}
+
+/* ---- The line ---- */
+
+static uint64_t idle_ns(void)
+{
+    return (IDLE_CHARS + 1) * m_char_ns + MAX_BLOCK_CHARS * m_char_ns;
+}
+
+static void byte_arrives(void * p_context);
+
+static void next_burst(void)
+{
+    uint64_t gap;
+
+    switch (host_rand() % 4)
+    {
+        case 0:
+            gap = 0;
+            break;
+        case 1:
+            gap = host_rand() % (IDLE_CHARS * m_char_ns / 2);
+            break;
+        default:
+            gap = idle_ns() + host_rand() % (8 * m_char_ns);
+            break;
+    }
+    m_long_gap = gap >= idle_ns();
+    m_burst_start = true;
+    if (host_rand() & 1)
+        m_burst_left = RX_BUF_SIZE - m_sent % RX_BUF_SIZE + (host_rand() & 1) * RX_BUF_SIZE;
+    else
+        m_burst_left = 1 + host_rand() % MAX_BURST;
+    if (m_burst_left > STREAM_BYTES - m_sent)
+        m_burst_left = STREAM_BYTES - m_sent;
+    host_at(host_time() + gap + m_char_ns, byte_arrives, NULL);
+}
+
+static void byte_arrives(void * p_context)
+{
+    if (m_burst_start && m_long_gap && m_delivered != m_sent)
+        host_fail("%u bytes still not handed up after an idle line", m_sent - m_delivered);
+    m_burst_start = false;
+    if (!m_rx_on)
+        host_fail("byte %u arrived with RX stopped", m_sent);
+    if (m_rx_count >= m_rx_maxcnt)
+        host_fail("byte %u arrived past the end of the buffer", m_sent);
+
+    m_dma.addr = m_rx_ptr + m_rx_count;
+    m_dma.byte = m_stream[m_sent];
+    m_dma.last = ++m_rx_count == m_rx_maxcnt;
+    host_at(host_time() + host_rand() % (m_char_ns / 2), dma_write, NULL);
+    m_sent++;
+    ppi_event(&NRF_UARTE0->EVENTS_RXDRDY);
+
+    if (m_sent == STREAM_BYTES)
+        return;
+    if (--m_burst_left > 0)
+        host_at(host_time() + m_char_ns, byte_arrives, NULL);
+    else
+        next_burst();
+}
+
+static void rx_callback(const uint8_t * const data, uint8_t len)
+{
+    if (len == 0)
+        host_fail("empty rx callback");
+    if (len > m_sent - m_delivered)
+        host_fail("%u bytes handed up, %u received", len, m_sent - m_delivered);
+    if (memcmp(data, &m_stream[m_delivered], len) != 0)
+        host_fail("bytes %u to %u handed up wrong", m_delivered, m_delivered + len - 1);
+    m_delivered += len;
+}
+
+/* ---- Tests ---- */
+
+static void test_rx(uint32_t baud, bool parity)
+{
+    uint32_t rate = (uint32_t)(((uint64_t)baud * 16000000UL) >> 32);
+    uint32_t i;
+
+    host_init(host_rand());
+    memset(m_timers, 0, sizeof(m_timers));
+    m_timers[0].p_reg = UARTE_RX_IDLE_TIMER;
+    m_timers[1].p_reg = UARTE_RX_COUNT_TIMER;
+    m_uarte_inten = 0;
+    m_ppi_chen = 0;
+    m_rx_on = false;
+    m_blocked_until = 0;
+    m_sent = 0;
+    m_burst_left = 0;
+    m_burst_start = false;
+    m_long_gap = false;
+    m_delivered = 0;
+    memset(&m_count, 0, sizeof(m_count));
+    for (i = 0; i < STREAM_BYTES; i++)
+        m_stream[i] = host_rand();
+
+    simple_uarte_config(5, 6, 7, 8, false, baud, parity);
+    sync();
+    m_char_ns = (1 + 8 + (parity ? 1 : 0) + 1) * HOST_NS_PER_S / rate;
+    if (((NRF_UARTE0->CONFIG & UARTE_CONFIG_PARITY_Msk) != 0) != parity)
+        host_fail("parity isn't as configured");
+    simple_uarte_enable(rx_callback);
+    sync();
+    irq_dispatch();
+
+    host_at(0, block, NULL);
+    next_burst();
+    while (m_sent < STREAM_BYTES)
+        host_run_until(host_time() + 1000 * m_char_ns);
+    host_run_until(host_time() + 2 * idle_ns());
+    if (m_delivered != STREAM_BYTES)
+        host_fail("%u of %u bytes handed up", m_delivered, STREAM_BYTES);
+
+    printf("  %7u baud%s: %u bytes, %u buffer swaps, %u idle flushes, "
+           "%u right after a swap, %u with its ENDRX pending\n",
+           rate, parity ? " parity" : "", STREAM_BYTES, m_count.swaps,
+           m_count.idle_flushes, m_count.after_swap, m_count.swap_pending);
+    if (m_count.after_swap == 0 || m_count.swap_pending == 0)
+        host_fail("no idle flush came right after a buffer swap");
+
+    simple_uarte_disable();
+    sync();
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+
+    host_init(seed);
+    test_rx(UARTE_BAUDRATE_BAUDRATE_Baud115200, false);
+    test_rx(UARTE_BAUDRATE_BAUDRATE_Baud1M, true);
+    printf("test_uarte: ok\n");
+    return 0;
+}
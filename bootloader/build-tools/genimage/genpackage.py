@@ -0,0 +1,289 @@
+#!/usr/bin/python
+
+'''
+  Tool to build RigDfu application packages: plain, encrypted, and patch
+  (bsdiff + heatshrink against the application already on the device).
+
+  @copyright (c) Rigado, LLC. All rights reserved.
+
+  Source code licensed under BMD-200 Software License Agreement.
+  You should have received a copy with purchase of BMD-200 product.
+  If not, contact info@rigado.com for for a copy.
+'''
+
+import os
+import sys
+import struct
+import shutil
+import zlib
+import tempfile
+import subprocess
+
+from genimage import RigDfuGen, RigError
+import rigcrypto
+import rigpatch
+
+HEADER_SIZE = 12
+IV_SIZE = 16
+TAG_SIZE = 16
+PATCH_INIT_SIZE = 12
+
+LIB_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                       "..", "..", "lib")
+PATCHCHECK_SOURCES = [
+    os.path.join(os.path.dirname(os.path.abspath(__file__)), "patchcheck.c"),
+    os.path.join(LIB_DIR, "patch", "bspatch.c"),
+    os.path.join(LIB_DIR, "patch", "patcher.c"),
+    os.path.join(LIB_DIR, "heatshrink", "heatshrink_decoder.c"),
+]
+PATCHCHECK_INCLUDES = ["patch", "heatshrink", "utils"]
+# Smallest and largest BLE DFU writes (ATT MTU 23 and 247)
+PATCHCHECK_PACKET_SIZES = [20, 244]
+
+def crc32(data):
+    """Same CRC as lib/utils/crc32.c"""
+    return zlib.crc32(data) & 0xffffffff
+
+def parse_key(s):
+    try:
+        key = bytearray.fromhex(s)
+    except ValueError:
+        key = b''
+    if len(key) != 16:
+        raise RigError("key must be 32 hex characters")
+    # The bootloader treats an all 0x00 or all 0xFF key as "no key"
+    if key == bytearray(16) or key == bytearray(b'\xff' * 16):
+        return None
+    return bytes(key)
+
+class RigDfuPackage(object):
+
+    def __init__(self, new_app, old_app = None, key = None, verbose = True):
+        """new_app, old_app: application binaries, as extracted by
+           RigDfuGen.  If old_app is given, build a patch package.
+
+        key: 16 byte AES key, or None for an unencrypted package."""
+        self.new_app = new_app
+        self.old_app = old_app
+        self.key = key
+        self.verbose = verbose
+
+    def log(self, msg):
+        if self.verbose:
+            sys.stderr.write(msg + "\n")
+
+    def gen_package(self):
+        """Generate output package, returning it as a byte stream"""
+        if len(self.new_app) % 4:
+            raise RigError("application size must be a multiple of 4")
+        # Start packet, also the EAX header
+        header = struct.pack('<3I', 0, 0, len(self.new_app))
+
+        if self.old_app is not None:
+            raw = rigpatch.bsdiff(self.old_app, self.new_app)
+            data = rigpatch.heatshrink_encode(raw)
+            patch_init = struct.pack('<3I', len(data), crc32(self.new_app),
+                                     crc32(self.old_app))
+            self.log("%12s: %d bytes (%d before compression), %.1f%% of image"
+                     % ("patch", len(data), len(raw),
+                        100.0 * len(data) / max(len(self.new_app), 1)))
+        else:
+            data = self.new_app
+            patch_init = b''
+
+        if self.key:
+            iv = os.urandom(IV_SIZE)
+            data, tag = rigcrypto.eax_encrypt(self.key, iv, header, data)
+            self.log("%12s: AES-128 EAX" % "encryption")
+        else:
+            iv = b'\0' * IV_SIZE
+            tag = b'\0' * TAG_SIZE
+
+        return header + bytes(iv) + bytes(tag) + patch_init + bytes(data)
+
+    def check_package(self, package, use_host_build = True):
+        """Unpack a package the way the bootloader does and make sure it
+        produces new_app.  Raises RigError on any mismatch."""
+        package = bytes(package)
+        if len(package) < HEADER_SIZE + IV_SIZE + TAG_SIZE:
+            raise RigError("package too short")
+        (sd_size, bl_size, app_size) = struct.unpack('<3I',
+                                                     package[:HEADER_SIZE])
+        if sd_size or bl_size or app_size != len(self.new_app):
+            raise RigError("header sizes %d/%d/%d don't match application"
+                           % (sd_size, bl_size, app_size))
+        pos = HEADER_SIZE
+        iv = package[pos:pos+IV_SIZE]
+        pos += IV_SIZE
+        tag = package[pos:pos+TAG_SIZE]
+        pos += TAG_SIZE
+
+        # Patch init packet is sent on its own and is not encrypted
+        patch_init = None
+        if self.old_app is not None:
+            patch_init = struct.unpack('<3I', package[pos:pos+PATCH_INIT_SIZE])
+            pos += PATCH_INIT_SIZE
+        data = package[pos:]
+
+        # decrypt_prepare / decrypt_data / decrypt_validate
+        if self.key:
+            if iv + tag == b'\0' * (IV_SIZE + TAG_SIZE):
+                raise RigError("package is not encrypted")
+            data = rigcrypto.eax_decrypt(self.key, iv, package[:HEADER_SIZE],
+                                         data, tag)
+            if data is None:
+                raise RigError("EAX tag mismatch")
+            data = bytes(data)
+        elif iv + tag != b'\0' * (IV_SIZE + TAG_SIZE):
+            raise RigError("package is encrypted")
+
+        if patch_init is None:
+            if data != self.new_app:
+                raise RigError("image data doesn't match application")
+            self.log("%12s: %s image OK"
+                     % ("check", "encrypted" if self.key else "plain"))
+            return
+
+        # patch_prepare / dfu_image_validate
+        (patch_size, patch_crc, orig_crc) = patch_init
+        if patch_size != len(data):
+            raise RigError("patch_size %d, but %d bytes of patch data"
+                           % (patch_size, len(data)))
+        if orig_crc != crc32(self.old_app):
+            raise RigError("orig_crc doesn't match old application")
+        image = None
+        if use_host_build:
+            image = self.run_patchcheck(data)
+        if image is None:
+            image = rigpatch.bspatch(self.old_app,
+                                     rigpatch.heatshrink_decode(data),
+                                     app_size)
+            how = "python model"
+        else:
+            how = "host build of lib/patch"
+        if crc32(image) != patch_crc:
+            raise RigError("patched image fails patch_crc (%s)" % how)
+        if image != self.new_app:
+            raise RigError("patched image doesn't match application (%s)"
+                           % how)
+        self.log("%12s: patch OK (%s)" % ("check", how))
+
+    def run_patchcheck(self, patch):
+        """Patch old_app with the bootloader's own C code, built for the
+        host, once for each of PATCHCHECK_PACKET_SIZES.  Returns the new
+        image, or None if there's no compiler."""
+        cc = os.environ.get("CC", "cc")
+        tmp = tempfile.mkdtemp(prefix = "genpackage")
+        try:
+            exe = os.path.join(tmp, "patchcheck")
+            cmd = [cc, "-O2", "-o", exe] + PATCHCHECK_SOURCES + \
+                  ["-I" + os.path.join(LIB_DIR, d) for d in PATCHCHECK_INCLUDES]
+            try:
+                subprocess.check_output(cmd, stderr = subprocess.STDOUT)
+            except OSError:
+                self.log("Warning: no host compiler (%s), "
+                         "checking with python model" % cc)
+                return None
+            except subprocess.CalledProcessError as e:
+                raise RigError("building patchcheck failed:\n%s"
+                               % e.output.decode(errors = "replace"))
+
+            files = {}
+            for name, contents in (("old.bin", self.old_app),
+                                   ("patch.bin", patch)):
+                files[name] = os.path.join(tmp, name)
+                with open(files[name], "wb") as f:
+                    f.write(contents)
+            image = None
+            for size in PATCHCHECK_PACKET_SIZES:
+                out = os.path.join(tmp, "new-%d.bin" % size)
+                try:
+                    subprocess.check_output([exe, files["old.bin"],
+                                             files["patch.bin"],
+                                             str(len(self.new_app)), out,
+                                             str(size)],
+                                            stderr = subprocess.STDOUT)
+                except subprocess.CalledProcessError as e:
+                    raise RigError("%d byte packets: %s" % (size,
+                                   e.output.decode(errors = "replace").strip()))
+                with open(out, "rb") as f:
+                    new = f.read()
+                if image is not None and new != image:
+                    raise RigError("patched image depends on packet size")
+                image = new
+            return image
+        finally:
+            shutil.rmtree(tmp)
+
+if __name__ == "__main__":
+    import argparse
+
+    description = "Generate application packages for RigDFU bootloader"
+    parser = argparse.ArgumentParser(description = description)
+
+    parser.add_argument("hexfile", metavar = "HEXFILE", nargs = "+",
+                        help = "Hex file(s) containing the new application")
+
+    parser.add_argument("--output", "-o", metavar = "BIN",
+                        help = "Output file")
+    parser.add_argument("--quiet", "-q", action = "store_true",
+                        help = "Print less output")
+    parser.add_argument("--key", "-k", metavar = "KEY",
+                        help = "Encrypt with this key, 32 hex characters")
+    parser.add_argument("--old", "-O", metavar = "HEXFILE", action = "append",
+                        help = "Hex file(s) containing the application on "
+                        "the device; generates a patch package")
+    parser.add_argument("--check", "-c", action = "store_true",
+                        help = "Unpack the package with the bootloader's "
+                        "decrypt and patch steps and compare the result")
+    parser.add_argument("--no-host-build", action = "store_true",
+                        help = "With --check, use the python patch model "
+                        "instead of building lib/patch for the host")
+
+    group = parser.add_argument_group(
+        "Application locations in the HEX files",
+        "If unspecified, locations are guessed heuristically.  Format "
+        "is LOW-HIGH, for example 0x1b000-0x3b000.")
+    group.add_argument("--application-addr", "-A", metavar="LOW-HIGH",
+                       help = "New application location")
+    group.add_argument("--old-application-addr", metavar="LOW-HIGH",
+                       help = "Old application location")
+
+    args = parser.parse_args()
+
+    if not args.output:
+        parser.error("must specify --output file")
+
+    def parse_addr(s):
+        if not s:
+            return None
+        (l, h) = s.split('-')
+        return (int(l, 0), int(h, 0))
+
+    def load_app(hexfiles, addr):
+        gen = RigDfuGen(inputs = hexfiles, sd = False, bl = False, app = True,
+                        sd_addr = None, bl_addr = None,
+                        app_addr = parse_addr(addr),
+                        verbose = not args.quiet)
+        return gen.data.extract(*gen.app_addr)
+
+    try:
+        key = parse_key(args.key) if args.key else None
+        new_app = load_app(args.hexfile, args.application_addr)
+        old_app = None
+        if args.old:
+            old_app = load_app(args.old, args.old_application_addr)
+        rigdfupkg = RigDfuPackage(new_app, old_app, key,
+                                  verbose = not args.quiet)
+        pkg = rigdfupkg.gen_package()
+        with open(args.output, "wb") as f:
+            f.write(pkg)
+        if not args.quiet:
+            sys.stderr.write("Wrote %d bytes to %s\n" % (len(pkg), args.output))
+        if args.check:
+            with open(args.output, "rb") as f:
+                rigdfupkg.check_package(f.read(),
+                                        use_host_build = not args.no_host_build)
+    except RigError as e:
+        sys.stderr.write("Error: %s\n" % str(e))
+        raise SystemExit(1)
@@ -0,0 +1,131 @@
+/** @file patchcheck.c
+*
+* @brief Host driver for the bootloader patch code
+*
+* @par
+* Built and run by genpackage.py --check.  Feeds a decrypted patch stream
+* through lib/patch and lib/heatshrink exactly as dfu_patch_data_pkt_handle
+* does, in packets of the given size (default 20 bytes, the smallest BLE
+* write), and writes the image that would be flashed.
+*
+*   usage: patchcheck <old.bin> <patch.bin> <new size> <out.bin> [packet size]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "patcher.h"
+
+#define PACKET_SIZE     20
+#define MAX_PACKET_SIZE 255
+#define MAX_IMAGE_SIZE  (1024 * 1024)
+
+static uint8_t m_patch_buffer[4096] __attribute__((aligned(4)));
+static uint8_t * m_image;
+static uint32_t m_image_size;
+static uint32_t m_data_received;
+
+static uint32_t store_data(uint8_t * data, uint32_t len)
+{
+    if (m_data_received + len > m_image_size)
+        return 1;
+    memcpy(m_image + m_data_received, data, len);
+    m_data_received += len;
+    return 0;
+}
+
+static uint8_t * read_file(const char * name, uint32_t * len)
+{
+    FILE * f = fopen(name, "rb");
+    uint8_t * buf = malloc(MAX_IMAGE_SIZE);
+    if (f == NULL || buf == NULL)
+    {
+        fprintf(stderr, "patchcheck: can't read %s\n", name);
+        exit(1);
+    }
+    *len = fread(buf, 1, MAX_IMAGE_SIZE, f);
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t old_size, patch_size, pos, packet_size = PACKET_SIZE;
+    uint8_t * old, * patch;
+    int32_t status = PATCHER_NEED_MORE;
+    patch_init_t init;
+    FILE * f;
+
+    if (argc == 6)
+        packet_size = strtoul(argv[5], NULL, 0);
+    if ((argc != 5 && argc != 6) || packet_size == 0 || packet_size > MAX_PACKET_SIZE)
+    {
+        fprintf(stderr, "usage: %s <old.bin> <patch.bin> <new size> <out.bin> "
+                "[packet size]\n", argv[0]);
+        return 1;
+    }
+
+    old = read_file(argv[1], &old_size);
+    patch = read_file(argv[2], &patch_size);
+    m_image_size = strtoul(argv[3], NULL, 0);
+    m_image = malloc(m_image_size);
+    if (m_image == NULL)
+        return 1;
+
+    memset(&init, 0, sizeof(init));
+    init.new_buf_ptr = m_patch_buffer;
+    init.new_buf_size = sizeof(m_patch_buffer);
+    init.new_size = m_image_size;
+    init.old_ptr = old;
+    init.old_size = old_size;
+    init.store_func = store_data;
+    patcher_init(&init);
+
+    for (pos = 0; status != PATCHER_COMPLETE; )
+    {
+        if (status == PATCHER_FLASHING)
+        {
+            /* Stores complete immediately on the host */
+            patcher_store_complete();
+            status = patcher_patch();
+        }
+        else if (pos < patch_size)
+        {
+            uint32_t len = patch_size - pos;
+            if (len > packet_size)
+                len = packet_size;
+            if (patcher_add_data(patch + pos, len) == PATCHER_INPUT_FULL)
+            {
+                fprintf(stderr, "patchcheck: patcher input full\n");
+                return 1;
+            }
+            pos += len;
+            status = patcher_patch();
+        }
+        else
+        {
+            fprintf(stderr, "patchcheck: patch ended after %u of %u bytes\n",
+                    m_data_received, m_image_size);
+            return 1;
+        }
+
+        if (status == PATCHER_FAIL)
+        {
+            fprintf(stderr, "patchcheck: patcher failed at patch offset %u\n",
+                    pos);
+            return 1;
+        }
+    }
+
+    f = fopen(argv[4], "wb");
+    if (f == NULL || fwrite(m_image, 1, m_data_received, f) != m_data_received)
+    {
+        fprintf(stderr, "patchcheck: can't write %s\n", argv[4]);
+        return 1;
+    }
+    fclose(f);
+    return 0;
+}
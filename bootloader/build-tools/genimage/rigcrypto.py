@@ -0,0 +1,129 @@
+'''
+  AES-128 EAX encryption matching the RigDFU bootloader (libtomcrypt
+  eax_* on top of the nRF ECB peripheral).  Pure Python so the build
+  tools have no external dependencies; speed is fine for firmware sized
+  images.
+
+  @copyright (c) Rigado, LLC. All rights reserved.
+
+  Source code licensed under BMD-200 Software License Agreement.
+  You should have received a copy with purchase of BMD-200 product.
+  If not, contact info@rigado.com for for a copy.
+'''
+
+def _xtime(a):
+    a <<= 1
+    if a & 0x100:
+        a ^= 0x11b
+    return a
+
+def _gen_sbox():
+    sbox = [0] * 256
+    p = q = 1
+    while True:
+        # p := p * 3, q := q / 3 in GF(2^8)
+        p = p ^ _xtime(p)
+        q ^= q << 1
+        q ^= q << 2
+        q ^= q << 4
+        q &= 0xff
+        if q & 0x80:
+            q ^= 0x09
+        x = q ^ ((q << 1) | (q >> 7)) ^ ((q << 2) | (q >> 6)) ^ \
+            ((q << 3) | (q >> 5)) ^ ((q << 4) | (q >> 4))
+        sbox[p] = (x ^ 0x63) & 0xff
+        if p == 1:
+            break
+    sbox[0] = 0x63
+    return sbox
+
+_SBOX = _gen_sbox()
+_XTIME = [_xtime(i) & 0xff for i in range(256)]
+
+class AES128(object):
+    """AES-128, encrypt direction only (all EAX needs)"""
+    def __init__(self, key):
+        key = bytearray(key)
+        if len(key) != 16:
+            raise ValueError("key must be 16 bytes")
+        w = [list(key[i:i+4]) for i in range(0, 16, 4)]
+        rcon = 1
+        for i in range(4, 44):
+            t = list(w[i-1])
+            if i % 4 == 0:
+                t = [_SBOX[t[1]] ^ rcon, _SBOX[t[2]], _SBOX[t[3]], _SBOX[t[0]]]
+                rcon = _XTIME[rcon]
+            w.append([w[i-4][j] ^ t[j] for j in range(4)])
+        self.round_keys = [sum(w[r*4:r*4+4], []) for r in range(11)]
+
+    def encrypt_block(self, block):
+        s = [b ^ k for b, k in zip(bytearray(block), self.round_keys[0])]
+        for rnd in range(1, 11):
+            s = [_SBOX[b] for b in s]
+            # ShiftRows, state is column major
+            s = [s[(i + 4 * (i % 4)) % 16] for i in range(16)]
+            if rnd != 10:
+                m = []
+                for c in range(0, 16, 4):
+                    a0, a1, a2, a3 = s[c:c+4]
+                    t = a0 ^ a1 ^ a2 ^ a3
+                    m += [a0 ^ t ^ _XTIME[a0 ^ a1], a1 ^ t ^ _XTIME[a1 ^ a2],
+                          a2 ^ t ^ _XTIME[a2 ^ a3], a3 ^ t ^ _XTIME[a3 ^ a0]]
+                s = m
+            s = [b ^ k for b, k in zip(s, self.round_keys[rnd])]
+        return bytearray(s)
+
+def _dbl(block):
+    """Multiply by x in GF(2^128), as used for the OMAC subkeys"""
+    n = int(''.join('%02x' % b for b in block), 16) << 1
+    if n >> 128:
+        n = (n ^ 0x87) & ((1 << 128) - 1)
+    return bytearray.fromhex('%032x' % n)
+
+def _xor(a, b):
+    return bytearray(x ^ y for x, y in zip(a, b))
+
+def _omac(aes, tweak, data):
+    """OMAC1 (CMAC) of [0]*15 + [tweak] + data"""
+    l = aes.encrypt_block(bytearray(16))
+    k1 = _dbl(l)
+    k2 = _dbl(k1)
+    data = bytearray(15) + bytearray([tweak]) + bytearray(data)
+    if len(data) % 16 == 0:
+        last = _xor(data[-16:], k1)
+    else:
+        tail = data[len(data) - len(data) % 16:]
+        last = _xor(tail + bytearray([0x80]) + bytearray(15 - len(tail)), k2)
+        data = data[:len(data) - len(tail)] + bytearray(16)
+    mac = bytearray(16)
+    for i in range(0, len(data) - 16, 16):
+        mac = aes.encrypt_block(_xor(mac, data[i:i+16]))
+    return aes.encrypt_block(_xor(mac, last))
+
+def _ctr(aes, counter, data):
+    out = bytearray()
+    ctr = int(''.join('%02x' % b for b in counter), 16)
+    for i in range(0, len(data), 16):
+        ks = aes.encrypt_block(bytearray.fromhex('%032x' % ctr))
+        out += _xor(data[i:i+16], ks)
+        ctr = (ctr + 1) & ((1 << 128) - 1)
+    return out
+
+def eax_encrypt(key, nonce, header, data):
+    """Return (ciphertext, 16 byte tag)"""
+    aes = AES128(key)
+    n = _omac(aes, 0, nonce)
+    h = _omac(aes, 1, header)
+    ct = _ctr(aes, n, bytearray(data))
+    c = _omac(aes, 2, ct)
+    return ct, _xor(_xor(n, h), c)
+
+def eax_decrypt(key, nonce, header, data, tag):
+    """Return plaintext, or None if the tag doesn't match"""
+    aes = AES128(key)
+    n = _omac(aes, 0, nonce)
+    h = _omac(aes, 1, header)
+    c = _omac(aes, 2, bytearray(data))
+    if _xor(_xor(n, h), c) != bytearray(tag):
+        return None
+    return _ctr(aes, n, bytearray(data))
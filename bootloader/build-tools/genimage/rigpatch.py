@@ -0,0 +1,237 @@
+'''
+  Patch generation for the RigDFU bootloader.
+
+  A patch is a bsdiff style control/diff/extra stream, compressed with
+  heatshrink, exactly as consumed by lib/patch/bspatch.c and
+  lib/heatshrink/heatshrink_decoder.c.  The matching decoders are
+  included so a generated patch can be checked on the host.
+
+  @copyright (c) Rigado, LLC. All rights reserved.
+
+  Source code licensed under BMD-200 Software License Agreement.
+  You should have received a copy with purchase of BMD-200 product.
+  If not, contact info@rigado.com for for a copy.
+'''
+
+import struct
+
+# Must match lib/heatshrink/heatshrink_config.h
+HS_WINDOW_BITS = 10
+HS_LOOKAHEAD_BITS = 8
+
+# Shortest exact match that starts a new diff region
+DIFF_MIN_MATCH = 16
+# Old image positions remembered per 8 byte key
+DIFF_MAX_CANDIDATES = 64
+
+class PatchError(Exception):
+    pass
+
+def _offtout(x):
+    """Sign-magnitude little-endian 64-bit, as read by offtin()"""
+    y = struct.pack('<Q', abs(x))
+    if x < 0:
+        y = y[:7] + struct.pack('B', bytearray(y)[7] | 0x80)
+    return y
+
+def _offtin(buf):
+    y = struct.unpack('<Q', bytes(buf))[0]
+    if y & (1 << 63):
+        return -(y & ((1 << 63) - 1))
+    return y
+
+def _match_len(a, apos, b, bpos, limit):
+    """Length of the common prefix of a[apos:] and b[bpos:], up to limit"""
+    n = 0
+    while n + 32 <= limit and a[apos+n:apos+n+32] == b[bpos+n:bpos+n+32]:
+        n += 32
+    while n < limit and a[apos+n] == b[bpos+n]:
+        n += 1
+    return n
+
+def bsdiff(old, new):
+    """Return the uncompressed control/diff/extra stream turning old
+    into new."""
+    old = bytearray(old)
+    new = bytearray(new)
+
+    index = {}
+    for i in range(0, len(old) - 7):
+        cands = index.setdefault(bytes(old[i:i+8]), [])
+        if len(cands) < DIFF_MAX_CANDIDATES:
+            cands.append(i)
+
+    # Find (newpos, oldpos, length) regions where new is close to old
+    regions = []
+    pos = 0
+    lastoff = 0
+    while pos + 8 <= len(new):
+        best_len = 0
+        best_old = 0
+        # Prefer continuing at the previous offset; firmware changes are
+        # mostly small edits with everything around them shifted alike
+        cands = index.get(bytes(new[pos:pos+8]), [])
+        if 0 <= pos + lastoff < len(old):
+            cands = [pos + lastoff] + cands
+        for c in cands:
+            l = _match_len(new, pos, old, c, min(len(new) - pos, len(old) - c))
+            if l > best_len:
+                best_len, best_old = l, c
+        if best_len < DIFF_MIN_MATCH:
+            pos += 1
+            continue
+
+        # Extend past mismatches while at least half the bytes still
+        # match, the same score bsdiff uses (2 * matches - length)
+        score = best_score = 0
+        end = best_len
+        i = best_len
+        while pos + i < len(new) and best_old + i < len(old):
+            if new[pos+i] == old[best_old+i]:
+                score += 1
+                if score > best_score:
+                    best_score = score
+                    end = i + 1
+            else:
+                score -= 1
+                if score < best_score - 16:
+                    break
+            i += 1
+        regions.append((pos, best_old, end))
+        lastoff = best_old - pos
+        pos += end
+
+    # Emit one record per region: diff over the region, extra up to the
+    # next region, then seek the old position to where the next one starts
+    out = bytearray()
+    if not regions or regions[0][0] != 0:
+        first = regions[0] if regions else (len(new), 0, 0)
+        out += _offtout(0) + _offtout(first[0]) + _offtout(first[1])
+        out += new[:first[0]]
+    for n, (npos, opos, length) in enumerate(regions):
+        if n + 1 < len(regions):
+            next_new, next_old = regions[n+1][0], regions[n+1][1]
+        else:
+            next_new, next_old = len(new), opos + length
+        out += _offtout(length)
+        out += _offtout(next_new - (npos + length))
+        out += _offtout(next_old - (opos + length))
+        out += bytearray((new[npos+i] - old[opos+i]) & 0xff
+                         for i in range(length))
+        out += new[npos+length:next_new]
+    return bytes(out)
+
+def bspatch(old, patch, newsize):
+    """Apply an uncompressed stream from bsdiff(); mirrors bspatch.c"""
+    old = bytearray(old)
+    patch = bytearray(patch)
+    new = bytearray()
+    oldpos = 0
+    p = 0
+    while len(new) < newsize:
+        if p + 24 > len(patch):
+            raise PatchError("patch truncated")
+        ctrl = [_offtin(patch[p+i*8:p+i*8+8]) for i in range(3)]
+        p += 24
+        if len(new) + ctrl[0] > newsize:
+            raise PatchError("diff region past end of image")
+        for i in range(ctrl[0]):
+            o = oldpos + i
+            new.append((patch[p+i] + (old[o] if 0 <= o < len(old) else 0))
+                       & 0xff)
+        p += ctrl[0]
+        oldpos += ctrl[0]
+        if len(new) + ctrl[1] > newsize:
+            raise PatchError("extra region past end of image")
+        new += patch[p:p+ctrl[1]]
+        p += ctrl[1]
+        oldpos += ctrl[2]
+    return bytes(new)
+
+def heatshrink_encode(data, window_bits = HS_WINDOW_BITS,
+                      lookahead_bits = HS_LOOKAHEAD_BITS):
+    """Compress data into the heatshrink bit stream"""
+    data = bytearray(data)
+    window = 1 << window_bits
+    lookahead = 1 << lookahead_bits
+    # A backref costs 1 + window_bits + lookahead_bits; a literal costs 9
+    min_match = (1 + window_bits + lookahead_bits) // 9 + 1
+
+    out = bytearray()
+    acc = [0, 0]    # bit accumulator, bit count
+    def put(value, bits):
+        acc[0] = (acc[0] << bits) | value
+        acc[1] += bits
+        while acc[1] >= 8:
+            acc[1] -= 8
+            out.append((acc[0] >> acc[1]) & 0xff)
+        acc[0] &= (1 << acc[1]) - 1
+
+    chains = {}
+    pos = 0
+    while pos < len(data):
+        best_len = 0
+        best_off = 0
+        limit = min(lookahead, len(data) - pos)
+        if limit >= min_match:
+            key = bytes(data[pos:pos+min_match])
+            for c in reversed(chains.get(key, [])):
+                if pos - c > window:
+                    break
+                l = _match_len(data, pos, data, c, limit)
+                if l > best_len:
+                    best_len, best_off = l, pos - c
+                    if l == limit:
+                        break
+        if best_len >= min_match:
+            put(0, 1)
+            put(best_off - 1, window_bits)
+            put(best_len - 1, lookahead_bits)
+            step = best_len
+        else:
+            put(0x100 | data[pos], 9)
+            step = 1
+        for i in range(pos, min(pos + step, len(data) - min_match + 1)):
+            chain = chains.setdefault(bytes(data[i:i+min_match]), [])
+            chain.append(i)
+            if len(chain) > 32:
+                del chain[0]
+        pos += step
+    if acc[1]:
+        out.append((acc[0] << (8 - acc[1])) & 0xff)
+    return bytes(out)
+
+def heatshrink_decode(data, window_bits = HS_WINDOW_BITS,
+                      lookahead_bits = HS_LOOKAHEAD_BITS):
+    """Decompress a heatshrink bit stream; trailing pad bits are ignored"""
+    data = bytearray(data)
+    nbits = len(data) * 8
+    pos = [0]
+    def get(bits):
+        if pos[0] + bits > nbits:
+            return None
+        v = 0
+        for i in range(pos[0], pos[0] + bits):
+            v = (v << 1) | ((data[i >> 3] >> (7 - (i & 7))) & 1)
+        pos[0] += bits
+        return v
+
+    out = bytearray()
+    while True:
+        tag = get(1)
+        if tag is None:
+            break
+        if tag:
+            c = get(8)
+            if c is None:
+                break
+            out.append(c)
+        else:
+            off = get(window_bits)
+            count = get(lookahead_bits)
+            if off is None or count is None:
+                break
+            for i in range(count + 1):
+                o = len(out) - off - 1
+                out.append(out[o] if o >= 0 else 0)
+    return bytes(out)
@@ -14,6 +14,7 @@
     EAX implementation, decrypt block, by Tom St Denis
 */
 #include "tomcrypt.h"
+#include "ltc_nrf.h"
 
 #ifdef LTC_EAX_MODE
 
@@ -28,19 +29,12 @@
 int eax_decrypt(eax_state *eax, const unsigned char *ct, unsigned char *pt, 
                 unsigned long length)
 {
-   int err;
-   
    LTC_ARGCHK(eax != NULL);
    LTC_ARGCHK(pt  != NULL);
    LTC_ARGCHK(ct  != NULL);
 
-   /* omac ciphertext */
-   if ((err = omac_process(&eax->ctomac, ct, length)) != CRYPT_OK) {
-      return err;
-   }
-
-   /* decrypt  */
-   return ctr_decrypt(ct, pt, length, &eax->ctr);
+   /* omac ciphertext and decrypt, sharing AES calls */
+   return ltc_nrf_eax_process(eax, ct, pt, length, 0);
 }
 
 #endif
@@ -14,6 +14,7 @@
    EAX implementation, encrypt block by Tom St Denis 
 */
 #include "tomcrypt.h"
+#include "ltc_nrf.h"
 
 #ifdef LTC_EAX_MODE
 
@@ -28,19 +29,12 @@
 int eax_encrypt(eax_state *eax, const unsigned char *pt, unsigned char *ct, 
                 unsigned long length)
 {
-   int err;
-   
    LTC_ARGCHK(eax != NULL);
    LTC_ARGCHK(pt  != NULL);
    LTC_ARGCHK(ct  != NULL);
 
-   /* encrypt */
-   if ((err = ctr_encrypt(pt, ct, length, &eax->ctr)) != CRYPT_OK) {
-      return err;
-   }
-
-   /* omac ciphertext */
-   return omac_process(&eax->ctomac, ct, length);
+   /* encrypt and omac ciphertext, sharing AES calls */
+   return ltc_nrf_eax_process(eax, pt, ct, length, 1);
 }
 
 #endif
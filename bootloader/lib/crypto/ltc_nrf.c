@@ -1,6 +1,7 @@
 #include <nrf.h>
 #include <nrf_soc.h>
 #include "nordic_common.h"
+#include "app_util_platform.h"
 #include <tomcrypt.h>
 #include "ltc_nrf.h"
 
@@ -10,9 +11,13 @@
 
 static nrf_ecb_hal_data_t ecb_data;
 
+static void ks_reset(const symmetric_CTR *ctr);
+
 void ltc_nrf_ecb_setup(const unsigned char *key)
 {
     memcpy(ecb_data.key, key, 16);
+    /* New key, any read-ahead keystream is useless */
+    ks_reset(NULL);
 }
 
 int ltc_nrf_ecb_encrypt(const unsigned char *pt,
@@ -24,3 +29,237 @@ int ltc_nrf_ecb_encrypt(const unsigned char *pt,
     memcpy(ct, ecb_data.ciphertext, 16);
     return CRYPT_OK;
 }
+
+/* Encrypt pt[i] into ct[i] for each of 'blocks' 16-byte blocks.  SDK12
+   SoftDevices take the whole set in one call and read and write the
+   blocks in place; older ones fall back to one call per block.  Safe to
+   call from thread mode while an interrupt uses it too. */
+int ltc_nrf_ecb_encrypt_blocks(const unsigned char * const *pt,
+                               unsigned char * const *ct,
+                               unsigned long blocks)
+{
+#ifdef SDK12
+    nrf_ecb_hal_data_block_t desc[LTC_NRF_BATCH_BLOCKS + 1];
+    unsigned long i;
+
+    if (blocks > LTC_NRF_BATCH_BLOCKS + 1)
+        return CRYPT_INVALID_ARG;
+    for (i = 0; i < blocks; i++) {
+        desc[i].p_key = &ecb_data.key;
+        desc[i].p_cleartext = (soc_ecb_cleartext_t *)pt[i];
+        desc[i].p_ciphertext = (soc_ecb_ciphertext_t *)ct[i];
+    }
+    if (sd_ecb_blocks_encrypt(blocks, desc) != NRF_SUCCESS)
+        return CRYPT_ERROR;
+#else
+    nrf_ecb_hal_data_t data;
+    unsigned long i;
+
+    memcpy(data.key, ecb_data.key, 16);
+    for (i = 0; i < blocks; i++) {
+        memcpy(data.cleartext, pt[i], 16);
+        if (sd_ecb_block_encrypt(&data) != NRF_SUCCESS)
+            return CRYPT_ERROR;
+        memcpy(ct[i], data.ciphertext, 16);
+    }
+#endif
+    return CRYPT_OK;
+}
+
+/* CTR keystream read-ahead.  The ring holds E(ctr + 1), E(ctr + 2), ...
+   for the CTR state in ks_owner, where ctr is that state's current
+   counter.  It is topped up by ltc_nrf_eax_prefetch from thread mode
+   and, when it runs dry, by ltc_nrf_eax_process itself, which may run
+   in the SoftDevice event interrupt.  Anything that restarts the ring
+   bumps ks_gen so a prefetch that was interrupted throws its work away
+   rather than publishing stale keystream. */
+static unsigned char ks_ring[LTC_NRF_KS_BLOCKS][16];
+static unsigned char ks_next_ctr[16];   /* counter after the ring's last block */
+static const symmetric_CTR *ks_owner;
+static unsigned long ks_head;
+static unsigned long ks_count;
+static unsigned long ks_gen;
+
+/* Counters being encrypted by ltc_nrf_eax_process */
+static unsigned char ctr_blocks[LTC_NRF_BATCH_BLOCKS][16];
+
+/* Counters and keystream being built by ltc_nrf_eax_prefetch */
+static unsigned char pf_ctr[LTC_NRF_BATCH_BLOCKS][16];
+static unsigned char pf_ks[LTC_NRF_BATCH_BLOCKS][16];
+
+static void ctr_increment(unsigned char *c, const symmetric_CTR *ctr)
+{
+    int x;
+
+    if (ctr->mode == CTR_COUNTER_LITTLE_ENDIAN) {
+        for (x = 0; x < ctr->ctrlen; x++) {
+            if (++c[x] != 0)
+                break;
+        }
+    } else {
+        for (x = ctr->blocklen - 1; x >= ctr->ctrlen; x--) {
+            if (++c[x] != 0)
+                break;
+        }
+    }
+}
+
+static void ks_reset(const symmetric_CTR *ctr)
+{
+    ks_gen++;
+    ks_owner = ctr;
+    ks_head = 0;
+    ks_count = 0;
+    if (ctr != NULL)
+        XMEMCPY(ks_next_ctr, ctr->ctr, 16);
+}
+
+/* Refill an empty ring with up to 'want' blocks for ctr.  src0/dst0, if
+   given, is one more block to encrypt in the same call. */
+static int ks_fill(const symmetric_CTR *ctr, unsigned long want,
+                   const unsigned char *src0, unsigned char *dst0)
+{
+    const unsigned char *src[LTC_NRF_BATCH_BLOCKS + 1];
+    unsigned char *dst[LTC_NRF_BATCH_BLOCKS + 1];
+    unsigned long n = 0, x;
+    int err;
+
+    ks_reset(ctr);
+    if (src0 != NULL) {
+        src[n] = src0;
+        dst[n] = dst0;
+        n++;
+    }
+    want = MIN(want, LTC_NRF_BATCH_BLOCKS);
+    for (x = 0; x < want; x++) {
+        ctr_increment(ks_next_ctr, ctr);
+        XMEMCPY(ctr_blocks[x], ks_next_ctr, 16);
+        src[n] = ctr_blocks[x];
+        dst[n] = ks_ring[x];
+        n++;
+    }
+    if ((err = ltc_nrf_ecb_encrypt_blocks(src, dst, n)) != CRYPT_OK) {
+        ks_reset(NULL);
+        return err;
+    }
+    ks_count = want;
+    return CRYPT_OK;
+}
+
+/* EAX data step: CTR over the data and OMAC over the ciphertext.  The
+   keystream normally comes from the read-ahead ring, leaving only the
+   OMAC chain to compute here.  When the ring is empty it is refilled
+   with enough blocks for the rest of the buffer (up to
+   LTC_NRF_BATCH_BLOCKS), in the same SoftDevice call as the pending
+   OMAC block.  Same state updates as ctr_encrypt followed by
+   omac_process, so eax_done and later calls are unaffected. */
+int ltc_nrf_eax_process(eax_state *eax,
+                        const unsigned char *in,
+                        unsigned char *out,
+                        unsigned long len,
+                        int encrypt)
+{
+    omac_state *omac = &eax->ctomac;
+    symmetric_CTR *ctr = &eax->ctr;
+    unsigned long n, x;
+    unsigned char c;
+    int err;
+
+    if (omac->blklen != 16 || omac->buflen < 0 || omac->buflen > 16 ||
+        ctr->blocklen != 16 || ctr->padlen < 0 || ctr->padlen > 16)
+        return CRYPT_INVALID_ARG;
+
+    while (len) {
+        /* A full OMAC block is only chained in once more data follows */
+        if (omac->buflen == 16) {
+            for (x = 0; x < 16; x++)
+                omac->block[x] ^= omac->prev[x];
+            if (ctr->padlen == 16 && (ks_owner != ctr || ks_count == 0))
+                err = ks_fill(ctr, (len + 15) / 16, omac->block, omac->prev);
+            else
+                err = ltc_nrf_ecb_encrypt(omac->block, omac->prev);
+            if (err != CRYPT_OK)
+                return err;
+            omac->buflen = 0;
+        }
+
+        /* Pad used up: take the next block from the ring */
+        if (ctr->padlen == 16) {
+            if (ks_owner != ctr || ks_count == 0) {
+                if ((err = ks_fill(ctr, (len + 15) / 16, NULL, NULL)) != CRYPT_OK)
+                    return err;
+            }
+            XMEMCPY(ctr->pad, ks_ring[ks_head], 16);
+            ks_head = (ks_head + 1) % LTC_NRF_KS_BLOCKS;
+            ks_count--;
+            ctr_increment(ctr->ctr, ctr);
+            ctr->padlen = 0;
+        }
+
+        n = MIN(len, (unsigned long)MIN(16 - omac->buflen, 16 - ctr->padlen));
+        for (x = 0; x < n; x++) {
+            if (encrypt) {
+                c = in[x] ^ ctr->pad[ctr->padlen + x];
+                out[x] = c;
+            } else {
+                c = in[x];
+                out[x] = c ^ ctr->pad[ctr->padlen + x];
+            }
+            omac->block[omac->buflen + x] = c;
+        }
+        omac->buflen += n;
+        ctr->padlen += n;
+        in += n;
+        out += n;
+        len -= n;
+    }
+
+    return CRYPT_OK;
+}
+
+/* Top up the keystream ring for eax by one batch.  Call from thread mode
+   when idle.  Returns true if there is room for more. */
+bool ltc_nrf_eax_prefetch(eax_state *eax)
+{
+    const unsigned char *src[LTC_NRF_BATCH_BLOCKS];
+    unsigned char *dst[LTC_NRF_BATCH_BLOCKS];
+    const symmetric_CTR *ctr = &eax->ctr;
+    unsigned char next_ctr[16];
+    unsigned long gen, n, x, tail;
+    bool more = false;
+
+    CRITICAL_REGION_ENTER();
+    if (ks_owner != ctr)
+        ks_reset(ctr);
+    gen = ks_gen;
+    n = MIN(LTC_NRF_KS_BLOCKS - ks_count, LTC_NRF_BATCH_BLOCKS);
+    XMEMCPY(next_ctr, ks_next_ctr, 16);
+    CRITICAL_REGION_EXIT();
+
+    if (n == 0)
+        return false;
+
+    for (x = 0; x < n; x++) {
+        ctr_increment(next_ctr, ctr);
+        XMEMCPY(pf_ctr[x], next_ctr, 16);
+        src[x] = pf_ctr[x];
+        dst[x] = pf_ks[x];
+    }
+    if (ltc_nrf_ecb_encrypt_blocks(src, dst, n) != CRYPT_OK)
+        return false;
+
+    /* Publish, unless the ring was restarted meanwhile.  Blocks taken
+       from the head in the meantime don't move the tail. */
+    CRITICAL_REGION_ENTER();
+    if (gen == ks_gen) {
+        tail = ks_head + ks_count;
+        for (x = 0; x < n; x++)
+            XMEMCPY(ks_ring[(tail + x) % LTC_NRF_KS_BLOCKS], pf_ks[x], 16);
+        ks_count += n;
+        XMEMCPY(ks_next_ctr, next_ctr, 16);
+        more = (ks_count < LTC_NRF_KS_BLOCKS);
+    }
+    CRITICAL_REGION_EXIT();
+
+    return more;
+}
@@ -1,10 +1,30 @@
 #ifndef LTC_NRF_H
 #define LTC_NRF_H
 
+#include <stdbool.h>
 #include <tomcrypt.h>
 
 void ltc_nrf_ecb_setup(const unsigned char *key);
 int ltc_nrf_ecb_encrypt(const unsigned char *pt,
                         unsigned char *ct);
 
+/* Most CTR keystream blocks generated per batch */
+#define LTC_NRF_BATCH_BLOCKS 8
+
+/* CTR keystream read ahead by ltc_nrf_eax_prefetch, in blocks; enough
+   for one full 244 byte BLE write */
+#define LTC_NRF_KS_BLOCKS 16
+
+int ltc_nrf_ecb_encrypt_blocks(const unsigned char * const *pt,
+                               unsigned char * const *ct,
+                               unsigned long blocks);
+
+int ltc_nrf_eax_process(eax_state *eax,
+                        const unsigned char *in,
+                        unsigned char *out,
+                        unsigned long len,
+                        int encrypt);
+
+bool ltc_nrf_eax_prefetch(eax_state *eax);
+
 #endif
@@ -15,18 +15,30 @@
 #include "rigdfu_util.h"
 #include "rigdfu_serial.h"
 #include "version.h"
-#include "queue.h"
 #include "patcher.h"
+#include "crc32.h"
 
 #include "nrf_gpio.h"
 
-/* Serial RX queue */
-DECLARE_QUEUE(queue, 512);
-
-int offset = 0;
 static uint32_t     m_num_of_firmware_bytes_rcvd;                                            /**< Cumulative number of bytes of firmware data received. */
 static bool         m_is_patch_complete = false;
 
+/* Frame being received.  Parsing stops while m_frame_held is set: the
+   data of the last frame is then being written to flash straight from
+   m_frame, and its response waits in m_pending_resp until it is done. */
+static serial_frame_t m_frame;
+static volatile bool m_frame_held = false;
+static volatile uint8_t m_pending_resp = 0;
+static volatile uint32_t m_write_err = NRF_SUCCESS;
+static uint8_t m_resp_long_len = 0;
+
+/* Streamed firmware data: next frame expected, and whether an ack or a
+   RESEND for it is owed or has been sent */
+static uint32_t m_stream_seq = 0;
+static bool m_stream_ack_owed = false;
+static bool m_stream_resend_sent = false;
+static bool m_stream_complete = false;
+
 static void app_data_process(serial_frame_t* frame);
 static void generic_data_process( serial_dfu_op_t op,
                                     serial_frame_t* frame,
@@ -36,79 +48,172 @@ static serial_dfu_resp_val_t nrf_err_code_translate(uint32_t err_code, const uin
 static uint32_t serial_dfu_op_to_dfu_packet_type(serial_dfu_op_t op);
 static void put_op_response(uint8_t op_id, uint8_t op_sts);
 static void put_frame(uint8_t * op_data, uint16_t op_data_len);
+static void put_pending_response(void);
 static void process_frame(struct serial_frame *frame);
 static void patch_data_process(serial_frame_t *p_frame);
+static void stream_data_process(serial_frame_t *p_frame);
+static void stream_response(uint8_t resp_val);
+static uint16_t stream_max_frame_data(void);
+static void resume_process(serial_frame_t *p_frame);
 
-static bool scheduled_process = false;
-static void process_rx_bytes(void *p_event_data, uint16_t event_size)
+/* Longest response data: op, resp_val and the resume offset and crc */
+#define SERIAL_RESP_MAX_DATA (2 + SERIAL_RESUME_DATA_SZ)
+
+static enum
+    { wait_frame, wait_len, wait_len_lo, wait_len_hi, wait_op, wait_data } m_rx_state = wait_frame;
+static bool m_rx_escape = false;
+static uint16_t m_rx_offset = 0;
+
+static void rx_frame_done(void)
 {
-    static struct serial_frame frame;
-//    static uint8_t * const framebytes = (uint8_t *)&(frame.packet_len); //we need data to be word aligned...
-    //static int offset = 0;
-    static enum 
-        { wait_frame, wait_len, wait_op, wait_data } state = wait_frame;
-    static bool escape = false;
-    int c;
+    m_rx_state = wait_frame;
+    m_resp_long_len = m_frame.long_len;
+    process_frame(&m_frame);
+}
 
-    /* clear the uart proc event */
-    scheduled_process = false;
+/* Parse received bytes into m_frame and process each complete frame.
+   Returns the number of bytes used, which is less than len only if a
+   frame left m_frame held; the rest is parsed once it is released. */
+static uint32_t rx_parse(const uint8_t * p_data, uint32_t len)
+{
+    const uint8_t * p = p_data;
+    const uint8_t * end = p_data + len;
+    uint16_t data_len;
+    int c;
 
-    while ((c = queue_pop(&queue)) != -1)
+    while (p < end && !m_frame_held)
     {
+        data_len = m_frame.packet_len - SERIAL_FRAME_HDR_SZ;
+
+        /* Copy a run of frame data up to the next special byte */
+        if (m_rx_state == wait_data && !m_rx_escape) {
+            uint32_t n = MIN((uint32_t)(end - p), (uint32_t)(data_len - m_rx_offset));
+            uint32_t i = 0;
+
+            while (i < n && p[i] != SERIAL_FRAME_MARKER && p[i] != SERIAL_FRAME_ESCAPE)
+                i++;
+            memcpy(&m_frame.data[m_rx_offset], p, i);
+            m_rx_offset += i;
+            p += i;
+
+            if (m_rx_offset == data_len) {
+                rx_frame_done();
+                continue;
+            }
+            if (p == end)
+                break;
+        }
+
+        c = *p++;
+
         /* Regardless of state, start processing a new frame when
            the marker is received. */
         if (c == SERIAL_FRAME_MARKER) {
-            state = wait_len;
-            offset = 0;
-            escape = false;
+            m_rx_state = wait_len;
+            m_rx_offset = 0;
+            m_rx_escape = false;
             continue;
         }
 
         /* If we were escaping, decode the escaped character. */
-        if (escape) {
+        if (m_rx_escape) {
             if (c == SERIAL_FRAME_ESCAPE_ESCAPE)
                 c = SERIAL_FRAME_ESCAPE;
             else if (c == SERIAL_FRAME_ESCAPE_MARKER)
                 c = SERIAL_FRAME_MARKER;
-            escape = false;
-        } else {
+            m_rx_escape = false;
+        } else if (c == SERIAL_FRAME_ESCAPE) {
             /* If we get an escape character, wait for the next one. */
-            if (c == SERIAL_FRAME_ESCAPE) {
-                escape = true;
-                continue;
-            }
+            m_rx_escape = true;
+            continue;
         }
 
-        /* If we want a new frame and don't have it, ignore */
-        if (state == wait_frame) {
-            continue;
-        } 
-        
-        if(state == wait_len) {
-            frame.packet_len = c;
-            state = wait_op;
-        } else if(state == wait_op) {
-            frame.opcode = c;
-            state = wait_data;
-        } else if(state == wait_data) {
-            frame.data[offset] = c;
-            offset++;
+        switch (m_rx_state)
+        {
+            case wait_frame:
+                /* If we want a new frame and don't have it, ignore */
+                break;
+
+            case wait_len:
+                m_frame.long_len = (c == SERIAL_FRAME_LONG_LEN);
+                m_frame.packet_len = c;
+                if (m_frame.long_len)
+                    m_rx_state = wait_len_lo;
+                else if (c < SERIAL_FRAME_HDR_SZ)
+                    m_rx_state = wait_frame;
+                else
+                    m_rx_state = wait_op;
+                break;
+
+            case wait_len_lo:
+                m_frame.packet_len = c;
+                m_rx_state = wait_len_hi;
+                break;
+
+            case wait_len_hi:
+                m_frame.packet_len |= c << 8;
+                if (m_frame.packet_len < SERIAL_FRAME_HDR_SZ ||
+                    m_frame.packet_len > SERIAL_FRAME_MAX_DATA + SERIAL_FRAME_HDR_SZ)
+                    m_rx_state = wait_frame;
+                else
+                    m_rx_state = wait_op;
+                break;
+
+            case wait_op:
+                m_frame.opcode = c;
+                m_rx_state = wait_data;
+                if (data_len == 0)
+                    rx_frame_done();
+                break;
+
+            case wait_data:
+                m_frame.data[m_rx_offset++] = c;
+                if (m_rx_offset == data_len)
+                    rx_frame_done();
+                break;
         }
-        
-        if (state == wait_data &&
-            (offset + 2) >= frame.packet_len) {
-            state = wait_frame;
-            process_frame(&frame);
+    }
+
+    return p - p_data;
+}
+
+static bool scheduled_process = false;
+static void process_rx_bytes(void *p_event_data, uint16_t event_size)
+{
+    const uint8_t * p_data;
+    uint32_t len;
+
+    /* clear the uart proc event */
+    scheduled_process = false;
+
+    if (m_frame_held)
+        return;
+
+    /* Answer a data frame whose flash write has now finished */
+    put_pending_response();
+
+    if (rigdfu_serial_rx_overrun())
+        m_rx_state = wait_frame;
+
+    while (!m_frame_held && (len = rigdfu_serial_rx_span(&p_data)) != 0)
+        rigdfu_serial_rx_release(rx_parse(p_data, len));
+
+    /* Ack streamed frames once everything received so far is parsed */
+    if (m_stream_ack_owed) {
+        uint8_t resp = m_stream_complete ? SERIAL_DFU_RESP_VAL_SUCCESS
+                                         : SERIAL_DFU_RESP_VAL_OK_MORE_DATA_EXP;
+        if (m_write_err != NRF_SUCCESS) {
+            resp = nrf_err_code_translate(m_write_err, SERIAL_OP_STREAM_FIRMWARE_IMAGE);
+            m_write_err = NRF_SUCCESS;
         }
+        stream_response(resp);
     }
 }
 
-/* Called whenever a byte is received (from interrupt context) */
-static void uart_rx(uint8_t x)
+/* Schedule a call to the function that will parse received bytes
+   (from outside interrupt context) */
+static void schedule_process(void)
 {
-    _queue_push(&queue, x);
-    /* Schedule a call to the function that will pull bytes from the
-       queue and process them (from outside interrupt context) */
     if (!scheduled_process) {
         scheduled_process = true;
         app_sched_event_put(NULL, 0, process_rx_bytes);
@@ -130,6 +235,10 @@ static void process_frame(struct serial_frame *frame)
     switch(frame->opcode)
     {
         case SERIAL_OP_START_DFU:
+            m_stream_seq = 0;
+            m_stream_ack_owed = false;
+            m_stream_resend_sent = false;
+            m_stream_complete = false;
             //we will issue the reply after the erase is complete via dfu_cb_handler 
             generic_data_process((serial_dfu_op_t)frame->opcode, frame, dfu_start_pkt_handle, false);
             break;
@@ -172,6 +281,25 @@ static void process_frame(struct serial_frame *frame)
         case SERIAL_OP_PROTOCOL_VER:
             put_op_response(SERIAL_OP_PROTOCOL_VER, API_PROTOCOL_VERSION);
             break;
+
+        case SERIAL_OP_STREAM_FIRMWARE_IMAGE:
+            stream_data_process(frame);
+            break;
+
+        case SERIAL_OP_RESUME:
+            resume_process(frame);
+            break;
+
+        case SERIAL_OP_STREAM_INFO:
+        {
+            uint8_t msg[6];
+            msg[0] = SERIAL_OP_STREAM_INFO;
+            msg[1] = SERIAL_DFU_RESP_VAL_SUCCESS;
+            (void)uint16_encode(rigdfu_serial_rx_size(), &msg[2]);
+            (void)uint16_encode(stream_max_frame_data(), &msg[4]);
+            put_frame(msg, sizeof(msg));
+            break;
+        }
         
         case SERIAL_OP_SYSTEM_RESET:
             dfu_reset();
@@ -203,7 +331,16 @@ static void dfu_cb_handler(uint32_t packet, uint32_t result, uint8_t * p_data)
             put_op_response(SERIAL_OP_START_DFU,resp_val);
             break;
 
-        case DATA_PACKET: 
+        case DATA_PACKET:
+            /* Report write errors with the next data response */
+            if (result != NRF_SUCCESS)
+                m_write_err = result;
+            /* m_frame.data was written directly; resume parsing */
+            if ((p_data == m_frame.data ||
+                 p_data == &m_frame.data[SERIAL_STREAM_HDR_SZ]) && m_frame_held) {
+                m_frame_held = false;
+                schedule_process();
+            }
             break;
         case CONFIG_PACKET:
             break;
@@ -231,7 +368,7 @@ uint32_t dfu_transport_update_start_serial(void)
 {
     /* Reinitialize serial port and use our own RX handler */
     rigdfu_serial_reinit_dfu();
-    rigdfu_serial_set_rx_handler(uart_rx);
+    rigdfu_serial_set_rx_notify(schedule_process);
 
     /* When we start the serial transport, send an identification
        string.  Format is 42-characters:
@@ -267,48 +404,78 @@ static void put_op_response(uint8_t op_id, uint8_t op_sts)
     put_frame(msg,sizeof(msg));
 }
 
+/* Send the response for a held data frame, once it has been released */
+static void put_pending_response(void)
+{
+    uint8_t resp = m_pending_resp;
+
+    if (resp == 0)
+        return;
+    m_pending_resp = 0;
+
+    if (m_write_err != NRF_SUCCESS) {
+        resp = nrf_err_code_translate(m_write_err, SERIAL_OP_RECEIVE_FIRMWARE_IMAGE);
+        m_write_err = NRF_SUCCESS;
+    }
+    put_op_response(SERIAL_OP_RECEIVE_FIRMWARE_IMAGE, resp);
+}
+
+/* Append a byte to a frame being built, escaping it if needed */
+static uint16_t put_escaped(uint8_t * buf, uint16_t pos, uint8_t c)
+{
+    if (c == SERIAL_FRAME_MARKER || c == SERIAL_FRAME_ESCAPE)
+    {
+        buf[pos++] = SERIAL_FRAME_ESCAPE;
+        c = (c == SERIAL_FRAME_MARKER) ? SERIAL_FRAME_ESCAPE_MARKER
+                                       : SERIAL_FRAME_ESCAPE_ESCAPE;
+    }
+    buf[pos++] = c;
+    return pos;
+}
+
 static void put_frame(uint8_t * op_data, uint16_t op_data_len)
 {
-    //calculate the data length with escapes
-    uint16_t pkt_len = op_data_len;
-    for(uint8_t i=0; i<op_data_len; i++)
+    /* Responses are short: marker, up to 3 length bytes, op and data,
+       escaped.  The longest is a resume response. */
+    uint8_t buf[1 + 2 * (3 + 1 + SERIAL_RESP_MAX_DATA)];
+    uint16_t pos = 0;
+
+    if (op_data_len > SERIAL_RESP_MAX_DATA)
+        return;
+
+    //frame start marker
+    buf[pos++] = SERIAL_FRAME_MARKER;
+
+    if (m_resp_long_len)
     {
-        if( op_data[i] == SERIAL_FRAME_MARKER 
-            || op_data[i] == SERIAL_FRAME_ESCAPE )
-            pkt_len++;
+        //long frame length, of the unescaped data
+        uint16_t len = op_data_len + SERIAL_FRAME_HDR_SZ;
+
+        buf[pos++] = SERIAL_FRAME_LONG_LEN;
+        pos = put_escaped(buf, pos, len & 0xff);
+        pos = put_escaped(buf, pos, len >> 8);
     }
-    
-    //check length
-    if((pkt_len + SERIAL_FRAME_HDR_SZ) <= 0xff)
+    else
     {
-        //frame start marker
-        rigdfu_serial_put(SERIAL_FRAME_MARKER);
-        
-        //frame length
-        rigdfu_serial_put(pkt_len + SERIAL_FRAME_HDR_SZ);
-        
-        //frame op, always response
-        rigdfu_serial_put(SERIAL_OP_RESPONSE);
-        
-        //frame data
-        for(uint8_t i=0; i<op_data_len; i++)
+        //frame length, counting escapes, as older hosts expect
+        uint16_t pkt_len = op_data_len;
+        for(uint16_t i=0; i<op_data_len; i++)
         {
-            //escape it
-            if(op_data[i] == SERIAL_FRAME_MARKER || op_data[i] == SERIAL_FRAME_ESCAPE)
-            {
-                rigdfu_serial_put(SERIAL_FRAME_ESCAPE);
-                
-                if(op_data[i] == SERIAL_FRAME_MARKER)
-                    rigdfu_serial_put(SERIAL_FRAME_ESCAPE_MARKER);
-                else
-                    rigdfu_serial_put(SERIAL_FRAME_ESCAPE_ESCAPE);
-            }
-            else
-            {
-                rigdfu_serial_put(op_data[i]);
-            }
-        }        
+            if( op_data[i] == SERIAL_FRAME_MARKER
+                || op_data[i] == SERIAL_FRAME_ESCAPE )
+                pkt_len++;
+        }
+        buf[pos++] = pkt_len + SERIAL_FRAME_HDR_SZ;
     }
+
+    //frame op, always response
+    buf[pos++] = SERIAL_OP_RESPONSE;
+
+    //frame data
+    for(uint16_t i=0; i<op_data_len; i++)
+        pos = put_escaped(buf, pos, op_data[i]);
+
+    rigdfu_serial_write(buf, pos);
 }
 
 
@@ -328,7 +495,7 @@ static void generic_data_process( serial_dfu_op_t op,
                                     bool send_response_on_success)
 {
     uint32_t err_code;
-    uint8_t frame_payload_len = frame->packet_len - SERIAL_FRAME_HDR_SZ;
+    uint16_t frame_payload_len = frame->packet_len - SERIAL_FRAME_HDR_SZ;
     dfu_update_packet_t dfu_pkt;
 
     /* Length must be a multiple of 4 bytes */
@@ -386,7 +553,9 @@ static serial_dfu_resp_val_t nrf_err_code_translate(uint32_t err_code, const uin
             return SERIAL_DFU_RESP_VAL_DATA_SIZE;
 
         case NRF_ERROR_INVALID_DATA:
-            if (op_code == SERIAL_OP_VALIDATE_FIRMWARE_IMAGE || op_code == SERIAL_OP_INITIALIZE_PATCH)
+            if (op_code == SERIAL_OP_VALIDATE_FIRMWARE_IMAGE ||
+                op_code == SERIAL_OP_INITIALIZE_PATCH ||
+                op_code == SERIAL_OP_RESUME)
             {
                 // When this error is received in Validation phase, then it maps to a CRC Error.
                 // Refer dfu_image_validate function for more information.
@@ -414,6 +583,7 @@ static uint32_t serial_dfu_op_to_dfu_packet_type(serial_dfu_op_t op)
             break;
         
         case SERIAL_OP_RECEIVE_FIRMWARE_IMAGE:
+        case SERIAL_OP_STREAM_FIRMWARE_IMAGE:
             dfu_packet = DATA_PACKET;
             break;
         
@@ -447,7 +617,7 @@ static uint32_t serial_dfu_op_to_dfu_packet_type(serial_dfu_op_t op)
 static void app_data_process(serial_frame_t* frame)
 {
     volatile uint32_t err_code;
-    uint8_t frame_payload_len = frame->packet_len - SERIAL_FRAME_HDR_SZ;
+    uint16_t frame_payload_len = frame->packet_len - SERIAL_FRAME_HDR_SZ;
 
     if ((frame_payload_len & (sizeof(uint32_t) - 1)) != 0)
     {
@@ -461,7 +631,11 @@ static void app_data_process(serial_frame_t* frame)
     dfu_pkt.packet_type                      = DATA_PACKET;
     dfu_pkt.params.data_packet.packet_length = frame_payload_len / sizeof(uint32_t);
     dfu_pkt.params.data_packet.p_data_packet = (uint32_t*)frame->data;
-   
+
+    /* Hold the frame until the DFU module is done with its data; if
+       it has to be written to flash directly, the DATA_PACKET
+       callback releases it later. */
+    m_frame_held = true;
     err_code = dfu_data_pkt_handle(&dfu_pkt);
 
     if (err_code == NRF_SUCCESS)
@@ -470,7 +644,7 @@ static void app_data_process(serial_frame_t* frame)
         m_num_of_firmware_bytes_rcvd += frame_payload_len;
 
         // Notify the DFU Controller about the success about the procedure.
-        put_op_response(SERIAL_OP_RECEIVE_FIRMWARE_IMAGE, SERIAL_DFU_RESP_VAL_SUCCESS);
+        m_pending_resp = SERIAL_DFU_RESP_VAL_SUCCESS;
     }
     else if (err_code == NRF_ERROR_INVALID_LENGTH)
     {
@@ -478,16 +652,170 @@ static void app_data_process(serial_frame_t* frame)
         m_num_of_firmware_bytes_rcvd += frame_payload_len;
         
         //DSC - no response here, this seems to hang up the app_uart driver for some reason
-        put_op_response(SERIAL_OP_RECEIVE_FIRMWARE_IMAGE, SERIAL_DFU_RESP_VAL_OK_MORE_DATA_EXP);
+        m_pending_resp = SERIAL_DFU_RESP_VAL_OK_MORE_DATA_EXP;
     }
     else
     {   
-        //indicate the error
+        //indicate the error, the data wasn't taken
+        m_frame_held = false;
         serial_dfu_resp_val_t resp = nrf_err_code_translate(SERIAL_OP_RECEIVE_FIRMWARE_IMAGE,err_code);
         put_op_response(SERIAL_OP_RECEIVE_FIRMWARE_IMAGE,resp);
+        return;
+    }
+
+    /* Otherwise this is sent when the frame is released */
+    if (!m_frame_held)
+        put_pending_response();
+}
+
+/* Send a streaming ack or error for everything before m_stream_seq */
+static void stream_response(uint8_t resp_val)
+{
+    uint8_t msg[6];
+    msg[0] = SERIAL_OP_STREAM_FIRMWARE_IMAGE;
+    msg[1] = resp_val;
+    (void)uint32_encode(m_stream_seq, &msg[2]);
+    put_frame(msg, sizeof(msg));
+
+    m_stream_ack_owed = false;
+}
+
+/**@brief     Function for processing a streamed firmware data frame.
+ *
+ * @details   Frames are taken in sequence and acked in batches from
+ *            process_rx_bytes.  A damaged frame or a gap in the sequence
+ *            gets a RESEND; later frames are dropped until the host
+ *            goes back, since there is only room for one frame.
+ *
+ * @param[in] frame     Pointer to the data frame rx'd
+ */
+static void stream_data_process(serial_frame_t *frame)
+{
+    uint32_t err_code;
+    uint16_t frame_payload_len = frame->packet_len - SERIAL_FRAME_HDR_SZ;
+    uint32_t crc, seq;
+
+    if (frame_payload_len < SERIAL_STREAM_HDR_SZ)
+        return;
+    crc = uint32_decode(&frame->data[0]);
+    seq = uint32_decode(&frame->data[4]);
+
+    if (crc32_final(crc32_update(crc32_init(), &frame->data[4], frame_payload_len - 4)) != crc)
+    {
+        stream_response(SERIAL_DFU_RESP_VAL_RESEND);
+        m_stream_resend_sent = true;
+        return;
+    }
+
+    if (seq != m_stream_seq)
+    {
+        if (seq < m_stream_seq)
+        {
+            // A resent frame we already have; the host missed the ack.
+            m_stream_ack_owed = true;
+        }
+        else if (!m_stream_resend_sent)
+        {
+            // Frames were lost; ask once, the host times out otherwise.
+            stream_response(SERIAL_DFU_RESP_VAL_RESEND);
+            m_stream_resend_sent = true;
+        }
+        return;
+    }
+
+    frame_payload_len -= SERIAL_STREAM_HDR_SZ;
+    if ((frame_payload_len & (sizeof(uint32_t) - 1)) != 0)
+    {
+        // Data length is not a multiple of 4 (word size).
+        stream_response(SERIAL_DFU_RESP_VAL_NOT_SUPPORTED);
+        return;
+    }
+
+    dfu_update_packet_t dfu_pkt;
+    dfu_pkt.packet_type                      = DATA_PACKET;
+    dfu_pkt.params.data_packet.packet_length = frame_payload_len / sizeof(uint32_t);
+    dfu_pkt.params.data_packet.p_data_packet = (uint32_t*)&frame->data[SERIAL_STREAM_HDR_SZ];
+
+    /* As in app_data_process, but the ack doesn't wait for a direct
+       write: the frame's bytes are already out of the receive ring, and
+       a failed write is reported with a later ack. */
+    m_frame_held = true;
+    err_code = dfu_data_pkt_handle(&dfu_pkt);
+
+    if (err_code == NRF_SUCCESS || err_code == NRF_ERROR_INVALID_LENGTH)
+    {
+        m_num_of_firmware_bytes_rcvd += frame_payload_len;
+        m_stream_seq++;
+        m_stream_resend_sent = false;
+        m_stream_complete = (err_code == NRF_SUCCESS);
+        m_stream_ack_owed = true;
+    }
+    else
+    {
+        m_frame_held = false;
+        stream_response(nrf_err_code_translate(err_code, SERIAL_OP_STREAM_FIRMWARE_IMAGE));
     }
 }
 
+/**@brief     Function for getting the largest frame data a host may stream.
+ *
+ * @details   A host only sends a frame when its worst case, every byte
+ *            escaped, fits in the receive buffer with what is unacked, so
+ *            a frame must fit on its own.  Stream data is whole words.
+ */
+static uint16_t stream_max_frame_data(void)
+{
+    // Marker, long length byte, escaped length, then escaped op and data.
+    uint32_t overhead = 1 + 1 + 2 * 2 + 2 * 1;
+    uint32_t rx_size = rigdfu_serial_rx_size();
+    uint32_t max_data = rx_size > overhead ? (rx_size - overhead) / 2 : 0;
+
+    return MIN(SERIAL_FRAME_MAX_DATA, max_data & ~(sizeof(uint32_t) - 1));
+}
+
+/**@brief     Function for processing a resume query or request.
+ *
+ * @param[in] frame     Pointer to the frame rx'd; no data for a query,
+ *                      offset and crc32 to resume
+ */
+static void resume_process(serial_frame_t *frame)
+{
+    uint32_t err_code;
+    uint16_t frame_payload_len = frame->packet_len - SERIAL_FRAME_HDR_SZ;
+    uint32_t offset = 0;
+    uint32_t crc = 0;
+    uint8_t msg[2 + SERIAL_RESUME_DATA_SZ];
+
+    if (frame_payload_len == 0)
+    {
+        err_code = dfu_resume_offset_get(&offset, &crc);
+    }
+    else if (frame_payload_len == SERIAL_RESUME_DATA_SZ)
+    {
+        offset = uint32_decode(&frame->data[0]);
+        crc = uint32_decode(&frame->data[4]);
+        err_code = dfu_resume(offset, crc);
+        if (err_code == NRF_SUCCESS)
+        {
+            m_num_of_firmware_bytes_rcvd = offset;
+            m_stream_seq = 0;
+            m_stream_ack_owed = false;
+            m_stream_resend_sent = false;
+            m_stream_complete = false;
+        }
+    }
+    else
+    {
+        err_code = NRF_ERROR_NOT_SUPPORTED;
+    }
+
+    msg[0] = SERIAL_OP_RESUME;
+    msg[1] = nrf_err_code_translate(err_code, SERIAL_OP_RESUME);
+    (void)uint32_encode(offset, &msg[2]);
+    (void)uint32_encode(crc, &msg[6]);
+    put_frame(msg, sizeof(msg));
+}
+
 static void patch_data_process(serial_frame_t *p_frame)
 {
     volatile uint32_t err_code;
@@ -499,7 +827,7 @@ static void patch_data_process(serial_frame_t *p_frame)
     //likely just finished
     if(p_frame != NULL)
     {
-        uint8_t frame_payload_len = p_frame->packet_len - SERIAL_FRAME_HDR_SZ;
+        uint16_t frame_payload_len = p_frame->packet_len - SERIAL_FRAME_HDR_SZ;
     
         memset(&dfu_pkt, 0, sizeof(dfu_pkt));
         dfu_pkt.packet_type                      = PATCH_DATA_PACKET;
@@ -6,6 +6,18 @@
 /* pkt_len byte + op_id */
 #define SERIAL_FRAME_HDR_SZ 2
 
+/* Frames are either short or long:
+     0xAA, pkt_len, op_id, data             pkt_len = data length + 2, 2..255
+     0xAA, 0x00, len_lo, len_hi, op_id, data
+                                            16-bit length, same meaning
+   Everything after the 0xAA marker is escaped as below.  The bootloader
+   answers in the format of the request, so a host can send a long
+   PROTOCOL_VER request to find out whether long frames are supported;
+   older bootloaders ignore it.  Long frames carry up to
+   SERIAL_FRAME_MAX_DATA bytes. */
+#define SERIAL_FRAME_LONG_LEN 0x00
+#define SERIAL_FRAME_MAX_DATA 1024
+
 /* 0xAA occurs only immediately before a frame */
 #define SERIAL_FRAME_MARKER 0xAA
 
@@ -16,11 +28,43 @@
 #define SERIAL_FRAME_ESCAPE_ESCAPE 0xAB
 #define SERIAL_FRAME_ESCAPE_MARKER 0xAC
 
+/* Firmware data can also be streamed: the host keeps several
+   SERIAL_OP_STREAM_FIRMWARE_IMAGE frames outstanding instead of waiting
+   for a response to each.  Their data is
+     crc32, seq, firmware data
+   with crc32 (little-endian, as lib/utils/crc32) over seq and the
+   firmware data, and seq (32-bit little-endian) counting frames from 0
+   after SERIAL_OP_START_DFU.  Frames are only taken in order.  Responses
+   are op, resp_val, next seq (32-bit little-endian):
+     OK_MORE_DATA_EXP, SUCCESS  cumulative ack of all frames before seq
+     RESEND                     frame seq is missing or damaged; frames
+                                after it were dropped, resend from seq
+     other                      the update failed
+   Acks are coalesced.  A host must not have more than the receive
+   buffer size, from SERIAL_OP_STREAM_INFO, of unacked frame bytes on
+   the wire, counting the marker, length and escapes.  It should resend
+   from the last ack if nothing arrives for a while.  Older bootloaders
+   don't answer SERIAL_OP_STREAM_INFO; use SERIAL_OP_RECEIVE_FIRMWARE_IMAGE
+   with them. */
+#define SERIAL_STREAM_HDR_SZ 8
+
+/* An interrupted transfer into bank 1 can be resumed.  After
+   SERIAL_OP_START_DFU and SERIAL_OP_INITIALIZE_DFU, with the same data
+   as before, send SERIAL_OP_RESUME with no data.  The response is
+     op, resp_val, offset, crc32      (32-bit little-endian)
+   where crc32 covers the image data before offset, as sent.  Offset 0
+   means start from the beginning.  If crc32 matches the host's image,
+   send SERIAL_OP_RESUME again with offset, crc32 as its data; the
+   response is the same, and on SUCCESS data continues from offset.
+   Streamed frames count seq from 0 again.  Older bootloaders don't
+   answer SERIAL_OP_RESUME. */
+#define SERIAL_RESUME_DATA_SZ 8
+
 typedef struct serial_frame {
-    uint8_t pad[2];
-    uint8_t packet_len;    /* Total packet length, including this byte */
+    uint16_t packet_len;   /* Data length + SERIAL_FRAME_HDR_SZ */
     uint8_t opcode;        /* Opcode, from SERIAL_OP constants below */
-    uint8_t data[253];     /* Data, up to 253 bytes */
+    uint8_t long_len;      /* Received as a long frame */
+    uint8_t data[SERIAL_FRAME_MAX_DATA];  /* Data, word aligned */
 } serial_frame_t __attribute__((aligned(4)));
 
 
@@ -36,6 +80,9 @@ typedef enum
     SERIAL_OP_INITIALIZE_PATCH = 10,
     SERIAL_OP_RECEIVE_PATCH_IMAGE = 11,
     SERIAL_OP_PROTOCOL_VER = 12,
+    SERIAL_OP_STREAM_FIRMWARE_IMAGE = 13,
+    SERIAL_OP_STREAM_INFO = 14,       /* Response: op, SUCCESS, rx buffer size, max frame data (16-bit LE); a frame of max data fits the buffer escaped */
+    SERIAL_OP_RESUME = 15,
     SERIAL_OP_RESPONSE = 16,
 } serial_dfu_op_t;
 
@@ -50,6 +97,7 @@ typedef enum
     SERIAL_DFU_RESP_VAL_CRC_ERROR,                                         /**< CRC Error.*/
     SERIAL_DFU_RESP_VAL_OPER_FAILED,                                        /**< Operation failed.*/
     SERIAL_DFU_RESP_VAL_OK_MORE_DATA_EXP,
+    SERIAL_DFU_RESP_VAL_RESEND,                                            /**< Streamed frame missing, resend from seq.*/
 } serial_dfu_resp_val_t;
 
 
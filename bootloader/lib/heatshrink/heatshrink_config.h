@@ -12,7 +12,7 @@
     #define HEATSHRINK_FREE(P, SZ) free(P)
 #else
     /* Required parameters for static configuration */
-    #define HEATSHRINK_STATIC_INPUT_BUFFER_SIZE 200
+    #define HEATSHRINK_STATIC_INPUT_BUFFER_SIZE 256   /* >= largest patch packet */
     #define HEATSHRINK_STATIC_WINDOW_BITS 10
     #define HEATSHRINK_STATIC_LOOKAHEAD_BITS 8
 #endif
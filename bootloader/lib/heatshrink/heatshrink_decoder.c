@@ -84,7 +84,7 @@ void heatshrink_decoder_reset(heatshrink_decoder *hsd) {
     hsd->state = HSDS_TAG_BIT;
     hsd->input_size = 0;
     hsd->input_index = 0;
-    hsd->bit_index = 0x00;
+    hsd->bit_index = 0;
     hsd->current_byte = 0x00;
     hsd->output_count = 0;
     hsd->output_index = 0;
@@ -277,7 +277,23 @@ static HSD_state st_yield_backref(heatshrink_decoder *hsd,
         ASSERT(neg_offset < mask + 1);
         ASSERT(count <= (size_t)(1 << BACKREF_COUNT_BITS(hsd)));
 
-        for (i=0; i<count; i++) {
+        /* Block copy when the reference doesn't repeat itself and neither
+         * range wraps around the end of the window. Anything it would
+         * overwrite is only read after being copied out, same as the
+         * byte loop below. */
+        uint16_t src = (hsd->head_index - neg_offset) & mask;
+        uint16_t dst = hsd->head_index & mask;
+        if ((count <= neg_offset) &&
+            (src + count <= (size_t)mask + 1) &&
+            (dst + count <= (size_t)mask + 1)) {
+            memcpy(&oi->buf[*oi->output_size], &buf[src], count);
+            memmove(&buf[dst], &buf[src], count);
+            *oi->output_size += count;
+            hsd->head_index += count;
+            i = count;
+        }
+
+        for (; i<count; i++) {
             uint8_t c = buf[(hsd->head_index - neg_offset) & mask];
             push_byte(hsd, oi, c);
             buf[hsd->head_index & mask] = c;
@@ -291,52 +307,40 @@ static HSD_state st_yield_backref(heatshrink_decoder *hsd,
 }
 
 /* Get the next COUNT bits from the input buffer, saving incremental progress.
+ * Bits are taken a whole byte at a time; current_byte holds the bit_index
+ * bits of the last byte that haven't been used yet.
  * Returns NO_BITS on end of input, or if more than 15 bits are requested. */
 static uint16_t get_bits(heatshrink_decoder *hsd, uint8_t count) {
-    uint16_t accumulator = 0;
-    int i = 0;
+    uint32_t accumulator;
+    uint8_t bits_left = hsd->bit_index;
     if (count > 15) { return NO_BITS; }
     LOG("-- popping %u bit(s)\n", count);
 
     /* If we aren't able to get COUNT bits, suspend immediately, because we
      * don't track how many bits of COUNT we've accumulated before suspend. */
-    if (hsd->input_size == 0) {
-        if (hsd->bit_index < (1 << (count - 1))) { return NO_BITS; }
+    if (bits_left + 8 * (uint32_t)(hsd->input_size - hsd->input_index) < count) {
+        return NO_BITS;
     }
 
-    for (i = 0; i < count; i++) {
-        if (hsd->bit_index == 0x00) {
-            if (hsd->input_size == 0) {
-                LOG("  -- out of bits, suspending w/ accumulator of %u (0x%02x)\n",
-                    accumulator, accumulator);
-                return NO_BITS;
-            }
-            hsd->current_byte = hsd->buffers[hsd->input_index++];
-            LOG("  -- pulled byte 0x%02x\n", hsd->current_byte);
-            if (hsd->input_index == hsd->input_size) {
-                hsd->input_index = 0; /* input is exhausted */
-                hsd->input_size = 0;
-            }
-            hsd->bit_index = 0x80;
+    accumulator = hsd->current_byte & ((1 << bits_left) - 1);
+    while (bits_left < count) {
+        accumulator = (accumulator << 8) | hsd->buffers[hsd->input_index++];
+        LOG("  -- pulled byte 0x%02x\n", hsd->buffers[hsd->input_index - 1]);
+        if (hsd->input_index == hsd->input_size) {
+            hsd->input_index = 0; /* input is exhausted */
+            hsd->input_size = 0;
         }
-        accumulator <<= 1;
-        if (hsd->current_byte & hsd->bit_index) {
-            accumulator |= 0x01;
-            if (0) {
-                LOG("  -- got 1, accumulator 0x%04x, bit_index 0x%02x\n",
-                accumulator, hsd->bit_index);
-            }
-        } else {
-            if (0) {
-                LOG("  -- got 0, accumulator 0x%04x, bit_index 0x%02x\n",
-                accumulator, hsd->bit_index);
-            }
-        }
-        hsd->bit_index >>= 1;
+        bits_left += 8;
     }
 
+    /* Keep the unused low bits for next time */
+    bits_left -= count;
+    hsd->current_byte = (uint8_t)accumulator;
+    hsd->bit_index = bits_left;
+    accumulator >>= bits_left;
+
     if (count > 1) { LOG("  -- accumulated %08x\n", accumulator); }
-    return accumulator;
+    return (uint16_t)(accumulator & ((1 << count) - 1));
 }
 
 HSD_finish_res heatshrink_decoder_finish(heatshrink_decoder *hsd) {
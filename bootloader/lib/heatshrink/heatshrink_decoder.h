@@ -49,7 +49,7 @@ typedef struct {
     uint16_t head_index;        /* head of window buffer */
     uint8_t state;              /* current state machine node */
     uint8_t current_byte;       /* current byte of input */
-    uint8_t bit_index;          /* current bit index */
+    uint8_t bit_index;          /* unused bits left in current_byte */
 
 #if HEATSHRINK_DYNAMIC_ALLOC
     /* Fields that are only used if dynamically allocated. */
@@ -26,9 +26,21 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include "bspatch.h"
 #include "heatshrink_decoder.h"
 
+#if defined(__ARM_FEATURE_DSP) && (__ARM_FEATURE_DSP == 1)
+#include "nrf.h"
+/* Four independent byte adds in one instruction (Cortex-M4) */
+#define ADD8(a, b)      __UADD8((a), (b))
+#else
+/* Four independent byte adds: add the low 7 bits of each byte, then fix up
+   the top bits without letting the carry cross into the next byte */
+#define ADD8(a, b)      ((((a) & 0x7F7F7F7FUL) + ((b) & 0x7F7F7F7FUL)) ^ \
+                         (((a) ^ (b)) & 0x80808080UL))
+#endif
+
 #define BSPATCH_CTRL_CNT			3
 
 #define BSPATCH_STATE_IDLE			0
@@ -70,6 +82,36 @@ static int64_t offtin(uint8_t *buf)
 	return y;
 }
 
+/* new[i] += old[i] for len bytes, modulo 256 */
+static void add_old(uint8_t * new_data, const uint8_t * old_data, uint32_t len)
+{
+	uint32_t a;
+	uint32_t b;
+
+	/* Byte adds until the new buffer is word aligned */
+	for( ; len > 0 && ((uintptr_t)new_data & 3); len--)
+	{
+		*new_data++ += *old_data++;
+	}
+
+	/* The old image has no particular alignment relative to new, so load
+	   it with memcpy; that is a single LDR on cores that allow unaligned
+	   access and byte loads elsewhere */
+	for( ; len >= 4; len -= 4)
+	{
+		a = *(uint32_t *)new_data;
+		memcpy(&b, old_data, sizeof(b));
+		*(uint32_t *)new_data = ADD8(a, b);
+		new_data += 4;
+		old_data += 4;
+	}
+
+	for( ; len > 0; len--)
+	{
+		*new_data++ += *old_data++;
+	}
+}
+
 void bspatch_init(const uint8_t* old, int32_t oldsize, uint8_t* new_buf, int32_t newsize, int32_t new_buf_size)
 {
 	m_newsize = newsize;
@@ -94,10 +136,19 @@ uint32_t bspatch_get_total_received(void)
 
 int32_t bspatch(struct bspatch_stream* stream)
 {
-	int64_t i;
 	int64_t op_bytes;
 	int32_t res;
 
+	/* Output buffer was handed to flash, wait for one to free up */
+	if(m_new_ptr == NULL && m_total_new < m_newsize)
+	{
+		m_new_ptr = stream->next_buf(stream);
+		if(m_new_ptr == NULL)
+		{
+			return BSPATCH_RES_FLASHING;
+		}
+	}
+
 	while(m_total_new < m_newsize) 
 	{
 		switch(m_patch_state)
@@ -165,14 +216,22 @@ int32_t bspatch(struct bspatch_stream* stream)
 					}
 
 
-					for(i = 0; i < op_bytes; i++) 
+					/* Only the part overlapping the old image gets old bytes added */
 					{
-						if((m_oldpos + i >= 0) && (m_oldpos + i < m_oldsize)) 
+						int64_t add_start = (m_oldpos < 0) ? -m_oldpos : 0;
+						int64_t add_end = m_oldsize - m_oldpos;
+
+						if(add_end > op_bytes)
+						{
+							add_end = op_bytes;
+						}
+
+						if(add_start < add_end)
 						{
-							m_new_ptr[m_newpos + i] += m_old_ptr[m_oldpos + i];
+							add_old(m_new_ptr + m_newpos + add_start, m_old_ptr + m_oldpos + add_start,
+								(uint32_t)(add_end - add_start));
 						}
 					}
-					//printf("copied\n");
 
 					m_newpos += op_bytes;
 					m_total_new += op_bytes;
@@ -181,11 +240,18 @@ int32_t bspatch(struct bspatch_stream* stream)
 
 					if(m_newpos == m_new_buf_size)
 					{
-						//TODO: If patching needs to wait on storage to be complete, return
-                        //appropriate status
-                        status = BSPATCH_RES_FLASHING;
-						stream->store_data(m_new_ptr, m_new_buf_size);
+						if(stream->store_data(m_new_ptr, m_new_buf_size) != 0)
+						{
+							return BSPATCH_RES_ERROR;
+						}
 						m_newpos = 0;
+						
+						/* keep patching into the other buffer while this one is flashed */
+						m_new_ptr = stream->next_buf(stream);
+						if(m_new_ptr == NULL && status == 0)
+						{
+							status = BSPATCH_RES_FLASHING;
+						}
 					}
 
 					//printf("np: %d     op: %d\n", m_newpos, m_oldpos);
@@ -237,12 +303,17 @@ int32_t bspatch(struct bspatch_stream* stream)
 					if(m_newpos == m_new_buf_size)
 					{
 						//write data to flash
-						//printf("write in new\n");
-                        //TODO: If patching needs to wait on storage to be complete, return
-                        //appropriate status
-                        status = BSPATCH_RES_FLASHING;
-						stream->store_data(m_new_ptr, m_new_buf_size);
+						if(stream->store_data(m_new_ptr, m_new_buf_size) != 0)
+						{
+							return BSPATCH_RES_ERROR;
+						}
 						m_newpos = 0;
+						
+						m_new_ptr = stream->next_buf(stream);
+						if(m_new_ptr == NULL && status == 0)
+						{
+							status = BSPATCH_RES_FLASHING;
+						}
 					}
 
 					m_total_new += op_bytes;
@@ -276,11 +347,14 @@ int32_t bspatch(struct bspatch_stream* stream)
 
 	//write final data if any
 	//note, control flow should never reach this point unless the patch is complete
+	//the caller is responsible for waiting until the stores have finished
 	if(m_newpos != 0) 
 	{
-		stream->store_data(m_new_ptr, m_newpos);
+		if(stream->store_data(m_new_ptr, m_newpos) != 0)
+		{
+			return BSPATCH_RES_ERROR;
+		}
 		m_newpos = 0;
-        return BSPATCH_RES_FLASHING;
 	}
 
 	return BSPATCH_RES_FINISHED;
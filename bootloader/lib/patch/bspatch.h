@@ -42,6 +42,10 @@ struct bspatch_stream
 	void* opaque;
 	int32_t (*read)(const struct bspatch_stream* stream, void* buffer, uint32_t length);
     store_data_fptr store_data;
+    /* Returns the next output buffer once the previous one was stored, or
+       NULL if none is free yet. bspatch then returns BSPATCH_RES_FLASHING
+       and asks again on the next call. */
+    uint8_t* (*next_buf)(const struct bspatch_stream* stream);
     int64_t ctrl[3];
 	int32_t ctrl_cnt;
 };
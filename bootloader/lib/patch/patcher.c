@@ -3,12 +3,25 @@
 #include "heatshrink_decoder.h"
 
 #include "patcher.h"
+#include "dfu_profile.h"
+
+/* The output buffer is split in two: bspatch fills one while the other
+   is being written to flash. */
+#define PATCHER_OUT_BUF_CNT     2
 
 static heatshrink_decoder m_decoder;
 static struct bspatch_stream m_stream;
 size_t total_sunk_cnt = 0;
 
+static uint8_t * m_out_buf[PATCHER_OUT_BUF_CNT];
+static uint8_t m_out_next;
+static uint8_t m_out_in_flight;
+static bool m_waiting_on_flash;
+static store_data_fptr m_store_func;
+
 static int heatshrink_read(const struct bspatch_stream* stream, void* buffer, uint32_t length);
+static uint32_t store_out_buf(uint8_t * data, uint32_t len);
+static uint8_t * next_out_buf(const struct bspatch_stream* stream);
 
 int32_t patcher_init(patch_init_t * init_data) 
 {
@@ -18,12 +31,22 @@ int32_t patcher_init(patch_init_t * init_data)
     if(init_data->new_buf_ptr == NULL || init_data->old_ptr == NULL)
         return PATCHER_FAIL;
     
+    /* halves must stay word aligned for flash writes */
+    uint32_t out_buf_size = (init_data->new_buf_size / PATCHER_OUT_BUF_CNT) & ~3UL;
+    m_out_buf[0] = init_data->new_buf_ptr;
+    m_out_buf[1] = init_data->new_buf_ptr + out_buf_size;
+    m_out_next = 1;
+    m_out_in_flight = 0;
+    m_waiting_on_flash = false;
+    m_store_func = init_data->store_func;
+    
     heatshrink_decoder_reset(&m_decoder);
-    bspatch_init(init_data->old_ptr, init_data->old_size, init_data->new_buf_ptr, init_data->new_size, init_data->new_buf_size);
+    bspatch_init(init_data->old_ptr, init_data->old_size, m_out_buf[0], init_data->new_size, out_buf_size);
     
     memset(&m_stream, 0, sizeof(m_stream));
     m_stream.read = heatshrink_read;
-    m_stream.store_data = init_data->store_func;
+    m_stream.store_data = store_out_buf;
+    m_stream.next_buf = next_out_buf;
     total_sunk_cnt = 0;
     
     return PATCHER_SUCCESS;
@@ -32,13 +55,17 @@ int32_t patcher_init(patch_init_t * init_data)
 int32_t patcher_add_data(uint8_t * data, uint32_t len)
 {
     size_t sunk_cnt;
-    HSD_sink_res status = heatshrink_decoder_sink(&m_decoder, data, len, &sunk_cnt);
-    total_sunk_cnt += sunk_cnt;
-    if(status == HSDR_SINK_FULL)
+    HSD_sink_res status;
+    
+    /* A packet is taken whole or not at all; a partial sink would drop the rest */
+    if(len > HEATSHRINK_DECODER_INPUT_BUFFER_SIZE(&m_decoder) - m_decoder.input_size)
     {
         return PATCHER_INPUT_FULL;
-    } 
-    else if(status < HSDR_SINK_OK) 
+    }
+    
+    status = heatshrink_decoder_sink(&m_decoder, data, len, &sunk_cnt);
+    total_sunk_cnt += sunk_cnt;
+    if(status < HSDR_SINK_OK) 
     {
         return PATCHER_FAIL;
     }
@@ -51,7 +78,9 @@ int32_t patcher_patch(void)
     int32_t status = BSPATCH_RES_NEED_MORE;
     while(status != BSPATCH_RES_FINISHED)
     {
+        DFU_PROFILE_START(start);
         status = bspatch(&m_stream);
+        DFU_PROFILE_STOP(DFU_STAGE_PATCH, start);
         
         if(status == BSPATCH_RES_NEED_MORE)
         {
@@ -63,13 +92,37 @@ int32_t patcher_patch(void)
         }
         else if(status == BSPATCH_RES_FLASHING)
         {
+            m_waiting_on_flash = true;
             return PATCHER_FLASHING;
         }
     }
     
+    /* Not complete until the last buffers have made it to flash */
+    if(m_out_in_flight != 0)
+    {
+        m_waiting_on_flash = true;
+        return PATCHER_FLASHING;
+    }
+    
     return PATCHER_COMPLETE;
 }
 
+bool patcher_store_complete(void)
+{
+    if(m_out_in_flight > 0)
+    {
+        m_out_in_flight--;
+    }
+    
+    if(m_waiting_on_flash)
+    {
+        m_waiting_on_flash = false;
+        return true;
+    }
+    
+    return false;
+}
+
 uint32_t patcher_get_bytes_received(void)
 {
     return bspatch_get_total_received();
@@ -78,10 +131,40 @@ uint32_t patcher_get_bytes_received(void)
 static int32_t heatshrink_read(const struct bspatch_stream* stream, void* buffer, uint32_t length) 
 {
 	size_t bytes_out = 0;
+	DFU_PROFILE_START(start);
 	HSD_poll_res status = heatshrink_decoder_poll(&m_decoder, buffer, length, &bytes_out);
+	DFU_PROFILE_STOP(DFU_STAGE_DECOMPRESS, start);
 	if(status < 0) {
 		return -1;
 	}
 
 	return bytes_out;
 }
+
+static uint32_t store_out_buf(uint8_t * data, uint32_t len)
+{
+    uint32_t err_code = m_store_func(data, len);
+    if(err_code == 0)
+    {
+        m_out_in_flight++;
+    }
+    
+    return err_code;
+}
+
+/* Stores complete in order, so the next buffer is free as long as not
+   every buffer is in flight */
+static uint8_t * next_out_buf(const struct bspatch_stream* stream)
+{
+    uint8_t * buf;
+    
+    if(m_out_in_flight >= PATCHER_OUT_BUF_CNT)
+    {
+        return NULL;
+    }
+    
+    buf = m_out_buf[m_out_next];
+    m_out_next = (m_out_next + 1) % PATCHER_OUT_BUF_CNT;
+    
+    return buf;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include "bspatch.h"
 
 #define PATCHER_COMPLETE    4
@@ -25,4 +26,8 @@ int32_t patcher_init(patch_init_t * init_data);
 int32_t patcher_add_data(uint8_t * data, uint32_t length);
 uint32_t patcher_get_bytes_received(void);
 int32_t patcher_patch(void);
+
+/* Call when a store issued through store_func has finished.  Returns true
+   if patcher_patch returned PATCHER_FLASHING and should be called again. */
+bool patcher_store_complete(void);
 #endif
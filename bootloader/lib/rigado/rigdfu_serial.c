@@ -1,6 +1,7 @@
 #include <nrf.h>
 #include <nrf_gpio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "boards.h"
 #include "rigdfu_serial.h"
@@ -8,6 +9,12 @@
 #include "simple_uart.h"
 #include "app_util_platform.h"
 #include "app_scheduler.h"
+#include "app_util.h"
+#ifdef NRF52
+    #include "nrf_soc.h"
+    #include "nrf_delay.h"
+    #include "app_error.h"
+#endif
 
 /* This serial driver is used for two things:
    (1) initial detection of whether to enter DFU mode
@@ -18,16 +25,140 @@ static bool m_open = false;
 static rigdfu_serial_rx_handler_t m_uart_rx_handler = NULL;
 static volatile bool m_tx_pending = false;
 
+/* For the DFU, received bytes go to a ring that the transport reads in
+   place.  The indices run freely and are masked on access; m_rx_head is
+   only written by the producer and m_rx_tail only by the consumer.  On
+   nRF51 the producer is the RXDRDY interrupt.  On nRF52 the UARTE
+   writes the ring by EasyDMA, one half at a time, and the head is a
+   TIMER counting RXDRDY over PPI, so there is no per-byte interrupt.
+   RXDRDY comes when a byte is received, before EasyDMA has written it,
+   so rx_head holds back the newest byte counted, see there. */
+#define RX_RING_SIZE            RIGDFU_SERIAL_RX_SIZE
+#ifdef NRF52
+#define RX_DMA_SIZE             (RX_RING_SIZE / 2)
+#define RX_COUNT_TIMER          NRF_TIMER1
+#define RX_PPI_CH               0
+/* EasyDMA writes a byte a few bus cycles after its RXDRDY, more if the
+   radio's DMA holds the bus; this is well past either */
+#define RX_DMA_SETTLE_US        1
+#endif
+STATIC_ASSERT((RX_RING_SIZE & (RX_RING_SIZE - 1)) == 0);
+
+static uint8_t m_rx_ring[RX_RING_SIZE] __attribute__((aligned(4)));
+static volatile uint32_t m_rx_tail;
+static volatile bool m_rx_overrun;
+static volatile bool m_rx_notify_armed;
+static rigdfu_serial_rx_notify_t m_rx_notify = NULL;
+#ifdef NRF52
+static bool m_rx_dma = false;
+static uint8_t m_rx_dma_next;       /* ring half to queue on RXSTARTED */
+static uint32_t m_rx_counted;       /* count at the last look */
+#else
+static volatile uint32_t m_rx_head;
+#endif
+
+static void rx_notify(void)
+{
+    if (m_rx_notify_armed && m_rx_notify != NULL) {
+        m_rx_notify_armed = false;
+        m_rx_notify();
+    }
+}
+
+#ifdef NRF52
+static void uarte_irq(void)
+{
+    if (NRF_UARTE0->EVENTS_RXSTARTED) {
+        NRF_UARTE0->EVENTS_RXSTARTED = 0;
+        /* Picked up by the ENDRX_STARTRX short when this half is full */
+        NRF_UARTE0->RXD.PTR = (uint32_t)&m_rx_ring[m_rx_dma_next * RX_DMA_SIZE];
+        m_rx_dma_next ^= 1;
+    }
+
+    /* Only enabled while the transport waits for data; see rx_notify_arm */
+    if (NRF_UARTE0->EVENTS_RXDRDY &&
+        (NRF_UARTE0->INTENSET & UARTE_INTENSET_RXDRDY_Msk)) {
+        NRF_UARTE0->EVENTS_RXDRDY = 0;
+        NRF_UARTE0->INTENCLR = UARTE_INTENSET_RXDRDY_Msk;
+        rx_notify();
+    }
+
+    if (NRF_UARTE0->EVENTS_ERROR) {
+        NRF_UARTE0->EVENTS_ERROR = 0;
+        NRF_UARTE0->ERRORSRC = NRF_UARTE0->ERRORSRC;
+    }
+}
+#endif
+
+/* The bytes before the head are in the ring.  On nRF52 the newest byte
+   counted is only taken once a later look has seen the same count, or
+   with settle, after waiting RX_DMA_SETTLE_US for its write; the bytes
+   before it were written before it was received. */
+static uint32_t rx_head(bool settle)
+{
+#ifdef NRF52
+    uint32_t count;
+
+    RX_COUNT_TIMER->TASKS_CAPTURE[0] = 1;
+    count = RX_COUNT_TIMER->CC[0];
+    if (count == m_rx_counted)
+        return count;
+    if (settle) {
+        nrf_delay_us(RX_DMA_SETTLE_US);
+        m_rx_counted = count;
+        return count;
+    }
+    m_rx_counted = count;
+    return count - 1;
+#else
+    return m_rx_head;
+#endif
+}
+
+static void rx_notify_arm(void)
+{
+    m_rx_notify_armed = true;
+#ifdef NRF52
+    /* Bytes counted before this point are picked up by the caller's
+       second look at rx_head(); later ones raise the interrupt. */
+    NRF_UARTE0->EVENTS_RXDRDY = 0;
+    NRF_UARTE0->INTENSET = UARTE_INTENSET_RXDRDY_Msk;
+#endif
+}
+
 void UART0_IRQHandler(void)
 {
+#ifdef NRF52
+    if (m_rx_dma) {
+        uarte_irq();
+        NVIC_ClearPendingIRQ(UART0_IRQn);
+        return;
+    }
+#endif
+
     if(NRF_UART0->EVENTS_RXDRDY == 1)
     {
+        NRF_UART0->EVENTS_RXDRDY = 0;
+
         if(m_uart_rx_handler != NULL)
             m_uart_rx_handler(NRF_UART0->RXD);
+#ifndef NRF52
+        else if(m_rx_notify != NULL)
+        {
+            uint32_t head = m_rx_head;
+            uint8_t x = NRF_UART0->RXD;
+
+            if (head - m_rx_tail < RX_RING_SIZE) {
+                m_rx_ring[head & (RX_RING_SIZE - 1)] = x;
+                m_rx_head = head + 1;
+            } else {
+                m_rx_overrun = true;
+            }
+            rx_notify();
+        }
+#endif
         else
             (void)NRF_UART0->RXD;
-        
-        NRF_UART0->EVENTS_RXDRDY = 0;
     }
     
     if(NRF_UART0->EVENTS_ERROR == 1)
@@ -41,6 +172,68 @@ void UART0_IRQHandler(void)
 }
 
 
+#ifdef NRF52
+/* Switch the UART, already configured by simple_uart_init, to UARTE
+   and start receiving into the ring. */
+static void uarte_rx_dma_start(void)
+{
+    uint32_t err_code;
+
+    NRF_UART0->TASKS_STOPRX = 1;
+    NRF_UART0->ENABLE = (UART_ENABLE_ENABLE_Disabled << UART_ENABLE_ENABLE_Pos);
+
+    /* simple_uart only drives TX while sending; UARTE owns the pin */
+    nrf_gpio_pin_set(TX_PIN_NUMBER);
+    nrf_gpio_cfg_output(TX_PIN_NUMBER);
+
+    RX_COUNT_TIMER->TASKS_STOP = 1;
+    RX_COUNT_TIMER->MODE = (TIMER_MODE_MODE_Counter << TIMER_MODE_MODE_Pos);
+    RX_COUNT_TIMER->BITMODE = (TIMER_BITMODE_BITMODE_32Bit << TIMER_BITMODE_BITMODE_Pos);
+    RX_COUNT_TIMER->TASKS_CLEAR = 1;
+    RX_COUNT_TIMER->TASKS_START = 1;
+    m_rx_counted = 0;
+
+    /* Without the channel the head never moves, and the DFU would wait
+       for bytes that have long arrived */
+    err_code = sd_ppi_channel_assign(RX_PPI_CH, &NRF_UARTE0->EVENTS_RXDRDY,
+                                     &RX_COUNT_TIMER->TASKS_COUNT);
+    APP_ERROR_CHECK(err_code);
+    err_code = sd_ppi_channel_enable_set(1UL << RX_PPI_CH);
+    APP_ERROR_CHECK(err_code);
+
+    m_rx_dma = true;
+    m_rx_dma_next = 1;
+    NRF_UARTE0->ENABLE = (UARTE_ENABLE_ENABLE_Enabled << UARTE_ENABLE_ENABLE_Pos);
+    NRF_UARTE0->RXD.PTR = (uint32_t)&m_rx_ring[0];
+    NRF_UARTE0->RXD.MAXCNT = RX_DMA_SIZE;
+    NRF_UARTE0->SHORTS = UARTE_SHORTS_ENDRX_STARTRX_Msk;
+    NRF_UARTE0->EVENTS_RXSTARTED = 0;
+    NRF_UARTE0->EVENTS_RXDRDY = 0;
+    NRF_UARTE0->EVENTS_ERROR = 0;
+    NRF_UARTE0->INTENSET = UARTE_INTENSET_RXSTARTED_Msk | UARTE_INTENSET_ERROR_Msk;
+    NRF_UARTE0->TASKS_STARTRX = 1;
+}
+
+static void uarte_rx_dma_stop(void)
+{
+    if (!m_rx_dma)
+        return;
+
+    NRF_UARTE0->INTENCLR = 0xffffffff;
+    NRF_UARTE0->SHORTS = 0;
+    NRF_UARTE0->EVENTS_RXTO = 0;
+    NRF_UARTE0->TASKS_STOPRX = 1;
+    while (NRF_UARTE0->EVENTS_RXTO == 0)
+        continue;
+    NRF_UARTE0->TASKS_STOPTX = 1;
+    NRF_UARTE0->ENABLE = (UARTE_ENABLE_ENABLE_Disabled << UARTE_ENABLE_ENABLE_Pos);
+
+    APP_ERROR_CHECK(sd_ppi_channel_enable_clr(1UL << RX_PPI_CH));
+    RX_COUNT_TIMER->TASKS_STOP = 1;
+    m_rx_dma = false;
+}
+#endif
+
 /* Initialize UART for the initial host detection. */
 void rigdfu_serial_init(bool force_init)
 {
@@ -106,6 +299,10 @@ void rigdfu_serial_reinit_dfu(void)
     m_open = true;
     m_tx_pending = false;
     m_uart_rx_handler = NULL;
+    m_rx_notify = NULL;
+    m_rx_notify_armed = false;
+    m_rx_overrun = false;
+    m_rx_tail = 0;
 
     simple_uart_config_t config;
     config.rx_pin   = RX_PIN_NUMBER;
@@ -116,9 +313,15 @@ void rigdfu_serial_reinit_dfu(void)
     config.baud_enum = UART_BAUDRATE_BAUDRATE_Baud115200;
     simple_uart_init(&config);
     
+#ifdef NRF52
+    uarte_rx_dma_start();
+#else
+    m_rx_head = 0;
+
     //setup interrupt
     NRF_UART0->INTENSET = (UART_INTENSET_RXDRDY_Set << UART_INTENSET_RXDRDY_Pos);
     NRF_UART0->INTENSET = (UART_INTENSET_ERROR_Set << UART_INTENSET_ERROR_Pos);
+#endif
     
     NVIC_ClearPendingIRQ(UART0_IRQn);
     NVIC_SetPriority(UART0_IRQn, APP_IRQ_PRIORITY_HIGH);
@@ -148,11 +351,16 @@ void rigdfu_serial_close(void)
     NVIC_DisableIRQ(UART0_IRQn);
     NVIC_ClearPendingIRQ(UART0_IRQn);
     
+#ifdef NRF52
+    uarte_rx_dma_stop();
+#endif
+
     //deinit peripheral/gpio
     simple_uart_deinit();
     
     //cleanup handles
     m_uart_rx_handler = NULL;
+    m_rx_notify = NULL;
     m_open = false;
 }
 
@@ -162,10 +370,93 @@ void rigdfu_serial_set_rx_handler(rigdfu_serial_rx_handler_t handler)
     m_uart_rx_handler = handler;
 }
 
+/* Set the function to call when bytes arrive for the DFU */
+void rigdfu_serial_set_rx_notify(rigdfu_serial_rx_notify_t notify)
+{
+    m_rx_notify = notify;
+    rx_notify_arm();
+}
+
+/* Get the next contiguous span of received bytes */
+uint32_t rigdfu_serial_rx_span(const uint8_t ** pp_data)
+{
+    uint32_t avail = rx_head(false) - m_rx_tail;
+
+    if (avail == 0) {
+        /* A byte held back may be the last to come, so this look waits
+           for it; any counted after it raise the notify */
+        rx_notify_arm();
+        avail = rx_head(true) - m_rx_tail;
+        if (avail == 0)
+            return 0;
+    }
+
+    if (avail > RX_RING_SIZE) {
+        /* The DMA has lapped us; what is in the ring is a mix of old
+           and new data, so drop it all */
+        m_rx_tail += avail;
+        m_rx_overrun = true;
+        return 0;
+    }
+
+    uint32_t offset = m_rx_tail & (RX_RING_SIZE - 1);
+    *pp_data = &m_rx_ring[offset];
+    return MIN(avail, RX_RING_SIZE - offset);
+}
+
+/* Consume bytes returned by rigdfu_serial_rx_span */
+void rigdfu_serial_rx_release(uint32_t len)
+{
+    m_rx_tail += len;
+}
+
+/* Check, and clear, the lost data flag */
+bool rigdfu_serial_rx_overrun(void)
+{
+    bool overrun = m_rx_overrun;
+    m_rx_overrun = false;
+    return overrun;
+}
+
+/* Size of the receive ring */
+uint32_t rigdfu_serial_rx_size(void)
+{
+    return RX_RING_SIZE;
+}
+
 /* Send byte to the UART */
 void rigdfu_serial_put(uint8_t x)
 {    
-    simple_uart_put(x);
+    rigdfu_serial_write(&x, 1);
+}
+
+/* Send bytes to the UART */
+void rigdfu_serial_write(const uint8_t * p_data, uint32_t len)
+{
+#ifdef NRF52
+    if (m_rx_dma) {
+        /* EasyDMA can only read RAM, so go through a RAM buffer */
+        static uint8_t tx_buf[32];
+
+        while (len) {
+            uint32_t n = MIN(len, sizeof(tx_buf));
+            memcpy(tx_buf, p_data, n);
+            NRF_UARTE0->TXD.PTR = (uint32_t)tx_buf;
+            NRF_UARTE0->TXD.MAXCNT = n;
+            NRF_UARTE0->EVENTS_ENDTX = 0;
+            NRF_UARTE0->TASKS_STARTTX = 1;
+            while (NRF_UARTE0->EVENTS_ENDTX == 0)
+                continue;
+            NRF_UARTE0->EVENTS_ENDTX = 0;
+            p_data += n;
+            len -= n;
+        }
+        NRF_UARTE0->TASKS_STOPTX = 1;
+        return;
+    }
+#endif
+    while (len--)
+        simple_uart_put(*p_data++);
 }
 
 /* Send string */
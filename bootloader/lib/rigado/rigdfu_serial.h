@@ -5,7 +5,15 @@
 #include <stdbool.h>
 #include "app_scheduler.h"
 
+/* Size of the DFU receive ring; see rigdfu_serial_rx_size */
+#ifdef NRF52
+#define RIGDFU_SERIAL_RX_SIZE   4096
+#else
+#define RIGDFU_SERIAL_RX_SIZE   512
+#endif
+
 typedef void (*rigdfu_serial_rx_handler_t)(uint8_t x);
+typedef void (*rigdfu_serial_rx_notify_t)(void);
 
 /* Initialize UART for the initial host detection. */
 void rigdfu_serial_init(bool force_init);
@@ -20,9 +28,32 @@ void rigdfu_serial_close(void);
 /* Set the UART RX handler */
 void rigdfu_serial_set_rx_handler(rigdfu_serial_rx_handler_t handler);
 
+/* After rigdfu_serial_reinit_dfu, received bytes are buffered in a ring
+   (written by EasyDMA on nRF52) and read in place with the calls below.
+   The notify function is called from interrupt context when bytes
+   arrive after rigdfu_serial_rx_span has returned 0. */
+void rigdfu_serial_set_rx_notify(rigdfu_serial_rx_notify_t notify);
+
+/* Point *pp_data at the oldest received bytes and return how many are
+   contiguous there, or 0 if there are none. */
+uint32_t rigdfu_serial_rx_span(const uint8_t ** pp_data);
+
+/* Consume len bytes from the span returned by rigdfu_serial_rx_span. */
+void rigdfu_serial_rx_release(uint32_t len);
+
+/* Returns true, once, if received bytes were lost since the last call */
+bool rigdfu_serial_rx_overrun(void);
+
+/* Size of the receive ring: how many bytes may arrive before they are
+   consumed without being lost */
+uint32_t rigdfu_serial_rx_size(void);
+
 /* Send byte to the UART */
 void rigdfu_serial_put(uint8_t x);
 
+/* Send bytes to the UART */
+void rigdfu_serial_write(const uint8_t * p_data, uint32_t len);
+
 /* Send string */
 void rigdfu_serial_puts(const char *s);
 
@@ -12,4 +12,28 @@
  */
 uint32_t crc32(uint8_t * data, uint32_t len);
 
+/** @brief Start an incremental CRC32.
+ *
+ *  @return Initial CRC state
+ */
+uint32_t crc32_init(void);
+
+/** @brief Add data to an incremental CRC32.
+ *
+ *  @param[in] crc  CRC state from crc32_init or a previous crc32_update
+ *  @param[in] data The data to CRC
+ *  @param[in] len  The length of the data
+ *
+ *  @return Updated CRC state
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t * data, uint32_t len);
+
+/** @brief Finish an incremental CRC32.
+ *
+ *  @param[in] crc CRC state from crc32_update
+ *
+ *  @return CRC32 of all data passed to crc32_update
+ */
+uint32_t crc32_final(uint32_t crc);
+
 #endif /* _CRC32_H_ */
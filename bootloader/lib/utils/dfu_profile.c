@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <nrf.h>
+
+#include "dfu_profile.h"
+
+#ifdef DFU_PROFILE
+
+#define RTC_COUNTER_MASK    (0x00FFFFFF)
+
+static volatile uint32_t m_stage_ticks[DFU_STAGE_max];
+
+void dfu_profile_reset(void)
+{
+    memset((void *)m_stage_ticks, 0, sizeof(m_stage_ticks));
+}
+
+/* RTC1 is already running for app_timer, so it costs nothing to read */
+uint32_t dfu_profile_now(void)
+{
+    return NRF_RTC1->COUNTER;
+}
+
+void dfu_profile_add(dfu_stage_t stage, uint32_t start)
+{
+    m_stage_ticks[stage] += (NRF_RTC1->COUNTER - start) & RTC_COUNTER_MASK;
+}
+
+uint32_t dfu_profile_get(dfu_stage_t stage)
+{
+    return m_stage_ticks[stage];
+}
+
+#endif
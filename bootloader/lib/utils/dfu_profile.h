@@ -0,0 +1,44 @@
+#ifndef _DFU_PROFILE_H_
+#define _DFU_PROFILE_H_
+
+#include <stdint.h>
+
+/* Time spent in each stage of the DFU pipeline.  Only collected when the
+   bootloader is built with DFU_PROFILE defined, otherwise the macros
+   below compile away.  Times are RTC1 ticks (32768 Hz); short stages are
+   sampled at tick resolution but average out over a whole image. */
+typedef enum {
+    DFU_STAGE_DECRYPT,      /* eax_decrypt of received data */
+    DFU_STAGE_DECOMPRESS,   /* heatshrink output, part of DFU_STAGE_PATCH */
+    DFU_STAGE_PATCH,        /* patcher_patch, including decompression */
+    DFU_STAGE_FLASH,        /* fstorage queue busy */
+    DFU_STAGE_max
+} dfu_stage_t;
+
+#ifdef DFU_PROFILE
+
+/** @brief Clear all stage times. Called when a new DFU starts. */
+void dfu_profile_reset(void);
+
+/** @brief Current timestamp for dfu_profile_add. */
+uint32_t dfu_profile_now(void);
+
+/** @brief Add the time since start to a stage. */
+void dfu_profile_add(dfu_stage_t stage, uint32_t start);
+
+/** @brief Total ticks spent in a stage since the last reset. */
+uint32_t dfu_profile_get(dfu_stage_t stage);
+
+#define DFU_PROFILE_RESET()             dfu_profile_reset()
+#define DFU_PROFILE_START(start)        uint32_t start = dfu_profile_now()
+#define DFU_PROFILE_STOP(stage, start)  dfu_profile_add(stage, start)
+
+#else
+
+#define DFU_PROFILE_RESET()
+#define DFU_PROFILE_START(start)
+#define DFU_PROFILE_STOP(stage, start)
+
+#endif
+
+#endif
@@ -6,9 +6,11 @@
 #include <nrf_soc.h>
 
 #include "fstorage.h"
+#include "dfu_profile.h"
 
-#define WRITE_SIZE   (0x1000)
 #define PAGE_SIZE    (NRF_FICR->CODEPAGESIZE)
+/* sd_flash_write takes at most a page: 1024 bytes on nRF51, 4096 on nRF52 */
+#define WRITE_SIZE   (PAGE_SIZE)
 
 static fstorage_cb_t callbacks[FSTORAGE_max];
 
@@ -27,6 +29,11 @@ static struct {
     cmd_queue_element_t cmd[FSTORAGE_QUEUE_LEN];
 } cmd_queue;
 
+#ifdef DFU_PROFILE
+/* When the queue last went from empty to busy */
+static uint32_t m_busy_start;
+#endif
+
 /* Process next thing in the command queue */
 static void cmd_process(void)
 {
@@ -43,7 +50,7 @@ static void cmd_process(void)
     case FSTORAGE_STORE_OP_CODE:
         /* Write up to 1 page */
         len = cmd->len - cmd->offset;
-        if (len > WRITE_SIZE)
+        if (len > (int32_t)WRITE_SIZE)
             len = WRITE_SIZE;
 
         if (sd_flash_write((uint32_t *)(cmd->flash_addr + cmd->offset),
@@ -87,7 +94,12 @@ static uint32_t cmd_enqueue(fstorage_id_t id, uint8_t op_code,
     cmd_queue.cmd[next].offset = 0;
 
     if (cmd_queue.count++ == 0)
+    {
+#ifdef DFU_PROFILE
+        m_busy_start = dfu_profile_now();
+#endif
         cmd_process();
+    }
 
     return NRF_SUCCESS;
 }
@@ -121,6 +133,10 @@ void fstorage_sys_event_handler(uint32_t sys_evt)
     cmd_queue.index = (cmd_queue.index + 1) % FSTORAGE_QUEUE_LEN;
     if (--cmd_queue.count)
         cmd_process();
+#ifdef DFU_PROFILE
+    else
+        dfu_profile_add(DFU_STAGE_FLASH, m_busy_start);
+#endif
 }
 
 /* Initialize fstorage */
@@ -28,7 +28,9 @@
 #define PKT_RCPT_NOTIF_REQ_LEN  3                                               /**< Length (in bytes) of the Packet Receipt Notification Request. */
 #define MAX_PKTS_RCPT_NOTIF_LEN 6                                               /**< Maximum length (in bytes) of the Packets Receipt Notification. */
 #define MAX_RESPONSE_LEN        7                                               /**< Maximum length (in bytes) of the response to a Control Point command. */
-#define MAX_NOTIF_BUFFER_LEN    MAX(MAX_PKTS_RCPT_NOTIF_LEN, MAX_RESPONSE_LEN)  /**< Maximum length (in bytes) of the buffer needed by DFU Service while sending notifications to peer. */
+#define RESUME_REQ_LEN          9                                               /**< Length (in bytes) of the Resume request with an offset. */
+#define RESUME_RESPONSE_LEN     11                                              /**< Length (in bytes) of the response to a Resume request. */
+#define MAX_NOTIF_BUFFER_LEN    MAX(MAX(MAX_PKTS_RCPT_NOTIF_LEN, MAX_RESPONSE_LEN), RESUME_RESPONSE_LEN)  /**< Maximum length (in bytes) of the buffer needed by DFU Service while sending notifications to peer. */
 
 enum
 {
@@ -46,6 +48,7 @@ enum
 #ifdef SDK12
 	OP_CODE_GET_MAX_MTU        = 13,                                            /**< Value of the Op code field for 'Get Max MTU' command.*/
 #endif
+    OP_CODE_RESUME             = 14,                                            /**< Value of the Op code field for 'Resume' command.*/
     OP_CODE_RESPONSE           = 16,                                            /**< Value of the Op code field for 'Response.*/
     OP_CODE_PKT_RCPT_NOTIF     = 17,                                             /**< Value of the Op code field for 'Packets Receipt Notification'.*/
 	OP_CODE_SYS_RESTART_DFU    = 19
@@ -380,6 +383,28 @@ static uint32_t on_ctrl_pt_write(ble_dfu_t * p_dfu, ble_gatts_evt_write_t * p_bl
 
             break;
 
+        case OP_CODE_RESUME:
+            // Alone, a query for the resume point; with an offset and CRC, resume from there.
+            if (p_ble_write_evt->len == 1)
+            {
+                ble_dfu_evt.ble_dfu_evt_type = BLE_DFU_RESUME_QUERY;
+            }
+            else if (p_ble_write_evt->len >= RESUME_REQ_LEN)
+            {
+                ble_dfu_evt.ble_dfu_evt_type  = BLE_DFU_RESUME;
+                ble_dfu_evt.evt.resume.offset = uint32_decode(&(p_ble_write_evt->data[1]));
+                ble_dfu_evt.evt.resume.crc    = uint32_decode(&(p_ble_write_evt->data[5]));
+            }
+            else
+            {
+                return (ble_dfu_response_send(p_dfu,
+                                              BLE_DFU_RESUME_PROCEDURE,
+                                              BLE_DFU_RESP_VAL_NOT_SUPPORTED));
+            }
+
+            p_dfu->evt_handler(p_dfu, &ble_dfu_evt);
+            break;
+
         default:
             // Unsupported op code.
             return ble_dfu_response_send(p_dfu,
@@ -629,3 +654,40 @@ uint32_t ble_dfu_response_send(ble_dfu_t         * p_dfu,
 
     return sd_ble_gatts_hvx(p_dfu->conn_handle, &hvx_params);
 }
+
+
+uint32_t ble_dfu_resume_response_send(ble_dfu_t *        p_dfu,
+                                      ble_dfu_resp_val_t resp_val,
+                                      uint32_t           offset,
+                                      uint32_t           crc)
+{
+    if (p_dfu == NULL)
+    {
+        return NRF_ERROR_NULL;
+    }
+
+    if ((p_dfu->conn_handle == BLE_CONN_HANDLE_INVALID) || !m_is_dfu_service_initialized)
+    {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    ble_gatts_hvx_params_t hvx_params;
+    uint16_t               index = 0;
+
+    m_notif_buffer[index++] = OP_CODE_RESPONSE;
+    m_notif_buffer[index++] = (uint8_t)BLE_DFU_RESUME_PROCEDURE;
+    m_notif_buffer[index++] = (uint8_t)resp_val;
+
+    index += uint32_encode(offset, &m_notif_buffer[index]);
+    index += uint32_encode(crc, &m_notif_buffer[index]);
+
+    memset(&hvx_params, 0, sizeof(hvx_params));
+
+    hvx_params.handle = p_dfu->dfu_ctrl_pt_handles.value_handle;
+    hvx_params.type   = BLE_GATT_HVX_NOTIFICATION;
+    hvx_params.offset = 0;
+    hvx_params.p_len  = &index;
+    hvx_params.p_data = m_notif_buffer;
+
+    return sd_ble_gatts_hvx(p_dfu->conn_handle, &hvx_params);
+}
@@ -64,7 +64,9 @@ typedef enum
     BLE_DFU_RECEIVE_PATCH_INIT_DATA,                                    /**< The event indicating that the perr wants the application to prepare to receive patch init data. */
     BLE_DFU_RECEIVE_PATCH_DATA,                                         /**< The event indicating that the perr wants the application to prepare to receive the patch data. */
 	BLE_DFU_UNUSED, 
-	BLE_DFU_RESTART 													/**< re-start DFU  */
+	BLE_DFU_RESTART, 													/**< re-start DFU  */
+    BLE_DFU_RESUME_QUERY,                                               /**< The event indicating that the peer wants to know where an interrupted transfer can be resumed. */
+    BLE_DFU_RESUME,                                                     /**< The event indicating that the peer wants to resume an interrupted transfer. The offset is in the @ref resume element contained within @ref ble_dfu_evt_t. */
 } ble_dfu_evt_type_t;
 
 /**@brief   DFU Procedure type.
@@ -83,6 +85,7 @@ typedef enum
     BLE_DFU_RECEIVE_PATCH_PROCEDURE= 11,                                /**< Patch reception process.*/
     BLE_DFU_PROTOCOL_VER_PROCEDURE = 12,                                /**< Protocol version request procedure.*/
     BLE_DFU_MAX_MTU_SIZE_PROCEDURE = 13,                                /**< Max MTU request procedure.*/
+    BLE_DFU_RESUME_PROCEDURE       = 14,                                /**< Resume interrupted transfer procedure.*/
     BLE_DFU_RESTART_PROCEDURE      = 19,
 } ble_dfu_procedure_t;
 
@@ -123,6 +126,17 @@ typedef struct
     uint16_t                     num_of_pkts;                           /**< The number of packets of firmware data to be received by application before sending the next Packet Receipt Notification to the peer. */
 } ble_pkt_rcpt_notif_req_t;
 
+/**@brief   Resume request structure.
+ *
+ * @details This structure contains the point to resume an interrupted transfer from, as sent by
+ *          the DFU Controller.
+ */
+typedef struct
+{
+    uint32_t                     offset;                                /**< Image offset to resume from. */
+    uint32_t                     crc;                                   /**< CRC32 of the image data before offset. */
+} ble_dfu_resume_t;
+
 /**@brief   DFU Event structure.
  *
  * @details This structure contains the event generated by the DFU Service based on the data
@@ -135,6 +149,7 @@ typedef struct
     {
         ble_dfu_pkt_write_t      ble_dfu_pkt_write;                     /**< The DFU packet received. This field is when the @ref ble_dfu_evt_type field is set to @ref BLE_DFU_PACKET_WRITE.*/
         ble_pkt_rcpt_notif_req_t pkt_rcpt_notif_req;                    /**< Packet receipt notification request. This field is when the @ref ble_dfu_evt_type field is set to @ref BLE_DFU_PKT_RCPT_NOTIF_ENABLED.*/
+        ble_dfu_resume_t         resume;                                /**< Resume request. This field is used when the @ref ble_dfu_evt_type field is set to @ref BLE_DFU_RESUME.*/
     } evt;
 } ble_dfu_evt_t;
 
@@ -218,6 +233,24 @@ uint32_t ble_dfu_response_send(ble_dfu_t *          p_dfu,
                                ble_dfu_procedure_t  dfu_proc,
                                ble_dfu_resp_val_t   resp_val);
 
+/**@brief       Function for sending the response to a resume command.
+ *
+ * @details     Like @ref ble_dfu_response_send, followed by the resume offset and the CRC32 of the
+ *              image data before it, both 32-bit little-endian.
+ *
+ * @param[in]   p_dfu       Pointer to the DFU service structure.
+ * @param[in]   resp_val    Response value.
+ * @param[in]   offset      Image offset to resume from.
+ * @param[in]   crc         CRC32 of the image data before offset.
+ *
+ * @return      NRF_SUCCESS if the DFU Service has successfully requested the SoftDevice to send
+ *              the notification. Otherwise an error code, as for @ref ble_dfu_response_send.
+ */
+uint32_t ble_dfu_resume_response_send(ble_dfu_t *        p_dfu,
+                                      ble_dfu_resp_val_t resp_val,
+                                      uint32_t           offset,
+                                      uint32_t           crc);
+
 /**@brief      Function for notifying the peer about the number of bytes of firmware data received.
  *
  * @param[in]  p_dfu                      Pointer to the DFU service structure.
@@ -11,6 +11,7 @@
  */
 
 #include "bootloader.h"
+#include <stddef.h>
 #include <string.h>
 #include "bootloader_types.h"
 #ifdef SDK12
@@ -32,6 +33,7 @@
 #include "ble_flash.h"
 #include "nordic_common.h"
 #include "crc16.h"
+#include "crc32.h"
 #include "fstorage.h"
 #include "app_scheduler.h"
 #include "nrf_delay.h"
@@ -65,6 +67,11 @@ static bootloader_status_t      m_update_status;        /**< Current update stat
 /* If true, reboot rather than start the app. */
 static bool m_need_reboot;
 
+/* Settings saves under way, and the settings the last one asked for.
+   Until its bank codes are stored the page holds only part of them. */
+static uint32_t m_settings_saves;
+static const bootloader_settings_t * mp_settings_saving;
+
 /* Helper function set the mac address  */
 /* static void ble_set_mac(void);       */
 
@@ -137,10 +144,18 @@ static void fstorage_callback_handler(uint32_t address,
                                       uint32_t result,
                                       void *p_data)
 {
-    // If we are in BOOTLOADER_SETTINGS_SAVING state and the store completes,
-    // the settings have been saved and we're done.
+    if ((op_code == FSTORAGE_STORE_OP_CODE) &&
+        (address == BOOTLOADER_SETTINGS_ADDRESS) &&
+        (m_settings_saves > 0))
+    {
+        m_settings_saves--;
+    }
+
+    // If we are in BOOTLOADER_SETTINGS_SAVING state and the store of the bank codes, the last
+    // one, completes, the settings have been saved and we're done.
     if ((m_update_status == BOOTLOADER_SETTINGS_SAVING) &&
-        (op_code == FSTORAGE_STORE_OP_CODE))
+        (op_code == FSTORAGE_STORE_OP_CODE) &&
+        (address == BOOTLOADER_SETTINGS_ADDRESS))
     {
         m_update_status = BOOTLOADER_COMPLETE;
     }
@@ -161,6 +176,11 @@ static void wait_for_events(void)
 {
     for (;;)
     {
+        // Use the time before the next event for work that doesn't depend on it.
+        while (dfu_idle_process())
+        {
+        }
+
         // Wait in low power state for any events.
         uint32_t err_code = sd_app_evt_wait();
         APP_ERROR_CHECK(err_code);
@@ -209,44 +229,105 @@ bool bootloader_app_is_valid(void)
 
     /* Reset vector must point within application */
     if (reset < DFU_BANK_0_REGION_START ||
-        reset >= (DFU_BANK_0_REGION_START + DFU_IMAGE_MAX_SIZE_BANKED))
+        reset >= (DFU_BANK_0_REGION_START + DFU_APP_IMAGE_MAX_SIZE))
         return false;
 
+    /* The whole image must match the CRC recorded when it was
+       activated.  Once it has, bootloader_launch_app_after_reset
+       marks it as checked, and later boots skip this. */
+    if (p_bootloader_settings->bank_0 == BANK_VALID_APP &&
+        p_bootloader_settings->bank_0_check != BANK_CHECK_NONE &&
+        p_bootloader_settings->bank_0_check != BANK_CHECK_DONE)
+    {
+        if (p_bootloader_settings->bank_0_size > DFU_APP_IMAGE_MAX_SIZE)
+            return false;
+        if (crc32((uint8_t *)DFU_BANK_0_REGION_START,
+                  p_bootloader_settings->bank_0_size) !=
+            p_bootloader_settings->bank_0_crc)
+            return false;
+    }
+
     /* Looks good! */
     return true;
 }
 
+bool bootloader_app_start_now(uint8_t gpregret, bool dfu_requested)
+{
+    /* The bootloader, or the app, asked for a direct start */
+    if (gpregret >= BOOTLOADER_APP_START_MIN &&
+        gpregret <= BOOTLOADER_APP_START_MAX)
+        return bootloader_app_is_valid();
+
+    /* The app asked for DFU */
+    if (gpregret == BOOTLOADER_DFU_START ||
+        gpregret == BOOTLOADER_DFU_START_W_UART)
+        return false;
+
+    /* DFU was requested otherwise, or a SoftDevice or bootloader
+       update needs finishing */
+    if (dfu_requested || bootloader_dfu_sd_in_progress())
+        return false;
+
+    return bootloader_app_is_valid();
+}
+
+/* The first word holds the bank codes.  It is written after the rest,
+   so a save cut short leaves them erased, as BANK_UNKNOWN_FF, rather
+   than BANK_VALID_APP without the CRC to check it by. */
+#define SETTINGS_HEAD_SIZE sizeof(uint32_t)
+STATIC_ASSERT(offsetof(bootloader_settings_t, bank_0_size) == SETTINGS_HEAD_SIZE);
+
 static void bootloader_settings_save(bootloader_settings_t * p_settings)
 {
     uint32_t err_code;
 
+    mp_settings_saving = p_settings;
+    m_settings_saves++;
+
     err_code = fstorage_clear(FSTORAGE_BOOTLOADER,
                               BOOTLOADER_SETTINGS_ADDRESS,
                               sizeof(bootloader_settings_t));
     APP_ERROR_CHECK(err_code);
 
+    err_code = fstorage_store(FSTORAGE_BOOTLOADER,
+                              BOOTLOADER_SETTINGS_ADDRESS + SETTINGS_HEAD_SIZE,
+                              (uint8_t *)p_settings + SETTINGS_HEAD_SIZE,
+                              sizeof(bootloader_settings_t) - SETTINGS_HEAD_SIZE);
+    APP_ERROR_CHECK(err_code);
+
     err_code = fstorage_store(FSTORAGE_BOOTLOADER,
                               BOOTLOADER_SETTINGS_ADDRESS,
                               p_settings,
-                              sizeof(bootloader_settings_t));
+                              SETTINGS_HEAD_SIZE);
     APP_ERROR_CHECK(err_code);
 }
 
+/* The settings as they will be once any save under way is done */
+static void bootloader_settings_current(const bootloader_settings_t ** pp_settings)
+{
+    if (m_settings_saves > 0)
+        *pp_settings = mp_settings_saving;
+    else
+        bootloader_util_settings_get(pp_settings);
+}
+
 
 void bootloader_dfu_update_process(dfu_update_status_t update_status)
 {
     static bootloader_settings_t  settings;
     const bootloader_settings_t * p_bootloader_settings;
 
-    bootloader_util_settings_get(&p_bootloader_settings);
+    bootloader_settings_current(&p_bootloader_settings);
 
     if (update_status.status_code == DFU_UPDATE_APP_COMPLETE)
     {
-        settings.bank_0_size = update_status.app_size;
-        settings.bank_0      = BANK_VALID_APP;
-        settings.bank_1      = BANK_INVALID_APP;
+        settings.bank_0_size  = update_status.app_size;
+        settings.bank_0       = BANK_VALID_APP;
+        settings.bank_1       = BANK_INVALID_APP;
+        settings.bank_0_crc   = update_status.app_crc;
+        settings.bank_0_check = BANK_CHECK_PENDING;
 
-        m_update_status      = BOOTLOADER_SETTINGS_SAVING;
+        m_update_status       = BOOTLOADER_SETTINGS_SAVING;
         bootloader_settings_save(&settings);
     }
     else if (update_status.status_code == DFU_UPDATE_SD_COMPLETE)
@@ -261,6 +342,7 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
         settings.app_image_size = update_status.app_size;
         settings.app_image_size = update_status.app_size;
         settings.sd_image_start = update_status.sd_image_start;
+        settings.bank_0_check   = BANK_CHECK_NONE;
 
         m_update_status         = BOOTLOADER_SETTINGS_SAVING;
         bootloader_settings_save(&settings);
@@ -271,6 +353,8 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
     {
         settings.bank_0         = p_bootloader_settings->bank_0;
         settings.bank_0_size    = p_bootloader_settings->bank_0_size;
+        settings.bank_0_crc     = p_bootloader_settings->bank_0_crc;
+        settings.bank_0_check   = p_bootloader_settings->bank_0_check;
         settings.bank_1         = BANK_VALID_BOOT;
         settings.sd_image_size  = update_status.sd_size;
         settings.bl_image_size  = update_status.bl_size;
@@ -290,9 +374,12 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
                bootloader. */
             settings.bank_0         = p_bootloader_settings->bank_0;
             settings.bank_0_size    = p_bootloader_settings->bank_0_size;
+            settings.bank_0_crc     = p_bootloader_settings->bank_0_crc;
+            settings.bank_0_check   = p_bootloader_settings->bank_0_check;
         } else {
             settings.bank_0_size    = 0;
             settings.bank_0         = BANK_INVALID_APP;
+            settings.bank_0_check   = BANK_CHECK_NONE;
         }
         settings.bank_1         = BANK_INVALID_APP;
         settings.sd_image_size  = 0;
@@ -316,17 +403,20 @@ void bootloader_dfu_update_process(dfu_update_status_t update_status)
     }
     else if (update_status.status_code == DFU_BANK_0_ERASED)
     {
-        settings.bank_0_size = 0;
-        settings.bank_0      = BANK_ERASED;
-        settings.bank_1      = p_bootloader_settings->bank_1;
+        settings.bank_0_size  = 0;
+        settings.bank_0       = BANK_ERASED;
+        settings.bank_0_check = BANK_CHECK_NONE;
+        settings.bank_1       = p_bootloader_settings->bank_1;
 
         bootloader_settings_save(&settings);
     }
     else if (update_status.status_code == DFU_BANK_1_ERASED)
     {
-        settings.bank_0      = p_bootloader_settings->bank_0;
-        settings.bank_0_size = p_bootloader_settings->bank_0_size;
-        settings.bank_1      = BANK_ERASED;
+        settings.bank_0       = p_bootloader_settings->bank_0;
+        settings.bank_0_size  = p_bootloader_settings->bank_0_size;
+        settings.bank_0_crc   = p_bootloader_settings->bank_0_crc;
+        settings.bank_0_check = p_bootloader_settings->bank_0_check;
+        settings.bank_1       = BANK_ERASED;
 
         bootloader_settings_save(&settings);
     }
@@ -458,6 +548,26 @@ void bootloader_app_start(void)
  */
 void bootloader_launch_app_after_reset(void)
 {
+    const bootloader_settings_t * p_bootloader_settings;
+
+    /* bootloader_app_is_valid has just checked the image CRC, if it
+       was pending.  Don't check it again on later boots.  The
+       SoftDevice isn't enabled yet, so write the flag directly; this
+       only clears bits, and is the second and last write to the word
+       since the page was erased. */
+    bootloader_util_settings_get(&p_bootloader_settings);
+    if (p_bootloader_settings->bank_0 == BANK_VALID_APP &&
+        p_bootloader_settings->bank_0_check != BANK_CHECK_NONE &&
+        p_bootloader_settings->bank_0_check != BANK_CHECK_DONE)
+    {
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+        *(volatile uint32_t *)&p_bootloader_settings->bank_0_check = BANK_CHECK_DONE;
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+        NRF_NVMC->CONFIG = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+        while (NRF_NVMC->READY == NVMC_READY_READY_Busy);
+    }
+
     /* Protect the softdevice and bootloader from being erased or
        written, using PROTENSET.  The bank addresses may change with
        an updated bootloader, so they must be calculated at runtime.
@@ -543,7 +653,7 @@ void bootloader_settings_get(bootloader_settings_t * const p_settings)
 {
     const bootloader_settings_t *flash_settings;
 
-    bootloader_util_settings_get(&flash_settings);
+    bootloader_settings_current(&flash_settings);
     int i;
     for (i = 0; i < sizeof(bootloader_settings_t); i++)
         ((uint8_t *)p_settings)[i] =
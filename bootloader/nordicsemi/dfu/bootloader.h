@@ -33,12 +33,29 @@
 uint32_t bootloader_init(void);
 
 /**@brief Function for validating application region in flash.
+ *
+ * @details Checks the vector table, and, until it has passed once, the CRC of the whole image
+ *          recorded when it was activated.
  *
  * @retval     true          If Application region is valid.
  * @retval     false         If Application region is not valid.
  */
 bool bootloader_app_is_valid(void);
 
+/**@brief Function for deciding, straight after reset, whether to start the application without
+ *        bringing up the SoftDevice and the DFU transports.
+ *
+ * @details Only reads GPREGRET, the bootloader settings and the application image, so it is safe
+ *          to call before any initialization.
+ *
+ * @param[in]  gpregret       GPREGRET as found at reset.
+ * @param[in]  dfu_requested  true if DFU was requested by other means, e.g. a DFU pin.
+ *
+ * @retval     true    Start the application now, see \ref bootloader_launch_app_after_reset.
+ *             false   Open the DFU window first.
+ */
+bool bootloader_app_start_now(uint8_t gpregret, bool dfu_requested);
+
 /**@brief Function for starting the Device Firmware Update.
  *
  * @param[in]  initial_timeout_ticks Initial timeout for first DFU contact
@@ -57,7 +74,8 @@ bool bootloader_dfu_start(uint32_t initial_timeout_ticks,
  */
 void bootloader_app_start(void);
 
-/**@brief Call after reset to actually jump to the application
+/**@brief Call after reset to actually jump to the application, once \ref bootloader_app_is_valid
+ *        has returned true.
  */
 void bootloader_launch_app_after_reset(void);
 
@@ -53,6 +53,11 @@ typedef enum
     BANK_UNKNOWN_FF  = 0xFF,
 } bootloader_bank_code_t;
 
+/* Values of bank_0_check in the bootloader settings: */
+#define BANK_CHECK_NONE    0xFFFFFFFF       /**< No CRC recorded; erased flash, or written by an older bootloader. */
+#define BANK_CHECK_PENDING 0x4B435243       /**< "CRCK", bank_0_crc is checked on every boot until it passes. */
+#define BANK_CHECK_DONE    0x00000000       /**< bank_0_crc has passed since the settings were written. */
+
 /**@brief Structure holding bootloader settings for application and bank data.
  */
 typedef struct
@@ -64,8 +69,35 @@ typedef struct
     uint32_t               bl_image_size;   /**< Size of Bootloader image in bank0 if bank_0 code is \ref BANK_VALID_SD. */
     uint32_t               app_image_size;  /**< Size of Application image in bank0 if bank_0 code is \ref BANK_VALID_SD. */
     uint32_t               sd_image_start;  /**< Location in flash where SoftDevice image is stored for SoftDevice update. */
+    uint32_t               bank_0_crc;      /**< CRC32 of the bank_0_size bytes of the application in bank 0, recorded at activation. */
+    uint32_t               bank_0_check;    /**< Whether bank_0_crc has been checked, see BANK_CHECK_NONE. */
 } bootloader_settings_t;
 
+#define DFU_CHECKPOINT_MAGIC 0x52504B43     /**< "CKPR", marks a written checkpoint. */
+
+/**@brief DFU progress checkpoint.
+ *
+ * @details Appended to the bootloader settings page, after @ref bootloader_settings_t, while an
+ *          image is received into bank 1, so that a transfer can be resumed after a reset or link
+ *          loss. Saving the settings erases them.
+ */
+typedef struct
+{
+    uint32_t magic;                         /**< DFU_CHECKPOINT_MAGIC. */
+    uint32_t offset;                        /**< Image bytes written to bank 1. */
+    uint32_t session;                       /**< CRC32 of the start and init packets of the transfer. */
+    uint32_t data_crc;                      /**< Running CRC32 state of the image data as received. */
+    uint32_t image_crc;                     /**< Running CRC32 state of the image data as written. */
+    uint8_t  ctr[16];                       /**< EAX CTR counter. */
+    uint8_t  pad[16];                       /**< EAX CTR keystream block. */
+    uint8_t  omac_prev[16];                 /**< EAX ciphertext OMAC chaining value. */
+    uint8_t  omac_block[16];                /**< EAX ciphertext OMAC pending block. */
+    uint8_t  padlen;                        /**< Keystream bytes used from pad. */
+    uint8_t  buflen;                        /**< Bytes in omac_block. */
+    uint8_t  rfu[2];                        /**< Reserved, 0xFF. */
+    uint32_t crc;                           /**< CRC32 of the fields above. */
+} dfu_checkpoint_t;
+
 #endif // BOOTLOADER_TYPES_H__ 
 
 /**@} */
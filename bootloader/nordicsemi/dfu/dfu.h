@@ -65,6 +65,11 @@ void dfu_register_callback(dfu_callback_t callback_handler);
 uint32_t dfu_start_pkt_handle(dfu_update_packet_t * p_packet);
 
 /**@brief Function for handling DFU data packets.
+ *
+ * @details Data is gathered in staging buffers and written to flash a page at a time; the last
+ *          partial page is written by \ref dfu_image_validate. A DATA_PACKET callback with the
+ *          packet's data pointer means the packet buffer may be reused. That is normally before
+ *          this function returns, or after the write if flash has fallen behind.
  *
  * @param[in] p_packet   Pointer to the DFU packet.
  *
@@ -78,6 +83,32 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet);
  */
 uint32_t dfu_init_pkt_handle(dfu_update_packet_t * p_packet);
 
+/**@brief Function for finding where an interrupted transfer can be resumed.
+ *
+ * @details Call after the init packet. Image data received into bank 1 is checkpointed to flash
+ *          as it arrives; this returns the last checkpoint of a transfer with the same start and
+ *          init packets, or offset 0 if there is none.
+ *
+ * @param[out] p_offset  Image offset to resume from.
+ * @param[out] p_crc     CRC32 of the image data, as sent, before that offset.
+ *
+ * @return    NRF_SUCCESS on success, an error_code otherwise.
+ */
+uint32_t dfu_resume_offset_get(uint32_t * p_offset, uint32_t * p_crc);
+
+/**@brief Function for resuming an interrupted transfer.
+ *
+ * @details The peer passes back what \ref dfu_resume_offset_get returned, after checking the CRC
+ *          against its own image, and then sends data packets from that offset.
+ *
+ * @param[in] offset  Image offset to resume from.
+ * @param[in] crc     CRC32 of the image data, as sent, before that offset.
+ *
+ * @return    NRF_SUCCESS on success, NRF_ERROR_INVALID_DATA if there is no such checkpoint, an
+ *            error_code otherwise.
+ */
+uint32_t dfu_resume(uint32_t offset, uint32_t crc);
+
 /**@brief Function for handling DFU patch init packets.
  *
  * @return    NRF_SUCCESS on success, an error_code otherwise.
@@ -101,6 +132,15 @@ int32_t dfu_patch_data_pkt_handle(uint8_t * p_data, uint32_t length);
  */
 uint32_t dfu_config_pkt_handle(dfu_update_packet_t * p_packet);
 
+/**@brief Function for doing background work while waiting for the next packet.
+ *
+ * @details Reads the decryption keystream ahead, so that decrypting an arriving packet only
+ *          needs the XOR and the MAC update. Called from the main loop before sleeping.
+ *
+ * @return    true if there is more work to do, false if the caller may sleep.
+ */
+bool dfu_idle_process(void);
+
 /**@brief Function for validating a transferred image after the transfer has completed.
  * 
  * @return    NRF_SUCCESS on success, an error_code otherwise.
@@ -38,8 +38,10 @@
 #include "nrf_gpio.h"
 #include "nrf_mbr.h"
 #include "patcher.h"
+#include "dfu_profile.h"
 
 #include <tomcrypt.h>
+#include "ltc_nrf.h"
 #include "rigdfu.h"
 #include "rigdfu_util.h"
 #include "rigdfu_serial.h"
@@ -60,6 +62,9 @@ static dfu_bank_func_t              m_functions;                /**< Structure h
 
 /* Fstorage */
 static uint32_t target_base_address;
+static uint32_t m_erase_next;               /**< Bank pages below this are erased or queued for erase. */
+static bool     m_invalidate_bank_0;        /**< Application is written in place, and bank 0 is still valid. */
+static bool     m_in_place;                 /**< Application is written in place. */
 
 /** Packets */
 
@@ -83,7 +88,53 @@ static bool m_decrypt;
 static uint8_t m_shared_mem[sizeof(rigado_data_t)] __attribute__((aligned (4)));
 static bool m_shared_mem_in_use;
 
-static uint8_t m_patch_buffer[4096] __attribute__((aligned (4)));
+static uint8_t m_patch_buffer[DFU_PATCH_BUFFER_SIZE] __attribute__((aligned (4)));
+
+/** Staging for full image data.  When not patching, m_patch_buffer is
+    used as two staging buffers: one fills with decrypted packets while
+    the other is being written, so each flash write covers a whole
+    staging buffer instead of a single packet. */
+#ifndef DFU_STAGE_SIZE
+#define DFU_STAGE_SIZE MIN(CODE_PAGE_SIZE, DFU_PATCH_BUFFER_SIZE / 2)
+#endif
+STATIC_ASSERT(DFU_STAGE_SIZE * 2 <= DFU_PATCH_BUFFER_SIZE);
+STATIC_ASSERT((DFU_STAGE_SIZE & 3) == 0);
+
+#define STAGE_BUF(i) (m_patch_buffer + (i) * DFU_STAGE_SIZE)
+
+static uint32_t m_stage_len;                /**< Bytes in the current staging buffer. */
+static uint8_t m_stage_idx;                 /**< Staging buffer being filled. */
+static volatile bool m_stage_busy[2];       /**< Staging buffer is queued to fstorage. */
+
+/** Initial stack pointer and reset vector, which start an application
+    image.  Copying an application to bank 0 writes them last, and so
+    does writing one in place, from m_vector_head: until then the image
+    has no vector table, and can't be started even if the settings that
+    invalidate it are lost. */
+#define APP_VECTOR_HEAD_SIZE 8
+
+static uint32_t m_vector_head[APP_VECTOR_HEAD_SIZE / sizeof(uint32_t)];
+
+/** Checkpoints, so that an interrupted transfer into bank 1 can be
+    resumed.  They are logged after the bootloader settings, in the
+    settings page, and each one is queued to fstorage after the image
+    data it covers, so it only reaches flash once that data has. */
+#define CHECKPOINT_BASE  (BOOTLOADER_SETTINGS_ADDRESS + sizeof(bootloader_settings_t))
+#define CHECKPOINT_SLOTS ((CODE_PAGE_SIZE - sizeof(bootloader_settings_t)) / sizeof(dfu_checkpoint_t))
+#define CHECKPOINT(i)    ((const dfu_checkpoint_t *)(CHECKPOINT_BASE + (i) * sizeof(dfu_checkpoint_t)))
+STATIC_ASSERT((sizeof(bootloader_settings_t) & 3) == 0);
+STATIC_ASSERT((sizeof(dfu_checkpoint_t) & 3) == 0);
+/* Resuming rewrites the start of a page from the two staging buffers */
+STATIC_ASSERT(CODE_PAGE_SIZE <= 2 * DFU_STAGE_SIZE);
+
+static dfu_checkpoint_t m_checkpoint;       /**< Checkpoint being written. */
+static volatile bool m_checkpoint_busy;     /**< m_checkpoint is queued to fstorage. */
+static uint32_t m_checkpoint_next;          /**< Next free slot; CHECKPOINT_SLOTS when full or not checkpointing. */
+static uint32_t m_checkpoint_due;           /**< Image offset for the next checkpoint. */
+static const dfu_checkpoint_t * mp_resume;  /**< Last checkpoint of this transfer, if any. */
+static uint32_t m_session;                  /**< CRC32 of the start and init packets. */
+static uint32_t m_data_crc;                 /**< Running CRC32 of the data as received. */
+static uint32_t m_image_crc;                /**< Running CRC32 of the data as written. */
 
 /** State varible to denote if a patch is in progress */
 //TODO: Remove?
@@ -108,10 +159,11 @@ uint32_t decrypt_prepare(void)
         }
 
         /* Ensure that, if we're writing to the application location,
-           the existing application has been marked invalid.  Otherwise,
-           a subsequent boot could try to execute code that was not
-           properly validated. */
-        if (target_base_address == DFU_BANK_0_REGION_START)
+           the existing application has been marked invalid, or will be
+           before any image data is written.  Otherwise, a subsequent
+           boot could try to execute code that was not properly
+           validated. */
+        if (target_base_address == DFU_BANK_0_REGION_START && !m_invalidate_bank_0)
         {
             bootloader_settings_t bootloader_settings;
             bootloader_settings_get(&bootloader_settings);
@@ -153,11 +205,35 @@ uint32_t decrypt_prepare(void)
 /* Decrypt a data packet in-place */
 uint32_t decrypt_data(uint8_t *data, int len)
 {
-    if (eax_decrypt(&m_eax, data, data, len) != CRYPT_OK)
+    int err;
+    DFU_PROFILE_START(start);
+    
+    err = eax_decrypt(&m_eax, data, data, len);
+    DFU_PROFILE_STOP(DFU_STAGE_DECRYPT, start);
+    
+    if (err != CRYPT_OK)
         return NRF_ERROR_INVALID_STATE;
     return NRF_SUCCESS;
 }
 
+bool dfu_idle_process(void)
+{
+    if (!m_decrypt)
+        return false;
+
+    switch (m_dfu_state)
+    {
+        case DFU_STATE_INIT_PKT_DONE:
+        case DFU_STATE_RX_PATCH_INIT_PKT:
+        case DFU_STATE_RX_DATA_PKT:
+        case DFU_STATE_RX_PATCH_PKT:
+            return ltc_nrf_eax_prefetch(&m_eax);
+
+        default:
+            return false;
+    }
+}
+
 /* Finish decryption and validate key */
 uint32_t decrypt_validate(void)
 {
@@ -197,13 +273,55 @@ uint32_t decrypt_validate(void)
     return NRF_SUCCESS;
 }
 
+static bool flash_is_blank(uint32_t address, uint32_t len)
+{
+    const uint32_t * p_word = (const uint32_t *)address;
+
+    for (uint32_t i = 0; i < len / sizeof(uint32_t); i++)
+    {
+        if (p_word[i] != EMPTY_FLASH_MASK)
+            return false;
+    }
+    return true;
+}
+
+static bool page_is_blank(uint32_t address)
+{
+    return flash_is_blank(address, CODE_PAGE_SIZE);
+}
+
+/* Store image data to the bank.  The bank isn't erased up front;
+   instead, each page is erased just before the first store to it,
+   unless it's already blank.  fstorage runs its queue in order, so
+   the erase always happens before the write.  Writes must be in
+   increasing address order. */
+static uint32_t bank_store(uint32_t address, uint8_t * p_data, uint32_t len)
+{
+    uint32_t err_code;
+    uint32_t page = address & ~(CODE_PAGE_SIZE - 1);
+
+    if (m_erase_next < page)
+        m_erase_next = page;
+
+    while (m_erase_next < address + len)
+    {
+        if (!page_is_blank(m_erase_next))
+        {
+            err_code = fstorage_clear(FSTORAGE_DFU, m_erase_next, CODE_PAGE_SIZE);
+            if (err_code != NRF_SUCCESS)
+                return err_code;
+        }
+        m_erase_next += CODE_PAGE_SIZE;
+    }
+
+    return fstorage_store(FSTORAGE_DFU, address, p_data, len);
+}
+
 static uint32_t store_data(uint8_t * data, uint32_t len)
 {
     uint32_t err_code;
     
-    err_code = fstorage_store(FSTORAGE_DFU,
-                              target_base_address + m_data_received,
-                              data, len);
+    err_code = bank_store(target_base_address + m_data_received, data, len);
     if (err_code != NRF_SUCCESS)
     {
         return err_code;
@@ -214,10 +332,209 @@ static uint32_t store_data(uint8_t * data, uint32_t len)
     return NRF_SUCCESS;
 }
 
+/* Queue the current staging buffer to flash, if it holds anything.
+   end is the image offset just past the staged data. */
+static uint32_t stage_flush(uint32_t end)
+{
+    uint32_t err_code;
+
+    if (m_stage_len == 0)
+        return NRF_SUCCESS;
+
+    m_stage_busy[m_stage_idx] = true;
+    err_code = bank_store(target_base_address + end - m_stage_len,
+                          STAGE_BUF(m_stage_idx), m_stage_len);
+    if (err_code != NRF_SUCCESS)
+    {
+        m_stage_busy[m_stage_idx] = false;
+        return err_code;
+    }
+
+    m_stage_len = 0;
+    m_stage_idx ^= 1;
+    return NRF_SUCCESS;
+}
+
+/* Copy a packet, which starts at image offset m_data_received, into
+   staging.  A staging buffer is flushed when it reaches a
+   DFU_STAGE_SIZE boundary in the image, so writes stay aligned.
+   Returns NRF_ERROR_NO_MEM, without staging anything, if a buffer the
+   packet needs is still being written. */
+static uint32_t stage_data(uint8_t * p_data, uint32_t len)
+{
+    uint32_t err_code;
+    uint32_t room = DFU_STAGE_SIZE - (m_data_received % DFU_STAGE_SIZE);
+    uint32_t n = MIN(len, room);
+
+    if (len > DFU_STAGE_SIZE ||
+        m_stage_busy[m_stage_idx] ||
+        (len > room && m_stage_busy[m_stage_idx ^ 1]))
+        return NRF_ERROR_NO_MEM;
+
+    memcpy(STAGE_BUF(m_stage_idx) + m_stage_len, p_data, n);
+    m_stage_len += n;
+
+    if (n == room)
+    {
+        err_code = stage_flush(m_data_received + n);
+        if (err_code != NRF_SUCCESS)
+        {
+            m_stage_len -= n;
+            return err_code;
+        }
+    }
+
+    if (len > n)
+    {
+        memcpy(STAGE_BUF(m_stage_idx), p_data + n, len - n);
+        m_stage_len = len - n;
+    }
+
+    return NRF_SUCCESS;
+}
+
+/* Mark a staging buffer free once its write completes.  Returns false
+   if p_data wasn't a staging buffer. */
+static bool stage_release(void * p_data)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (m_stage_busy[i] && p_data == STAGE_BUF(i))
+        {
+            m_stage_busy[i] = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t checkpoint_crc(const dfu_checkpoint_t * p_checkpoint)
+{
+    return crc32((uint8_t *)p_checkpoint, offsetof(dfu_checkpoint_t, crc));
+}
+
+/* Bytes of image between checkpoints; the log has room for a whole
+   image, plus a few resumes. */
+static uint32_t checkpoint_interval(void)
+{
+    return MAX(DFU_STAGE_SIZE, m_image_size / CHECKPOINT_SLOTS);
+}
+
+/* Erase the log, by saving the settings again */
+static void checkpoint_clear(void)
+{
+    dfu_update_status_t update_status = {DFU_BANK_1_ERASED, };
+
+    bootloader_dfu_update_process(update_status);
+    m_checkpoint_next = 0;
+    mp_resume = NULL;
+}
+
+/* Called once the init packet is in.  Find this transfer's last
+   checkpoint and the end of the log.  A log left by a different
+   transfer is cleared. */
+static void checkpoint_open(void)
+{
+    const dfu_checkpoint_t * p_last = NULL;
+    uint32_t next = 0;
+
+    m_data_crc  = crc32_init();
+    m_image_crc = crc32_init();
+    m_checkpoint_due  = checkpoint_interval();
+    m_checkpoint_next = CHECKPOINT_SLOTS;
+    mp_resume = NULL;
+
+    // SoftDevice images and applications written in place go to bank 0. The application
+    // there is invalidated before they are written, so there is nothing to resume.
+    if (target_base_address != DFU_BANK_1_REGION_START)
+        return;
+
+    m_session = crc32_init();
+    m_session = crc32_update(m_session, (uint8_t *)&m_start_packet, sizeof(m_start_packet));
+    m_session = crc32_update(m_session, (uint8_t *)&m_init_packet, sizeof(m_init_packet));
+    m_session = crc32_final(m_session);
+
+    for (uint32_t i = 0; i < CHECKPOINT_SLOTS; i++)
+    {
+        const dfu_checkpoint_t * p_checkpoint = CHECKPOINT(i);
+
+        // A slot is used once any of it is written, even if the write was cut short.
+        if (!flash_is_blank((uint32_t)p_checkpoint, sizeof(dfu_checkpoint_t)))
+        {
+            next = i + 1;
+            if (p_checkpoint->magic == DFU_CHECKPOINT_MAGIC &&
+                p_checkpoint->crc == checkpoint_crc(p_checkpoint))
+                p_last = p_checkpoint;
+        }
+    }
+
+    if (p_last != NULL && p_last->session == m_session)
+    {
+        mp_resume = p_last;
+        m_checkpoint_next = next;
+    }
+    else if (next > 0)
+    {
+        checkpoint_clear();
+    }
+    else
+    {
+        m_checkpoint_next = 0;
+    }
+}
+
+/* Checkpoint everything received so far, if it's time to.  The staged
+   data is queued first, then the record, so fstorage only writes the
+   record once the data is in flash.  If flash is too far behind, the
+   next packet tries again. */
+static void checkpoint_save(void)
+{
+    if (m_checkpoint_next >= CHECKPOINT_SLOTS || m_checkpoint_busy ||
+        m_data_received < m_checkpoint_due)
+        return;
+
+    if (stage_flush(m_data_received) != NRF_SUCCESS)
+        return;
+
+    memset(&m_checkpoint, 0xFF, sizeof(m_checkpoint));
+    m_checkpoint.magic     = DFU_CHECKPOINT_MAGIC;
+    m_checkpoint.offset    = m_data_received;
+    m_checkpoint.session   = m_session;
+    m_checkpoint.data_crc  = m_data_crc;
+    m_checkpoint.image_crc = m_image_crc;
+    if (m_decrypt)
+    {
+        memcpy(m_checkpoint.ctr, m_eax.ctr.ctr, 16);
+        memcpy(m_checkpoint.pad, m_eax.ctr.pad, 16);
+        memcpy(m_checkpoint.omac_prev, m_eax.ctomac.prev, 16);
+        memcpy(m_checkpoint.omac_block, m_eax.ctomac.block, 16);
+        m_checkpoint.padlen = m_eax.ctr.padlen;
+        m_checkpoint.buflen = m_eax.ctomac.buflen;
+    }
+    m_checkpoint.crc = checkpoint_crc(&m_checkpoint);
+
+    m_checkpoint_busy = true;
+    if (fstorage_store(FSTORAGE_DFU, (uint32_t)CHECKPOINT(m_checkpoint_next),
+                       &m_checkpoint, sizeof(m_checkpoint)) != NRF_SUCCESS)
+    {
+        m_checkpoint_busy = false;
+        return;
+    }
+
+    m_checkpoint_next++;
+    m_checkpoint_due = m_data_received + checkpoint_interval();
+}
+
 static uint32_t patch_prepare()
 {
     bootloader_settings_t bootloader_settings;
     bootloader_settings_get(&bootloader_settings);
+
+    // Patches read the current application, so they can't be written over it.
+    if (m_invalidate_bank_0)
+    {
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
     
     //check to make sure current app is valid
     if(bootloader_settings.bank_0 != BANK_VALID_APP)
@@ -364,7 +681,17 @@ static void fstorage_callback_handler(uint32_t address,
         switch (op_code)
         {
             case FSTORAGE_STORE_OP_CODE:
-                if (m_dfu_state == DFU_STATE_RX_DATA_PKT) {
+                if (p_data == &m_checkpoint) {
+                    m_checkpoint_busy = false;
+                }
+                else if (stage_release(p_data)) {
+                    /* The packets in it were already released when
+                       they were staged; only report failures */
+                    if (result != NRF_SUCCESS &&
+                        m_dfu_state == DFU_STATE_RX_DATA_PKT)
+                        m_data_pkt_cb(DATA_PACKET, result, NULL);
+                }
+                else if (m_dfu_state == DFU_STATE_RX_DATA_PKT) {
                     m_data_pkt_cb(DATA_PACKET, result, (uint8_t *)p_data);
                 }
                 else if (m_dfu_state == DFU_STATE_CONFIGURING) {
@@ -374,7 +701,10 @@ static void fstorage_callback_handler(uint32_t address,
                     m_data_pkt_cb(CONFIG_PACKET, result, (uint8_t *)p_data);
                 }
                 else if (m_dfu_state == DFU_STATE_RX_PATCH_PKT) {
-                    m_data_pkt_cb(PATCH_DATA_PACKET, result, (uint8_t *)p_data);
+                    /* Only resume the patcher if it stalled on this write */
+                    if (patcher_store_complete() || result != NRF_SUCCESS) {
+                        m_data_pkt_cb(PATCH_DATA_PACKET, result, (uint8_t *)p_data);
+                    }
                 }
                 break;
 
@@ -382,17 +712,9 @@ static void fstorage_callback_handler(uint32_t address,
                 if (m_dfu_state == DFU_STATE_PREPARING &&
                     address == DFU_BANK_0_REGION_START)
                 {
-                    dfu_update_status_t update_status = {DFU_BANK_0_ERASED, };
-                    bootloader_dfu_update_process(update_status);
-
                     m_dfu_state = DFU_STATE_RDY;
                     m_data_pkt_cb(START_PACKET, result, (uint8_t *)p_data);
                 }
-                else if(m_dfu_state == DFU_STATE_RESTART)
-                {                    
-                    m_dfu_state = DFU_STATE_IDLE;
-                    m_data_pkt_cb(RESTART_PACKET, result, (uint8_t *)p_data);
-                }
                 break;
 
             default:
@@ -436,31 +758,73 @@ uint32_t offset_calculate(uint32_t sd_image_size)
 
 /**@brief   Function for preparing of flash before receiving SoftDevice image.
  *
- * @details This function will erase current application area to ensure sufficient amount of
- *          storage for the SoftDevice image. Upon erase complete a callback will be done.
- *          See \ref dfu_bank_prepare_t for further details.
+ * @details This function will invalidate the current application, as the SoftDevice image is
+ *          stored over it. Only its first page, holding the vector table, is erased here; the
+ *          rest is erased as the image is written, see \ref bank_store. Upon erase complete a
+ *          callback will be done. See \ref dfu_bank_prepare_t for further details.
  */
 static void dfu_prepare_func_app_erase(uint32_t image_size)
 {
     uint32_t err_code;
+    dfu_update_status_t update_status = {DFU_BANK_0_ERASED, };
 
     target_base_address = DFU_BANK_0_REGION_START;
+    m_erase_next = DFU_BANK_0_REGION_START + CODE_PAGE_SIZE;
+
+    // Current application must be marked invalid before it's overwritten. fstorage runs
+    // in order, so the settings are saved by the time the erase callback arrives.
+    bootloader_dfu_update_process(update_status);
 
-    // Current application must be cleared for the SoftDevice
     m_dfu_state = DFU_STATE_PREPARING;
     err_code = fstorage_clear(FSTORAGE_DFU,
-                              DFU_BANK_0_REGION_START, m_image_size);
+                              DFU_BANK_0_REGION_START, CODE_PAGE_SIZE);
     APP_ERROR_CHECK(err_code);
 }
 
+/**@brief   Function for checking whether the current application reaches into bank 1, which
+ *          is only possible if it was received in place.
+ */
+static bool bank_0_overlaps_bank_1(void)
+{
+    bootloader_settings_t bootloader_settings;
+    bootloader_settings_get(&bootloader_settings);
+
+    return bootloader_settings.bank_0 == BANK_VALID_APP &&
+           bootloader_settings.bank_0_size > DFU_APP_IMAGE_MAX_SIZE_BANKED;
+}
+
+/**@brief   Function for preparing before receiving an application image in place.
+ *
+ * @details Like the swap area, bank 0 is erased as the image is written, see \ref bank_store.
+ *          The current application is only invalidated when the first image data arrives, see
+ *          \ref dfu_data_pkt_handle, so that a patch, which can't be written in place, is
+ *          refused before anything is touched.
+ */
+static void dfu_prepare_func_app_in_place(uint32_t image_size)
+{
+    target_base_address = DFU_BANK_0_REGION_START;
+    m_erase_next = 0;
+    m_invalidate_bank_0 = true;
+    m_in_place = true;
+
+    m_dfu_state = DFU_STATE_RDY;
+
+    if (m_data_pkt_cb != NULL)
+    {
+        // Nothing to wait for. Issue callback immediately.
+        m_data_pkt_cb(START_PACKET, NRF_SUCCESS, NULL);
+    }
+}
+
 /**@brief   Function for preparing before receiving application or bootloader image.
  *
- * @details As swap area is prepared during init then this function only update current state and\
- *          issue a callback.
+ * @details The swap area is erased as the image is written, see \ref bank_store, so this
+ *          function only updates current state and issues a callback.
  */
 static void dfu_prepare_func(uint32_t image_size)
 {
     target_base_address = DFU_BANK_1_REGION_START;
+    m_erase_next = 0;
 
     m_dfu_state = DFU_STATE_RDY;
     
@@ -519,10 +883,18 @@ static uint32_t dfu_activate_app(void)
                               m_start_packet.app_image_size);
     APP_ERROR_CHECK(err_code);
 
+    // Copy the initial stack pointer and reset vector last, so that a copy cut short by a
+    // reset leaves no vector table to start a partial image from.
+    err_code = fstorage_store(FSTORAGE_DFU,
+                              DFU_BANK_0_REGION_START + APP_VECTOR_HEAD_SIZE,
+                              (uint8_t *)DFU_BANK_1_REGION_START + APP_VECTOR_HEAD_SIZE,
+                              m_start_packet.app_image_size - APP_VECTOR_HEAD_SIZE);
+    APP_ERROR_CHECK(err_code);
+
     err_code = fstorage_store(FSTORAGE_DFU,
                               DFU_BANK_0_REGION_START,
                               (uint8_t *)DFU_BANK_1_REGION_START,
-                              m_start_packet.app_image_size);
+                              APP_VECTOR_HEAD_SIZE);
 
     if (err_code == NRF_SUCCESS)
     {
@@ -530,6 +902,10 @@ static uint32_t dfu_activate_app(void)
 
         update_status.status_code = DFU_UPDATE_APP_COMPLETE;
         update_status.app_size    = m_start_packet.app_image_size;
+        // The last writes to bank 1 may still be queued, so take the CRC of the data that
+        // went to it rather than reading it back.
+        update_status.app_crc     = m_is_patching ? m_patch_init_packet.patch_crc
+                                                  : crc32_final(m_image_crc);
 
         bootloader_dfu_update_process(update_status);
     }
@@ -538,6 +914,35 @@ static uint32_t dfu_activate_app(void)
 }
 
 
+/**@brief Function for activating an Application image received straight into bank 0.
+ *
+ *  @details The image is already in place but for its vector head, which is written now, after
+ *           the rest of it. fstorage runs in order, so the settings are saved after that.
+ *
+ * @return NRF_SUCCESS on success. Error code otherwise.
+ */
+static uint32_t dfu_activate_app_in_place(void)
+{
+    uint32_t            err_code;
+    dfu_update_status_t update_status;
+
+    err_code = fstorage_store(FSTORAGE_DFU, DFU_BANK_0_REGION_START,
+                              (uint8_t *)m_vector_head, APP_VECTOR_HEAD_SIZE);
+    if (err_code != NRF_SUCCESS)
+    {
+        return err_code;
+    }
+
+    update_status.status_code = DFU_UPDATE_APP_COMPLETE;
+    update_status.app_size    = m_start_packet.app_image_size;
+    update_status.app_crc     = crc32_final(m_image_crc);
+
+    bootloader_dfu_update_process(update_status);
+
+    return NRF_SUCCESS;
+}
+
+
 /**@brief Function for activating received Bootloader image.
  *
  *  @note This function will not move the bootloader image.
@@ -567,34 +972,34 @@ uint32_t dfu_init(dfu_state_t new_state)
     dfu_update_status_t     update_status;
 
     err_code = fstorage_register(FSTORAGE_DFU, fstorage_callback_handler);
+    if (err_code != NRF_SUCCESS)
+    {
+        m_dfu_state = DFU_STATE_INIT_ERROR;
+        return err_code;
+    }
 
     m_dfu_state = new_state;
     
-    /* Check / clear swap area */
+    /* Invalidate swap area.  Its pages are erased as an image is
+       written to it, see bank_store. */
     bootloader_settings_get(&bootloader_settings);
-    if ((bootloader_settings.bank_1 != BANK_ERASED) ||
-        (*(uint32_t *)DFU_BANK_1_REGION_START != EMPTY_FLASH_MASK))
+    if (bootloader_settings.bank_1 != BANK_ERASED)
     {
-        err_code = fstorage_clear(FSTORAGE_DFU,
-                                  DFU_BANK_1_REGION_START,
-                                  DFU_IMAGE_MAX_SIZE_BANKED);
-        if (err_code != NRF_SUCCESS)
-        {
-            m_dfu_state = DFU_STATE_INIT_ERROR;
-            return err_code;
-        }
-
         update_status.status_code = DFU_BANK_1_ERASED;
         bootloader_dfu_update_process(update_status);
     }
-    else if(m_dfu_state == DFU_STATE_RESTART)
+
+    if (m_dfu_state == DFU_STATE_RESTART)
     {
         m_dfu_state = DFU_STATE_IDLE;
         m_data_pkt_cb(RESTART_PACKET, NRF_SUCCESS, NULL);
     }
 
-    m_data_received = 0;
-    m_is_patching   = false;
+    m_data_received     = 0;
+    m_is_patching       = false;
+    m_invalidate_bank_0 = false;
+    m_in_place          = false;
+    DFU_PROFILE_RESET();
 
     return NRF_SUCCESS;
 }
@@ -658,6 +1063,8 @@ uint32_t dfu_start_pkt_handle(dfu_update_packet_t * p_packet)
         return err_code;
 
     /* Got the full start packet; validate and configure */
+    m_invalidate_bank_0 = false;
+    m_in_place = false;
 
     if (IS_UPDATING_APP(m_start_packet) &&
         (IS_UPDATING_SD(m_start_packet) || IS_UPDATING_BL(m_start_packet)))
@@ -682,6 +1089,13 @@ uint32_t dfu_start_pkt_handle(dfu_update_packet_t * p_packet)
         return NRF_ERROR_DATA_SIZE;
     }
 
+    if (DFU_SINGLE_BANK_APP && !IS_UPDATING_APP(m_start_packet) && bank_0_overlaps_bank_1())
+    {
+        // SoftDevice and bootloader images would be written over the end of the current
+        // application. Only an application update can replace it.
+        return NRF_ERROR_NOT_SUPPORTED;
+    }
+
     if (IS_UPDATING_SD(m_start_packet))
     {
         if (m_image_size > (DFU_IMAGE_MAX_SIZE_FULL - CODE_PAGE_SIZE))
@@ -692,6 +1106,19 @@ uint32_t dfu_start_pkt_handle(dfu_update_packet_t * p_packet)
         m_functions.prepare  = dfu_prepare_func_app_erase;
         m_functions.activate = dfu_activate_sd;
     }
+    else if (DFU_SINGLE_BANK_APP && IS_UPDATING_APP(m_start_packet) &&
+             (m_image_size > DFU_APP_IMAGE_MAX_SIZE_BANKED || bank_0_overlaps_bank_1()))
+    {
+        // Too big for bank 1, or bank 1 would overwrite the end of the current application:
+        // write it in place instead.
+        if (m_image_size > DFU_APP_IMAGE_MAX_SIZE || m_image_size < APP_VECTOR_HEAD_SIZE)
+        {
+            return NRF_ERROR_DATA_SIZE;
+        }
+
+        m_functions.prepare  = dfu_prepare_func_app_in_place;
+        m_functions.activate = dfu_activate_app_in_place;
+    }
     else
     {
         if (m_image_size > DFU_IMAGE_MAX_SIZE_BANKED)
@@ -706,6 +1133,12 @@ uint32_t dfu_start_pkt_handle(dfu_update_packet_t * p_packet)
         }
         else
         {
+            if (m_image_size > DFU_APP_IMAGE_MAX_SIZE_BANKED ||
+                m_image_size < APP_VECTOR_HEAD_SIZE)
+            {
+                return NRF_ERROR_DATA_SIZE;
+            }
+
             m_functions.activate = dfu_activate_app;
 //            if(IS_PATCHING(m_start_packet))
 //            {
@@ -749,7 +1182,18 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
     switch (m_dfu_state)
     {
         case DFU_STATE_INIT_PKT_DONE:
+            if (m_invalidate_bank_0)
+            {
+                // Writing in place: current application must be marked invalid before it's
+                // overwritten. fstorage runs in order, so this is saved before any image data.
+                dfu_update_status_t update_status = {DFU_BANK_0_ERASED, };
+
+                m_invalidate_bank_0 = false;
+                bootloader_dfu_update_process(update_status);
+            }
             m_dfu_state = DFU_STATE_RX_DATA_PKT;
+            m_stage_len = 0;
+            m_stage_idx = 0;
             //fall through - if not performing a patch
         case DFU_STATE_RX_DATA_PKT:
             
@@ -776,17 +1220,45 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
 
             p_data = (uint8_t *)p_packet->params.data_packet.p_data_packet;
 
+            m_data_crc = crc32_update(m_data_crc, p_data, data_length);
             if (m_decrypt) {
                 err_code = decrypt_data(p_data, data_length);
                 if (err_code != NRF_SUCCESS)
                     return err_code;
+                m_image_crc = crc32_update(m_image_crc, p_data, data_length);
+            } else {
+                m_image_crc = m_data_crc;
             }
 
-            //TODO: Insert patching code here??
-            //Need to determine if system is sending a patch file or full firmware image
-            err_code = fstorage_store(FSTORAGE_DFU,
-                                      target_base_address + m_data_received,
-                                      p_data, data_length);
+            if (m_in_place && m_data_received < APP_VECTOR_HEAD_SIZE)
+            {
+                // Hold the vector head back until activation, leaving it blank for now.
+                uint32_t head_length = MIN(data_length, APP_VECTOR_HEAD_SIZE - m_data_received);
+
+                memcpy((uint8_t *)m_vector_head + m_data_received, p_data, head_length);
+                memset(p_data, 0xFF, head_length);
+            }
+
+            err_code = stage_data(p_data, data_length);
+            if (err_code == NRF_SUCCESS)
+            {
+                // Packet was copied; the transport can reuse its buffer.
+                if (m_data_pkt_cb != NULL)
+                {
+                    m_data_pkt_cb(DATA_PACKET, NRF_SUCCESS, p_data);
+                }
+            }
+            else if (err_code == NRF_ERROR_NO_MEM)
+            {
+                // Flash is behind. Write out what is staged, then this packet directly from
+                // the transport's buffer; the fstorage callback releases it.
+                err_code = stage_flush(m_data_received);
+                if (err_code == NRF_SUCCESS)
+                {
+                    err_code = bank_store(target_base_address + m_data_received,
+                                          p_data, data_length);
+                }
+            }
             if (err_code != NRF_SUCCESS)
             {
                 return err_code;
@@ -797,6 +1269,7 @@ uint32_t dfu_data_pkt_handle(dfu_update_packet_t * p_packet)
             if (m_data_received != m_image_size)
             {
                 // The entire image is not received yet. More data is expected.
+                checkpoint_save();
                 err_code = NRF_ERROR_INVALID_LENGTH;
             }
             else
@@ -837,7 +1310,113 @@ uint32_t dfu_init_pkt_handle(dfu_update_packet_t * p_packet)
         return err_code;
 
     /* Have the full packet, process it */
-    return decrypt_prepare();
+    err_code = decrypt_prepare();
+    if (err_code == NRF_SUCCESS)
+        checkpoint_open();
+
+    return err_code;
+}
+
+uint32_t dfu_resume_offset_get(uint32_t * p_offset, uint32_t * p_crc)
+{
+    if (m_dfu_state != DFU_STATE_INIT_PKT_DONE || IMAGE_WRITE_IN_PROGRESS())
+        return NRF_ERROR_INVALID_STATE;
+
+    if (mp_resume == NULL)
+    {
+        *p_offset = 0;
+        *p_crc    = crc32_final(crc32_init());
+    }
+    else
+    {
+        *p_offset = mp_resume->offset;
+        *p_crc    = crc32_final(mp_resume->data_crc);
+    }
+    return NRF_SUCCESS;
+}
+
+uint32_t dfu_resume(uint32_t offset, uint32_t crc)
+{
+    const dfu_checkpoint_t * p_checkpoint = mp_resume;
+    uint32_t err_code;
+    uint32_t erase;
+    uint32_t page;
+    uint32_t stage;
+
+    if (m_dfu_state != DFU_STATE_INIT_PKT_DONE || IMAGE_WRITE_IN_PROGRESS())
+        return NRF_ERROR_INVALID_STATE;
+
+    if (offset == 0 && crc == crc32_final(crc32_init()))
+        return NRF_SUCCESS;
+
+    if (p_checkpoint == NULL ||
+        p_checkpoint->offset != offset ||
+        crc32_final(p_checkpoint->data_crc) != crc ||
+        offset > m_image_size)
+        return NRF_ERROR_INVALID_DATA;
+
+    // Bank 1 must still hold the image up to the checkpoint; starting the
+    // same transfer over erases it.
+    if (crc32((uint8_t *)target_base_address, offset) !=
+        crc32_final(p_checkpoint->image_crc))
+        return NRF_ERROR_INVALID_DATA;
+
+    if (m_stage_busy[0] || m_stage_busy[1])
+        return NRF_ERROR_BUSY;
+
+    /* The interrupted transfer may have written past the checkpoint in
+       its page, so the page is erased and its start written again: the
+       part before the current staging buffer now, and the rest with
+       the staging buffer.  Pages are in flash addresses; bank 1 need
+       only start on a staging boundary. */
+    erase = (target_base_address + offset) & ~(CODE_PAGE_SIZE - 1);
+    page  = MAX(erase, target_base_address) - target_base_address;
+    stage = offset - (offset % DFU_STAGE_SIZE);
+    if (stage < page || stage - page > DFU_STAGE_SIZE)
+        return NRF_ERROR_INVALID_DATA;
+
+    m_erase_next = erase;
+    m_stage_idx  = 0;
+    m_stage_len  = 0;
+
+    if (stage > page)
+    {
+        memcpy(STAGE_BUF(1), (uint8_t *)(target_base_address + page), stage - page);
+        m_stage_busy[1] = true;
+        err_code = bank_store(target_base_address + page, STAGE_BUF(1), stage - page);
+        if (err_code != NRF_SUCCESS)
+        {
+            m_stage_busy[1] = false;
+            return err_code;
+        }
+    }
+
+    if (m_decrypt)
+    {
+        // Start EAX over, which also drops any keystream read ahead, then
+        // move it on to the checkpoint.
+        err_code = decrypt_prepare();
+        if (err_code != NRF_SUCCESS)
+            return err_code;
+
+        memcpy(m_eax.ctr.ctr, p_checkpoint->ctr, 16);
+        memcpy(m_eax.ctr.pad, p_checkpoint->pad, 16);
+        memcpy(m_eax.ctomac.prev, p_checkpoint->omac_prev, 16);
+        memcpy(m_eax.ctomac.block, p_checkpoint->omac_block, 16);
+        m_eax.ctr.padlen    = p_checkpoint->padlen;
+        m_eax.ctomac.buflen = p_checkpoint->buflen;
+    }
+
+    memcpy(STAGE_BUF(0), (uint8_t *)(target_base_address + stage), offset - stage);
+    m_stage_len = offset - stage;
+
+    m_data_received  = offset;
+    m_data_crc       = p_checkpoint->data_crc;
+    m_image_crc      = p_checkpoint->image_crc;
+    m_checkpoint_due = offset + checkpoint_interval();
+    m_dfu_state      = DFU_STATE_RX_DATA_PKT;
+
+    return NRF_SUCCESS;
 }
 
 uint32_t dfu_patch_init_pkt_handle(dfu_update_packet_t * p_packet)
@@ -948,11 +1527,24 @@ uint32_t dfu_image_validate()
     if (err_code != NRF_SUCCESS)
         return err_code;
 
+    // Write out the last, partial, staging buffer.
+    if (!validate_patch)
+    {
+        err_code = stage_flush(m_data_received);
+        if (err_code != NRF_SUCCESS)
+            return err_code;
+    }
+
     // Finish EAX cipher, and check that the tag in m_init_packet matches,
     // if we were decrypting.
     err_code = decrypt_validate();
     if (err_code != NRF_SUCCESS)
+    {
+        // Don't let the host resume into the same failure.
+        if (target_base_address == DFU_BANK_1_REGION_START && m_checkpoint_next > 0)
+            checkpoint_clear();
         return NRF_ERROR_INVALID_DATA;
+    }
     
     if(validate_patch)
     {
@@ -39,6 +39,7 @@
 #include "ble_flash.h"
 #include "ble_conn_params.h"
 #include "hci_mem_pool_ble.h"
+#include "hci_mem_pool_internal.h"
 #include "bootloader.h"
 #include "ble_dis.h"
 #include "rigdfu_serial.h"
@@ -108,7 +109,8 @@ static ble_gap_conn_params_t m_preferred_conn_params;
 static bool                 m_is_patch_complete       = false;
 
 #ifdef SDK12
-static uint16_t             client_rx_mtu = 20;
+static uint16_t             client_rx_mtu = BLE_L2CAP_MTU_DEF - 3;
+static uint16_t             m_att_mtu     = BLE_GAP_MTU_MAX;                                         /**< ATT MTU the SoftDevice was enabled with. */
 #endif
 
 static void patch_data_process(ble_dfu_t * p_dfu, ble_dfu_evt_t * p_evt);
@@ -116,12 +118,19 @@ static void patch_data_process(ble_dfu_t * p_dfu, ble_dfu_evt_t * p_evt);
 #ifdef SDK12
 /**@brief     Accessor to the client_rx_mtu
  *
- * @details		client_rx_mtu is the value the client offered in the MTU negotiation
+ * @details		client_rx_mtu is the negotiated ATT MTU less the write header. The value
+ *            returned is the largest DFU data write we accept: it must fit in one RX
+ *            buffer and be a multiple of 4, so e.g. an MTU of 185 gives 180, not 182.
  *
  */
-uint8_t get_client_rx_mtu()
+uint16_t get_client_rx_mtu()
 {
-	return (uint8_t) client_rx_mtu;
+	return DFU_BLE_MAX_WRITE(client_rx_mtu + 3);
+}
+
+void dfu_transport_ble_att_mtu_set(uint16_t att_mtu)
+{
+    m_att_mtu = att_mtu;
 }
 #endif
 
@@ -154,7 +163,9 @@ static ble_dfu_resp_val_t nrf_err_code_translate(uint32_t                  err_c
             return BLE_DFU_RESP_VAL_DATA_SIZE;
 
         case NRF_ERROR_INVALID_DATA:
-            if (current_dfu_proc == BLE_DFU_VALIDATE_PROCEDURE || current_dfu_proc == BLE_DFU_PATCH_INIT_PROCEDURE)
+            if (current_dfu_proc == BLE_DFU_VALIDATE_PROCEDURE ||
+                current_dfu_proc == BLE_DFU_PATCH_INIT_PROCEDURE ||
+                current_dfu_proc == BLE_DFU_RESUME_PROCEDURE)
             {
                 // When this error is received in Validation phase, then it maps to a CRC Error.
                 // Refer dfu_image_validate function for more information.
@@ -628,6 +639,36 @@ static void on_dfu_evt(ble_dfu_t * p_dfu, ble_dfu_evt_t * p_evt)
             m_pkt_type = PKT_TYPE_START;
             break;
 
+        case BLE_DFU_RESUME_QUERY:
+        {
+            uint32_t offset = 0;
+            uint32_t crc    = 0;
+
+            err_code = dfu_resume_offset_get(&offset, &crc);
+            err_code = ble_dfu_resume_response_send(p_dfu,
+                                                    nrf_err_code_translate(err_code, BLE_DFU_RESUME_PROCEDURE),
+                                                    offset,
+                                                    crc);
+            APP_ERROR_CHECK(err_code);
+            break;
+        }
+
+        case BLE_DFU_RESUME:
+            // The peer follows this with RECEIVE_APP_DATA, as for a new transfer.
+            err_code = dfu_resume(p_evt->evt.resume.offset, p_evt->evt.resume.crc);
+            if (err_code == NRF_SUCCESS)
+            {
+                m_num_of_firmware_bytes_rcvd = p_evt->evt.resume.offset;
+                m_pkt_notif_target_cnt       = m_pkt_notif_target;
+            }
+
+            err_code = ble_dfu_resume_response_send(p_dfu,
+                                                    nrf_err_code_translate(err_code, BLE_DFU_RESUME_PROCEDURE),
+                                                    p_evt->evt.resume.offset,
+                                                    p_evt->evt.resume.crc);
+            APP_ERROR_CHECK(err_code);
+            break;
+
         case BLE_DFU_RECEIVE_INIT_DATA:
             m_pkt_type = PKT_TYPE_INIT;
             break;
@@ -712,6 +753,9 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
             bootloader_timeout_reset_on_first_connect();
             m_conn_handle    = p_ble_evt->evt.gap_evt.conn_handle;
             m_is_advertising = false;
+#ifdef SDK12
+            client_rx_mtu    = BLE_L2CAP_MTU_DEF - 3;
+#endif
             break;
 
         case BLE_GAP_EVT_DISCONNECTED:
@@ -753,9 +797,9 @@ static void on_ble_evt(ble_evt_t * p_ble_evt)
 #ifdef SDK12
         case BLE_GATTS_EVT_EXCHANGE_MTU_REQUEST:
             {
-                client_rx_mtu = p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu - 3;
-                client_rx_mtu = MIN(client_rx_mtu, BLE_GAP_MTU_MAX - 3);
-                err_code = sd_ble_gatts_exchange_mtu_reply(p_ble_evt->evt.gatts_evt.conn_handle, BLE_GAP_MTU_MAX);
+                client_rx_mtu = p_ble_evt->evt.gatts_evt.params.exchange_mtu_request.client_rx_mtu;
+                client_rx_mtu = DFU_BLE_MTU(client_rx_mtu, m_att_mtu) - 3;
+                err_code = sd_ble_gatts_exchange_mtu_reply(p_ble_evt->evt.gatts_evt.conn_handle, m_att_mtu);
                 APP_ERROR_CHECK(err_code);
             }
             break;
@@ -2,10 +2,29 @@
 #define DFU_TRANSPORT_BLE
 
 #include <stdint.h>
+#include "hci_mem_pool_internal.h"
+
+/* The ATT MTU to enable the SoftDevice with if it has no RAM for
+   BLE_GAP_MTU_MAX below the bootloader's RAM start: the MTU the
+   bootloader used before, which ran from 0x20002c00. */
+#define DFU_BLE_ATT_MTU_FALLBACK        131
+
+/* The ATT MTU of a link, from the client's MTU and the one the
+   SoftDevice was enabled with */
+#define DFU_BLE_MTU(client_mtu, att_mtu) \
+    MIN(MAX((client_mtu), BLE_L2CAP_MTU_DEF), (att_mtu))
+
+/* The largest DFU data write taken over an ATT MTU: it must fit in one
+   RX buffer and be a multiple of 4 */
+#define DFU_BLE_MAX_WRITE(mtu) \
+    (MIN((mtu) - 3, BLE_RX_BUF_SIZE) & ~(sizeof(uint32_t) - 1))
 
 uint32_t dfu_transport_update_start_ble(void);
 uint32_t dfu_transport_close_ble(void);
 
-uint8_t get_client_rx_mtu(void);
+uint16_t get_client_rx_mtu(void);
+
+/* The ATT MTU the SoftDevice was enabled with, BLE_GAP_MTU_MAX until set */
+void dfu_transport_ble_att_mtu_set(uint16_t att_mtu);
 
 #endif
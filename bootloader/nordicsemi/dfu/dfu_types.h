@@ -87,6 +87,30 @@
 
 #define DFU_BANK_0_REGION_START         CODE_REGION_1_START                                             /**< Bank 0 region start. */
 #define DFU_BANK_1_REGION_START         (DFU_BANK_0_REGION_START + DFU_IMAGE_MAX_SIZE_BANKED)           /**< Bank 1 region start. */
+#define DFU_APP_IMAGE_MAX_SIZE_BANKED   ((DFU_BANK_1_REGION_START & ~(CODE_PAGE_SIZE - 1)) - \
+                                         DFU_BANK_0_REGION_START)                                       /**< Maximum size of an application received into bank 1. Bank 1 may start mid-page, and the page it starts in is erased with it. */
+
+/* Optional single-bank mode.  If DFU_SINGLE_BANK_APP is 1, an
+   application larger than DFU_APP_IMAGE_MAX_SIZE_BANKED is received
+   straight into bank 0, up to DFU_IMAGE_MAX_SIZE_FULL, as is any
+   application while the current one reaches into bank 1.  The current
+   application is invalidated with the first image data, and the new
+   one's vector table is written last, so the device stays in the
+   bootloader until the new one is complete; there is
+   nothing to fall back to if the transfer fails.  Patches, and
+   SoftDevice or bootloader updates while the current application
+   reaches into bank 1, are refused. */
+#ifndef DFU_SINGLE_BANK_APP
+#define DFU_SINGLE_BANK_APP             0
+#endif
+
+#if DFU_SINGLE_BANK_APP
+#define DFU_APP_IMAGE_MAX_SIZE          DFU_IMAGE_MAX_SIZE_FULL                                         /**< Maximum size of an application. */
+#else
+#define DFU_APP_IMAGE_MAX_SIZE          DFU_APP_IMAGE_MAX_SIZE_BANKED                                   /**< Maximum size of an application. */
+#endif
+#define DFU_PATCH_BUFFER_SIZE           4096                                                            /**< Patch output buffer; also the two staging buffers of a full image. */
+
 #define EMPTY_FLASH_MASK                0xFFFFFFFF                                                      /**< Bit mask that defines an empty address in flash. */
 
 /* Packet identifiers, used for data packet callbacks, and also by the
@@ -199,6 +223,7 @@ typedef struct
     uint32_t                 bl_size;                                                                   /**< Size of the recieved BootLoader. */
     uint32_t                 app_size;                                                                  /**< Size of the recieved Application. */
     uint32_t                 sd_image_start;                                                            /**< Location in flash where the received SoftDevice image is stored. */
+    uint32_t                 app_crc;                                                                   /**< CRC32 of the recieved Application. */
 } dfu_update_status_t;
 
 /**@brief Update complete handler type. */
@@ -8,8 +8,15 @@
 
 /* BLE transport wants: */
 #define BLE_TX_BUF_SIZE 4u
+#ifdef SDK12
+/* One buffer holds a whole write at the largest ATT MTU (BLE_GAP_MTU_MAX - 3).
+   Buffers are released as soon as the data is staged, so 16 is plenty. */
+#define BLE_RX_BUF_SIZE 244u
+#define BLE_RX_BUF_QUEUE_SIZE 16u
+#else
 #define BLE_RX_BUF_SIZE 128u
 #define BLE_RX_BUF_QUEUE_SIZE 32u
+#endif
 
 /* Used by main.c to verify that we got the right copy of this file,
    since there are a few scattered around the SDK tree. */
@@ -363,7 +363,7 @@ enum BLE_GAP_OPTS
 #define BLE_GAP_SEC_STATUS_RFU_RANGE2_END         0xFF  /**< Reserved for Future Use range #2 end. */
 /**@} */
 
-#define BLE_GAP_MTU_MAX                           131
+#define BLE_GAP_MTU_MAX                           247
 
 /**@defgroup BLE_GAP_SEC_STATUS_SOURCES GAP Security status sources
  * @{ */
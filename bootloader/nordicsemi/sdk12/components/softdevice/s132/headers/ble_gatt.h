@@ -54,7 +54,7 @@ extern "C" {
  * @{ */
 
 /** @brief Default MTU size, in bytes. */
-#define GATT_MTU_SIZE_DEFAULT 131
+#define GATT_MTU_SIZE_DEFAULT 247
 
 /**@brief Invalid Attribute Handle. */
 #define BLE_GATT_HANDLE_INVALID            0x0000
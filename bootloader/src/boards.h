@@ -26,4 +26,19 @@
    used. */
 #define HWFC true
 
+/* DFU pin.  If DFU_PIN_NUMBER is defined, a reset with a valid
+   application starts it straight away, before the SoftDevice is
+   initialized, unless the pin reads DFU_PIN_ACTIVE; the DFU window is
+   then only opened on request.  Without it, every reset opens the DFU
+   window for a couple of seconds, which is how applications without
+   DFU support are updated.
+
+   The fast start is opt-in, and off in this build: modules ship to
+   boards that have no DFU pin, and applications that can't enter DFU
+   themselves would never be updatable again.  Define DFU_PIN_NUMBER
+   for a board that wires one up.  A start request in GPREGRET
+   (BOOTLOADER_APP_START_MIN..MAX) skips the window either way. */
+/* #define DFU_PIN_NUMBER 17 */
+#define DFU_PIN_ACTIVE 0
+
 #endif
@@ -61,6 +61,8 @@
 #endif
 
 #include "rigdfu_serial.h"
+#include "dfu_transport_serial.h"
+#include "dfu_transport_ble.h"
 #include "nrf_delay.h"
 #include "version.h"
 #include "rigdfu.h"
@@ -81,6 +83,36 @@
 
 #define TICKS_FROM_MSEC(x) APP_TIMER_TICKS(x, APP_TIMER_PRESCALER)
 
+/* Without a DFU pin, every reset opens the DFU window */
+#ifdef DFU_PIN_NUMBER
+#define DFU_WINDOW_ON_RESET             false
+#else
+#define DFU_WINDOW_ON_RESET             true
+#endif
+
+/* RAM budget.  The bootloader gets RAM from the IRAM1 start in
+   bootloader.uvprojx, which must be at least the app_ram_base that
+   sd_ble_enable reports for the BLE settings in ble_stack_init, to the
+   end of RAM; these are the smallest sizes of the targets for each
+   chip.  The stack (arm_startup_nrf5x.s, without __STACK_SIZE) and the
+   largest buffers must fit, with room for everything else. */
+#if defined(NRF52) && defined(SDK12)
+#define BOOTLOADER_RAM_SIZE             0xC000                                                  /**< From 0x20003000, for att_mtu 247. */
+#elif defined(NRF52)
+#define BOOTLOADER_RAM_SIZE             0x7800
+#else
+#define BOOTLOADER_RAM_SIZE             0x5800
+#endif
+#define BOOTLOADER_STACK_SIZE           8192
+#define BOOTLOADER_RAM_OTHER            4096                                                    /**< Heatshrink, EAX, SoftDevice events, scheduler and the rest. */
+
+STATIC_ASSERT(BOOTLOADER_STACK_SIZE +
+              RIGDFU_SERIAL_RX_SIZE +
+              sizeof(serial_frame_t) +
+              DFU_PATCH_BUFFER_SIZE +
+              BLE_RX_BUF_SIZE * BLE_RX_BUF_QUEUE_SIZE +
+              BOOTLOADER_RAM_OTHER <= BOOTLOADER_RAM_SIZE);
+
 #ifdef SDK10
 /**@brief Function for error handling, which is called when an error has occurred. 
  *
@@ -210,14 +242,40 @@ static void ble_stack_init(bool init_softdevice)
     ble_enable_params_t ble_enable_params;
     // Only one connection as a central is used when performing dfu.
     err_code = softdevice_enable_get_default_config(0, 1, &ble_enable_params);
+    APP_ERROR_CHECK(err_code);
 #ifdef SDK12
     ble_enable_params.gatt_enable_params.att_mtu = BLE_GAP_MTU_MAX;
 #endif
-    APP_ERROR_CHECK(err_code);
 
+    // softdevice_enable passes the IRAM1 start to sd_ble_enable, which
+    // fails with NRF_ERROR_NO_MEM and the app_ram_base it needs if it is
+    // too low; see BOOTLOADER_RAM_SIZE.
     ble_enable_params.gatts_enable_params.service_changed = IS_SRVC_CHANGED_CHARACT_PRESENT;
     err_code = softdevice_enable(&ble_enable_params);
+#ifdef SDK12
+    // The RAM S132 needs for an att_mtu of 247 hasn't been measured on
+    // every SoftDevice build we ship with.  Rather than reset on every
+    // boot if 0x20003000 is too low, fall back to the MTU the old RAM
+    // start was known to fit; DFU then runs with smaller packets.
+    if (err_code == NRF_ERROR_NO_MEM)
+    {
+        ble_enable_params.gatt_enable_params.att_mtu = DFU_BLE_ATT_MTU_FALLBACK;
+        err_code = softdevice_enable(&ble_enable_params);
+    }
+#endif
     APP_ERROR_CHECK(err_code);
+
+#ifdef SDK12
+    dfu_transport_ble_att_mtu_set(ble_enable_params.gatt_enable_params.att_mtu);
+
+    // Allow link layer packets large enough to carry a whole ATT_MTU write
+    // (4 bytes of L2CAP header), so a DFU packet is not fragmented on air.
+    ble_opt_t ble_opt;
+    memset(&ble_opt, 0, sizeof(ble_opt));
+    ble_opt.gap_opt.ext_len.rxtx_max_pdu_payload_size = ble_enable_params.gatt_enable_params.att_mtu + 4;
+    err_code = sd_ble_opt_set(BLE_GAP_OPT_EXT_LEN, &ble_opt);
+    APP_ERROR_CHECK(err_code);
+#endif
     
     err_code = softdevice_sys_evt_handler_set(sys_evt_dispatch);
     APP_ERROR_CHECK(err_code);
@@ -252,6 +310,27 @@ static void update_readback_protection(void)
 static void update_readback_protection(void) {}
 #endif
 
+/**@brief Function for checking the DFU pin, if there is one.
+ *
+ * @return true if the pin is held at DFU_PIN_ACTIVE.
+ */
+static bool dfu_pin_asserted(void)
+{
+#ifdef DFU_PIN_NUMBER
+    bool asserted;
+
+    nrf_gpio_cfg_input(DFU_PIN_NUMBER, DFU_PIN_ACTIVE ? NRF_GPIO_PIN_PULLDOWN
+                                                      : NRF_GPIO_PIN_PULLUP);
+    nrf_delay_us(10); // Let the pull settle.
+    asserted = (nrf_gpio_pin_read(DFU_PIN_NUMBER) == DFU_PIN_ACTIVE);
+    nrf_gpio_cfg_default(DFU_PIN_NUMBER);
+
+    return asserted;
+#else
+    return false;
+#endif
+}
+
 /**@brief Function for bootloader main entry.
  */
 int main(void)
@@ -270,16 +349,20 @@ int main(void)
     
     bool triggered_from_app = false;
     bool force_uart_init = false;
+    bool dfu_pin = dfu_pin_asserted();
     
     gpregret = NRF_POWER->GPREGRET;
 
-    if (gpregret >= BOOTLOADER_APP_START_MIN &&
-        gpregret <= BOOTLOADER_APP_START_MAX &&
-        bootloader_app_is_valid()) {
+    if (bootloader_app_start_now(gpregret, dfu_pin || DFU_WINDOW_ON_RESET)) {
         /* Either the bootloader, or the app, requested a direct
-           reboot into the application, and then triggered a reset.
-           Launch the application now. */
-        NRF_POWER->GPREGRET &= BOOTLOADER_APP_START_MASK;
+           reboot into the application, or nothing requested DFU.
+           Launch the application now, before any of the delays and
+           initialization below. */
+        if (gpregret >= BOOTLOADER_APP_START_MIN &&
+            gpregret <= BOOTLOADER_APP_START_MAX)
+            NRF_POWER->GPREGRET &= BOOTLOADER_APP_START_MASK;
+        else
+            NRF_POWER->GPREGRET = 0;
         bootloader_launch_app_after_reset();
     }
 
@@ -342,9 +425,9 @@ int main(void)
     int t_firstcmd = TICKS_FROM_MSEC(15000); /* before first DFU command */
     int t_nextcmd  = TICKS_FROM_MSEC(10000); /* between each DFU cmd */
 
-    if (triggered_from_app || !bootloader_app_is_valid())
+    if (triggered_from_app || dfu_pin || !bootloader_app_is_valid())
     {
-        /* DFU requested by app, or app is invalid -- be more patient */
+        /* DFU requested by app or pin, or app is invalid -- be more patient */
         t_initial  = TICKS_FROM_MSEC(120000);
     }
     
@@ -0,0 +1,12 @@
+#ifndef AES_H
+#define AES_H
+
+#include <stdint.h>
+
+/* Encrypt one block with AES-128 */
+void aes128_encrypt(const uint8_t key[16], const uint8_t in[16], uint8_t out[16]);
+
+/* Blocks encrypted so far, by either SoftDevice call */
+extern uint32_t aes_block_count;
+
+#endif
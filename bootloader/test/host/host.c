@@ -0,0 +1,652 @@
+/** @file host.c
+*
+* @brief Fake SoftDevice, MBR and chip for the host build
+*
+* @par
+* Flash is NOR: an erase sets a page to 0xFF, and a write can only clear
+* bits.  A write that would need to set one fails the test, since on the
+* chip it would silently leave the wrong data.  As with the SoftDevice,
+* one flash operation runs at a time and takes effect when its event is
+* delivered, so the source buffer must stay valid until then.
+*
+* sd_app_evt_wait is where the rest of the world moves: it delivers the
+* flash event, lets the peer (see host_set_peer) send or read bytes, or,
+* if neither has anything to do, advances time to the next timer.  When
+* both could go, host_rand picks, so each seed gives a different but
+* repeatable interleaving.  A paced peer instead waits on host_time for
+* its bytes, and the flash operation ends once its time is up.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "bootloader.h"
+#include "bootloader_settings.h"
+#include "dfu_types.h"
+#include "dfu_transport_ble.h"
+#include "fstorage.h"
+#include "rigdfu_serial.h"
+
+#define HOST_UICR_SIZE      0x1000
+#define HOST_SCHED_SIZE     20          /* as src/main.c */
+#define HOST_SCHED_DATA     16
+#define HOST_MAX_TIMERS     4
+
+host_ficr_t host_ficr =
+{
+    .CODEPAGESIZE = CODE_PAGE_SIZE,
+    .CODESIZE     = HOST_FLASH_SIZE / CODE_PAGE_SIZE,
+    .DEVICEADDR   = { 0x9a8b7c6d, 0x5e4f },
+#ifdef NRF52
+    .INFO         = { 0x52832, 0, 0, 64, 512 },
+#else
+    .INFO         = { 0x51822, 0, 0, 32, 256 },
+#endif
+};
+host_nvmc_t host_nvmc = { NVMC_READY_READY_Ready, NVMC_CONFIG_WEN_Ren };
+host_mpu_t host_mpu;
+static host_rtc_t m_rtc1;
+static uint64_t m_time_ns;      /* see host_time */
+
+#define HOST_PAGES      (HOST_FLASH_SIZE / CODE_PAGE_SIZE)
+
+/* Shared with later boots: POWER, the state of host_rand, the flash
+   operations done since host_init, and the last DFU's profile */
+static struct
+{
+    host_power_t power;
+    uint32_t rand;
+    uint32_t flash_ops;
+    uint32_t profile[DFU_STAGE_max];
+    uint32_t page_writes[HOST_PAGES];
+    uint32_t page_erases[HOST_PAGES];
+    uint32_t page_blank_erases[HOST_PAGES];
+} * m_retained;
+host_power_t * host_power;
+
+static uint32_t m_rand = 1;
+
+/* The flash operation under way */
+static struct
+{
+    bool busy;
+    bool erase;
+    uint32_t addr;
+    const uint32_t * src;
+    uint32_t words;
+    uint64_t end_ns;            /* host_time when it ends */
+} m_flash_op;
+static uint64_t m_flash_latency_ns;     /* see host_flash_latency */
+static uint32_t m_power_loss_at;        /* 0 for never */
+static bool m_power_loss_torn;
+
+static struct
+{
+    app_sched_event_handler_t handler;
+    uint16_t size;
+    uint8_t data[HOST_SCHED_DATA];
+} m_sched[HOST_SCHED_SIZE];
+static uint32_t m_sched_head, m_sched_count;
+
+static app_timer_id_t m_timers[HOST_MAX_TIMERS];
+static uint32_t m_timer_count;
+static uint64_t m_ticks;
+
+static host_peer_step_t m_peer;
+static bool m_peer_paced;
+
+uint32_t host_rand(void)
+{
+    /* xorshift32 */
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 17;
+    m_rand ^= m_rand << 5;
+    return m_rand;
+}
+
+void host_fail(const char * fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "FAIL: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    fflush(NULL);
+    _exit(HOST_EXIT_FAIL);
+}
+
+static void host_exit(int code)
+{
+    fflush(NULL);
+    _exit(code);
+}
+
+static void * map_fixed(uintptr_t addr, size_t len)
+{
+    void * p = mmap((void *)addr, len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != (void *)addr)
+    {
+        perror("mmap");
+        exit(HOST_EXIT_FAIL);
+    }
+    return p;
+}
+
+void host_init(uint32_t seed)
+{
+    if (m_retained == NULL)
+    {
+        map_fixed(HOST_FLASH_START, HOST_FLASH_SIZE - HOST_FLASH_START);
+        map_fixed(NRF_UICR_BASE, HOST_UICR_SIZE);
+        m_retained = mmap(NULL, sizeof(*m_retained), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        host_power = &m_retained->power;
+    }
+    memset((void *)HOST_FLASH_START, 0xFF, HOST_FLASH_SIZE - HOST_FLASH_START);
+    memset((void *)NRF_UICR_BASE, 0xFF, HOST_UICR_SIZE);
+    memset(m_retained, 0, sizeof(*m_retained));
+
+    /* The Rigado data page comes programmed, without a key */
+    memset((void *)RIGADO_DATA_ADDRESS, 0, offsetof(rigado_data_t, radio_mac));
+
+    m_rand = seed ? seed : 1;
+}
+
+int host_run(void (*fn)(void * p_context), void * p_context)
+{
+    pid_t pid;
+    int status;
+
+    fflush(NULL);
+    m_retained->rand = host_rand();
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(HOST_EXIT_FAIL);
+    }
+    if (pid == 0)
+    {
+        m_rand = m_retained->rand;
+        fn(p_context);
+        host_exit(HOST_EXIT_DONE);
+    }
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status))
+        return HOST_EXIT_FAIL;
+    return WEXITSTATUS(status);
+}
+
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t * p_file_name)
+{
+    host_fail("error %u at %s:%u", error_code, (const char *)p_file_name, line_num);
+}
+
+/* ---- Flash ---- */
+
+static bool flash_range_ok(uint32_t addr, uint32_t len)
+{
+    return addr >= HOST_FLASH_START && addr <= HOST_FLASH_SIZE &&
+           len <= HOST_FLASH_SIZE - addr;
+}
+
+/* When a flash operation asked for now starts */
+static uint64_t flash_start_ns(void)
+{
+    if (m_flash_latency_ns == 0)
+        return m_time_ns;
+    return m_time_ns + host_rand() % m_flash_latency_ns;
+}
+
+void host_flash_latency(uint64_t max_ns)
+{
+    m_flash_latency_ns = max_ns;
+}
+
+uint32_t sd_flash_write(uint32_t * const p_dst, uint32_t const * const p_src, uint32_t size)
+{
+    uint32_t addr = (uint32_t)(uintptr_t)p_dst;
+
+    if (m_flash_op.busy)
+        return NRF_ERROR_BUSY;
+    if ((addr & 3) || ((uintptr_t)p_src & 3))
+        return NRF_ERROR_INVALID_ADDR;
+    if (size == 0 || size > CODE_PAGE_SIZE / sizeof(uint32_t))
+        return NRF_ERROR_INVALID_LENGTH;
+    if (!flash_range_ok(addr, size * sizeof(uint32_t)))
+        return NRF_ERROR_FORBIDDEN;
+
+    m_flash_op.busy = true;
+    m_flash_op.erase = false;
+    m_flash_op.addr = addr;
+    m_flash_op.src = p_src;
+    m_flash_op.words = size;
+    m_flash_op.end_ns = flash_start_ns() + size * HOST_FLASH_WORD_NS;
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_flash_page_erase(uint32_t page_number)
+{
+    uint32_t addr = page_number * CODE_PAGE_SIZE;
+
+    if (m_flash_op.busy)
+        return NRF_ERROR_BUSY;
+    if (!flash_range_ok(addr, CODE_PAGE_SIZE))
+        return NRF_ERROR_FORBIDDEN;
+
+    m_flash_op.busy = true;
+    m_flash_op.erase = true;
+    m_flash_op.addr = addr;
+    m_flash_op.end_ns = flash_start_ns() + HOST_FLASH_ERASE_NS;
+    return NRF_SUCCESS;
+}
+
+static void flash_program(uint32_t addr, const uint32_t * src, uint32_t words)
+{
+    volatile uint32_t * dst = (volatile uint32_t *)(uintptr_t)addr;
+    uint32_t i;
+
+    for (i = 0; i < words; i++)
+    {
+        if ((dst[i] & src[i]) != src[i])
+            host_fail("flash write of %08x over %08x at %#x", src[i], dst[i],
+                      addr + 4 * i);
+        dst[i] &= src[i];
+    }
+}
+
+/* Finish the flash operation under way, or lose power during it */
+static void flash_complete(void)
+{
+    bool lose_power = m_power_loss_at != 0 && m_retained->flash_ops + 1 == m_power_loss_at;
+    uint32_t words = m_flash_op.erase ? CODE_PAGE_SIZE / 4 : m_flash_op.words;
+    volatile uint32_t * dst = (volatile uint32_t *)(uintptr_t)m_flash_op.addr;
+    uint32_t page, i;
+
+    if (lose_power && m_power_loss_torn)
+    {
+        uint32_t done = host_rand() % words;
+
+        if (m_flash_op.erase)
+        {
+            for (i = 0; i < words; i++)
+                dst[i] |= host_rand() & host_rand();
+        }
+        else
+        {
+            flash_program(m_flash_op.addr, m_flash_op.src, done);
+            dst[done] &= m_flash_op.src[done] | host_rand();
+        }
+        host_exit(HOST_EXIT_POWER_LOSS);
+    }
+
+    page = m_flash_op.addr / CODE_PAGE_SIZE;
+    if (m_flash_op.erase)
+    {
+        for (i = 0; i < words && dst[i] == 0xFFFFFFFF; i++)
+            ;
+        if (i == words)
+            m_retained->page_blank_erases[page]++;
+        m_retained->page_erases[page]++;
+        memset((void *)dst, 0xFF, CODE_PAGE_SIZE);
+    }
+    else
+    {
+        m_retained->page_writes[page]++;
+        flash_program(m_flash_op.addr, m_flash_op.src, words);
+    }
+    m_flash_op.busy = false;
+    m_retained->flash_ops++;
+    m_time_ns = MAX(m_time_ns, m_flash_op.end_ns);
+
+    if (lose_power)
+        host_exit(HOST_EXIT_POWER_LOSS);
+
+    fstorage_sys_event_handler(NRF_EVT_FLASH_OPERATION_SUCCESS);
+}
+
+void host_power_loss_after(uint32_t ops, bool torn)
+{
+    m_power_loss_at = ops ? m_retained->flash_ops + ops : 0;
+    m_power_loss_torn = torn;
+}
+
+uint32_t host_flash_ops(void)
+{
+    return m_retained->flash_ops;
+}
+
+/* ---- RTC1 ---- */
+
+host_rtc_t * host_rtc1(void)
+{
+    struct timespec now;
+    uint64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec + m_time_ns;
+    m_rtc1.COUNTER = (uint32_t)(ns * 32768 / 1000000000) & 0xFFFFFF;
+    return &m_rtc1;
+}
+
+uint32_t host_dfu_profile(dfu_stage_t stage)
+{
+    return m_retained->profile[stage];
+}
+
+host_flash_count_t host_flash_count(uint32_t start, uint32_t end)
+{
+    host_flash_count_t count = { 0 };
+    uint32_t page;
+
+    for (page = start / CODE_PAGE_SIZE; page < HOST_PAGES && page * CODE_PAGE_SIZE < end; page++)
+    {
+        count.writes += m_retained->page_writes[page];
+        count.erases += m_retained->page_erases[page];
+        count.blank_erases += m_retained->page_blank_erases[page];
+    }
+    return count;
+}
+
+/* ---- MBR ---- */
+
+uint32_t sd_mbr_command(sd_mbr_command_t * param)
+{
+    uint32_t dst, len, i;
+
+    switch (param->command)
+    {
+        case SD_MBR_COMMAND_COMPARE:
+            return memcmp(param->params.compare.ptr1, param->params.compare.ptr2,
+                          param->params.compare.len * 4) ? NRF_ERROR_NULL : NRF_SUCCESS;
+
+        case SD_MBR_COMMAND_COPY_BL:
+            /* Erase and copy, then reset into the new bootloader */
+            len = param->params.copy_bl.bl_len * 4;
+            if (len > BOOTLOADER_SETTINGS_ADDRESS - BOOTLOADER_REGION_START)
+                return NRF_ERROR_INVALID_LENGTH;
+            memset((void *)BOOTLOADER_REGION_START, 0xFF,
+                   (len + CODE_PAGE_SIZE - 1) & ~(CODE_PAGE_SIZE - 1));
+            memcpy((void *)BOOTLOADER_REGION_START, param->params.copy_bl.bl_src, len);
+            host_exit(HOST_EXIT_RESET);
+
+        case SD_MBR_COMMAND_COPY_SD:
+            dst = (uint32_t)(uintptr_t)param->params.copy_sd.dst;
+            len = param->params.copy_sd.len * 4;
+            if (!flash_range_ok(dst, len))
+                host_fail("SoftDevice copy to %#x, which isn't modelled", dst);
+            for (i = dst & ~(CODE_PAGE_SIZE - 1); i < dst + len; i += CODE_PAGE_SIZE)
+                memset((void *)(uintptr_t)i, 0xFF, CODE_PAGE_SIZE);
+            memcpy((void *)(uintptr_t)dst, param->params.copy_sd.src, len);
+            return NRF_SUCCESS;
+
+        case SD_MBR_COMMAND_INIT_SD:
+        case SD_MBR_COMMAND_VECTOR_TABLE_BASE_SET:
+            return NRF_SUCCESS;
+
+        default:
+            return NRF_ERROR_INVALID_PARAM;
+    }
+}
+
+/* ---- SoftDevice, chip ---- */
+
+uint32_t sd_softdevice_disable(void)
+{
+    return NRF_SUCCESS;
+}
+
+uint32_t sd_softdevice_vector_table_base_set(uint32_t address)
+{
+    return NRF_SUCCESS;
+}
+
+void NVIC_SystemReset(void)
+{
+    host_exit(HOST_EXIT_RESET);
+}
+
+void nrf_bootloader_app_start(uint32_t start_addr)
+{
+    if (start_addr != DFU_BANK_0_REGION_START)
+        host_fail("app started at %#x", start_addr);
+    host_exit(HOST_EXIT_APP);
+}
+
+void bootloader_util_app_start(uint32_t start_addr)
+{
+    nrf_bootloader_app_start(start_addr);
+}
+
+void nrf_ic_info_get(nrf_ic_info_t * p_ic_info)
+{
+    p_ic_info->ic_revision = 0;
+    p_ic_info->ram_size = host_ficr.INFO.RAM;
+    p_ic_info->flash_size = host_ficr.INFO.FLASH;
+}
+
+/* bootloader_settings.c puts its settings page here by a linker
+   section */
+void bootloader_util_settings_get(const bootloader_settings_t ** pp_bootloader_settings)
+{
+    *pp_bootloader_settings = (const bootloader_settings_t *)BOOTLOADER_SETTINGS_ADDRESS;
+}
+
+/* No radio */
+uint32_t dfu_transport_update_start_ble(void)
+{
+    return NRF_SUCCESS;
+}
+
+uint32_t dfu_transport_close_ble(void)
+{
+    return NRF_SUCCESS;
+}
+
+/* ---- Scheduler, timers ---- */
+
+uint32_t app_sched_event_put(void * p_event_data, uint16_t event_size,
+                             app_sched_event_handler_t handler)
+{
+    uint32_t i = (m_sched_head + m_sched_count) % HOST_SCHED_SIZE;
+
+    if (m_sched_count == HOST_SCHED_SIZE)
+        return NRF_ERROR_NO_MEM;
+    if (event_size > HOST_SCHED_DATA)
+        return NRF_ERROR_INVALID_LENGTH;
+    m_sched[i].handler = handler;
+    m_sched[i].size = event_size;
+    if (event_size)
+        memcpy(m_sched[i].data, p_event_data, event_size);
+    m_sched_count++;
+    return NRF_SUCCESS;
+}
+
+void app_sched_execute(void)
+{
+    while (m_sched_count)
+    {
+        uint8_t data[HOST_SCHED_DATA];
+        uint32_t i = m_sched_head;
+        uint16_t size = m_sched[i].size;
+        app_sched_event_handler_t handler = m_sched[i].handler;
+
+        memcpy(data, m_sched[i].data, size);
+        m_sched_head = (m_sched_head + 1) % HOST_SCHED_SIZE;
+        m_sched_count--;
+        handler(size ? data : NULL, size);
+    }
+}
+
+uint32_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode,
+                          app_timer_timeout_handler_t timeout_handler)
+{
+    app_timer_id_t timer = *p_timer_id;
+    uint32_t i;
+
+    if (timeout_handler == NULL)
+        return NRF_ERROR_INVALID_PARAM;
+    timer->handler = timeout_handler;
+    timer->mode = mode;
+    timer->expires = 0;
+    for (i = 0; i < m_timer_count; i++)
+        if (m_timers[i] == timer)
+            return NRF_SUCCESS;
+    if (m_timer_count == HOST_MAX_TIMERS)
+        return NRF_ERROR_NO_MEM;
+    m_timers[m_timer_count++] = timer;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context)
+{
+    if (timer_id->handler == NULL)
+        return NRF_ERROR_INVALID_STATE;
+    if (timeout_ticks < 5)
+        return NRF_ERROR_INVALID_PARAM;
+    timer_id->ticks = timeout_ticks;
+    timer_id->expires = m_ticks + timeout_ticks;
+    timer_id->p_context = p_context;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_stop(app_timer_id_t timer_id)
+{
+    timer_id->expires = 0;
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(uint32_t * p_ticks)
+{
+    *p_ticks = (uint32_t)m_ticks & 0xFFFFFF;
+    return NRF_SUCCESS;
+}
+
+void nrf_delay_ms(uint32_t volatile number_of_ms)
+{
+    m_ticks += APP_TIMER_TICKS(number_of_ms, 0);
+}
+
+/* Move time on to the first timer to expire, and run it */
+static bool timer_fire(void)
+{
+    app_timer_id_t first = NULL;
+    uint32_t i;
+
+    for (i = 0; i < m_timer_count; i++)
+        if (m_timers[i]->expires && (!first || m_timers[i]->expires < first->expires))
+            first = m_timers[i];
+    if (first == NULL)
+        return false;
+
+    m_ticks = first->expires;
+    first->expires = first->mode == APP_TIMER_MODE_REPEATED ? m_ticks + first->ticks : 0;
+    first->handler(first->p_context);
+    return true;
+}
+
+/* ---- Events ---- */
+
+void host_set_peer(host_peer_step_t step, bool paced)
+{
+    m_peer = step;
+    m_peer_paced = paced;
+}
+
+uint64_t host_time(void)
+{
+    return m_time_ns;
+}
+
+bool host_wait_until(uint64_t ns)
+{
+    if (m_flash_op.busy && m_flash_op.end_ns <= ns)
+        return false;
+    m_time_ns = MAX(m_time_ns, ns);
+    return true;
+}
+
+uint32_t sd_app_evt_wait(void)
+{
+    bool idle = !m_flash_op.busy;
+
+    /* Events already queued are handled first */
+    if (m_sched_count)
+        return NRF_SUCCESS;
+
+    if (m_flash_op.busy &&
+        (m_peer == NULL || (m_peer_paced ? m_time_ns >= m_flash_op.end_ns : host_rand() % 2)))
+    {
+        flash_complete();
+        return NRF_SUCCESS;
+    }
+    if (m_peer != NULL && m_peer(idle))
+        return NRF_SUCCESS;
+    if (m_flash_op.busy)
+    {
+        flash_complete();
+        return NRF_SUCCESS;
+    }
+    if (!timer_fire())
+        host_fail("nothing left to wait for");
+    return NRF_SUCCESS;
+}
+
+/* ---- src/main.c ---- */
+
+/* Timeouts as src/main.c, in ticks */
+#define HOST_TIMEOUT_INITIAL        APP_TIMER_TICKS(2000, 0)
+#define HOST_TIMEOUT_INITIAL_DFU    APP_TIMER_TICKS(120000, 0)
+#define HOST_TIMEOUT_FIRST_CMD      APP_TIMER_TICKS(15000, 0)
+#define HOST_TIMEOUT_NEXT_CMD       APP_TIMER_TICKS(10000, 0)
+
+void host_bootloader_main(bool dfu_requested)
+{
+    uint8_t gpregret = NRF_POWER->GPREGRET;
+    uint32_t t_initial = HOST_TIMEOUT_INITIAL;
+    bool try_app;
+    int i;
+
+    if (bootloader_app_start_now(gpregret, dfu_requested))
+    {
+        if (gpregret >= BOOTLOADER_APP_START_MIN &&
+            gpregret <= BOOTLOADER_APP_START_MAX)
+            NRF_POWER->GPREGRET &= BOOTLOADER_APP_START_MASK;
+        else
+            NRF_POWER->GPREGRET = 0;
+        bootloader_launch_app_after_reset();
+        host_fail("bootloader_launch_app_after_reset returned");
+    }
+
+    (void)bootloader_init();
+    if (bootloader_dfu_sd_in_progress())
+    {
+        APP_ERROR_CHECK(bootloader_dfu_sd_update_continue());
+        APP_ERROR_CHECK(bootloader_dfu_sd_update_finalize());
+    }
+    NRF_POWER->GPREGRET = 0;
+
+    if (gpregret == BOOTLOADER_DFU_START || gpregret == BOOTLOADER_DFU_START_W_UART ||
+        dfu_requested || !bootloader_app_is_valid())
+        t_initial = HOST_TIMEOUT_INITIAL_DFU;
+
+    try_app = bootloader_dfu_start(t_initial, HOST_TIMEOUT_FIRST_CMD, HOST_TIMEOUT_NEXT_CMD);
+    for (i = 0; i < DFU_STAGE_max; i++)
+        m_retained->profile[i] = dfu_profile_get((dfu_stage_t)i);
+    rigdfu_serial_close();
+    if (try_app && bootloader_app_is_valid())
+        bootloader_app_start();
+    NVIC_SystemReset();
+    host_fail("NVIC_SystemReset returned");
+}
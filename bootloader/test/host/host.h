@@ -0,0 +1,356 @@
+/** @file host.h
+*
+* @brief Host stand-ins for the nRF5 SDK and SoftDevice
+*
+* @par
+* Just enough of the SDK and SoftDevice API to build the bootloader's DFU
+* code on a PC.  Every header under sdk/ includes this one.  The fakes
+* themselves are in host.c: flash is a NOR model mapped at the chip's
+* own addresses, written by sd_flash_write and sd_flash_page_erase when
+* the SoftDevice would report the operation done.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "dfu_profile.h"
+
+/* nrf_error.h */
+#define NRF_SUCCESS                         0
+#define NRF_ERROR_INTERNAL                  3
+#define NRF_ERROR_NO_MEM                    4
+#define NRF_ERROR_NOT_FOUND                 5
+#define NRF_ERROR_NOT_SUPPORTED             6
+#define NRF_ERROR_INVALID_PARAM             7
+#define NRF_ERROR_INVALID_STATE             8
+#define NRF_ERROR_INVALID_LENGTH            9
+#define NRF_ERROR_INVALID_FLAGS             10
+#define NRF_ERROR_INVALID_DATA              11
+#define NRF_ERROR_DATA_SIZE                 12
+#define NRF_ERROR_TIMEOUT                   13
+#define NRF_ERROR_NULL                      14
+#define NRF_ERROR_FORBIDDEN                 15
+#define NRF_ERROR_INVALID_ADDR              16
+#define NRF_ERROR_BUSY                      17
+
+/* nordic_common.h, app_util.h */
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+#endif
+#define STATIC_ASSERT(EXPR) _Static_assert(EXPR, #EXPR)
+#define UNUSED_PARAMETER(X) (void)(X)
+
+static inline bool is_word_aligned(void const * p)
+{
+    return ((uintptr_t)p & 0x03) == 0;
+}
+
+static inline uint8_t uint16_encode(uint16_t value, uint8_t * p_encoded_data)
+{
+    p_encoded_data[0] = (uint8_t)(value >> 0);
+    p_encoded_data[1] = (uint8_t)(value >> 8);
+    return sizeof(uint16_t);
+}
+
+static inline uint8_t uint32_encode(uint32_t value, uint8_t * p_encoded_data)
+{
+    p_encoded_data[0] = (uint8_t)(value >> 0);
+    p_encoded_data[1] = (uint8_t)(value >> 8);
+    p_encoded_data[2] = (uint8_t)(value >> 16);
+    p_encoded_data[3] = (uint8_t)(value >> 24);
+    return sizeof(uint32_t);
+}
+
+static inline uint16_t uint16_decode(const uint8_t * p_encoded_data)
+{
+    return (uint16_t)p_encoded_data[0] | ((uint16_t)p_encoded_data[1] << 8);
+}
+
+static inline uint32_t uint32_decode(const uint8_t * p_encoded_data)
+{
+    return ((uint32_t)p_encoded_data[0] << 0)  |
+           ((uint32_t)p_encoded_data[1] << 8)  |
+           ((uint32_t)p_encoded_data[2] << 16) |
+           ((uint32_t)p_encoded_data[3] << 24);
+}
+
+/* app_error.h: any error the code doesn't handle fails the test */
+void app_error_handler(uint32_t error_code, uint32_t line_num, const uint8_t * p_file_name);
+#define APP_ERROR_CHECK(ERR_CODE)                                           \
+    do {                                                                    \
+        const uint32_t LOCAL_ERR_CODE = (ERR_CODE);                         \
+        if (LOCAL_ERR_CODE != NRF_SUCCESS)                                  \
+            app_error_handler(LOCAL_ERR_CODE, __LINE__, (uint8_t *)__FILE__); \
+    } while (0)
+
+/* app_util_platform.h: everything runs in one thread */
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT()  }
+
+/* app_scheduler.h */
+typedef void (*app_sched_event_handler_t)(void * p_event_data, uint16_t event_size);
+uint32_t app_sched_event_put(void * p_event_data, uint16_t event_size,
+                             app_sched_event_handler_t handler);
+void app_sched_execute(void);
+
+/* app_timer.h: ticks of the 32768 Hz RTC, prescaler 0 */
+typedef void (*app_timer_timeout_handler_t)(void * p_context);
+typedef enum
+{
+    APP_TIMER_MODE_SINGLE_SHOT,
+    APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+typedef struct host_timer * app_timer_id_t;
+struct host_timer
+{
+    app_timer_timeout_handler_t handler;
+    app_timer_mode_t mode;
+    uint32_t ticks;
+    uint64_t expires;           /* 0 when stopped */
+    void * p_context;
+};
+#define APP_TIMER_DEF(timer_id)                                             \
+    static struct host_timer timer_id##_data;                               \
+    static const app_timer_id_t timer_id = &timer_id##_data
+#define APP_TIMER_TICKS(MS, PRESCALER) ((uint32_t)(((uint64_t)(MS) * 32768) / (1000 * ((PRESCALER) + 1))))
+uint32_t app_timer_create(app_timer_id_t const * p_timer_id, app_timer_mode_t mode,
+                          app_timer_timeout_handler_t timeout_handler);
+uint32_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void * p_context);
+uint32_t app_timer_stop(app_timer_id_t timer_id);
+uint32_t app_timer_cnt_get(uint32_t * p_ticks);
+
+/* nrf_delay.h */
+void nrf_delay_ms(uint32_t volatile number_of_ms);
+
+/* nrf_soc.h */
+#define NRF_EVT_FLASH_OPERATION_SUCCESS     2
+#define NRF_EVT_FLASH_OPERATION_ERROR       3
+
+uint32_t sd_flash_write(uint32_t * const p_dst, uint32_t const * const p_src, uint32_t size);
+uint32_t sd_flash_page_erase(uint32_t page_number);
+uint32_t sd_app_evt_wait(void);
+
+typedef uint8_t soc_ecb_key_t[16];
+typedef uint8_t soc_ecb_cleartext_t[16];
+typedef uint8_t soc_ecb_ciphertext_t[16];
+typedef struct
+{
+    soc_ecb_key_t        key;
+    soc_ecb_cleartext_t  cleartext;
+    soc_ecb_ciphertext_t ciphertext;
+} nrf_ecb_hal_data_t;
+typedef struct
+{
+    soc_ecb_key_t        * p_key;
+    soc_ecb_cleartext_t  * p_cleartext;
+    soc_ecb_ciphertext_t * p_ciphertext;
+} nrf_ecb_hal_data_block_t;
+uint32_t sd_ecb_block_encrypt(nrf_ecb_hal_data_t * p_ecb_data);
+uint32_t sd_ecb_blocks_encrypt(uint8_t block_count, nrf_ecb_hal_data_block_t * p_data_blocks);
+
+/* nrf_sdm.h.  The SoftDevice itself, below 0x10000, is not modelled;
+   its size is fixed per target by the Makefile. */
+#define MBR_SIZE                            0x1000
+#define SD_SIZE_GET(baseaddr)               ((uint32_t)HOST_SD_SIZE)
+uint32_t sd_softdevice_disable(void);
+uint32_t sd_softdevice_vector_table_base_set(uint32_t address);
+
+/* nrf_mbr.h */
+enum
+{
+    SD_MBR_COMMAND_COPY_BL,
+    SD_MBR_COMMAND_COPY_SD,
+    SD_MBR_COMMAND_INIT_SD,
+    SD_MBR_COMMAND_COMPARE,
+    SD_MBR_COMMAND_VECTOR_TABLE_BASE_SET,
+};
+typedef struct { uint32_t * src; uint32_t * dst; uint32_t len; } sd_mbr_command_copy_sd_t;
+typedef struct { uint32_t * ptr1; uint32_t * ptr2; uint32_t len; } sd_mbr_command_compare_t;
+typedef struct { uint32_t * bl_src; uint32_t bl_len; } sd_mbr_command_copy_bl_t;
+typedef struct { uint32_t address; } sd_mbr_command_vector_table_base_set_t;
+typedef struct
+{
+    uint32_t command;
+    union
+    {
+        sd_mbr_command_copy_sd_t copy_sd;
+        sd_mbr_command_compare_t compare;
+        sd_mbr_command_copy_bl_t copy_bl;
+        sd_mbr_command_vector_table_base_set_t base_set;
+    } params;
+} sd_mbr_command_t;
+uint32_t sd_mbr_command(sd_mbr_command_t * param);
+
+/* ble_gap.h, ble_gatts.h, ble.h, ble_srv_common.h, ble_l2cap.h: types
+   and the MTUs only */
+#define BLE_GAP_ADDR_LEN 6
+#define BLE_L2CAP_MTU_DEF 23
+#define BLE_GAP_MTU_MAX 247             /* S132's, as the bootloader patches it */
+typedef struct
+{
+    uint8_t addr_type;
+    uint8_t addr[BLE_GAP_ADDR_LEN];
+} ble_gap_addr_t;
+typedef struct
+{
+    uint16_t value_handle;
+    uint16_t user_desc_handle;
+    uint16_t cccd_handle;
+    uint16_t sccd_handle;
+} ble_gatts_char_handles_t;
+typedef struct { uint8_t evt_id; } ble_evt_t;
+typedef void (*ble_srv_error_handler_t)(uint32_t nrf_error);
+
+/* Registers.  The flash model maps UICR too; FICR, NVMC and MPU are
+   plain structs, and POWER is shared with the processes for later
+   resets, like GPREGRET. */
+#define NRF_UICR_BASE                       0x10001000UL
+typedef struct
+{
+    uint32_t CODEPAGESIZE;
+    uint32_t CODESIZE;
+    uint32_t DEVICEADDR[2];
+    struct { uint32_t PART, VARIANT, PACKAGE, RAM, FLASH; } INFO;
+} host_ficr_t;
+typedef struct { volatile uint32_t READY, CONFIG; } host_nvmc_t;
+typedef struct { volatile uint32_t PROTENSET0, PROTENSET1; } host_mpu_t;
+typedef struct { volatile uint32_t GPREGRET, RESETREAS; } host_power_t;
+extern host_ficr_t host_ficr;
+extern host_nvmc_t host_nvmc;
+extern host_mpu_t host_mpu;
+extern host_power_t * host_power;           /* retained across resets */
+#define NRF_FICR    (&host_ficr)
+#define NRF_NVMC    (&host_nvmc)
+#define NRF_MPU     (&host_mpu)
+#define NRF_POWER   host_power
+
+/* RTC1, read only by dfu_profile.  Its COUNTER runs on the PC's clock,
+   with host_time added, so the stages come out as the PC's processing
+   and the chip's flash, and any wait for a paced peer.  app_timer keeps
+   its own simulated ticks. */
+typedef struct { volatile uint32_t COUNTER; } host_rtc_t;
+host_rtc_t * host_rtc1(void);
+#define NRF_RTC1    (host_rtc1())
+#define NVMC_CONFIG_WEN_Pos     0
+#define NVMC_CONFIG_WEN_Ren     0
+#define NVMC_CONFIG_WEN_Wen     1
+#define NVMC_READY_READY_Busy   0
+#define NVMC_READY_READY_Ready  1
+void NVIC_SystemReset(void);
+
+/* nrf_ic_info.h */
+typedef struct
+{
+    uint32_t ic_revision;
+    uint16_t ram_size;
+    uint16_t flash_size;
+} nrf_ic_info_t;
+void nrf_ic_info_get(nrf_ic_info_t * p_ic_info);
+
+/* nrf_bootloader_app_start.h, bootloader_util.h */
+void nrf_bootloader_app_start(uint32_t start_addr);
+void bootloader_util_app_start(uint32_t start_addr);
+
+/* The model, for the tests.  Flash, UICR and POWER are shared memory,
+   so a test runs each boot of the device in a child process, which
+   ends the way the chip would stop running the bootloader. */
+#ifdef NRF52
+#define HOST_FLASH_SIZE         0x80000
+#else
+#define HOST_FLASH_SIZE         0x40000
+#endif
+#define HOST_FLASH_START        0x10000     /* the SoftDevice ends above this */
+
+/* Page erase and word write times, from the datasheets */
+#ifdef NRF52
+#define HOST_FLASH_ERASE_NS     85000000ULL
+#define HOST_FLASH_WORD_NS      41000ULL
+#else
+#define HOST_FLASH_ERASE_NS     22300000ULL
+#define HOST_FLASH_WORD_NS      46300ULL
+#endif
+
+enum
+{
+    HOST_EXIT_DONE,             /* the function given to host_run returned */
+    HOST_EXIT_FAIL,             /* the test failed */
+    HOST_EXIT_RESET,            /* NVIC_SystemReset, or the MBR after a copy */
+    HOST_EXIT_POWER_LOSS,       /* power lost, see host_power_loss_after */
+    HOST_EXIT_APP,              /* the application was started */
+};
+
+/* Map and erase flash; seed host_rand */
+void host_init(uint32_t seed);
+
+/* Pseudo-random numbers, the same for the same seed */
+uint32_t host_rand(void);
+
+/* Report a failed check and end the process */
+void host_fail(const char * fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+
+/* Run fn in a child process, as one boot of the device; returns its
+   HOST_EXIT_ code. */
+int host_run(void (*fn)(void * p_context), void * p_context);
+
+/* Lose power when the ops'th flash operation from now completes, in
+   whichever boot that is, or while it is under way if torn: part of a
+   write is done, and an erase leaves random bits set.  0 disarms. */
+void host_power_loss_after(uint32_t ops, bool torn);
+
+/* Start each flash operation up to max_ns after it is asked for, at
+   random, as the SoftDevice fits flash around the radio; 0 for at once.
+   Only a paced peer waits for it. */
+void host_flash_latency(uint64_t max_ns);
+
+/* Flash operations completed since host_init */
+uint32_t host_flash_ops(void);
+
+/* Writes and erases completed since host_init in the pages from start
+   up to end, and erases of pages that were already blank */
+typedef struct
+{
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t blank_erases;
+} host_flash_count_t;
+host_flash_count_t host_flash_count(uint32_t start, uint32_t end);
+
+/* The RTC1 ticks dfu_profile counted in a stage, in the last boot that
+   got as far as bootloader_dfu_start returning */
+uint32_t host_dfu_profile(dfu_stage_t stage);
+
+/* The other end of a transport.  step is called whenever the device
+   waits for an event; idle says nothing else is about to happen, as a
+   peer would see a link gone quiet.  It returns false if it has nothing
+   to do either, and time moves on to the next timer.  A paced peer
+   keeps time with host_wait_until, and the flash operation under way
+   then ends when host_time reaches its end rather than at random. */
+typedef bool (*host_peer_step_t)(bool idle);
+void host_set_peer(host_peer_step_t step, bool paced);
+
+/* Simulated time this boot, in ns: each flash operation takes its
+   HOST_FLASH_*_NS from when it starts, and a paced peer moves it on */
+uint64_t host_time(void);
+
+/* Move host_time on to ns, as a paced peer waits for its next byte.
+   Returns false, and leaves it, if the flash operation under way ends
+   first: the peer should then return false, so that it does. */
+bool host_wait_until(uint64_t ns);
+
+/* What src/main.c does after a reset, without the radio: start the app
+   if it is valid and DFU isn't requested, otherwise run the bootloader
+   until it resets or starts the app.  Never returns. */
+void host_bootloader_main(bool dfu_requested) __attribute__((noreturn));
+
+#endif /* HOST_H */
@@ -0,0 +1,84 @@
+#!/usr/bin/python
+
+'''
+  Build the application images and packages test_dfu replays: an old
+  and a new application for the given start address, and the new one
+  as a plain, an encrypted and a patch package, with genpackage.py.
+  Also a big application, too large for bank 1 on the nRF52, which a
+  single-bank build writes in place.
+
+    usage: mkpackages.py <output dir> <application start address>
+
+  @copyright (c) Rigado, LLC. All rights reserved.
+'''
+
+import os
+import sys
+import random
+import struct
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                "..", "..", "build-tools", "genimage"))
+from genpackage import RigDfuPackage
+
+KEY = bytes(bytearray(range(0x10, 0x20)))
+OLD_SIZE = 16 * 1024
+NEW_SIZE = 18 * 1024 + 36
+BIG_SIZE = 168 * 1024 + 36
+
+def gen_app(rng, start, size):
+    """Something shaped like an application: a vector table that
+    bootloader_app_is_valid accepts, then code built from a small set of
+    instruction words, so a patch between two versions is small."""
+    words = [rng.getrandbits(32) for i in range(64)]
+    image = struct.pack("<2I", 0x20008000, start + 0xc1)
+    while len(image) < size:
+        image += struct.pack("<I", rng.choice(words))
+    return image[:size]
+
+def gen_new_app(rng, start, old):
+    """The old application with a few functions changed and one added"""
+    new = bytearray(old)
+    for i in range(8):
+        at = rng.randrange(0x100, len(new) - 64) & ~3
+        new[at:at + 16] = bytearray(rng.getrandbits(8) for i in range(16))
+    at = len(new) // 2 & ~3
+    new[at:at] = gen_app(rng, start, NEW_SIZE - len(old))[8:]
+    new[at:at] = bytearray(8)
+    return bytes(new[:NEW_SIZE])
+
+def write(outdir, name, data):
+    with open(os.path.join(outdir, name), "wb") as f:
+        f.write(data)
+
+def main(outdir, start):
+    rng = random.Random(start)
+    old = gen_app(rng, start, OLD_SIZE)
+    new = gen_new_app(rng, start, old)
+
+    if not os.path.isdir(outdir):
+        os.makedirs(outdir)
+    write(outdir, "old.bin", old)
+    write(outdir, "new.bin", new)
+    write(outdir, "key.bin", KEY)
+    write(outdir, "old.pkg", RigDfuPackage(old, verbose = False).gen_package())
+    write(outdir, "new.pkg", RigDfuPackage(new, verbose = False).gen_package())
+    write(outdir, "new_enc.pkg",
+          RigDfuPackage(new, key = KEY, verbose = False).gen_package())
+    write(outdir, "patch.pkg",
+          RigDfuPackage(new, old, verbose = False).gen_package())
+    write(outdir, "patch_enc.pkg",
+          RigDfuPackage(new, old, KEY, verbose = False).gen_package())
+
+    big = gen_app(rng, start, BIG_SIZE)
+    write(outdir, "big.bin", big)
+    write(outdir, "big.pkg", RigDfuPackage(big, verbose = False).gen_package())
+    write(outdir, "big_enc.pkg",
+          RigDfuPackage(big, key = KEY, verbose = False).gen_package())
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: %s <output dir> <application start>\n"
+                         % sys.argv[0])
+        sys.exit(1)
+    main(sys.argv[1], int(sys.argv[2], 0))
@@ -0,0 +1,69 @@
+#!/usr/bin/python
+
+'''
+  Write the corpus of patches test_bspatch applies: for each pair of
+  images, the old and the new image and the uncompressed stream
+  rigpatch.bsdiff makes between them, as genpackage.py puts in a patch
+  package.  Also two streams bsdiff doesn't make, with a diff region
+  that starts before the old image and one that runs past its end.
+  An index lists each patch's name.
+
+    usage: mkpatches.py <output dir> <name> <old> <new> [<name> <old> <new> ...]
+
+  @copyright (c) Rigado, LLC. All rights reserved.
+'''
+
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                "..", "..", "build-tools", "genimage"))
+import rigpatch
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+def write(outdir, name, data):
+    with open(os.path.join(outdir, name), "wb") as f:
+        f.write(data)
+
+def window_patch(old, new, oldpos):
+    """One diff region over the whole new image, adding the old one from
+    oldpos on; old bytes outside the image count as 0"""
+    old = bytearray(old)
+    diff = bytearray((new[i] - (old[oldpos + i] if 0 <= oldpos + i < len(old) else 0))
+                     & 0xff for i in range(len(new)))
+    seek = rigpatch._offtout(0) * 2 + rigpatch._offtout(oldpos)
+    region = (rigpatch._offtout(len(new)) + rigpatch._offtout(0) +
+              rigpatch._offtout(0))
+    return seek + region + bytes(diff)
+
+def main(outdir, pairs):
+    index = []
+
+    if not os.path.isdir(outdir):
+        os.makedirs(outdir)
+    for name, old_path, new_path in pairs:
+        old = read(old_path)
+        new = read(new_path)
+        patches = [(name, rigpatch.bsdiff(old, new))]
+        if not index:
+            patches.append((name + "_before", window_patch(old, new, -7)))
+            patches.append((name + "_past_end", window_patch(old, new, len(old) // 2 + 3)))
+        for patch_name, patch in patches:
+            if rigpatch.bspatch(old, patch, len(new)) != new:
+                raise rigpatch.PatchError("%s doesn't apply" % patch_name)
+            write(outdir, patch_name + ".old", old)
+            write(outdir, patch_name + ".new", new)
+            write(outdir, patch_name + ".diff", patch)
+            index.append(patch_name)
+    write(outdir, "index", ("\n".join(index) + "\n").encode())
+
+if __name__ == "__main__":
+    if len(sys.argv) < 5 or (len(sys.argv) - 2) % 3:
+        sys.stderr.write("usage: %s <output dir> <name> <old> <new> ...\n"
+                         % sys.argv[0])
+        sys.exit(1)
+    args = sys.argv[2:]
+    main(sys.argv[1], [args[i:i + 3] for i in range(0, len(args), 3)])
@@ -0,0 +1,2 @@
+/* Host build: see host.h */
+#include "host.h"
@@ -0,0 +1,833 @@
+/** @file serial.c
+*
+* @brief Fake UART, and a host tool on the other end of it
+*
+* @par
+* The rigdfu_serial calls lib/dfu/dfu_transport_serial.c uses, over a
+* receive ring of the same size as lib/rigado/rigdfu_serial.c, with no
+* flow control: bytes that arrive when it is full are lost.  The peer
+* sends a few bytes at a time, so the bootloader sees frames split at
+* random, and reads the responses back from what the bootloader wrote.
+*
+* On a paced line, each byte takes its time at the baud rate, and
+* arrives a latency later, as through a USB serial adapter, both ways.
+* The peer waits on host_time for the next byte to arrive, so flash
+* operations take their time alongside, and the data phase is timed.
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "host.h"
+#include "serial.h"
+#include "rigdfu_serial.h"
+#include "dfu_transport_serial.h"
+#include "crc32.h"
+
+#define RX_RING_SIZE            RIGDFU_SERIAL_RX_SIZE
+#define WIRE_SIZE               (1 << 16)
+#define TX_SIZE                 (1 << 16)
+#define MAX_CHUNK               64
+#define DEFAULT_FRAME_SIZE      20
+#define MAX_STREAM_FRAMES       16384
+#define MAX_WRITES              1024    /* on the way to the peer */
+
+#define PKG_HEADER_SIZE         12
+#define PKG_INIT_SIZE           32
+#define PKG_PATCH_INIT_SIZE     12
+
+/* Device side */
+static uint8_t m_rx_ring[RX_RING_SIZE];
+static uint32_t m_rx_head, m_rx_tail;
+static bool m_rx_overrun;
+static rigdfu_serial_rx_handler_t m_rx_handler;
+static rigdfu_serial_rx_notify_t m_rx_notify;
+static uint8_t m_tx[TX_SIZE];
+static uint32_t m_tx_len;
+
+/* Paced line: when each byte on the wire arrives, when each side's line
+   is next free, and the device's writes on their way, each as where it
+   ends in m_tx and when it arrives; the peer reads up to m_tx_arrived */
+static uint64_t m_wire_at[WIRE_SIZE];
+static uint64_t m_line_free, m_tx_line_free, m_tx_written_at;
+static struct
+{
+    uint32_t end;
+    uint64_t at;
+} m_writes[MAX_WRITES];
+static uint32_t m_writes_head, m_writes_count;
+static uint32_t m_tx_arrived;
+
+/* Peer side */
+static serial_session_t m_session;
+static serial_result_t * m_result;
+static uint8_t m_wire[WIRE_SIZE];       /* sent, not yet arrived */
+static uint32_t m_wire_head, m_wire_len;
+static uint32_t m_tx_pos;               /* next device byte to parse */
+static const uint8_t * m_data;          /* firmware or patch data */
+static uint32_t m_data_size;
+static uint32_t m_pos;                  /* next data byte to send */
+static uint64_t m_data_start;           /* host_time of the first data frame */
+
+static enum
+{
+    PEER_MAGIC,             /* send the serial DFU pattern */
+    PEER_HELLO,             /* wait for the identification string */
+    PEER_START,
+    PEER_INIT,
+    PEER_RESUME_QUERY,
+    PEER_RESUME,
+    PEER_PATCH_INIT,
+    PEER_STREAM_INFO,
+    PEER_DATA,              /* one frame at a time */
+    PEER_STREAM,
+    PEER_VALIDATE,
+    PEER_ACTIVATE,
+    PEER_RAW,               /* sending raw bytes */
+    PEER_QUIET,             /* done, failed, or stopped */
+} m_state;
+static uint8_t m_waiting_op;            /* request awaiting a response */
+static bool m_long_frames;
+
+/* Streaming: frames below m_acked are acked, frames up to m_next are
+   to be sent next, and up to m_sent were ever sent; m_sent_mark counts
+   wire bytes, m_frame_mark[seq] where frame seq ended */
+static uint32_t m_first, m_acked, m_next, m_sent, m_frames;
+static uint32_t m_sent_mark, m_acked_mark;
+static uint32_t * m_frame_mark;
+
+static bool serial_peer_step(bool idle);
+static void serial_peer_drain(void);
+
+/* ---- rigdfu_serial ---- */
+
+void rigdfu_serial_init(bool force_init)
+{
+}
+
+void rigdfu_serial_reinit_dfu(void)
+{
+    m_rx_handler = NULL;
+    m_rx_notify = NULL;
+    m_rx_head = m_rx_tail = 0;
+    m_rx_overrun = false;
+}
+
+void rigdfu_serial_close(void)
+{
+    /* What was written goes out before the port closes */
+    serial_peer_drain();
+    m_rx_handler = NULL;
+    m_rx_notify = NULL;
+}
+
+void rigdfu_serial_set_rx_handler(rigdfu_serial_rx_handler_t handler)
+{
+    m_rx_handler = handler;
+}
+
+void rigdfu_serial_set_rx_notify(rigdfu_serial_rx_notify_t notify)
+{
+    m_rx_notify = notify;
+}
+
+uint32_t rigdfu_serial_rx_span(const uint8_t ** pp_data)
+{
+    uint32_t avail = m_rx_head - m_rx_tail;
+    uint32_t offset = m_rx_tail % RX_RING_SIZE;
+
+    *pp_data = &m_rx_ring[offset];
+    return MIN(avail, RX_RING_SIZE - offset);
+}
+
+void rigdfu_serial_rx_release(uint32_t len)
+{
+    if (len > m_rx_head - m_rx_tail)
+        host_fail("released %u of %u received bytes", len, m_rx_head - m_rx_tail);
+    m_rx_tail += len;
+}
+
+bool rigdfu_serial_rx_overrun(void)
+{
+    bool overrun = m_rx_overrun;
+
+    m_rx_overrun = false;
+    return overrun;
+}
+
+uint32_t rigdfu_serial_rx_size(void)
+{
+    return RX_RING_SIZE;
+}
+
+static uint64_t byte_ns(void)
+{
+    return 10000000000ULL / m_session.baud;
+}
+
+void rigdfu_serial_write(const uint8_t * p_data, uint32_t len)
+{
+    if (len > TX_SIZE - m_tx_len)
+        host_fail("serial output overflow");
+    memcpy(&m_tx[m_tx_len], p_data, len);
+    m_tx_len += len;
+    if (!m_session.baud)
+        return;
+
+    /* Writes at the same time, as put_frame's, arrive together, so the
+       peer never reads part of a response */
+    m_tx_line_free = MAX(m_tx_line_free, host_time()) + len * byte_ns();
+    if (m_writes_count == 0 || m_tx_written_at != host_time())
+    {
+        if (m_writes_count == MAX_WRITES)
+            host_fail("too many writes on their way");
+        m_writes_count++;
+    }
+    m_tx_written_at = host_time();
+    m_writes[(m_writes_head + m_writes_count - 1) % MAX_WRITES].end = m_tx_len;
+    m_writes[(m_writes_head + m_writes_count - 1) % MAX_WRITES].at =
+        m_tx_line_free + m_session.latency_us * 1000ULL;
+}
+
+void rigdfu_serial_put(uint8_t x)
+{
+    rigdfu_serial_write(&x, 1);
+}
+
+void rigdfu_serial_puts(const char * s)
+{
+    rigdfu_serial_write((const uint8_t *)s, strlen(s));
+}
+
+int rigdfu_serial_printf(const char * fmt, ...)
+{
+    return 0;
+}
+
+/* ---- Sending ---- */
+
+static void wire_put(uint8_t c)
+{
+    uint32_t i = (m_wire_head + m_wire_len) % WIRE_SIZE;
+
+    if (m_wire_len == WIRE_SIZE)
+        host_fail("peer sent too much");
+    m_wire[i] = c;
+    m_wire_len++;
+    m_sent_mark++;
+    if (m_session.baud)
+    {
+        m_line_free = MAX(m_line_free, host_time()) + byte_ns();
+        m_wire_at[i] = m_line_free + m_session.latency_us * 1000ULL;
+    }
+}
+
+static void wire_put_escaped(uint8_t c)
+{
+    if (c == SERIAL_FRAME_MARKER || c == SERIAL_FRAME_ESCAPE)
+    {
+        wire_put(SERIAL_FRAME_ESCAPE);
+        c = (c == SERIAL_FRAME_MARKER) ? SERIAL_FRAME_ESCAPE_MARKER
+                                       : SERIAL_FRAME_ESCAPE_ESCAPE;
+    }
+    wire_put(c);
+}
+
+/* Send a frame; the first hdr_len bytes of data come from hdr */
+static void send_frame(uint8_t op, const uint8_t * hdr, uint32_t hdr_len,
+                       const uint8_t * data, uint32_t len)
+{
+    uint32_t total = hdr_len + len + SERIAL_FRAME_HDR_SZ;
+    uint32_t i;
+
+    wire_put(SERIAL_FRAME_MARKER);
+    if (m_long_frames || total > 0xFF)
+    {
+        wire_put(SERIAL_FRAME_LONG_LEN);
+        wire_put_escaped(total & 0xFF);
+        wire_put_escaped(total >> 8);
+    }
+    else
+    {
+        wire_put_escaped(total);
+    }
+    wire_put_escaped(op);
+    for (i = 0; i < hdr_len; i++)
+        wire_put_escaped(hdr[i]);
+    for (i = 0; i < len; i++)
+        wire_put_escaped(data[i]);
+}
+
+static void request(uint8_t op, const uint8_t * data, uint32_t len)
+{
+    send_frame(op, NULL, 0, data, len);
+    m_waiting_op = op;
+}
+
+static bool wire_arrived(void)
+{
+    return m_wire_len > 0 &&
+           (!m_session.baud || m_wire_at[m_wire_head] <= host_time());
+}
+
+/* Deliver some of what has arrived on the wire */
+static bool wire_deliver(void)
+{
+    uint32_t n = 1 + host_rand() % MAX_CHUNK;
+
+    if (!wire_arrived())
+        return false;
+    for (; n > 0 && wire_arrived(); n--)
+    {
+        uint8_t c = m_wire[m_wire_head];
+
+        m_wire_head = (m_wire_head + 1) % WIRE_SIZE;
+        m_wire_len--;
+        if (m_rx_handler != NULL)
+        {
+            m_rx_handler(c);
+        }
+        else if (m_rx_head - m_rx_tail < RX_RING_SIZE)
+        {
+            m_rx_ring[m_rx_head++ % RX_RING_SIZE] = c;
+        }
+        else
+        {
+            m_rx_overrun = true;
+            m_result->overruns++;
+        }
+    }
+    if (m_rx_notify != NULL)
+        m_rx_notify();
+    return true;
+}
+
+/* ---- Receiving ---- */
+
+/* Move m_tx_arrived on over the writes that have arrived */
+static void tx_arrive(void)
+{
+    if (!m_session.baud)
+    {
+        m_tx_arrived = m_tx_len;
+        return;
+    }
+    while (m_writes_count && m_writes[m_writes_head].at <= host_time())
+    {
+        m_tx_arrived = m_writes[m_writes_head].end;
+        m_writes_head = (m_writes_head + 1) % MAX_WRITES;
+        m_writes_count--;
+    }
+}
+
+/* On a paced line, when the next byte arrives, either way, or 0 if
+   none is on its way */
+static uint64_t next_arrival(void)
+{
+    uint64_t at = 0;
+
+    if (m_wire_len)
+        at = m_wire_at[m_wire_head];
+    if (m_writes_count && (at == 0 || m_writes[m_writes_head].at < at))
+        at = m_writes[m_writes_head].at;
+    return at;
+}
+
+/* Parse the next response the bootloader wrote into resp, and return
+   its length, or 0 if there is none.  put_frame writes a response in
+   one go, so it runs to the next marker or the end of what has arrived;
+   anything before a marker is the identification string. */
+static uint32_t next_response(uint8_t * resp, uint32_t size)
+{
+    uint8_t buf[4 + 16];
+    uint32_t len = 0, hdr = 1;
+    bool esc = false;
+
+    tx_arrive();
+    while (m_tx_pos < m_tx_arrived && m_tx[m_tx_pos] != SERIAL_FRAME_MARKER)
+        m_tx_pos++;
+    if (m_tx_pos >= m_tx_arrived)
+        return 0;
+
+    for (m_tx_pos++; m_tx_pos < m_tx_arrived && m_tx[m_tx_pos] != SERIAL_FRAME_MARKER;
+         m_tx_pos++)
+    {
+        uint8_t c = m_tx[m_tx_pos];
+
+        if (esc)
+            c = (c == SERIAL_FRAME_ESCAPE_MARKER) ? SERIAL_FRAME_MARKER : SERIAL_FRAME_ESCAPE;
+        else if (c == SERIAL_FRAME_ESCAPE)
+        {
+            esc = true;
+            continue;
+        }
+        esc = false;
+        if (len == sizeof(buf))
+            host_fail("response too long");
+        buf[len++] = c;
+    }
+
+    /* Short responses count escapes in their length byte, long ones
+       don't; both are checked against what arrived */
+    if (len > 0 && buf[0] == SERIAL_FRAME_LONG_LEN)
+    {
+        hdr = 3;
+        if (len < hdr || (uint32_t)(buf[1] | (buf[2] << 8)) != len - hdr + 1)
+            host_fail("bad long response length");
+        if (!m_long_frames)
+            host_fail("long response to a short request");
+    }
+    else if (len == 0 || m_long_frames)
+    {
+        host_fail("bad response");
+    }
+    if (len < hdr + 3 || buf[hdr] != SERIAL_OP_RESPONSE || len - hdr - 1 > size)
+        host_fail("bad response");
+    len -= hdr + 1;
+    memcpy(resp, &buf[hdr + 1], len);
+    return len;
+}
+
+static void fail(uint8_t op, uint8_t resp)
+{
+    m_result->failed_op = op;
+    m_result->failed_resp = resp;
+    m_state = PEER_QUIET;
+}
+
+/* ---- Data ---- */
+
+static uint32_t frame_size(void)
+{
+    return m_session.frame_size ? m_session.frame_size : DEFAULT_FRAME_SIZE;
+}
+
+static bool stop_here(void)
+{
+    if (m_session.stop_at && m_pos >= m_session.stop_at)
+    {
+        m_state = PEER_QUIET;
+        return true;
+    }
+    return false;
+}
+
+static void send_data(void)
+{
+    uint32_t n = MIN(frame_size(), m_data_size - m_pos);
+
+    request(m_session.patch ? SERIAL_OP_RECEIVE_PATCH_IMAGE : SERIAL_OP_RECEIVE_FIRMWARE_IMAGE,
+            &m_data[m_pos], n);
+    m_pos += n;
+    m_result->data_sent += n;
+}
+
+static void data_begin(void)
+{
+    m_data_start = host_time();
+    m_state = PEER_DATA;
+    send_data();
+}
+
+/* The data phase is over */
+static void validate(void)
+{
+    m_result->data_ns = host_time() - m_data_start;
+    m_state = PEER_VALIDATE;
+    request(SERIAL_OP_VALIDATE_FIRMWARE_IMAGE, NULL, 0);
+}
+
+static uint32_t stream_offset(uint32_t seq)
+{
+    return m_first + seq * frame_size();
+}
+
+static void stream_begin(void)
+{
+    m_first = m_pos;
+    m_frames = (m_data_size - m_pos + frame_size() - 1) / frame_size();
+    m_acked = m_next = m_sent = 0;
+    m_acked_mark = m_sent_mark;
+    m_data_start = host_time();
+    if (m_frames > MAX_STREAM_FRAMES)
+        host_fail("too many frames to stream");
+    m_state = PEER_STREAM;
+}
+
+/* Send the next frame if it fits in the window */
+static bool stream_send(void)
+{
+    uint8_t hdr[SERIAL_STREAM_HDR_SZ];
+    uint32_t off, n, crc, mark;
+
+    if (m_next == m_frames)
+        return false;
+    if (m_session.window && m_next - m_acked >= m_session.window)
+        return false;
+    off = stream_offset(m_next);
+    if (m_session.stop_at && off >= m_session.stop_at)
+        return false;
+    n = MIN(frame_size(), m_data_size - off);
+
+    /* Worst case on the wire: marker, long length, and every other
+       byte escaped */
+    if (m_sent_mark - m_acked_mark + 2 + 2 * (2 + 1 + sizeof(hdr) + n) >
+        m_result->rx_size)
+    {
+        if (m_sent_mark != m_acked_mark)
+            return false;
+        host_fail("a %u byte frame doesn't fit the %u byte receive buffer",
+                  n, m_result->rx_size);
+    }
+
+    (void)uint32_encode(m_next, &hdr[4]);
+    crc = crc32_update(crc32_init(), &hdr[4], 4);
+    crc = crc32_final(crc32_update(crc, &m_data[off], n));
+    if (m_session.damage && host_rand() % m_session.damage == 0)
+        crc ^= 1;
+    (void)uint32_encode(crc, &hdr[0]);
+
+    send_frame(SERIAL_OP_STREAM_FIRMWARE_IMAGE, hdr, sizeof(hdr), &m_data[off], n);
+    mark = m_sent_mark;
+    m_frame_mark[m_next++] = mark;
+    m_sent = MAX(m_sent, m_next);
+    m_result->data_sent += n;
+    return true;
+}
+
+static void stream_response(const uint8_t * resp, uint32_t len)
+{
+    uint32_t seq;
+
+    if (len < 6)
+        host_fail("short stream response");
+    seq = uint32_decode(&resp[2]);
+    if (seq > m_sent)
+        host_fail("ack of frame %u, only %u sent", seq, m_sent);
+    if (seq > m_acked)
+    {
+        m_acked = seq;
+        m_acked_mark = m_frame_mark[seq - 1];
+    }
+    /* Frames sent before going back for a resend may arrive after all */
+    m_next = MAX(m_next, seq);
+
+    switch (resp[1])
+    {
+        case SERIAL_DFU_RESP_VAL_OK_MORE_DATA_EXP:
+            break;
+
+        case SERIAL_DFU_RESP_VAL_SUCCESS:
+            if (seq != m_frames)
+                host_fail("stream done at frame %u of %u", seq, m_frames);
+            validate();
+            break;
+
+        case SERIAL_DFU_RESP_VAL_RESEND:
+            m_result->resends++;
+            m_next = seq;
+            break;
+
+        default:
+            fail(SERIAL_OP_STREAM_FIRMWARE_IMAGE, resp[1]);
+            break;
+    }
+}
+
+/* ---- Session ---- */
+
+void serial_session_start(const serial_session_t * p_session)
+{
+    uint32_t data_start = PKG_HEADER_SIZE + PKG_INIT_SIZE;
+
+    if (m_result == NULL)
+    {
+        m_result = mmap(NULL, sizeof(*m_result), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        m_frame_mark = malloc(MAX_STREAM_FRAMES * sizeof(uint32_t));
+    }
+    memset(m_result, 0, sizeof(*m_result));
+    m_session = *p_session;
+    m_wire_len = m_tx_pos = m_pos = 0;
+    m_line_free = m_tx_line_free = 0;
+    m_writes_count = m_tx_arrived = 0;
+    m_state = PEER_MAGIC;
+    host_set_peer(serial_peer_step, m_session.baud != 0);
+    if (m_session.raw != NULL)
+        return;
+
+    if (m_session.patch)
+        data_start += PKG_PATCH_INIT_SIZE;
+    if (m_session.package_size < data_start)
+        host_fail("package too short");
+    m_data = m_session.package + data_start;
+    m_data_size = m_session.package_size - data_start;
+    m_long_frames = frame_size() + SERIAL_STREAM_HDR_SZ + SERIAL_FRAME_HDR_SZ > 0xFF;
+}
+
+const serial_result_t * serial_result(void)
+{
+    return m_result;
+}
+
+static void expect(const uint8_t * resp, uint8_t ok)
+{
+    if (resp[1] != ok)
+        fail(resp[0], resp[1]);
+}
+
+/* Act on a response to the request we are waiting for */
+static void handle_response(const uint8_t * resp, uint32_t len)
+{
+    const uint8_t * pkg = m_session.package;
+    uint32_t offset, crc;
+
+    if (resp[0] == SERIAL_OP_STREAM_FIRMWARE_IMAGE)
+    {
+        /* Acks of frames sent twice can come after the last one */
+        if (m_state == PEER_STREAM)
+            stream_response(resp, len);
+        return;
+    }
+    if (resp[0] != m_waiting_op)
+        host_fail("response to op %u while waiting for %u", resp[0], m_waiting_op);
+    m_waiting_op = 0;
+
+    switch (m_state)
+    {
+        case PEER_START:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            m_state = PEER_INIT;
+            request(SERIAL_OP_INITIALIZE_DFU, &pkg[PKG_HEADER_SIZE], PKG_INIT_SIZE);
+            break;
+
+        case PEER_INIT:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            if (m_session.resume)
+            {
+                m_state = PEER_RESUME_QUERY;
+                request(SERIAL_OP_RESUME, NULL, 0);
+            }
+            else if (m_session.patch)
+            {
+                m_state = PEER_PATCH_INIT;
+                request(SERIAL_OP_INITIALIZE_PATCH, &pkg[PKG_HEADER_SIZE + PKG_INIT_SIZE],
+                        PKG_PATCH_INIT_SIZE);
+            }
+            else if (m_session.stream)
+            {
+                m_state = PEER_STREAM_INFO;
+                request(SERIAL_OP_STREAM_INFO, NULL, 0);
+            }
+            else
+            {
+                data_begin();
+            }
+            break;
+
+        case PEER_RESUME_QUERY:
+        case PEER_RESUME:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            if (len < 2 + SERIAL_RESUME_DATA_SZ)
+                host_fail("short resume response");
+            offset = uint32_decode(&resp[2]);
+            crc = uint32_decode(&resp[6]);
+            if (m_state == PEER_RESUME_QUERY && offset > 0 && offset <= m_data_size &&
+                crc == crc32_final(crc32_update(crc32_init(), m_data, offset)))
+            {
+                uint8_t req[SERIAL_RESUME_DATA_SZ];
+
+                (void)uint32_encode(offset, &req[0]);
+                (void)uint32_encode(crc, &req[4]);
+                m_state = PEER_RESUME;
+                request(SERIAL_OP_RESUME, req, sizeof(req));
+                break;
+            }
+            if (m_state == PEER_RESUME)
+                m_pos = m_result->resumed_at = offset;
+            if (m_session.stream)
+            {
+                m_state = PEER_STREAM_INFO;
+                request(SERIAL_OP_STREAM_INFO, NULL, 0);
+            }
+            else
+            {
+                data_begin();
+            }
+            break;
+
+        case PEER_PATCH_INIT:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            data_begin();
+            break;
+
+        case PEER_STREAM_INFO:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            if (len < 6)
+                host_fail("short stream info");
+            m_result->rx_size = uint16_decode(&resp[2]);
+            m_result->max_frame = uint16_decode(&resp[4]);
+            if (!m_session.frame_size)
+                m_session.frame_size = m_result->max_frame - SERIAL_STREAM_HDR_SZ;
+            if (m_session.frame_size + SERIAL_STREAM_HDR_SZ > m_result->max_frame)
+                host_fail("frame size %u over the device's %u", m_session.frame_size,
+                          m_result->max_frame);
+            m_long_frames = true;
+            stream_begin();
+            break;
+
+        case PEER_DATA:
+            if (m_pos < m_data_size)
+            {
+                expect(resp, SERIAL_DFU_RESP_VAL_OK_MORE_DATA_EXP);
+                if (m_state == PEER_QUIET || stop_here())
+                    break;
+                send_data();
+            }
+            else
+            {
+                expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+                if (m_state == PEER_QUIET)
+                    break;
+                validate();
+            }
+            break;
+
+        case PEER_VALIDATE:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            m_state = PEER_ACTIVATE;
+            request(SERIAL_OP_ACTIVATE_FIRMWARE_AND_RESET, NULL, 0);
+            break;
+
+        case PEER_ACTIVATE:
+            expect(resp, SERIAL_DFU_RESP_VAL_SUCCESS);
+            if (m_state == PEER_QUIET)
+                break;
+            m_result->done = true;
+            m_state = PEER_QUIET;
+            break;
+
+        default:
+            host_fail("unexpected response to op %u", resp[0]);
+    }
+}
+
+/* Read the responses already written, as the port closes */
+static void serial_peer_drain(void)
+{
+    uint8_t resp[16];
+    uint32_t len;
+
+    if (m_state == PEER_MAGIC || m_state == PEER_HELLO ||
+        m_state == PEER_RAW || m_state == PEER_QUIET)
+        return;
+    m_writes_count = 0;
+    m_tx_arrived = m_tx_len;
+    while ((len = next_response(resp, sizeof(resp))) != 0)
+        handle_response(resp, len);
+}
+
+static bool serial_peer_step(bool idle)
+{
+    uint8_t resp[16];
+    uint32_t len;
+
+    switch (m_state)
+    {
+        case PEER_MAGIC:
+            /* The bootloader listens for it once it is waiting for a
+               connection */
+            if (m_rx_handler == NULL)
+                return false;
+#ifdef RELEASE
+            wire_put(0xca); wire_put(0x9d); wire_put(0xc6); wire_put(0xa4);
+#else
+            wire_put('a'); wire_put('s'); wire_put('d'); wire_put('f');
+#endif
+            m_state = PEER_HELLO;
+            return true;
+
+        case PEER_HELLO:
+            if (m_tx_len >= 2 && m_tx[m_tx_len - 2] == '\r' && m_tx[m_tx_len - 1] == '\n')
+            {
+                m_tx_pos = m_tx_len;
+                if (m_session.raw != NULL)
+                {
+                    uint32_t i;
+
+                    for (i = 0; i < m_session.raw_size; i++)
+                        wire_put(m_session.raw[i]);
+                    m_state = PEER_RAW;
+                    return true;
+                }
+                m_state = PEER_START;
+                request(SERIAL_OP_START_DFU, m_session.package, PKG_HEADER_SIZE);
+                return true;
+            }
+            break;
+
+        case PEER_RAW:
+            /* Everything has arrived, and been answered */
+            if (wire_deliver() || !idle)
+                return true;
+            if (m_tx_len - m_tx_pos > sizeof(m_result->raw_reply))
+                host_fail("raw reply too long");
+            m_result->raw_reply_size = m_tx_len - m_tx_pos;
+            memcpy(m_result->raw_reply, &m_tx[m_tx_pos], m_result->raw_reply_size);
+            m_state = PEER_QUIET;
+            return false;
+
+        case PEER_QUIET:
+            return false;
+
+        default:
+            break;
+    }
+
+    /* Read a response, or send, or let bytes arrive */
+    if ((len = next_response(resp, sizeof(resp))) != 0)
+    {
+        handle_response(resp, len);
+        return true;
+    }
+    if (m_state == PEER_STREAM && host_rand() % 2 && stream_send())
+        return true;
+    if (wire_deliver())
+        return true;
+    if (m_state == PEER_STREAM && stream_send())
+        return true;
+
+    /* On a paced line, wait for the next byte */
+    if (m_session.baud && next_arrival())
+        return host_wait_until(next_arrival());
+
+    /* The device has gone quiet */
+    if (idle && m_state == PEER_STREAM &&
+        (m_acked < m_next || m_acked_mark != m_sent_mark))
+    {
+        /* Time out, and go back to the last ack; whatever was sent
+           after it is gone */
+        m_next = m_acked;
+        m_acked_mark = m_sent_mark;
+        return true;
+    }
+    if (idle && m_waiting_op && m_state != PEER_HELLO)
+        fail(m_waiting_op, 0);
+    return false;
+}
@@ -0,0 +1,51 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* A serial DFU session, as a host tool would run it: switch the
+   bootloader to the serial transport, send the package, validate and
+   activate. */
+typedef struct
+{
+    const uint8_t * package;    /* as genpackage.py writes it */
+    uint32_t package_size;
+    bool patch;                 /* the package carries a patch init */
+    bool stream;                /* send data with SERIAL_OP_STREAM_FIRMWARE_IMAGE */
+    bool resume;                /* ask where to resume before sending data */
+    uint32_t frame_size;        /* data bytes per frame, 0 for 20 */
+    uint32_t damage;            /* when streaming, damage 1 in this many frames */
+    uint32_t window;            /* when streaming, frames unacked at most, 0 for
+                                   as many as fit the receive ring */
+    uint32_t baud;              /* if not 0, pace the line, 10 bits a byte */
+    uint32_t latency_us;        /* on a paced line, added to each byte's trip */
+    uint32_t stop_at;           /* go quiet once this much data is sent, if not 0 */
+    const uint8_t * raw;        /* if set, send these bytes after the greeting */
+    uint32_t raw_size;          /* instead of a session */
+} serial_session_t;
+
+/* What happened, readable after the device's process has ended */
+typedef struct
+{
+    bool done;                  /* activated */
+    uint8_t failed_op;          /* the request that failed, or 0 */
+    uint8_t failed_resp;        /* and the response value, 0 for none */
+    uint32_t resumed_at;        /* offset the device resumed from */
+    uint32_t data_sent;         /* data bytes sent, counting resends */
+    uint32_t resends;           /* RESEND responses */
+    uint32_t overruns;          /* bytes lost to a full receive ring */
+    uint32_t rx_size;           /* from SERIAL_OP_STREAM_INFO */
+    uint32_t max_frame;         /* from SERIAL_OP_STREAM_INFO */
+    uint64_t data_ns;           /* host_time from the first data frame to the
+                                   response to the last */
+    uint8_t raw_reply[256];     /* what the device sent back to raw bytes */
+    uint32_t raw_reply_size;
+} serial_result_t;
+
+/* Become the device's peer for this session.  The result is cleared. */
+void serial_session_start(const serial_session_t * p_session);
+
+const serial_result_t * serial_result(void);
+
+#endif
@@ -0,0 +1,288 @@
+/** @file test_bspatch.c
+*
+* @brief bspatch.c against the byte loop its add_old replaced
+*
+* @par
+* ref/bspatch.c is bspatch as it was before it added old image bytes
+* four at a time, one byte and two bounds checks per iteration; the
+* Makefile builds it with its functions renamed to ref_*.  Both apply
+* the corpus mkpatches.py wrote: bsdiff streams between the packages'
+* applications, and between the code of host builds, and two streams
+* whose diff region starts before the old image or runs past its end.
+* The stream is read in pieces of random sizes, and output buffers are
+* freed a random time after they are stored, as packets arrive and
+* flash writes finish.  The old image has bytes that aren't 0 on each
+* side, so a read outside it changes the output.  Each output must be
+* the new image, and the two must match.  Then each patch is applied
+* whole, over and over, and the megabytes of output a second of each
+* are printed.
+*
+*   usage: test_bspatch <corpus dir> [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "bspatch.h"
+
+#define BUF_SIZE        2048        /* patcher.c's half of the 4 KB buffer */
+#define BUF_CNT         2
+#define MAX_READ        300
+#define MAX_CALLS       10000000
+#define BENCH_NS        50000000ULL
+#define GUARD           64          /* bytes around the old image */
+
+void ref_bspatch_init(const uint8_t * old, int32_t oldsize, uint8_t * new_buf,
+                      int32_t newsize, int32_t new_buf_size);
+int32_t ref_bspatch(struct bspatch_stream * stream);
+
+typedef struct
+{
+    const char * name;
+    void (*init)(const uint8_t *, int32_t, uint8_t *, int32_t, int32_t);
+    int32_t (*patch)(struct bspatch_stream *);
+} patcher_t;
+
+static const patcher_t m_new = { "new", bspatch_init, bspatch };
+static const patcher_t m_ref = { "old", ref_bspatch_init, ref_bspatch };
+
+typedef struct
+{
+    uint8_t * data;
+    uint32_t size;
+} blob_t;
+
+/* The stream being applied, and where its output goes */
+static struct
+{
+    const blob_t * p_diff;
+    uint32_t pos;
+    bool pieces;                /* read in random pieces, free buffers late */
+    uint8_t * out;
+    uint32_t out_len, out_size;
+    uint32_t in_flight;         /* buffers stored, not yet free */
+    uint32_t next;
+} m_io;
+static uint8_t m_bufs[BUF_CNT][BUF_SIZE] __attribute__((aligned(4)));
+
+static const char * m_dir;
+static const char * m_test;
+static uint32_t m_failures;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+static blob_t load(const char * name, const char * ext)
+{
+    char path[512];
+    blob_t blob;
+    FILE * f;
+    long len;
+
+    snprintf(path, sizeof(path), "%s/%s%s", m_dir, name, ext);
+    f = fopen(path, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        exit(1);
+    }
+    rewind(f);
+    blob.size = (uint32_t)len;
+    blob.data = malloc(blob.size + 1);
+    if (blob.data == NULL || fread(blob.data, 1, blob.size, f) != blob.size)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+    return blob;
+}
+
+/* ---- Stream ---- */
+
+static int32_t read_diff(const struct bspatch_stream * stream, void * buffer, uint32_t length)
+{
+    uint32_t n = m_io.p_diff->size - m_io.pos;
+
+    if (n > length)
+        n = length;
+    if (m_io.pieces && n > 0)
+        n = rand() % (n < MAX_READ ? n : MAX_READ) + (rand() % 4 != 0);
+    memcpy(buffer, &m_io.p_diff->data[m_io.pos], n);
+    m_io.pos += n;
+    return (int32_t)n;
+}
+
+static uint32_t store_data(uint8_t * data, uint32_t len)
+{
+    if (len > m_io.out_size - m_io.out_len)
+        return 1;
+    memcpy(&m_io.out[m_io.out_len], data, len);
+    m_io.out_len += len;
+    if (m_io.pieces)
+        m_io.in_flight++;
+    return 0;
+}
+
+/* As patcher.c: the next buffer is free unless every one is stored and
+   not yet written */
+static uint8_t * next_buf(const struct bspatch_stream * stream)
+{
+    uint8_t * buf;
+
+    if (m_io.in_flight >= BUF_CNT)
+        return NULL;
+    buf = m_bufs[m_io.next];
+    m_io.next = (m_io.next + 1) % BUF_CNT;
+    return buf;
+}
+
+/* Apply p_diff to p_old, into out; returns the output's length, or 0 if
+   the patch failed */
+static uint32_t apply(const patcher_t * p_patcher, const blob_t * p_old, const blob_t * p_diff,
+                      uint8_t * out, uint32_t new_size, bool pieces)
+{
+    struct bspatch_stream stream;
+    uint32_t calls = 0;
+    int32_t res;
+
+    memset(&m_io, 0, sizeof(m_io));
+    m_io.p_diff = p_diff;
+    m_io.pieces = pieces;
+    m_io.out = out;
+    m_io.out_size = new_size;
+    m_io.next = 1;
+    memset(&stream, 0, sizeof(stream));
+    stream.read = read_diff;
+    stream.store_data = store_data;
+    stream.next_buf = next_buf;
+
+    p_patcher->init(p_old->data, (int32_t)p_old->size, m_bufs[0], (int32_t)new_size, BUF_SIZE);
+    do
+    {
+        /* flash writes finish in order, a random time after they start */
+        if (m_io.in_flight > 0 && (m_io.in_flight == BUF_CNT || rand() % 2))
+            m_io.in_flight--;
+        res = p_patcher->patch(&stream);
+        if (res == BSPATCH_RES_NEED_MORE && m_io.pos == p_diff->size)
+            res = BSPATCH_RES_ERROR;
+    } while (res != BSPATCH_RES_FINISHED && res != BSPATCH_RES_ERROR && ++calls < MAX_CALLS);
+
+    return res == BSPATCH_RES_FINISHED ? m_io.out_len : 0;
+}
+
+/* ---- Tests ---- */
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Megabytes of output a second, applying the patch whole */
+static double bench(const patcher_t * p_patcher, const blob_t * p_old, const blob_t * p_diff,
+                    uint8_t * out, uint32_t new_size)
+{
+    uint64_t start = now_ns();
+    uint64_t elapsed;
+    uint32_t count = 0;
+
+    do
+    {
+        (void)apply(p_patcher, p_old, p_diff, out, new_size, false);
+        count++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_NS);
+
+    return (double)count * new_size * 1000 / elapsed;
+}
+
+static void test_patch(const char * name, uint32_t seed)
+{
+    blob_t file = load(name, ".old");
+    blob_t new = load(name, ".new");
+    blob_t diff = load(name, ".diff");
+    uint8_t * out = malloc(new.size + 1);
+    uint8_t * ref_out = malloc(new.size + 1);
+    uint8_t * guarded = malloc(file.size + 2 * GUARD);
+    blob_t old = { guarded + GUARD, file.size };
+    uint32_t len, ref_len;
+    double rate, ref_rate;
+
+    m_test = name;
+    memset(guarded, 0x5a, file.size + 2 * GUARD);
+    memcpy(old.data, file.data, file.size);
+    srand(seed);
+    len = apply(&m_new, &old, &diff, out, new.size, true);
+    srand(seed);
+    ref_len = apply(&m_ref, &old, &diff, ref_out, new.size, true);
+    check(len == new.size && memcmp(out, new.data, new.size) == 0,
+          "output isn't the new image");
+    check(ref_len == new.size && memcmp(ref_out, new.data, new.size) == 0,
+          "old bspatch's output isn't the new image");
+    check(len == ref_len && memcmp(out, ref_out, len) == 0, "output differs from old bspatch's");
+
+    ref_rate = bench(&m_ref, &old, &diff, ref_out, new.size);
+    rate = bench(&m_new, &old, &diff, out, new.size);
+    printf("  %-20s %6u bytes, patch %6u: old %6.1f MB/s, new %6.1f MB/s\n",
+           name, new.size, diff.size, ref_rate, rate);
+
+    free(file.data);
+    free(guarded);
+    free(new.data);
+    free(diff.data);
+    free(out);
+    free(ref_out);
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t seed;
+    char path[512];
+    char name[128];
+    uint32_t count = 0;
+    FILE * f;
+
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <corpus dir> [seed]\n", argv[0]);
+        return 1;
+    }
+    m_dir = argv[1];
+    seed = argc == 3 ? strtoul(argv[2], NULL, 0) : 1;
+
+    snprintf(path, sizeof(path), "%s/index", m_dir);
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        return 1;
+    }
+    while (fscanf(f, "%127s", name) == 1)
+        test_patch(name, seed + count++);
+    fclose(f);
+
+    m_test = "corpus";
+    check(count > 0, "no patches");
+    if (m_failures)
+    {
+        fprintf(stderr, "test_bspatch: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_bspatch: ok\n");
+    return 0;
+}
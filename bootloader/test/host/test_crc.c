@@ -0,0 +1,98 @@
+/** @file test_crc.c
+*
+* @brief crc32.c against a bitwise CRC32
+*
+* @par
+* Built once for each of CRC32_BITWISE, CRC32_NIBBLE, CRC32_TABLE and
+* CRC32_SLICE4.  Checks the standard check value, then random data of
+* random lengths at every alignment, whole through crc32 and split into
+* random pieces through crc32_init, crc32_update and crc32_final.
+*
+*   usage: test_crc [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "crc32.h"
+
+#define RANDOM_RUNS     10000
+#define MAX_LEN         1100
+
+static uint32_t m_failures;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "crc32: %s\n", what);
+        m_failures++;
+    }
+}
+
+/* The CRC32 crc32.c had before it was table driven */
+static uint32_t crc32_ref(const uint8_t * message, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t i;
+    int32_t j;
+
+    for (i = 0; i < len; i++)
+    {
+        crc = crc ^ message[i];
+        for (j = 7; j >= 0; j--)
+        {
+            uint32_t mask = -(crc & 1);
+
+            crc = (crc >> 1) ^ (0xEDB88320 & mask);
+        }
+    }
+    return ~crc;
+}
+
+int main(int argc, char * argv[])
+{
+    static uint8_t buffer[MAX_LEN + 4];
+    uint32_t i;
+
+    srand(argc > 1 ? strtoul(argv[1], NULL, 0) : 1);
+
+    check(crc32((uint8_t *)"123456789", 9) == 0xCBF43926, "check value");
+    check(crc32(buffer, 0) == 0x00000000, "empty");
+
+    for (i = 0; i < RANDOM_RUNS && m_failures == 0; i++)
+    {
+        uint8_t * data = &buffer[i % 4];
+        uint32_t len = rand() % MAX_LEN;
+        uint32_t at = 0;
+        uint32_t expected, crc;
+        uint32_t j;
+
+        for (j = 0; j < len; j++)
+            data[j] = (uint8_t)rand();
+        expected = crc32_ref(data, len);
+
+        check(crc32(data, len) == expected, "whole");
+        crc = crc32_init();
+        while (at < len)
+        {
+            uint32_t n = rand() % (len - at) + 1;
+
+            crc = crc32_update(crc, &data[at], n);
+            at += n;
+        }
+        check(crc32_final(crc) == expected, "in pieces");
+    }
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_crc: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_crc: ok\n");
+    return 0;
+}
@@ -0,0 +1,1032 @@
+/** @file test_dfu.c
+*
+* @brief Serial DFU sessions replayed against the host build
+*
+* @par
+* Each test starts from blank flash, installs the old application, and
+* then updates it with one of the packages mkpackages.py wrote: plain,
+* encrypted and patch, a frame at a time and streamed, with damaged
+* frames, interrupted sessions that resume, and power lost at each flash
+* operation in turn.  Whatever happens, the device must only ever start
+* the old or the new application, and a later session must finish.
+* Raw bytes check the frame parser, on frames it must answer and ones
+* it must drop.  Flash is also counted: small frames must still reach
+* bank 1 a staging buffer at a time, and only pages of bank 1 that
+* aren't blank are erased.  Last, tables of boot decisions: when a
+* reset starts the application without opening the DFU window, and
+* when bank 0 is valid, for each state of its CRC check.  Built with
+* DFU_SINGLE_BANK_APP, the big application is also written in place,
+* with power lost at each flash operation, and the settings page too.
+* On the nRF52, the largest BLE write is checked for every MTU a client
+* may ask for, and writes of each size a link can end up with go
+* through the RX pool and update the application, plain and by patch.
+* The time dfu_profile counts in each stage of a streamed update is
+* printed for each package.  Last, over a line paced as a USB serial
+* adapter would, the data phase's throughput is printed a frame at a
+* time and streamed with each window from 1 to 16 frames; and the time
+* to patch, with flash operations starting at once and up to 20 ms late.
+*
+*   usage: test_dfu <package dir> [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host.h"
+#include "serial.h"
+#include "bootloader.h"
+#include "dfu_types.h"
+#include "rigdfu.h"
+#include "dfu_transport_serial.h"
+#include "rigdfu_serial.h"
+#include "dfu_transport_ble.h"
+#include "hci_mem_pool_ble.h"
+#include "heatshrink_config.h"
+#include "crc32.h"
+#include "version.h"
+
+#define MAX_BOOTS       8
+
+/* A USB serial adapter, as a host tool would see it */
+#define PACED_BAUD          115200
+#define PACED_LATENCY_US    16000
+#define MAX_WINDOW          16
+#define FLASH_LATENCY_MS    20
+
+/* Frames that leave room for several in the receive ring */
+#if RIGDFU_SERIAL_RX_SIZE >= 4096
+#define WINDOW_FRAME_SIZE   128
+#else
+#define WINDOW_FRAME_SIZE   32
+#endif
+
+/* DFU_STAGE_SIZE in dfu_dual_bank.c */
+#define STAGE_SIZE      MIN(CODE_PAGE_SIZE, DFU_PATCH_BUFFER_SIZE / 2)
+
+typedef struct
+{
+    uint8_t * data;
+    uint32_t size;
+} blob_t;
+
+static const char * m_dir;
+static uint32_t m_seed = 1;
+static blob_t m_old, m_new, m_key;
+static blob_t m_old_pkg, m_new_pkg, m_new_enc_pkg, m_patch_pkg, m_patch_enc_pkg;
+static blob_t m_big, m_big_pkg, m_big_enc_pkg;
+static const char * m_test;
+static uint32_t m_failures;
+
+static blob_t load(const char * name)
+{
+    char path[512];
+    blob_t blob;
+    FILE * f;
+    long len;
+
+    snprintf(path, sizeof(path), "%s/%s", m_dir, name);
+    f = fopen(path, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= 0)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        exit(1);
+    }
+    rewind(f);
+    blob.size = (uint32_t)len;
+    blob.data = malloc(blob.size);
+    if (blob.data == NULL || fread(blob.data, 1, blob.size, f) != blob.size)
+    {
+        fprintf(stderr, "can't read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+    return blob;
+}
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+/* ---- Boots ---- */
+
+static void boot_fn(void * p_context)
+{
+    host_bootloader_main(*(const bool *)p_context);
+}
+
+/* Boot once, as after a reset, with DFU requested if a session is
+   given, and return how the boot ended */
+static int boot(const serial_session_t * p_session)
+{
+    bool dfu_requested = (p_session != NULL);
+    int code;
+
+    if (p_session != NULL)
+        serial_session_start(p_session);
+    code = host_run(boot_fn, &dfu_requested);
+    host_set_peer(NULL, false);
+    return code;
+}
+
+/* Boot without DFU until the application starts, and return
+   HOST_EXIT_APP; power may be lost on the way.  HOST_EXIT_RESET means
+   the bootloader kept waiting for an update instead. */
+static int boot_app(void)
+{
+    int code = HOST_EXIT_RESET;
+    int i;
+
+    for (i = 0; i < MAX_BOOTS && code != HOST_EXIT_APP; i++)
+    {
+        code = boot(NULL);
+        if (code != HOST_EXIT_APP && code != HOST_EXIT_RESET &&
+            code != HOST_EXIT_POWER_LOSS)
+            return code;
+    }
+    return code == HOST_EXIT_POWER_LOSS ? HOST_EXIT_RESET : code;
+}
+
+static bool app_is(const blob_t * p_app)
+{
+    return memcmp((const void *)DFU_BANK_0_REGION_START, p_app->data, p_app->size) == 0;
+}
+
+static serial_session_t session(const blob_t * p_pkg)
+{
+    serial_session_t s;
+
+    memset(&s, 0, sizeof(s));
+    s.package = p_pkg->data;
+    s.package_size = p_pkg->size;
+    s.patch = (p_pkg == &m_patch_pkg || p_pkg == &m_patch_enc_pkg);
+    return s;
+}
+
+/* Run one session to the end, then boot into the application */
+static bool update(const serial_session_t * p_session, const blob_t * p_app)
+{
+    int code = boot(p_session);
+    const serial_result_t * r = serial_result();
+
+    if (code != HOST_EXIT_RESET || !r->done)
+    {
+        fprintf(stderr, "%s: session ended with %d, op %u failed with %u\n",
+                m_test, code, r->failed_op, r->failed_resp);
+        m_failures++;
+        return false;
+    }
+    check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+    check(app_is(p_app), "wrong application");
+    return true;
+}
+
+static void set_key(void)
+{
+    /* Programmed at the factory, like the rest of the Rigado data */
+    memcpy((void *)RIGADO_DATA->dfu_key, m_key.data, sizeof(RIGADO_DATA->dfu_key));
+}
+
+/* Blank flash, then install the old application, and the key if one
+   is wanted for the update */
+static bool start(const char * test, bool key)
+{
+    serial_session_t s = session(&m_old_pkg);
+
+    m_test = test;
+    host_init(m_seed++);
+    if (!update(&s, &m_old))
+        return false;
+    if (key)
+        set_key();
+    return true;
+}
+
+/* ---- Tests ---- */
+
+static void test_frames(void)
+{
+    static const uint32_t sizes[] = { 20, 244 };
+    uint32_t i;
+
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        serial_session_t s;
+
+        if (!start("frames", false))
+            return;
+        s = session(&m_new_pkg);
+        s.frame_size = sizes[i];
+        (void)update(&s, &m_new);
+    }
+}
+
+/* Send raw bytes after the greeting, and check the device's answer */
+static void parse(const char * what, const uint8_t * p_raw, uint32_t raw_size,
+                  const uint8_t * p_reply, uint32_t reply_size)
+{
+    serial_session_t s;
+    const serial_result_t * r;
+
+    memset(&s, 0, sizeof(s));
+    s.raw = p_raw;
+    s.raw_size = raw_size;
+    if (boot(&s) != HOST_EXIT_RESET)
+    {
+        check(false, "session didn't time out");
+        return;
+    }
+    r = serial_result();
+    if (r->raw_reply_size != reply_size || memcmp(r->raw_reply, p_reply, reply_size) != 0)
+    {
+        fprintf(stderr, "%s: %s: %u byte reply\n", m_test, what, r->raw_reply_size);
+        m_failures++;
+    }
+    check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+}
+
+/* PROTOCOL_VER requests, short and long, around frames the parser must
+   drop: noise, a frame cut short by the next marker, lengths out of
+   range.  Escaped data and the largest frame are still accepted. */
+static void test_frame_parser(void)
+{
+    static const uint8_t ver[] = { 0xAA, 0x02, SERIAL_OP_PROTOCOL_VER };
+    static const uint8_t ver_reply[] =
+        { 0xAA, 0x04, SERIAL_OP_RESPONSE, SERIAL_OP_PROTOCOL_VER, API_PROTOCOL_VERSION };
+    static const uint8_t ver_long[] = { 0xAA, 0x00, 0x02, 0x00, SERIAL_OP_PROTOCOL_VER };
+    static const uint8_t ver_long_reply[] =
+        { 0xAA, 0x00, 0x04, 0x00, SERIAL_OP_RESPONSE, SERIAL_OP_PROTOCOL_VER,
+          API_PROTOCOL_VERSION };
+    static const uint8_t escaped[] =
+        { 0xAA, 0x04, SERIAL_OP_PROTOCOL_VER, 0xAB, 0xAB, 0xAB, 0xAC };
+    static const uint8_t cut[] = { 0xAA, 0x05, SERIAL_OP_PROTOCOL_VER, 0x01 };
+    static const uint8_t too_short[] = { 0xAA, 0x01, SERIAL_OP_PROTOCOL_VER };
+    static const uint8_t too_short_long[] = { 0xAA, 0x00, 0x01, 0x00, SERIAL_OP_PROTOCOL_VER };
+    static uint8_t raw[2 * (SERIAL_FRAME_MAX_DATA + 8)];
+    uint32_t len, i;
+
+    if (!start("frame parser", false))
+        return;
+
+    parse("short", ver, sizeof(ver), ver_reply, sizeof(ver_reply));
+    parse("long", ver_long, sizeof(ver_long), ver_long_reply, sizeof(ver_long_reply));
+    parse("escaped data", escaped, sizeof(escaped), ver_reply, sizeof(ver_reply));
+
+    /* Noise before the marker */
+    for (len = 0; len < 100; len++)
+        raw[len] = (uint8_t)(host_rand() % SERIAL_FRAME_MARKER);
+    memcpy(&raw[len], ver, sizeof(ver));
+    parse("noise", raw, len + sizeof(ver), ver_reply, sizeof(ver_reply));
+
+    /* A marker starts a new frame, whatever came before */
+    memcpy(raw, cut, sizeof(cut));
+    memcpy(&raw[sizeof(cut)], ver, sizeof(ver));
+    parse("cut short", raw, sizeof(cut) + sizeof(ver), ver_reply, sizeof(ver_reply));
+
+    /* Lengths under the op are ignored */
+    memcpy(raw, too_short, sizeof(too_short));
+    memcpy(&raw[sizeof(too_short)], too_short_long, sizeof(too_short_long));
+    parse("too short", raw, sizeof(too_short) + sizeof(too_short_long), NULL, 0);
+
+    /* The largest long frame is answered; one byte more is dropped, and
+       so is its data, up to the next marker */
+    for (i = 0; i < 2; i++)
+    {
+        uint32_t total = SERIAL_FRAME_MAX_DATA + SERIAL_FRAME_HDR_SZ + i;
+
+        len = 0;
+        raw[len++] = 0xAA;
+        raw[len++] = 0x00;
+        raw[len++] = total & 0xFF;
+        raw[len++] = total >> 8;
+        raw[len++] = SERIAL_OP_PROTOCOL_VER;
+        while (len < total + 3)
+            raw[len++] = (uint8_t)(host_rand() % SERIAL_FRAME_MARKER);
+        if (i == 0)
+        {
+            parse("largest", raw, len, ver_long_reply, sizeof(ver_long_reply));
+        }
+        else
+        {
+            memcpy(&raw[len], ver, sizeof(ver));
+            parse("too long", raw, len + sizeof(ver), ver_reply, sizeof(ver_reply));
+        }
+    }
+}
+
+/* Image data is written to bank 1 a staging buffer at a time, however
+   small the frames: once when the buffer fills, and at most once more
+   when a checkpoint flushes it early */
+static void test_staging(void)
+{
+    uint32_t stages = (m_new.size + STAGE_SIZE - 1) / STAGE_SIZE;
+    host_flash_count_t before, after;
+    serial_session_t s;
+
+    if (!start("staging", false))
+        return;
+    s = session(&m_new_pkg);
+    s.frame_size = 20;
+    before = host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START);
+    if (!update(&s, &m_new))
+        return;
+    after = host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START);
+    check(after.writes - before.writes <= 2 * stages, "more than two writes per staging buffer");
+}
+
+/* Pages of bank 1 an image of the given size covers that aren't blank */
+static uint32_t dirty_pages(uint32_t size)
+{
+    uint32_t page, i;
+    uint32_t dirty = 0;
+
+    for (page = DFU_BANK_1_REGION_START & ~(CODE_PAGE_SIZE - 1);
+         page < DFU_BANK_1_REGION_START + size; page += CODE_PAGE_SIZE)
+    {
+        for (i = 0; i < CODE_PAGE_SIZE; i += 4)
+        {
+            if (*(const uint32_t *)(uintptr_t)(page + i) != 0xFFFFFFFF)
+            {
+                dirty++;
+                break;
+            }
+        }
+    }
+    return dirty;
+}
+
+/* Bank 1 is erased a page at a time as the image reaches it, and pages
+   that are already blank are left alone */
+static void test_lazy_erase(void)
+{
+    host_flash_count_t before, after;
+    serial_session_t s = session(&m_new_pkg);
+    uint32_t dirty;
+    uint32_t i;
+
+    /* Whatever the last update left in bank 1 */
+    if (!start("lazy erase", false))
+        return;
+    dirty = dirty_pages(m_new.size);
+    before = host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START);
+    if (!update(&s, &m_new))
+        return;
+    after = host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START);
+    check(after.erases - before.erases == dirty, "erased pages that were blank, or not all dirty ones");
+
+    /* Every page the image covers dirty */
+    if (!start("lazy erase dirty", false))
+        return;
+    for (i = 0; i < m_new.size; i += 4)
+        *(uint32_t *)(uintptr_t)(DFU_BANK_1_REGION_START + i) &= host_rand();
+    dirty = dirty_pages(m_new.size);
+    before = host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START);
+    if (!update(&s, &m_new))
+        return;
+    after = host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START);
+    check(after.erases - before.erases == dirty, "didn't erase every dirty page once");
+
+    /* Nor, since start, was any blank page of bank 1 */
+    check(host_flash_count(DFU_BANK_1_REGION_START, BOOTLOADER_REGION_START).blank_erases == 0,
+          "blank page erased");
+}
+
+static void test_stream(void)
+{
+    serial_session_t s;
+
+    /* The largest frames the device offers */
+    if (!start("stream", false))
+        return;
+    s = session(&m_new_pkg);
+    s.stream = true;
+    if (update(&s, &m_new))
+        check(serial_result()->overruns == 0, "receive ring overrun");
+
+    /* Small frames, some damaged */
+    if (!start("stream damaged", false))
+        return;
+    s = session(&m_new_pkg);
+    s.stream = true;
+    s.frame_size = 20;
+    s.damage = 7;
+    if (update(&s, &m_new))
+        check(serial_result()->resends > 0, "no resends");
+}
+
+/* The data phase's throughput over a paced line, a frame at a time and
+   streamed with each window; window 0 is a frame at a time */
+static void test_window(void)
+{
+    double rate[MAX_WINDOW + 1];
+    uint32_t w;
+
+    for (w = 0; w <= MAX_WINDOW; w++)
+    {
+        serial_session_t s;
+        const serial_result_t * r;
+
+        if (!start("window", false))
+            return;
+        s = session(&m_new_pkg);
+        s.stream = (w > 0);
+        s.window = w;
+        s.frame_size = WINDOW_FRAME_SIZE;
+        s.baud = PACED_BAUD;
+        s.latency_us = PACED_LATENCY_US;
+        if (!update(&s, &m_new))
+            return;
+        r = serial_result();
+        check(r->overruns == 0 && r->resends == 0, "frames lost");
+        rate[w] = r->data_sent * 1e9 / r->data_ns;
+    }
+
+    printf("  %u byte frames at %u baud, %u ms latency: a frame at a time %.0f B/s\n",
+           WINDOW_FRAME_SIZE, PACED_BAUD, PACED_LATENCY_US / 1000, rate[0]);
+    printf("  window");
+    for (w = 1; w <= MAX_WINDOW; w++)
+        printf(" %u:%.0f", w, rate[w]);
+    printf(" B/s\n");
+    check(rate[4] > 1.5 * rate[1], "a window of 4 isn't faster than a frame at a time");
+}
+
+static void test_encrypted(void)
+{
+    serial_session_t s;
+
+    if (!start("encrypted", true))
+        return;
+    s = session(&m_new_enc_pkg);
+    (void)update(&s, &m_new);
+
+    if (!start("encrypted stream", true))
+        return;
+    s = session(&m_new_enc_pkg);
+    s.stream = true;
+    (void)update(&s, &m_new);
+
+    /* With a key, a plain package is refused and the old application
+       stays */
+    if (!start("plain with key", true))
+        return;
+    s = session(&m_new_pkg);
+    (void)boot(&s);
+    check(!serial_result()->done, "plain package accepted with a key");
+    check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+    check(app_is(&m_old), "wrong application");
+}
+
+static void test_patch(void)
+{
+    serial_session_t s;
+
+    if (!start("patch", false))
+        return;
+    s = session(&m_patch_pkg);
+    (void)update(&s, &m_new);
+
+    if (!start("encrypted patch", true))
+        return;
+    s = session(&m_patch_enc_pkg);
+    (void)update(&s, &m_new);
+}
+
+/* A patch over a paced line, with each flash operation starting at
+   once, or up to FLASH_LATENCY_MS late at random: the application must
+   still come out right, and the data phase's time, the time to patch,
+   is printed.  Patches go a frame at a time, so the next frame waits
+   on the last one's flash writes. */
+static void test_patch_latency(void)
+{
+    double ms[2];
+    uint32_t late;
+    bool ok;
+
+    for (late = 0; late < 2; late++)
+    {
+        serial_session_t s;
+
+        if (!start("patch latency", false))
+            return;
+        s = session(&m_patch_pkg);
+        s.baud = PACED_BAUD;
+        s.latency_us = PACED_LATENCY_US;
+        host_flash_latency(late ? FLASH_LATENCY_MS * 1000000ULL : 0);
+        ok = update(&s, &m_new);
+        host_flash_latency(0);
+        if (!ok)
+            return;
+        ms[late] = serial_result()->data_ns / 1e6;
+    }
+    printf("  patch: %.0f ms, flash up to %u ms late %.0f ms\n",
+           ms[0], FLASH_LATENCY_MS, ms[1]);
+}
+
+#ifdef SDK12
+/* The RX pool the BLE transport copies each DFU write into, with
+   writes of one size: all BLE_RX_BUF_QUEUE_SIZE buffers fill, one more
+   is refused, and they come out in order, twice round */
+static void ble_pool(uint32_t size)
+{
+    uint8_t * p_buffer;
+    uint32_t length;
+    uint32_t round, i;
+
+    check(BLE_hci_mem_pool_open() == NRF_SUCCESS, "pool open");
+    check(BLE_hci_mem_pool_rx_produce(BLE_RX_BUF_SIZE + 1, (void **)&p_buffer) ==
+          NRF_ERROR_DATA_SIZE, "pool took a write bigger than its buffers");
+    for (round = 0; round < 2; round++)
+    {
+        for (i = 0; i < BLE_RX_BUF_QUEUE_SIZE; i++)
+        {
+            if (BLE_hci_mem_pool_rx_produce(size, (void **)&p_buffer) != NRF_SUCCESS)
+            {
+                check(false, "pool full too soon");
+                return;
+            }
+            memset(p_buffer, (uint8_t)(round * BLE_RX_BUF_QUEUE_SIZE + i), size);
+            (void)BLE_hci_mem_pool_rx_data_size_set(size);
+        }
+        check(BLE_hci_mem_pool_rx_produce(size, (void **)&p_buffer) == NRF_ERROR_NO_MEM,
+              "pool took more writes than it has buffers");
+        for (i = 0; i < BLE_RX_BUF_QUEUE_SIZE; i++)
+        {
+            if (BLE_hci_mem_pool_rx_extract(&p_buffer, &length) != NRF_SUCCESS)
+            {
+                check(false, "pool empty too soon");
+                return;
+            }
+            check(length == size &&
+                  p_buffer[0] == (uint8_t)(round * BLE_RX_BUF_QUEUE_SIZE + i) &&
+                  p_buffer[size - 1] == p_buffer[0], "pool write out of order");
+            check(BLE_hci_mem_pool_rx_consume(p_buffer) == NRF_SUCCESS, "pool consume");
+        }
+    }
+    (void)BLE_hci_mem_pool_close();
+}
+
+/* The BLE packet path at each ATT MTU: the largest write
+   get_client_rx_mtu takes for every MTU a client may ask for, with the
+   SoftDevice enabled at BLE_GAP_MTU_MAX or at the fallback, goes
+   through the RX pool, and whole writes of the sizes a link can end up
+   with update the application, plain and by patch, so each patch write
+   goes to patcher_add_data in one piece.  The serial transport stands
+   in for the radio. */
+static void test_ble_packets(void)
+{
+    static const uint16_t att_mtus[] = { BLE_GAP_MTU_MAX, DFU_BLE_ATT_MTU_FALLBACK };
+    static const uint16_t client_mtus[] = { BLE_L2CAP_MTU_DEF, 185, BLE_GAP_MTU_MAX };
+    uint32_t sizes[sizeof(att_mtus) / sizeof(att_mtus[0]) *
+                   sizeof(client_mtus) / sizeof(client_mtus[0])];
+    uint32_t n_sizes = 0;
+    uint32_t i, j, k;
+
+    m_test = "ble packets";
+    for (i = 0; i < sizeof(att_mtus) / sizeof(att_mtus[0]); i++)
+    {
+        uint32_t client;
+
+        for (client = 0; client <= 300; client++)
+        {
+            uint32_t mtu = DFU_BLE_MTU(client, att_mtus[i]);
+            uint32_t size = DFU_BLE_MAX_WRITE(mtu);
+
+            check(mtu >= BLE_L2CAP_MTU_DEF && mtu <= att_mtus[i], "MTU out of range");
+            check(size % sizeof(uint32_t) == 0, "write not a multiple of 4");
+            check(size <= mtu - 3 && size <= BLE_RX_BUF_SIZE, "write too big");
+            check(size + 3 >= MIN(mtu - 3, BLE_RX_BUF_SIZE), "write smaller than it need be");
+            check(size <= HEATSHRINK_STATIC_INPUT_BUFFER_SIZE, "write bigger than the patcher's input");
+        }
+        for (j = 0; j < sizeof(client_mtus) / sizeof(client_mtus[0]); j++)
+        {
+            uint32_t size = DFU_BLE_MAX_WRITE(DFU_BLE_MTU(client_mtus[j], att_mtus[i]));
+
+            for (k = 0; k < n_sizes && sizes[k] != size; k++)
+                ;
+            if (k == n_sizes)
+                sizes[n_sizes++] = size;
+        }
+    }
+
+    for (k = 0; k < n_sizes; k++)
+    {
+        serial_session_t s;
+        static char name[32];
+
+        ble_pool(sizes[k]);
+
+        snprintf(name, sizeof(name), "ble packets %u", sizes[k]);
+        if (!start(name, false))
+            return;
+        s = session(&m_new_pkg);
+        s.frame_size = sizes[k];
+        (void)update(&s, &m_new);
+
+        snprintf(name, sizeof(name), "ble patch packets %u", sizes[k]);
+        if (!start(name, false))
+            return;
+        s = session(&m_patch_pkg);
+        s.frame_size = sizes[k];
+        (void)update(&s, &m_new);
+    }
+}
+#endif
+
+/* Where a streamed update's time goes with each package, as dfu_profile
+   counts it: the PC's time for the processing, the chip's for flash */
+static void test_profile(void)
+{
+    static const struct
+    {
+        const char * name;
+        const blob_t * p_pkg;
+        bool key;
+    } packages[] =
+    {
+        { "plain",           &m_new_pkg,       false },
+        { "encrypted",       &m_new_enc_pkg,   true  },
+        { "patch",           &m_patch_pkg,     false },
+        { "encrypted patch", &m_patch_enc_pkg, true  },
+    };
+    double ms[DFU_STAGE_max];
+    uint32_t i, j;
+
+    for (i = 0; i < sizeof(packages) / sizeof(packages[0]); i++)
+    {
+        serial_session_t s;
+        int code;
+
+        if (!start("profile", packages[i].key))
+            return;
+        s = session(packages[i].p_pkg);
+        s.stream = true;
+        code = boot(&s);
+        for (j = 0; j < DFU_STAGE_max; j++)
+            ms[j] = host_dfu_profile((dfu_stage_t)j) * 1000.0 / 32768;
+        check(code == HOST_EXIT_RESET && serial_result()->done, "session failed");
+        check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+        check(app_is(&m_new), "wrong application");
+
+        printf("  %-15s decrypt %6.1f ms, decompress %6.1f ms, patch %6.1f ms, "
+               "flash %7.1f ms\n", packages[i].name, ms[DFU_STAGE_DECRYPT],
+               ms[DFU_STAGE_DECOMPRESS], ms[DFU_STAGE_PATCH], ms[DFU_STAGE_FLASH]);
+    }
+}
+
+static void test_resume(bool stream)
+{
+    serial_session_t s;
+
+    if (!start(stream ? "resume stream" : "resume frames", false))
+        return;
+
+    /* The host goes away halfway, and the bootloader gives up and
+       starts the old application */
+    s = session(&m_new_pkg);
+    s.stream = stream;
+    s.stop_at = m_new.size / 2;
+    (void)boot(&s);
+    check(!serial_result()->done, "interrupted session finished");
+    check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+    check(app_is(&m_old), "wrong application");
+
+    s.stop_at = 0;
+    s.resume = true;
+    if (update(&s, &m_new))
+        check(serial_result()->resumed_at > 0, "didn't resume");
+}
+
+/* Lose power at each flash operation of an update in turn.  The
+   device must then start the old or the new application, or, if power
+   went while the new one was copied to bank 0, wait for an update; and
+   never start anything else.  A second session must then finish, and
+   where a checkpoint was saved, carry on from it. */
+static void test_power_loss(bool torn)
+{
+    const char * name = torn ? "power loss torn" : "power loss";
+    serial_session_t s = session(&m_new_pkg);
+    uint32_t ops, at;
+    uint32_t resumed = 0;
+    int code;
+
+    s.stream = true;
+    s.frame_size = 244;
+
+    /* Count the operations in a whole update */
+    if (!start(name, false))
+        return;
+    ops = host_flash_ops();
+    if (!update(&s, &m_new))
+        return;
+    ops = host_flash_ops() - ops;
+
+    for (at = 1; at <= ops; at++)
+    {
+        if (!start(name, false))
+            return;
+        host_power_loss_after(at, torn);
+        (void)boot(&s);
+        code = boot_app();
+        host_power_loss_after(0, false);
+
+        if (code == HOST_EXIT_APP ? !(app_is(&m_old) || app_is(&m_new))
+                                  : code != HOST_EXIT_RESET)
+        {
+            fprintf(stderr, "%s: %s after power loss at op %u of %u\n", m_test,
+                    code == HOST_EXIT_APP ? "wrong application" : "failed", at, ops);
+            m_failures++;
+            continue;
+        }
+        if (code != HOST_EXIT_APP || !app_is(&m_new))
+        {
+            serial_session_t r = s;
+
+            r.resume = true;
+            if (update(&r, &m_new) && serial_result()->resumed_at > 0)
+                resumed++;
+        }
+    }
+
+    /* Power lost partway through the transfer leaves checkpoints */
+    check(resumed > 0, "no session resumed after power loss");
+}
+
+#if DFU_SINGLE_BANK_APP
+/* The application in bank 0 is the old or the big one, whole, and if
+   the settings say it's valid, they have its size and CRC, and the CRC
+   was checked when it started.  With the settings lost, nothing is
+   checked, so only the whole image will do. */
+static bool app_is_whole(void)
+{
+    const bootloader_settings_t * p_settings =
+        (const bootloader_settings_t *)BOOTLOADER_SETTINGS_ADDRESS;
+    const blob_t * p_app = app_is(&m_big) ? &m_big : app_is(&m_old) ? &m_old : NULL;
+
+    if (p_app == NULL)
+        return false;
+    if (p_settings->bank_0 != BANK_VALID_APP)
+        return true;
+    return p_settings->bank_0_size == p_app->size &&
+           p_settings->bank_0_crc == crc32(p_app->data, p_app->size) &&
+           p_settings->bank_0_check == BANK_CHECK_DONE;
+}
+
+/* Single bank: the big application is too large for bank 1, so it's
+   written over the old one.  Lose power at each flash operation in
+   turn, on page boundaries and, torn, partway through, and with
+   lose_settings, the settings page as well, as if its last save had
+   never been made.  The device must then wait for an update or start
+   a whole application: the old one, or the big one once its vector
+   table, written last, is in place.  A second session must finish. */
+static void test_in_place(bool torn, bool lose_settings)
+{
+    const char * name = lose_settings ? "in place, settings lost" :
+                        torn ? "in place, power loss torn" : "in place, power loss";
+    serial_session_t s = session(&m_big_pkg);
+    uint32_t ops, at;
+    int code;
+
+    s.stream = true;
+    s.frame_size = 244;
+
+    if (!start(name, false))
+        return;
+    ops = host_flash_ops();
+    if (!update(&s, &m_big))
+        return;
+    ops = host_flash_ops() - ops;
+    check(app_is_whole(), "big application not recorded");
+
+    for (at = 1; at <= ops; at++)
+    {
+        if (!start(name, false))
+            return;
+        host_power_loss_after(at, torn);
+        (void)boot(&s);
+        host_power_loss_after(0, false);
+        if (lose_settings)
+            memset((void *)BOOTLOADER_SETTINGS_ADDRESS, 0xFF, CODE_PAGE_SIZE);
+        code = boot_app();
+
+        if (code == HOST_EXIT_APP ? !app_is_whole() : code != HOST_EXIT_RESET)
+        {
+            fprintf(stderr, "%s: %s after power loss at op %u of %u\n", m_test,
+                    code == HOST_EXIT_APP ? "wrong application" : "failed", at, ops);
+            m_failures++;
+            continue;
+        }
+        if (code != HOST_EXIT_APP || !app_is(&m_big))
+            (void)update(&s, &m_big);
+    }
+}
+
+static void test_in_place_encrypted(void)
+{
+    serial_session_t s;
+
+    if (!start("in place encrypted", true))
+        return;
+    s = session(&m_big_enc_pkg);
+    s.stream = true;
+    if (update(&s, &m_big))
+        check(app_is_whole(), "big application not recorded");
+}
+#endif
+
+/* Whether a reset starts the application straight away, for each
+   GPREGRET value class, with DFU asked for by the pin or not, and with
+   a SoftDevice update pending or not */
+static void test_boot_start(void)
+{
+    static const struct
+    {
+        uint8_t gpregret;
+        bool pin;
+        bool sd_update;
+        bool start;
+    } table[] =
+    {
+        { 0x00,                         false, false, true  },
+        { 0x00,                         true,  false, false },
+        { 0x00,                         false, true,  false },
+        { 0x00,                         true,  true,  false },
+        { BOOTLOADER_APP_START_MIN,     false, false, true  },
+        { BOOTLOADER_APP_START_MIN,     true,  false, true  },
+        { BOOTLOADER_APP_START_MIN,     false, true,  true  },
+        { BOOTLOADER_APP_START_MAX,     true,  true,  true  },
+        { BOOTLOADER_DFU_START,         false, false, false },
+        { BOOTLOADER_DFU_START_W_UART,  false, false, false },
+        { BOOTLOADER_APP_START_MIN - 1, false, false, true  },
+        { BOOTLOADER_APP_START_MAX + 1, false, false, true  },
+        { BOOTLOADER_APP_START_MAX + 1, true,  false, false },
+        { BOOTLOADER_APP_START_MAX + 1, false, true,  false },
+    };
+    bootloader_settings_t * p_settings = (bootloader_settings_t *)BOOTLOADER_SETTINGS_ADDRESS;
+    bootloader_settings_t saved;
+    uint32_t i, valid;
+
+    if (!start("boot start", false))
+        return;
+    saved = *p_settings;
+
+    for (i = 0; i < sizeof(table) / sizeof(table[0]); i++)
+    {
+        /* With no application, nothing starts */
+        for (valid = 0; valid < 2; valid++)
+        {
+            bool expected = table[i].start && valid;
+
+            *p_settings = saved;
+            if (table[i].sd_update)
+                p_settings->bank_1 = BANK_VALID_BOOT;
+            if (!valid)
+                p_settings->bank_0 = BANK_INVALID_APP;
+            if (bootloader_app_start_now(table[i].gpregret, table[i].pin) != expected)
+            {
+                fprintf(stderr, "%s: GPREGRET 0x%02x, pin %d, SD update %d, app %d: "
+                        "%s\n", m_test, table[i].gpregret, table[i].pin,
+                        table[i].sd_update, valid, expected ? "not started" : "started");
+                m_failures++;
+            }
+        }
+    }
+    *p_settings = saved;
+
+    /* Through a whole boot: a start request is cleared of all but its
+       low bits, for the application to read */
+    NRF_POWER->GPREGRET = BOOTLOADER_APP_START_MIN | 5;
+    check(boot(NULL) == HOST_EXIT_APP, "application doesn't start");
+    check(NRF_POWER->GPREGRET == 5, "GPREGRET not masked");
+    NRF_POWER->GPREGRET = BOOTLOADER_DFU_START;
+    check(boot(NULL) == HOST_EXIT_RESET, "DFU request ignored");
+    check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+}
+
+/* Whether bank 0 is valid, for each settings code, CRC state, and an
+   image that matches its CRC or not */
+static void test_boot_crc(void)
+{
+    static const struct
+    {
+        bootloader_bank_code_t bank_0;
+        uint32_t check;
+        bool corrupt;
+        bool valid;
+    } table[] =
+    {
+        { BANK_VALID_APP,   BANK_CHECK_PENDING, false, true  },
+        { BANK_VALID_APP,   BANK_CHECK_PENDING, true,  false },
+        { BANK_VALID_APP,   0x12345678,         true,  false },
+        { BANK_VALID_APP,   BANK_CHECK_DONE,    false, true  },
+        { BANK_VALID_APP,   BANK_CHECK_DONE,    true,  true  },
+        { BANK_VALID_APP,   BANK_CHECK_NONE,    true,  true  },
+        { BANK_UNKNOWN_00,  BANK_CHECK_PENDING, true,  true  },
+        { BANK_UNKNOWN_FF,  BANK_CHECK_PENDING, true,  true  },
+        { BANK_INVALID_APP, BANK_CHECK_DONE,    false, false },
+        { BANK_VALID_SD,    BANK_CHECK_DONE,    false, false },
+    };
+    bootloader_settings_t * p_settings = (bootloader_settings_t *)BOOTLOADER_SETTINGS_ADDRESS;
+    uint8_t * p_last = (uint8_t *)DFU_BANK_0_REGION_START + m_old.size - 1;
+    bootloader_settings_t saved;
+    uint32_t i;
+
+    if (!start("boot crc", false))
+        return;
+    saved = *p_settings;
+    check(saved.bank_0 == BANK_VALID_APP && saved.bank_0_size == m_old.size,
+          "settings after an update");
+
+    for (i = 0; i < sizeof(table) / sizeof(table[0]); i++)
+    {
+        *p_settings = saved;
+        p_settings->bank_0 = table[i].bank_0;
+        p_settings->bank_0_check = table[i].check;
+        *p_last ^= table[i].corrupt ? 0x01 : 0x00;
+        if (bootloader_app_is_valid() != table[i].valid)
+        {
+            fprintf(stderr, "%s: bank 0 0x%02x, check 0x%08x, corrupt %d: %s\n", m_test,
+                    table[i].bank_0, table[i].check, table[i].corrupt,
+                    table[i].valid ? "invalid" : "valid");
+            m_failures++;
+        }
+        *p_last ^= table[i].corrupt ? 0x01 : 0x00;
+    }
+
+    /* An image longer than bank 0 can hold is never checked */
+    *p_settings = saved;
+    p_settings->bank_0_check = BANK_CHECK_PENDING;
+    p_settings->bank_0_size = DFU_APP_IMAGE_MAX_SIZE + 1;
+    check(!bootloader_app_is_valid(), "oversized image valid");
+    *p_settings = saved;
+
+    /* The first start checks the CRC, and records that it passed */
+    p_settings->bank_0_check = BANK_CHECK_PENDING;
+    check(boot_app() == HOST_EXIT_APP, "application doesn't start");
+    check(p_settings->bank_0_check == BANK_CHECK_DONE, "check not recorded");
+}
+
+int main(int argc, char * argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s <package dir> [seed]\n", argv[0]);
+        return 1;
+    }
+    m_dir = argv[1];
+    if (argc == 3)
+        m_seed = strtoul(argv[2], NULL, 0);
+
+    m_old = load("old.bin");
+    m_new = load("new.bin");
+    m_key = load("key.bin");
+    m_old_pkg = load("old.pkg");
+    m_new_pkg = load("new.pkg");
+    m_new_enc_pkg = load("new_enc.pkg");
+    m_patch_pkg = load("patch.pkg");
+    m_patch_enc_pkg = load("patch_enc.pkg");
+    m_big = load("big.bin");
+    m_big_pkg = load("big.pkg");
+    m_big_enc_pkg = load("big_enc.pkg");
+
+    test_frames();
+    test_frame_parser();
+    test_staging();
+    test_lazy_erase();
+    test_stream();
+    test_encrypted();
+    test_patch();
+#ifdef SDK12
+    test_ble_packets();
+#endif
+    test_profile();
+    test_resume(false);
+    test_resume(true);
+    test_power_loss(false);
+    test_power_loss(true);
+#if DFU_SINGLE_BANK_APP
+    test_in_place(false, false);
+    test_in_place(true, false);
+    test_in_place(false, true);
+    test_in_place_encrypted();
+#endif
+    test_boot_start();
+    test_boot_crc();
+    test_window();
+    test_patch_latency();
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_dfu: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_dfu: ok\n");
+    return 0;
+}
@@ -0,0 +1,255 @@
+/** @file test_eax.c
+*
+* @brief libtomcrypt EAX, through ltc_nrf.c and software AES
+*
+* @par
+* Checks aes.c against the FIPS-197 example, then the EAX paper's test
+* vectors, encrypted and decrypted in pieces of several sizes, with the
+* keystream read ahead by ltc_nrf_eax_prefetch between pieces or not.
+* A longer message must give the same plaintext and tag however it is
+* split, with two sessions taking turns, and cost no more AES blocks
+* than CTR and OMAC need plus what the read-ahead fetched.
+*
+*   usage: test_eax [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "host.h"
+#include "aes.h"
+#include "ltc_nrf.h"
+
+#define LONG_LEN        4099
+
+typedef struct
+{
+    const char * msg;
+    const char * key;
+    const char * nonce;
+    const char * header;
+    const char * cipher;
+    const char * tag;
+} eax_vector_t;
+
+/* From "The EAX Mode of Operation", Bellare, Rogaway and Wagner */
+static const eax_vector_t m_vectors[] =
+{
+    { "", "233952DEE4D5ED5F9B9C6D6FF80FF478", "62EC67F9C3A4A407FCB2A8C49031A8B3",
+      "6BFB914FD07EAE6B", "", "E037830E8389F27B025A2D6527E79D01" },
+    { "F7FB", "91945D3F4DCBEE0BF45EF52255F095A4", "BECAF043B0A23D843194BA972C66DEBD",
+      "FA3BFD4806EB53FA", "19DD", "5C4C9331049D0BDAB0277408F67967E5" },
+    { "1A47CB4933", "01F74AD64077F2E704C0F60ADA3DD523", "70C3DB4F0D26368400A10ED05D2BFF5E",
+      "234A3463C1264AC6", "D851D5BAE0", "3A59F238A23E39199DC9266626C40F80" },
+    { "481C9E39B1", "D07CF6CBB7F313BDDE66B727AFD3C5E8", "8408DFFF3C1A2B1292DC199E46B7D617",
+      "33CCE2EABFF5A79D", "632A9D131A", "D4C168A4225D8E1FF755939974A7BEDE" },
+    { "40D0C07DA5E4", "35B6D0580005BBC12B0587124557D2C2", "FDB6B06676EEDC5C61D74276E1F8E816",
+      "AEB96EAEBE2970E9", "071DFE16C675", "CB0677E536F73AFE6A14B74EE49844DD" },
+    { "4DE3B35C3FC039245BD1FB7D", "BD8E6E11475E60B268784C38C62FEB22",
+      "6EAC5C93072D8E8513F750935E46DA1B", "D4482D1CA78DCE0F",
+      "835BB4F15D743E350E728414", "ABB8644FD6CCB86947C5E10590210A4F" },
+    { "8B0A79306C9CE7ED99DAE4F87F8DD61636", "7C77D6E813BED5AC98BAA417477A2E7D",
+      "1A8C98DCD73D38393B2BF1569DEEFC19", "65D2017990D62528",
+      "02083E3979DA014812F59F11D52630DA30", "137327D10649B0AA6E1C181DB617D7F2" },
+    { "1BDA122BCE8A8DBAF1877D962B8592DD2D56", "5FFF20CAFAB119CA2FC73549E20F5B0D",
+      "DDE59B97D722156D4D9AFF2BC7559826", "54B9F04E6A09189A",
+      "2EC47B2C4954A489AFC7BA4897EDCDAE8CC3", "3B60450599BD02C96382902AEF7F832A" },
+    { "6CF36720872B8513F6EAB1A8A44438D5EF11", "A4A4782BCFFD3EC5E7EF6D8C34A56123",
+      "B781FCF2F75FA5A8DE97A9CA48E522EC", "899A175897561D7E",
+      "0DE18FD0FDD91E7AF19F1D8EE8733938B1E8", "E7F6D2231618102FDB7FE55FF1991700" },
+    { "CA40D7446E545FFAED3BD12A740A659FFBBB3CEAB7", "8395FCF1E95BEBD697BD010BC766AAC3",
+      "22E7ADD93CFC6393C57EC0B3C17D6B44", "126735FCC320D25A",
+      "CB8920F87A6C75CFF39627B56E3ED197C552D295A7", "CFC46AFC253B4652B1AF3795B124AB6E" },
+};
+
+static const uint32_t m_pieces[] = { 1, 7, 16, 20, 33, 244, 0xffffffff };
+
+static const char * m_test;
+static uint32_t m_failures;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+static uint32_t hex(const char * p_hex, uint8_t * p_out)
+{
+    uint32_t n = 0;
+
+    for (; p_hex[0] && p_hex[1]; p_hex += 2)
+        sscanf(p_hex, "%2hhx", &p_out[n++]);
+    return n;
+}
+
+/* Run data through an EAX session in pieces of the given size,
+   optionally reading keystream ahead before each one */
+static bool process(eax_state * p_eax, const uint8_t * p_in, uint8_t * p_out,
+                    uint32_t len, uint32_t piece, bool encrypt, bool prefetch)
+{
+    uint32_t at;
+
+    for (at = 0; at < len; at += piece)
+    {
+        uint32_t n = (len - at < piece) ? len - at : piece;
+
+        if (prefetch)
+            while (ltc_nrf_eax_prefetch(p_eax))
+                ;
+        if ((encrypt ? eax_encrypt(p_eax, p_in + at, p_out + at, n)
+                     : eax_decrypt(p_eax, p_in + at, p_out + at, n)) != CRYPT_OK)
+            return false;
+    }
+    return true;
+}
+
+/* ---- Tests ---- */
+
+static void test_aes(void)
+{
+    uint8_t key[16], pt[16], ct[16], out[16];
+
+    m_test = "aes";
+    hex("000102030405060708090a0b0c0d0e0f", key);
+    hex("00112233445566778899aabbccddeeff", pt);
+    hex("69c4e0d86a7b0430d8cdb78070b4c55a", ct);
+    aes128_encrypt(key, pt, out);
+    check(memcmp(out, ct, 16) == 0, "FIPS-197 example");
+}
+
+static void test_vectors(void)
+{
+    uint32_t v, p, mode;
+
+    m_test = "eax vectors";
+    for (v = 0; v < sizeof(m_vectors) / sizeof(m_vectors[0]); v++)
+    {
+        const eax_vector_t * p_v = &m_vectors[v];
+        uint8_t msg[32], key[16], nonce[16], header[16], cipher[32], tag[16];
+        uint32_t msg_len = hex(p_v->msg, msg);
+        uint32_t header_len = hex(p_v->header, header);
+
+        hex(p_v->key, key);
+        hex(p_v->nonce, nonce);
+        hex(p_v->cipher, cipher);
+        hex(p_v->tag, tag);
+
+        for (p = 0; p < sizeof(m_pieces) / sizeof(m_pieces[0]); p++)
+        {
+            /* encrypt or decrypt, with or without read-ahead */
+            for (mode = 0; mode < 4; mode++)
+            {
+                bool encrypt = (mode & 1), prefetch = (mode & 2);
+                uint8_t out[32], out_tag[16];
+                unsigned long tag_len = sizeof(out_tag);
+                eax_state eax;
+                bool ok;
+
+                ok = eax_init(&eax, 0, key, 16, nonce, 16, header, header_len) == CRYPT_OK &&
+                     process(&eax, encrypt ? msg : cipher, out, msg_len, m_pieces[p],
+                             encrypt, prefetch) &&
+                     eax_done(&eax, out_tag, &tag_len) == CRYPT_OK;
+                check(ok, "error");
+                check(memcmp(out, encrypt ? cipher : msg, msg_len) == 0,
+                      encrypt ? "ciphertext" : "plaintext");
+                check(tag_len == 16 && memcmp(out_tag, tag, 16) == 0, "tag");
+            }
+        }
+    }
+}
+
+/* The same long message however it's split, with a second session
+   taking a piece in turn so the read-ahead changes hands */
+static void test_long(void)
+{
+    static uint8_t key[16], nonce[16], msg[LONG_LEN], cipher[LONG_LEN], out[LONG_LEN];
+    static uint8_t out2[LONG_LEN];
+    uint8_t tag[16], out_tag[16], out_tag2[16];
+    unsigned long tag_len = sizeof(tag);
+    uint32_t i, p;
+    eax_state eax;
+
+    m_test = "eax long";
+    for (i = 0; i < sizeof(key); i++)
+        key[i] = (uint8_t)rand();
+    for (i = 0; i < LONG_LEN; i++)
+        msg[i] = (uint8_t)rand();
+
+    if (eax_init(&eax, 0, key, 16, nonce, 16, NULL, 0) != CRYPT_OK ||
+        !process(&eax, msg, cipher, LONG_LEN, LONG_LEN, true, false) ||
+        eax_done(&eax, tag, &tag_len) != CRYPT_OK)
+    {
+        check(false, "error");
+        return;
+    }
+
+    for (p = 0; p < sizeof(m_pieces) / sizeof(m_pieces[0]); p++)
+    {
+        uint32_t piece = m_pieces[p] == 0xffffffff ? LONG_LEN : m_pieces[p];
+        uint32_t blocks;
+        eax_state eax2;
+        bool ok;
+
+        /* CTR and OMAC, a block each per 16 bytes, and whatever is read
+           ahead and never used: at most the ring */
+        ok = eax_init(&eax, 0, key, 16, nonce, 16, NULL, 0) == CRYPT_OK;
+        blocks = aes_block_count;
+        for (i = 0; ok && i < LONG_LEN; i += piece)
+        {
+            uint32_t n = (LONG_LEN - i < piece) ? LONG_LEN - i : piece;
+
+            if (p & 1)
+                while (ltc_nrf_eax_prefetch(&eax))
+                    ;
+            ok = eax_decrypt(&eax, cipher + i, out + i, n) == CRYPT_OK;
+        }
+        check(aes_block_count - blocks <= 2 * ((LONG_LEN + 15) / 16) + LTC_NRF_KS_BLOCKS,
+              "more AES blocks than CTR and OMAC need");
+        tag_len = sizeof(out_tag);
+        ok = ok && eax_done(&eax, out_tag, &tag_len) == CRYPT_OK;
+        check(ok && memcmp(out, msg, LONG_LEN) == 0 && memcmp(out_tag, tag, 16) == 0,
+              "one session");
+
+        /* two sessions in turn */
+        ok = eax_init(&eax, 0, key, 16, nonce, 16, NULL, 0) == CRYPT_OK &&
+             eax_init(&eax2, 0, key, 16, nonce, 16, NULL, 0) == CRYPT_OK;
+        for (i = 0; ok && i < LONG_LEN; i += piece)
+        {
+            uint32_t n = (LONG_LEN - i < piece) ? LONG_LEN - i : piece;
+
+            ok = process(&eax, cipher + i, out + i, n, n, false, p & 1) &&
+                 process(&eax2, cipher + i, out2 + i, n, n, false, !(p & 1));
+        }
+        tag_len = sizeof(out_tag);
+        ok = ok && eax_done(&eax, out_tag, &tag_len) == CRYPT_OK;
+        tag_len = sizeof(out_tag2);
+        ok = ok && eax_done(&eax2, out_tag2, &tag_len) == CRYPT_OK;
+        check(ok && memcmp(out, msg, LONG_LEN) == 0 && memcmp(out2, msg, LONG_LEN) == 0 &&
+              memcmp(out_tag, tag, 16) == 0 && memcmp(out_tag2, tag, 16) == 0,
+              "two sessions");
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    srand(argc > 1 ? strtoul(argv[1], NULL, 0) : 1);
+
+    test_aes();
+    test_vectors();
+    test_long();
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_eax: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_eax: ok\n");
+    return 0;
+}
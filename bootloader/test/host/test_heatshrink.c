@@ -0,0 +1,254 @@
+/** @file test_heatshrink.c
+*
+* @brief heatshrink_decoder.c against the decoder it replaced
+*
+* @par
+* ref/heatshrink_decoder.c is the bit-at-a-time decoder as it was before
+* it read input a byte at a time and copied back-references in blocks;
+* the Makefile builds it with its functions renamed to ref_*.  Both
+* decode the same streams, sunk and polled in pieces of random sizes:
+* data compressed by a simple encoder, which must come back unchanged,
+* and random bytes, where the two decoders must still agree.
+*
+*   usage: test_heatshrink [seed]
+*
+* COPYRIGHT NOTICE: (c) Rigado
+*
+* All rights reserved. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "heatshrink_decoder.h"
+
+#define WINDOW_BITS     HEATSHRINK_STATIC_WINDOW_BITS
+#define LOOKAHEAD_BITS  HEATSHRINK_STATIC_LOOKAHEAD_BITS
+#define MAX_LEN         20000
+#define RANDOM_RUNS     100
+
+HSD_sink_res ref_heatshrink_decoder_sink(heatshrink_decoder * hsd,
+        uint8_t * in_buf, size_t size, size_t * input_size);
+HSD_poll_res ref_heatshrink_decoder_poll(heatshrink_decoder * hsd,
+        uint8_t * out_buf, size_t out_buf_size, size_t * output_size);
+HSD_finish_res ref_heatshrink_decoder_finish(heatshrink_decoder * hsd);
+void ref_heatshrink_decoder_reset(heatshrink_decoder * hsd);
+
+typedef struct
+{
+    HSD_sink_res (*sink)(heatshrink_decoder *, uint8_t *, size_t, size_t *);
+    HSD_poll_res (*poll)(heatshrink_decoder *, uint8_t *, size_t, size_t *);
+    HSD_finish_res (*finish)(heatshrink_decoder *);
+    void (*reset)(heatshrink_decoder *);
+} decoder_t;
+
+static const decoder_t m_decoder =
+{
+    heatshrink_decoder_sink, heatshrink_decoder_poll,
+    heatshrink_decoder_finish, heatshrink_decoder_reset
+};
+static const decoder_t m_ref =
+{
+    ref_heatshrink_decoder_sink, ref_heatshrink_decoder_poll,
+    ref_heatshrink_decoder_finish, ref_heatshrink_decoder_reset
+};
+
+static const char * m_test;
+static uint32_t m_failures;
+
+static void check(bool ok, const char * what)
+{
+    if (!ok)
+    {
+        fprintf(stderr, "%s: %s\n", m_test, what);
+        m_failures++;
+    }
+}
+
+/* ---- Encoder ---- */
+
+static void put_bits(uint8_t * p_out, size_t * p_bit, uint32_t value, uint8_t count)
+{
+    while (count--)
+    {
+        if ((value >> count) & 1)
+            p_out[*p_bit / 8] |= 0x80 >> (*p_bit % 8);
+        (*p_bit)++;
+    }
+}
+
+/* Longest match in the window, found the slow way; returns the size of
+   the output, which needs room for 9 bits per input byte */
+static size_t encode(const uint8_t * p_in, size_t size, uint8_t * p_out)
+{
+    size_t bit = 0;
+    size_t at = 0;
+
+    memset(p_out, 0, size * 9 / 8 + 1);
+    while (at < size)
+    {
+        size_t start = at > (1u << WINDOW_BITS) ? at - (1u << WINDOW_BITS) : 0;
+        size_t best = 0, offset = 0;
+        size_t from;
+
+        for (from = start; from < at; from++)
+        {
+            size_t len = 0;
+
+            while (len < (1u << LOOKAHEAD_BITS) && at + len < size &&
+                   p_in[from + len] == p_in[at + len])
+                len++;
+            if (len > best)
+            {
+                best = len;
+                offset = at - from;
+            }
+        }
+
+        if (best >= 3)
+        {
+            put_bits(p_out, &bit, 0, 1);
+            put_bits(p_out, &bit, offset - 1, WINDOW_BITS);
+            put_bits(p_out, &bit, best - 1, LOOKAHEAD_BITS);
+            at += best;
+        }
+        else
+        {
+            put_bits(p_out, &bit, 1, 1);
+            put_bits(p_out, &bit, p_in[at], 8);
+            at++;
+        }
+    }
+    return (bit + 7) / 8;
+}
+
+/* ---- Decoding ---- */
+
+/* Sink and poll in pieces of random sizes, as patch packets arrive and
+   flash pages fill; the same seed gives both decoders the same pieces */
+static size_t decode(const decoder_t * p_dec, uint32_t seed, uint8_t * p_in, size_t size,
+                     uint8_t * p_out, size_t out_size)
+{
+    static heatshrink_decoder hsd;
+    size_t in = 0, out = 0;
+    HSD_poll_res poll;
+
+    srand(seed);
+    p_dec->reset(&hsd);
+    do
+    {
+        if (in < size)
+        {
+            size_t n = rand() % HEATSHRINK_STATIC_INPUT_BUFFER_SIZE + 1;
+            size_t sunk = 0;
+
+            if (n > size - in)
+                n = size - in;
+            (void)p_dec->sink(&hsd, &p_in[in], n, &sunk);
+            in += sunk;
+        }
+        do
+        {
+            size_t n = rand() % 300 + 1;
+            size_t polled = 0;
+
+            if (n > out_size - out)
+                n = out_size - out;
+            poll = p_dec->poll(&hsd, &p_out[out], n, &polled);
+            out += polled;
+        } while (poll == HSDR_POLL_MORE && out < out_size);
+    } while (in < size && out < out_size && poll >= 0);
+
+    check(poll >= 0, "poll error");
+    return out;
+}
+
+static void fill_random(uint8_t * p_data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        p_data[i] = (uint8_t)rand();
+}
+
+/* Something like code: a few words repeated, with runs and changes */
+static void fill_code(uint8_t * p_data, size_t size)
+{
+    uint8_t words[16][4];
+    size_t i;
+
+    fill_random(&words[0][0], sizeof(words));
+    for (i = 0; i + 4 <= size; i += 4)
+        memcpy(&p_data[i], words[rand() % (rand() % 16 + 1)], 4);
+    for (; i < size; i++)
+        p_data[i] = (uint8_t)rand();
+    for (i = 0; i < size / 64; i++)
+        p_data[rand() % size] = 0xff;
+}
+
+/* ---- Tests ---- */
+
+static void round_trip(const char * test, const uint8_t * p_data, size_t size, uint32_t seed)
+{
+    static uint8_t compressed[MAX_LEN * 9 / 8 + 1];
+    static uint8_t out[MAX_LEN], ref_out[MAX_LEN];
+    size_t compressed_size = encode(p_data, size, compressed);
+    size_t n, ref_n;
+
+    m_test = test;
+    n = decode(&m_decoder, seed, compressed, compressed_size, out, size);
+    ref_n = decode(&m_ref, seed, compressed, compressed_size, ref_out, size);
+    check(n == size && memcmp(out, p_data, size) == 0, "output differs from the input");
+    check(ref_n == n && memcmp(ref_out, out, n) == 0, "output differs from the old decoder");
+}
+
+static void test_round_trip(uint32_t seed)
+{
+    static uint8_t data[MAX_LEN];
+    size_t size = rand() % MAX_LEN + 1;
+
+    memset(data, 0, size);
+    round_trip("zeros", data, size, seed);
+    fill_random(data, size);
+    round_trip("random", data, size, seed);
+    fill_code(data, size);
+    round_trip("code", data, size, seed);
+}
+
+/* Random input is still a valid stream, of random literals and
+   back-references, some reaching back past what's been output */
+static void test_garbage(uint32_t seed)
+{
+    static uint8_t in[MAX_LEN / 4];
+    static uint8_t out[MAX_LEN], ref_out[MAX_LEN];
+    size_t n, ref_n;
+
+    m_test = "garbage";
+    fill_random(in, sizeof(in));
+    n = decode(&m_decoder, seed, in, sizeof(in), out, sizeof(out));
+    ref_n = decode(&m_ref, seed, in, sizeof(in), ref_out, sizeof(ref_out));
+    check(ref_n == n && memcmp(ref_out, out, n) == 0, "output differs from the old decoder");
+}
+
+int main(int argc, char * argv[])
+{
+    uint32_t seed = argc > 1 ? strtoul(argv[1], NULL, 0) : 1;
+    uint32_t i;
+
+    for (i = 0; i < RANDOM_RUNS && m_failures == 0; i++)
+    {
+        srand(seed + i);
+        test_round_trip(seed + i);
+        srand(seed + i);
+        test_garbage(seed + i);
+    }
+
+    if (m_failures)
+    {
+        fprintf(stderr, "test_heatshrink: %u failures\n", m_failures);
+        return 1;
+    }
+    printf("test_heatshrink: ok\n");
+    return 0;
+}